@@ -29,6 +29,7 @@ Settings := Object clone do(
             Directory clone with(dir) create
         )
         
+        Config settings_dir := dir
         self path := dir .. "/" .. filename
         self controls_path := dir .. "/" .. controls_filename
     )
@@ -124,6 +124,54 @@ Config do(
   LoDQuadManager_detail_tex_name   := texture_dir .. "/detail-texture.spr"
   LoDQuadManager_tile_dir          := texture_dir .. "/terrain-tiles"
   LoDQuadManager_texture_list      := terrain_dir .. "/textures"
+  // Keep precomputed quad data in a .cache file per .qad file, in
+  // LoDQuadManager_cache_dir, see defaults2.io
+  LoDQuadManager_quad_cache        := "true"
+  // Store terrain heights in 16 bits and derive x/z from the vertex grid
+  LoDQuadManager_compact_vertices  := "false"
+  // Threads used for loading quads, "0" means one per processor
+  LoDQuadManager_load_threads      := "0"
+  // Threads used for batched terrain line tests, "0" means one per processor
+  LoDQuadManager_segment_threads   := "1"
+  // Threads used for building the terrain mesh, "0" means one per processor
+  LoDQuadManager_setup_threads     := "1"
+  // Only keep quads within this distance of the camera loaded, "0" loads all
+  LoDQuadManager_page_radius       := "0"
+  // Distance around live actors within which quads are kept loaded
+  LoDQuadManager_actor_page_radius := "2000"
+  // Memory (in MB) resident quads may use before unused ones are unloaded
+  LoDQuadManager_page_budget       := "512"
+  // Change the last frame's mesh instead of building it anew every frame
+  LoDQuadManager_incremental_lod   := "false"
+  // Triangles the incrementally refined mesh may have
+  LoDQuadManager_triangle_budget   := "100000"
+  // Milliseconds per frame incremental refinement may spend on the mesh
+  LoDQuadManager_lod_time_budget   := "2"
+
+  // Collision detection configuration
+  // Broad phase: "sweep" (x axis), "sweep3d" (all axes) or "grid" (x/z grid)
+  CollisionManager_broadphase      := "sweep"
+  // Cell size of the grid broad phase, "0" picks it from the bounding radii
+  CollisionManager_grid_cell_size  := "0"
+  // Seconds by which contacts may follow the first one to be resolved with it.
+  // The later ones get their impulses early, so keep this small.
+  CollisionManager_contact_time_tolerance := "0.0001"
+  // Threads testing candidate pairs, "0" means one per processor
+  CollisionManager_narrowphase_threads := "1"
+  // Keep compiled bounding geometry in a .cache file next to each .bounds file
+  CollisionManager_geometry_cache  := "true"
+  // Binary trace of every step, for tnl-collidetrace; "" writes none
+  CollisionManager_trace           := ""
+  // Pair tests that take this many iterations are written to the trace
+  CollisionManager_trace_min_iterations := "256"
+  // Bodies that move slower than this many m/s and rad/s for sleep_time
+  // seconds fall asleep; "0" seconds keeps them all awake
+  CollisionManager_sleep_time      := "2"
+  CollisionManager_sleep_velocity  := "0.05"
+  CollisionManager_sleep_angular_velocity := "0.05"
+  // Sleeping bodies wake when their forces accelerate them this much
+  CollisionManager_wake_acceleration := "0.5"
+  CollisionManager_wake_angular_acceleration := "0.5"
 
   // Map configuration
   Map_texture_file                 := terrain_dir .. "/map.spr"
@@ -4,6 +4,10 @@
 Config do(
   Game_grab_mouse := "true"
   
+  // The terrain data may be read-only, so the quad caches go to the
+  // settings directory
+  LoDQuadManager_cache_dir         := settings_dir .. "/cache"
+  
   // Camera configuration
   Camera_focus                     := "1.5"
   Camera_aspect                    := ((Game_xres asNumber / Game_yres asNumber) asString)
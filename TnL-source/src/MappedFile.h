@@ -0,0 +1,102 @@
+#ifndef TNL_MAPPEDFILE_H
+#define TNL_MAPPEDFILE_H
+
+// A read-only view of a whole file.
+// Where mmap is available the file is mapped, so its pages are only read
+// when they are touched and are shared with every other process mapping
+// the same file. Elsewhere the file is simply read into a heap buffer.
+
+#include <cstdio>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if !defined(_MSC_VER) && !defined(__MINGW32__)
+#define TNL_HAVE_MMAP
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+    const char *data;
+    size_t size;
+    bool mapped;
+
+    MappedFile(const MappedFile &);
+    MappedFile & operator= (const MappedFile &);
+public:
+    inline MappedFile() : data(0), size(0), mapped(false) { }
+    inline ~MappedFile() { close(); }
+
+    inline bool open(const char *filename) {
+        close();
+#ifdef TNL_HAVE_MMAP
+        int fd = ::open(filename, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) {
+                data = (const char*) p;
+                size = st.st_size;
+                mapped = true;
+            }
+        }
+        ::close(fd);
+        if (mapped) return true;
+#endif
+        // No mmap (or mapping failed): fall back to reading the file
+        FILE *f = fopen(filename, "rb");
+        if (!f) return false;
+        fseek(f, 0, SEEK_END);
+        long n = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        if (n <= 0) {
+            fclose(f);
+            return false;
+        }
+        char *buf = new char[n];
+        if (fread(buf, 1, n, f) != (size_t) n) {
+            delete[] buf;
+            fclose(f);
+            return false;
+        }
+        fclose(f);
+        data = buf;
+        size = n;
+        mapped = false;
+        return true;
+    }
+
+    inline void close() {
+        if (!data) return;
+#ifdef TNL_HAVE_MMAP
+        if (mapped) munmap((void*) data, size);
+        else
+#endif
+        delete[] data;
+        data = 0;
+        size = 0;
+        mapped = false;
+    }
+
+    inline bool isOpen() const { return data != 0; }
+    inline bool isMapped() const { return mapped; }
+    inline const char *getData() const { return data; }
+    inline size_t getSize() const { return size; }
+
+    // Size and modification time of a file, used to decide whether a
+    // file derived from it is still up to date.
+    static inline bool getFileInfo(const char *filename,
+                                   size_t *out_size, time_t *out_mtime)
+    {
+        struct stat st;
+        if (stat(filename, &st) != 0) return false;
+        *out_size = st.st_size;
+        *out_mtime = st.st_mtime;
+        return true;
+    }
+};
+
+#endif
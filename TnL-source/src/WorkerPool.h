@@ -0,0 +1,184 @@
+#ifndef TNL_WORKERPOOL_H
+#define TNL_WORKERPOOL_H
+
+// A small pool of worker threads that process queued jobs.
+// Jobs are owned by the caller. Finished jobs are handed back one by one
+// through nextFinished(), so that the calling thread can do the parts of
+// the work that must not leave it (e.g. anything touching the renderer).
+//
+// A pool with zero threads runs every job on the calling thread from
+// within nextFinished()/wait(). That is also what happens on platforms
+// without threads.
+//
+// Deleting the pool waits for the jobs that are running, but drops those
+// that haven't started yet.
+//
+// Jobs report problems with ls_message() and friends, which write each
+// message whole, or hand them back in the job to the calling thread.
+
+#include <vector>
+#include <SDL.h>
+#include <SDL_thread.h>
+
+#if !defined(_MSC_VER) && !defined(__MINGW32__)
+#include <unistd.h>
+#endif
+
+#ifdef __EMSCRIPTEN__
+#define TNL_NO_THREADS
+#endif
+
+class WorkerPool {
+public:
+    struct Job {
+        virtual ~Job() { }
+        virtual void run()=0;
+    };
+
+private:
+    // First in, first out. Unlike a deque, it keeps its storage, so that
+    // a pool in steady use doesn't allocate.
+    class JobQueue {
+        std::vector<Job*> jobs;
+        size_t head;
+    public:
+        inline JobQueue() : head(0) { }
+        inline bool empty() const { return head == jobs.size(); }
+        inline Job * front() const { return jobs[head]; }
+        inline void push_back(Job *job) { jobs.push_back(job); }
+        inline void pop_front() {
+            if (++head == jobs.size()) {
+                jobs.clear();
+                head = 0;
+            } else if (2*head > jobs.size() && head > 32) {
+                jobs.erase(jobs.begin(), jobs.begin() + head);
+                head = 0;
+            }
+        }
+    };
+
+    std::vector<SDL_Thread*> threads;
+    SDL_mutex *mutex;
+    SDL_cond *job_added;
+    SDL_cond *job_finished;
+    JobQueue pending;
+    JobQueue finished;
+    int running;
+    bool shutting_down;
+
+    WorkerPool(const WorkerPool &);
+    WorkerPool & operator= (const WorkerPool &);
+
+    static int threadMain(void *data) {
+        WorkerPool *pool = (WorkerPool*) data;
+        SDL_LockMutex(pool->mutex);
+        for (;;) {
+            while (pool->pending.empty() && !pool->shutting_down) {
+                SDL_CondWait(pool->job_added, pool->mutex);
+            }
+            // Jobs that haven't started yet are dropped on shutdown
+            if (pool->shutting_down) break;
+            Job *job = pool->pending.front();
+            pool->pending.pop_front();
+            pool->running++;
+            SDL_UnlockMutex(pool->mutex);
+
+            job->run();
+
+            SDL_LockMutex(pool->mutex);
+            pool->running--;
+            pool->finished.push_back(job);
+            SDL_CondBroadcast(pool->job_finished);
+        }
+        SDL_UnlockMutex(pool->mutex);
+        return 0;
+    }
+
+public:
+    // Number of processors that are online, or 1 if unknown
+    static inline int getCPUCount() {
+#if defined(_SC_NPROCESSORS_ONLN) && !defined(TNL_NO_THREADS)
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n > 0) return (int) n;
+#endif
+        return 1;
+    }
+
+    inline WorkerPool(int nthreads)
+        : mutex(0), job_added(0), job_finished(0)
+        , running(0), shutting_down(false)
+    {
+#ifdef TNL_NO_THREADS
+        nthreads = 0;
+#endif
+        if (nthreads <= 0) return;
+        mutex = SDL_CreateMutex();
+        job_added = SDL_CreateCond();
+        job_finished = SDL_CreateCond();
+        for (int i=0; i<nthreads; i++) {
+            SDL_Thread *thread = SDL_CreateThread(&threadMain, this);
+            if (thread) threads.push_back(thread);
+        }
+    }
+
+    inline ~WorkerPool() {
+        if (mutex) {
+            SDL_LockMutex(mutex);
+            shutting_down = true;
+            SDL_CondBroadcast(job_added);
+            SDL_UnlockMutex(mutex);
+            for (size_t i=0; i<threads.size(); i++) {
+                SDL_WaitThread(threads[i], 0);
+            }
+            SDL_DestroyCond(job_finished);
+            SDL_DestroyCond(job_added);
+            SDL_DestroyMutex(mutex);
+        }
+    }
+
+    inline int getThreadCount() const { return threads.size(); }
+
+    inline void add(Job *job) {
+        if (threads.empty()) {
+            pending.push_back(job);
+            return;
+        }
+        SDL_LockMutex(mutex);
+        pending.push_back(job);
+        SDL_CondSignal(job_added);
+        SDL_UnlockMutex(mutex);
+    }
+
+    // Returns a finished job, blocking until one is available if 'block' is
+    // set. Returns 0 when there is no job left (or, if not blocking, none
+    // has finished yet).
+    inline Job * nextFinished(bool block=true) {
+        if (threads.empty()) {
+            if (pending.empty()) return 0;
+            Job *job = pending.front();
+            pending.pop_front();
+            job->run();
+            return job;
+        }
+        Job *job = 0;
+        SDL_LockMutex(mutex);
+        while (block && finished.empty()
+               && (!pending.empty() || running > 0))
+        {
+            SDL_CondWait(job_finished, mutex);
+        }
+        if (!finished.empty()) {
+            job = finished.front();
+            finished.pop_front();
+        }
+        SDL_UnlockMutex(mutex);
+        return job;
+    }
+
+    // Runs all queued jobs to completion
+    inline void wait() {
+        while (nextFinished()) ;
+    }
+};
+
+#endif
@@ -0,0 +1,58 @@
+// Compiles bounding geometry files to the cache files that
+// CollisionManager::queryGeometry maps in their place.
+//
+// usage: tnl-boundscache <model.bounds>...
+//
+// The game writes a cache itself the first time it loads a geometry, if
+// CollisionManager_geometry_cache is on and it may write next to the
+// .bounds file. This is for data directories where it may not, like an
+// installed copy. Each cache is read back and compared to the text file.
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <modules/collide/BoundingGeometry.h>
+
+using namespace Collide;
+
+static bool compile(const char *name) {
+    std::ifstream in(name);
+    if (!in) {
+        fprintf(stderr, "%s: can't open\n", name);
+        return false;
+    }
+    Ptr<BoundingGeometry> bg = new BoundingGeometry;
+    in >> *bg;
+    if (!in) {
+        fprintf(stderr, "%s: can't read\n", name);
+        return false;
+    }
+
+    std::string cache_name = BoundingGeometry::getCacheName(name);
+    if (!bg->saveCache(cache_name.c_str(), name)) return false;
+
+    Ptr<BoundingGeometry> cached = new BoundingGeometry;
+    if (!cached->loadCache(cache_name.c_str(), name)) {
+        fprintf(stderr, "%s: can't read back\n", cache_name.c_str());
+        return false;
+    }
+    std::ostringstream text, cached_text;
+    text << *bg;
+    cached_text << *cached;
+    if (text.str() != cached_text.str()) {
+        fprintf(stderr, "%s: differs from %s\n", cache_name.c_str(), name);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <model.bounds>...\n", argv[0]);
+        return 1;
+    }
+    bool ok = true;
+    for (int i=1; i<argc; i++) ok = compile(argv[i]) && ok;
+    return ok ? 0 : 1;
+}
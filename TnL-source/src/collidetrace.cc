@@ -0,0 +1,175 @@
+// Prints a collision trace written by the CollisionManager.
+//
+// usage: tnl-collidetrace <trace> [pairs]
+//
+// Set CollisionManager_trace to a file name to have the game write a trace.
+// It holds the counters of every step, and the pair tests that took at
+// least CollisionManager_trace_min_iterations iterations. This prints the
+// averages of the counters, the steps with the most iterations and the
+// pairs with the most iterations, 20 unless given. The transforms of a pair
+// are those at the beginning of its pass, enough to set up the pair again.
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <modules/collide/CollisionTrace.h>
+
+using namespace Collide;
+
+namespace {
+    bool read(FILE *in, void *data, size_t size) {
+        return size == 0 || fread(data, size, 1, in) == 1;
+    }
+
+    bool moreIterations(const CollisionTracePair & a,
+                        const CollisionTracePair & b) {
+        return a.iterations > b.iterations;
+    }
+
+    bool moreStepIterations(const CollisionTraceStep & a,
+                            const CollisionTraceStep & b) {
+        return a.stats.iterations > b.stats.iterations;
+    }
+
+    const char *resultName(int result) {
+        switch (result) {
+        case 0: return "no contact";
+        case 1: return "contact";
+        case 2: return "unresolved";
+        }
+        return "?";
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s <trace> [pairs]\n", argv[0]);
+        return 1;
+    }
+    size_t n_pairs = argc > 2 ? atoi(argv[2]) : 20;
+
+    FILE *in = fopen(argv[1], "rb");
+    if (!in) {
+        fprintf(stderr, "%s: can't open\n", argv[1]);
+        return 1;
+    }
+    CollisionTraceHeader header;
+    if (!read(in, &header, sizeof(header))
+        || std::string(header.magic, 4) != COLLISION_TRACE_MAGIC
+        || header.version != COLLISION_TRACE_VERSION
+        || header.byte_order != COLLISION_TRACE_BYTE_ORDER)
+    {
+        fprintf(stderr, "%s: not a trace of this version and platform\n",
+                argv[1]);
+        return 1;
+    }
+
+    std::vector<std::string> names;
+    std::vector<CollisionTracePair> pairs;
+    std::vector<CollisionTraceStep> steps;
+    CollisionStats total;
+    total.clear();
+    CollisionTraceRecord record;
+    while (read(in, &record, sizeof(record))) {
+        if (record.type == TRACE_GEOMETRY
+            && record.size >= (int) sizeof(CollisionTraceGeometry))
+        {
+            CollisionTraceGeometry geometry;
+            std::string name(record.size - sizeof(geometry), '\0');
+            if (!read(in, &geometry, sizeof(geometry))
+                || !read(in, &name[0], name.size())) break;
+            if ((int) names.size() <= geometry.id) names.resize(geometry.id+1);
+            names[geometry.id] = name.empty() ? "(unnamed)" : name;
+        } else if (record.type == TRACE_PAIR
+                   && record.size == (int) sizeof(CollisionTracePair))
+        {
+            pairs.push_back(CollisionTracePair());
+            if (!read(in, &pairs.back(), sizeof(CollisionTracePair))) break;
+        } else if (record.type == TRACE_STEP
+                   && record.size == (int) sizeof(CollisionTraceStep))
+        {
+            steps.push_back(CollisionTraceStep());
+            if (!read(in, &steps.back(), sizeof(CollisionTraceStep))) break;
+            total += steps.back().stats;
+        } else if (record.size < 0 || fseek(in, record.size, SEEK_CUR)) {
+            break;
+        }
+    }
+    fclose(in);
+    // A trace that was cut off may end in the middle of a record
+    if (!steps.empty() && !pairs.empty()
+        && pairs.back().step > steps.back().step)
+    {
+        printf("The last step is incomplete.\n");
+    }
+
+    if (steps.empty()) {
+        printf("No steps.\n");
+        return 0;
+    }
+    float n = steps.size();
+    printf("%d steps, per step:\n", (int) steps.size());
+    printf("  %8.1f restarts\n", (total.passes - n) / n);
+    printf("  %8.1f candidate pairs\n", total.candidates / n);
+    printf("  %8.1f pair tests\n", total.tests / n);
+    printf("  %8.1f iterations, queue peak %d in all steps\n",
+           total.iterations / n, total.queue_peak);
+    printf("  %8.1f time subdivisions\n", total.subdiv_time / n);
+    printf("  %8.1f space subdivisions: %.1f spheres, %.1f leaves, "
+           "%.1f inner, %.1f domains, %.1f transforms, %.1f gates\n",
+           (total.subdiv_space[BoundingNode::NONE]
+            + total.subdiv_space[BoundingNode::LEAF]
+            + total.subdiv_space[BoundingNode::INNER]
+            + total.subdiv_space[BoundingNode::NEWDOMAIN]
+            + total.subdiv_space[BoundingNode::TRANSFORM]
+            + total.subdiv_space[BoundingNode::GATE]) / n,
+           total.subdiv_space[BoundingNode::NONE] / n,
+           total.subdiv_space[BoundingNode::LEAF] / n,
+           total.subdiv_space[BoundingNode::INNER] / n,
+           total.subdiv_space[BoundingNode::NEWDOMAIN] / n,
+           total.subdiv_space[BoundingNode::TRANSFORM] / n,
+           total.subdiv_space[BoundingNode::GATE] / n);
+    printf("  %8.1f contacts\n", total.contacts / n);
+    printf("  %8.1f sleeping collidables\n", total.sleeping / n);
+    printf("  %8.1f swept points\n", total.points / n);
+    printf("  %8.1f tests aborted, %d in all steps\n",
+           total.aborted / n, total.aborted);
+    printf("  %8.1f us broad phase, %.1f us narrow phase, "
+           "%.1f us response\n", total.broadphase_us / n,
+           total.narrowphase_us / n, total.response_us / n);
+
+    std::sort(steps.begin(), steps.end(), moreStepIterations);
+    printf("\nSteps with the most iterations:\n");
+    for (size_t i=0; i<steps.size() && i<5; i++) {
+        const CollisionTraceStep & s = steps[i];
+        printf("  step %d: %d iterations in %d tests, %d passes, "
+               "%d aborted, %d us narrow phase\n", s.step,
+               s.stats.iterations, s.stats.tests, s.stats.passes,
+               s.stats.aborted, s.stats.narrowphase_us);
+    }
+
+    std::stable_sort(pairs.begin(), pairs.end(), moreIterations);
+    printf("\n%d pair tests traced, the ones with the most iterations:\n",
+           (int) pairs.size());
+    for (size_t i=0; i<pairs.size() && i<n_pairs; i++) {
+        const CollisionTracePair & p = pairs[i];
+        printf("step %d pass %d, delta_t %g: %d iterations, queue peak %d, "
+               "%d time and %d space subdivisions, %s%s\n",
+               p.step, p.pass, p.delta_t, p.iterations, p.queue_peak,
+               p.subdiv_time, p.subdiv_space, resultName(p.result),
+               p.aborted ? ", aborted" : "");
+        for (int k=0; k<2; k++) {
+            int g = p.geometries[k];
+            const float *x = p.from[k], *y = p.to[k];
+            printf("  %d %s\n", p.handles[k],
+                   g >= 0 && g < (int) names.size() ? names[g].c_str() : "?");
+            printf("    from q=(%g %g %g %g) x=(%g %g %g)\n",
+                   x[0], x[1], x[2], x[3], x[4], x[5], x[6]);
+            printf("    to   q=(%g %g %g %g) x=(%g %g %g)\n",
+                   y[0], y[1], y[2], y[3], y[4], y[5], y[6]);
+        }
+    }
+    return 0;
+}
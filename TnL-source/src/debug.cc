@@ -7,6 +7,17 @@
 #define FORCE_SIMPLE_DEBUG
 #endif
 
+// Messages may come from worker threads, see WorkerPool.h. Each one is
+// written while holding the lock of stdout, so that messages of several
+// threads don't interleave.
+#ifdef _WIN32
+#define lock_output()   _lock_file(stdout)
+#define unlock_output() _unlock_file(stdout)
+#else
+#define lock_output()   flockfile(stdout)
+#define unlock_output() funlockfile(stdout)
+#endif
+
 void ls_message(const char *fmt, ...) {
 	va_list ap;
 	va_start(ap, fmt);
@@ -30,11 +41,14 @@ void ls_error(const char *fmt, ...) {
 
 #ifdef FORCE_SIMPLE_DEBUG
 void debug(int severity, const char *fmt, va_list ap) {
+	lock_output();
 	vprintf(fmt, ap);
 	fflush(stdout);
+	unlock_output();
 }
 #else
 void debug(int severity, const char *fmt, va_list ap) {
+	lock_output();
 	if (severity<2) {
   		printf("\033[0;32m");
 	} else if (severity <4) {
@@ -43,7 +57,8 @@ void debug(int severity, const char *fmt, va_list ap) {
   		printf("\033[0;31m");
 	}
 	vprintf(fmt, ap);
-	fflush(stdout);
 	printf("\033[0;39m");
+	fflush(stdout);
+	unlock_output();
 }
 #endif
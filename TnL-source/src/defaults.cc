@@ -22,6 +22,18 @@ void initialize_config(Ptr<IConfig> config)
     config->set("Carrier_model_bounds", std::string(config->query("Carrier_model_path")) + "/carrier.bounds");
     config->set("Carrier_model_hull", std::string(config->query("Carrier_model_path")) + "/carrier-hull-reduced.obj");
     config->set("Carrier_skeleton", std::string(config->query("Carrier_model_path")) + "/Carrier.spec");
+    config->set("CollisionManager_broadphase", "sweep");
+    config->set("CollisionManager_contact_time_tolerance", "0.0001");
+    config->set("CollisionManager_geometry_cache", "true");
+    config->set("CollisionManager_grid_cell_size", "0");
+    config->set("CollisionManager_narrowphase_threads", "1");
+    config->set("CollisionManager_sleep_angular_velocity", "0.05");
+    config->set("CollisionManager_sleep_time", "2");
+    config->set("CollisionManager_sleep_velocity", "0.05");
+    config->set("CollisionManager_trace", "");
+    config->set("CollisionManager_trace_min_iterations", "256");
+    config->set("CollisionManager_wake_acceleration", "0.5");
+    config->set("CollisionManager_wake_angular_acceleration", "0.5");
     config->set("Drone_Hydra_rounds", "14");
     config->set("Drone_Sidewinder_rounds", "6");
     config->set("Drone_Vulcan_rounds", "250");
@@ -130,6 +142,18 @@ void initialize_config(Ptr<IConfig> config)
     config->set("LoDQuadManager_texture_list", std::string(config->query("terrain_dir")) + "/textures");
     config->set("LoDQuadManager_quads_w", "1");
     config->set("LoDQuadManager_quads_h", "1");
+    config->set("LoDQuadManager_quad_cache", "true");
+    config->set("LoDQuadManager_cache_dir", "");
+    config->set("LoDQuadManager_compact_vertices", "false");
+    config->set("LoDQuadManager_load_threads", "0");
+    config->set("LoDQuadManager_segment_threads", "1");
+    config->set("LoDQuadManager_setup_threads", "1");
+    config->set("LoDQuadManager_page_radius", "0");
+    config->set("LoDQuadManager_actor_page_radius", "2000");
+    config->set("LoDQuadManager_page_budget", "512");
+    config->set("LoDQuadManager_incremental_lod", "false");
+    config->set("LoDQuadManager_triangle_budget", "100000");
+    config->set("LoDQuadManager_lod_time_budget", "2");
     config->set("Map_compass_tex", std::string(config->query("texture_dir")) + "/map-compass.png");
     config->set("Map_lines_tex", std::string(config->query("texture_dir")) + "/map-lines.png");
     config->set("Map_f", "6.8");
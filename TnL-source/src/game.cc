@@ -409,7 +409,7 @@ void Game::startupSimulation(Status & stat) {
     stat.beginJob("Simulation startup", 12);
     
     stat.beginJob("Initializing CollisionManager");
-    collisionman = new Collide::CollisionManager();
+    collisionman = new Collide::CollisionManager(config);
     stat.nextJob("Initializing clock");
     clock = new Clock;
    	stat.nextJob("Initializing Environment");
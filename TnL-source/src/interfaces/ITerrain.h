@@ -4,16 +4,29 @@
 #include <modules/math/Vector.h>
 #include <interfaces/IDrawable.h>
 
+// A line segment for ITerrain::linesCollide
+struct TerrainSegment {
+    Vector a, b;    // the segment to test
+    Vector x;       // set to the point where it hits the terrain, if it does
+    bool hit;       // set to wether it hits the terrain
+};
+
 struct ITerrain: public IDrawable
 {
 public:
     // queries for terrain height at point (x,z)
     // optionally returns normal
     virtual float getHeightAt(float x, float z, Vector *out_normal=0)=0;
+    // queries for the terrain heights at n points (x[i],z[i]) at once,
+    // optionally returns normals
+    virtual void getHeightsAt(int n, const float *x, const float *z,
+            float *out_height, Vector *out_normal=0)=0;
     // lineCollides: test if line between a and b intersects terrain
     // Stores intersection point in x
     // optionally returns normal at x
     virtual bool lineCollides(Vector a, Vector b, Vector * x, Vector *out_normal=0)=0;
+    // linesCollide tests n segments at once, like lineCollides
+    virtual void linesCollide(int n, TerrainSegment *segments)=0;
 };
 
 #endif
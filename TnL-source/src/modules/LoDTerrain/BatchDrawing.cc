@@ -0,0 +1,291 @@
+#include <algorithm>
+#include "LoDTerrain.h"
+#include "Config.h"
+
+/*
+Batched terrain drawing. Instead of issuing a begin()/end() pair per layer
+and triangle, the visible triangles are collected into one batch per layer
+and texture, and each batch is sent to the renderer with a single call.
+
+The layers are drawn in the same order as the per-triangle code draws them
+for a single triangle, so the depth test (LEQUAL on identical vertices)
+gives the same picture:
+    - the big texture, for triangles that aren't covered by tiles
+    - the opaque base tiles
+    - the blended tile patches, by descending texture index
+    - the lightmap, multiplied
+    - the fog layer, blended
+*/
+
+#define NORTHWEST 8
+#define NORTHEAST 4
+#define SOUTHEAST 2
+#define SOUTHWEST 1
+
+// Patch batches are keyed by texture index, patch mask and whether the
+// patch falls back to the full tile with per-corner alpha. Iterating the
+// keys backwards yields the descending texture index order.
+#define PATCH_KEY(idx, patch, fallback) (((idx) << 5) | ((patch) << 1) | (fallback))
+#define PATCH_KEY_INDEX(key)    ((key) >> 5)
+#define PATCH_KEY_PATCH(key)    (((key) >> 1) & 15)
+#define PATCH_KEY_FALLBACK(key) ((key) & 1)
+
+void LoDQuad::clearBatches()
+{
+    // Keep the entries, so that the arrays don't have to grow every frame
+    main_batch.clear();
+    lightmap_batch.clear();
+    fog_batch.clear();
+    std::map<int, LoDBatch>::iterator it;
+    for (it = tile_batches.begin(); it != tile_batches.end(); it++) {
+        it->second.clear();
+    }
+    for (it = patch_batches.begin(); it != patch_batches.end(); it++) {
+        it->second.clear();
+    }
+}
+
+void LoDQuad::addTriangle(LoDBatch & batch, ju32 tri, const Vector *p)
+{
+    for (int i=0; i<3; i++) {
+        int vtx = tri_vertex[tri][i];
+        batch.addVertex(p[i]);
+        batch.addUV(vertexU(vtx), vertexV(vtx));
+    }
+}
+
+void LoDQuad::collectRecursive(ju32 tri,
+        float y0, float y1, float y2, float * alpha)
+{
+    ju32 flags = triangle[tri].flags;
+    if(flags & TFLAG_DONT_DRAW) return;
+
+    const ju32 *vertex = tri_vertex[tri];
+    float morph = tri_morph[tri];
+    float y[3];
+    y[0] = y0;
+    y[1] = y1;
+    y[2] = morph * vertexY(vertex[2]) + (1.0 - morph) * y2;
+
+    if (flags & TFLAG_ENABLED) {
+        Vector p[3];
+        for (int i=0; i<3; i++) {
+            int vtx = vertex[i];
+            p[i] = Vector(vertexX(vtx), y[i], vertexZ(vtx));
+        }
+        // Backface culling, see drawRecursive
+        Vector n = (p[2] - p[0]) % (p[1] - p[0]);
+        if (n*(p[2]-view_pos) > 0) return;
+
+#if ENABLE_FOG_LAYER
+        float min_fog = std::min(alpha[0], std::min(alpha[1], alpha[2]));
+        if (min_fog >= 1) {
+            Vector fog_color = environment->getFogColor();
+            for (int i=0; i<3; i++) {
+                fog_batch.addVertex(p[i]);
+                fog_batch.addColor(fog_color, alpha[i]);
+            }
+            return;
+        }
+#endif
+
+        bool tiled = false;
+#if ENABLE_TEXTURING
+        tiled = (flags & TFLAG_HAS_CHILDREN) == 0;
+        if (tiled) collectTiles(tri, p);
+#endif
+#if ENABLE_BIG_TEXTURE
+        // The opaque base tile covers the big texture completely
+        if (!tiled) addTriangle(main_batch, tri, p);
+#endif
+#if ENABLE_LIGHTMAP
+        addTriangle(lightmap_batch, tri, p);
+#endif
+#if ENABLE_FOG_LAYER
+        Vector fog_color = environment->getFogColor();
+        for (int i=0; i<3; i++) {
+            fog_batch.addVertex(p[i]);
+            fog_batch.addColor(fog_color, alpha[i]);
+        }
+#endif
+    } else {
+        ju32 child = triangle[tri].child;
+        float ym = (y[0] + y[1]) / 2.0;
+        float a[3];
+#if ENABLE_FOG_LAYER
+        float fog = vfog[tri_vertex[child][2]];
+        a[2]=(alpha[0]+alpha[1])/2 * (1-tri_morph[child])
+                + fog * tri_morph[child];
+        a[0]=alpha[2];
+        a[1]=alpha[0];
+#endif
+        // left child
+        collectRecursive(child, y[2], y[0], ym, a);
+#if ENABLE_FOG_LAYER
+        a[0]=alpha[1];
+        a[1]=alpha[2];
+#endif
+        // right child
+        collectRecursive(child+1, y[1], y[2], ym, a);
+    }
+}
+
+// Same tile selection as drawTexturedTriangle
+void LoDQuad::collectTiles(ju32 tri, const Vector *p)
+{
+    Vector2 uv[3];
+    for(int i=0; i<3; i++) {
+        int vtx = tri_vertex[tri][i];
+        uv[i] = Vector2(vertexU(vtx), vertexV(vtx));
+    }
+    Vector2 midpt = 0.5f*(uv[0]+uv[1]);
+
+    int tex_size = texmap->getWidth();
+    int u = (int) floorf(midpt[0] * tex_size);
+    int v = (int) floorf(midpt[1] * tex_size);
+    unsigned char texidx = texmap->pixelAt(u,v);
+
+    // Collect the lower textures of the 8-neighborhood of (u,v), which
+    // overlap the current one
+    unsigned char neighbor_textures[8];
+    int n_neighbors = 0;
+    for(int v_neighbor = std::max(v-1,0); v_neighbor <= std::min(v+1,tex_size-1); ++v_neighbor) {
+        for(int u_neighbor = std::max(u-1,0); u_neighbor <= std::min(u+1,tex_size-1); ++u_neighbor) {
+            if (u_neighbor == u && v_neighbor == v) continue;
+            unsigned char neighbor_texidx = texmap->pixelAt(u_neighbor, v_neighbor);
+            if (neighbor_texidx < texidx
+                && std::find(neighbor_textures, neighbor_textures+n_neighbors,
+                             neighbor_texidx) == neighbor_textures+n_neighbors)
+            {
+                neighbor_textures[n_neighbors++] = neighbor_texidx;
+            }
+        }
+    }
+
+    // Set uv to the actual texture coordinates of the patch
+    float u_min = std::min(uv[0][0], std::min(uv[1][0], uv[2][0]));
+    float v_min = std::min(uv[0][1], std::min(uv[1][1], uv[2][1]));
+    for(int i=0; i<3; i++) uv[i] =(uv[i]-Vector2(u_min,v_min))*256;
+
+    int corner_bits[3];
+    for(int i=0; i<3; i++) {
+        if (uv[i][0] == 0) {
+            if (uv[i][1] == 0) corner_bits[i] = NORTHWEST;
+            else corner_bits[i] = SOUTHWEST;
+        } else {
+            if (uv[i][1] == 0) corner_bits[i] = NORTHEAST;
+            else corner_bits[i] = SOUTHEAST;
+        }
+    }
+
+    LoDBatch & base = tile_batches[texidx];
+    for (int i=0; i<3; i++) {
+        base.addVertex(p[i]);
+        base.addUV(uv[i][0], uv[i][1]);
+    }
+
+    Vector white(1,1,1);
+    for(int i=0; i<n_neighbors; ++i) {
+        unsigned char idx = neighbor_textures[i];
+        int patch = 0;
+        if (u+1<tex_size && texmap->pixelAt(u+1,v) == idx)
+            patch |= NORTHEAST | SOUTHEAST;
+        if (u+1<tex_size && v+1<tex_size && texmap->pixelAt(u+1,v+1) == idx)
+            patch |= SOUTHEAST;
+        if (v+1<tex_size && texmap->pixelAt(u,v+1) == idx)
+            patch |= SOUTHWEST | SOUTHEAST;
+        if (u-1>=0 && v+1<tex_size && texmap->pixelAt(u-1,v+1) == idx)
+            patch |= SOUTHWEST;
+        if (u-1>=0 && texmap->pixelAt(u-1,v) == idx)
+            patch |= SOUTHWEST | NORTHWEST;
+        if (u-1>=0 && v-1>=0 && texmap->pixelAt(u-1,v-1) == idx)
+            patch |= NORTHWEST;
+        if (v-1>=0 && texmap->pixelAt(u,v-1) == idx)
+            patch |= NORTHWEST | NORTHEAST;
+        if (u+1<tex_size && v-1>=0 && texmap->pixelAt(u+1,v-1) == idx)
+            patch |= NORTHEAST;
+
+        // Single tiles only have textures[idx][15]; their patches are
+        // made by fading the corners out
+        bool fallback = !textures[idx][patch];
+        LoDBatch & batch = patch_batches[PATCH_KEY(idx, patch, fallback)];
+        for (int j=0; j<3; ++j) {
+            batch.addVertex(p[j]);
+            batch.addUV(uv[j][0], uv[j][1]);
+            batch.addColor(white,
+                    (!fallback || (patch & corner_bits[j])) ? 1.0f : 0.0f);
+        }
+    }
+}
+
+void LoDQuad::drawBatch(JRenderer *r, LoDBatch & batch)
+{
+    if (batch.empty()) return;
+    r->drawArrays(JR_DRAWMODE_TRIANGLES, batch.size(),
+            &batch.xyz[0],
+            batch.uv.empty() ? 0 : &batch.uv[0],
+            batch.rgba.empty() ? 0 : &batch.rgba[0]);
+    draw_calls++;
+    draw_triangles += batch.size() / 3;
+}
+
+void LoDQuad::drawBatches(JRenderer *r)
+{
+    std::map<int, LoDBatch>::iterator it;
+    std::map<int, LoDBatch>::reverse_iterator rit;
+
+    r->setZBufferFunc(JR_ZBFUNC_LEQUAL);
+    r->enableSmoothShading();
+    r->setColor(Vector(1,1,1));
+    r->setAlpha(1.0f);
+    r->enableTexturing();
+    r->disableAlphaBlending();
+
+#if ENABLE_BIG_TEXTURE
+    if (!main_batch.empty()) {
+        r->setTexture(main_tex->getTxtid());
+        drawBatch(r, main_batch);
+    }
+#endif
+
+    for (it = tile_batches.begin(); it != tile_batches.end(); it++) {
+        if (it->second.empty()) continue;
+        r->setTexture(textures[it->first][0x0f]->getTxtid());
+        r->setWrapMode( JR_TEXDIM_U, JR_WRAPMODE_REPEAT );
+        r->setWrapMode( JR_TEXDIM_V, JR_WRAPMODE_REPEAT );
+        drawBatch(r, it->second);
+    }
+
+    r->enableAlphaBlending();
+    for (rit = patch_batches.rbegin(); rit != patch_batches.rend(); rit++) {
+        if (rit->second.empty()) continue;
+        int idx = PATCH_KEY_INDEX(rit->first);
+        if (PATCH_KEY_FALLBACK(rit->first)) {
+            r->setTexture(textures[idx][15]->getTxtid());
+            r->setWrapMode( JR_TEXDIM_U, JR_WRAPMODE_REPEAT );
+            r->setWrapMode( JR_TEXDIM_V, JR_WRAPMODE_REPEAT );
+        } else {
+            r->setTexture(textures[idx][PATCH_KEY_PATCH(rit->first)]->getTxtid());
+            r->setWrapMode( JR_TEXDIM_U, JR_WRAPMODE_CLAMP );
+            r->setWrapMode( JR_TEXDIM_V, JR_WRAPMODE_CLAMP );
+        }
+        drawBatch(r, rit->second);
+    }
+
+#if ENABLE_LIGHTMAP
+    if (!lightmap_batch.empty()) {
+        r->setTexture(lightmap->getTxtid());
+        r->setBlendMode(JR_BLENDMODE_MULTIPLICATIVE);
+        drawBatch(r, lightmap_batch);
+        r->setBlendMode(JR_BLENDMODE_BLEND);
+    }
+#endif
+
+#if ENABLE_FOG_LAYER
+    r->disableTexturing();
+    drawBatch(r, fog_batch);
+#endif
+
+    r->disableAlphaBlending();
+    r->disableTexturing();
+}
@@ -1,12 +1,28 @@
+#include <algorithm>
 #include <modules/math/Collide.h>
 #include "LoDTerrain.h"
 
+#define VSCALAR(x1,y1,x2,y2) ((x1)*(x2)+(y1)*(y2))
+
+// Marks grid cells that aren't contained in either root triangle, and
+// points that aren't on the quad
+#define GRID_ROOTS 0xffffffff
+
+// Cells of the height grid per side, and the levels of the max-mip pyramid
+// over it
+#define HEIGHT_GRID_SIZE 64
+#define HEIGHT_GRID_LEVELS 7
+
+// Padding in world units around the part of a ray that is tested against
+// the triangles of a grid cell, so that hits on cell borders aren't missed
+#define CELL_PADDING 0.01f
+
 LoDQuad::CoordRel LoDQuad::getCoordRelX(float x)
 {
     float vmin, vmax;
     
-    vmin = vx[triangle[0].vertex[0]];
-    vmax = vx[triangle[0].vertex[1]];
+    vmin = vertexX(tri_vertex[0][0]);
+    vmax = vertexX(tri_vertex[0][1]);
     
     if (x < vmin) return BELOW;
     else if (x > vmax) return ABOVE;
@@ -17,19 +33,38 @@ LoDQuad::CoordRel LoDQuad::getCoordRelZ(float z)
 {
     float vmin, vmax;
     
-    vmin = vz[triangle[0].vertex[0]];
-    vmax = vz[triangle[0].vertex[1]];
+    vmin = vertexZ(tri_vertex[0][0]);
+    vmax = vertexZ(tri_vertex[0][1]);
     
     if (z < vmin) return BELOW;
     else if (z > vmax) return ABOVE;
     else return INSIDE;
 }
 
+void LoDQuad::getExtent(float *x0, float *z0, float *x1, float *z1)
+{
+    const ju32 *vertex = tri_vertex[0];
+    *x0 = *x1 = vertexX(vertex[0]);
+    *z0 = *z1 = vertexZ(vertex[0]);
+    for (int i=1; i<3; i++) {
+        *x0 = std::min(*x0, vertexX(vertex[i]));
+        *x1 = std::max(*x1, vertexX(vertex[i]));
+        *z0 = std::min(*z0, vertexZ(vertex[i]));
+        *z1 = std::max(*z1, vertexZ(vertex[i]));
+    }
+}
+
 float LoDQuad::getHeightAt(float x, float z, Vector *out_normal)
 {
     float height;
-    if (!getHeightAtTriangle(&triangle[0], x, z, &height, out_normal) &&
-        !getHeightAtTriangle(&triangle[1], x, z, &height, out_normal))
+    ju32 start = findStartTriangle(x, z);
+    if (start != GRID_ROOTS &&
+        getHeightAtTriangle(start, x, z, &height, out_normal))
+    {
+        return height;
+    }
+    if (!getHeightAtTriangle(0, x, z, &height, out_normal) &&
+        !getHeightAtTriangle(1, x, z, &height, out_normal))
     {
         ls_error("LoDQuad::getHeightAt(%f, %f): could not determine height.\n", x, z);
         height = 0;
@@ -38,8 +73,217 @@ float LoDQuad::getHeightAt(float x, float z, Vector *out_normal)
     return height;
 }
 
+void LoDQuad::getHeightsAt(int n, const float *x, const float *z,
+                           float *out_height, Vector *out_normal)
+{
+    if (n <= 0) return;
+    
+    // First find the leaf triangles and copy their corners into arrays, so
+    // that the interpolation below is a plain loop over arrays which the
+    // compiler can vectorize
+    std::vector<ju32> leaf(n);
+    std::vector<float> corner(9*n);
+    float *px0 = &corner[0],   *px1 = &corner[n],   *px2 = &corner[2*n];
+    float *py0 = &corner[3*n], *py1 = &corner[4*n], *py2 = &corner[5*n];
+    float *pz0 = &corner[6*n], *pz1 = &corner[7*n], *pz2 = &corner[8*n];
+    int missed = 0;
+    for (int i=0; i<n; i++) {
+        leaf[i] = findLeaf(x[i], z[i]);
+        if (leaf[i] == GRID_ROOTS) {
+            // A flat triangle at height 0, as returned by getHeightAt
+            px0[i] = 0; py0[i] = 0; pz0[i] = 0;
+            px1[i] = 1; py1[i] = 0; pz1[i] = 0;
+            px2[i] = 0; py2[i] = 0; pz2[i] = 1;
+            missed++;
+            continue;
+        }
+        const ju32 *vertex = tri_vertex[leaf[i]];
+        px0[i] = vertexX(vertex[0]);
+        py0[i] = vertexY(vertex[0]);
+        pz0[i] = vertexZ(vertex[0]);
+        px1[i] = vertexX(vertex[1]);
+        py1[i] = vertexY(vertex[1]);
+        pz1[i] = vertexZ(vertex[1]);
+        px2[i] = vertexX(vertex[2]);
+        py2[i] = vertexY(vertex[2]);
+        pz2[i] = vertexZ(vertex[2]);
+    }
+    if (missed) {
+        ls_error("LoDQuad::getHeightsAt: could not determine %d of %d heights.\n",
+                missed, n);
+    }
+    
+    // Same interpolation as in getHeightAtTriangle
+    for (int i=0; i<n; i++) {
+        float nx1 = -(pz2[i] - pz1[i]), nz1 = px2[i] - px1[i];
+        float nx2 = -(pz0[i] - pz2[i]), nz2 = px0[i] - px2[i];
+        float d1 = VSCALAR(nx1, nz1, x[i]-px1[i], z[i]-pz1[i]);
+        float d2 = VSCALAR(nx2, nz2, x[i]-px2[i], z[i]-pz2[i]);
+        float dp1 = VSCALAR(nx2, nz2, px1[i]-px2[i], pz1[i]-pz2[i]);
+        float dp0 = VSCALAR(nx1, nz1, px0[i]-px2[i], pz0[i]-pz2[i]);
+        out_height[i] = py2[i]
+                + ((py1[i] - py2[i]) * d2) / dp1
+                + ((py0[i] - py2[i]) * d1) / dp0;
+    }
+    
+    if (out_normal) {
+        for (int i=0; i<n; i++) {
+            if (leaf[i] == GRID_ROOTS) {
+                out_normal[i] = Vector(0,1,0);
+                continue;
+            }
+            Vector p0(px0[i], py0[i], pz0[i]);
+            Vector p1(px1[i], py1[i], pz1[i]);
+            Vector p2(px2[i], py2[i], pz2[i]);
+            out_normal[i] = (p2 - p0) % (p1 - p2);
+            out_normal[i].normalize();
+        }
+    }
+}
+
+
+// Tests whether (x/z) is inside the triangle, like getHeightAtTriangle
+bool LoDQuad::triangleContains(ju32 tri, float x, float z)
+{
+    const ju32 *vertex = tri_vertex[tri];
+    for (int i=0; i<3; i++) {
+        int j = (i+1) % 3;
+        float px = vertexX(vertex[i]), pz = vertexZ(vertex[i]);
+        float nx = -(vertexZ(vertex[j]) - pz);
+        float nz = vertexX(vertex[j]) - px;
+        if (VSCALAR(nx, nz, x-px, z-pz) < 0) return false;
+    }
+    return true;
+}
+
+// The height grid divides the quad into cells and stores for each cell the
+// smallest triangle that contains the whole cell. Height queries start
+// their descent there instead of at the root triangles.
+void LoDQuad::setupHeightGrid()
+{
+    float x0, z0, x1, z1;
+    getExtent(&x0, &z0, &x1, &z1);
+    grid_x0 = x0;
+    grid_z0 = z0;
+    grid_scale_x = HEIGHT_GRID_SIZE / (x1 - x0);
+    grid_scale_z = HEIGHT_GRID_SIZE / (z1 - z0);
+    float cw = (x1 - x0) / HEIGHT_GRID_SIZE;
+    float ch = (z1 - z0) / HEIGHT_GRID_SIZE;
+    
+    height_grid.resize(HEIGHT_GRID_SIZE * HEIGHT_GRID_SIZE);
+    for (int j=0; j<HEIGHT_GRID_SIZE; j++) {
+        for (int i=0; i<HEIGHT_GRID_SIZE; i++) {
+            float cx[4], cz[4];
+            for (int k=0; k<4; k++) {
+                cx[k] = x0 + (i + (k&1)) * cw;
+                cz[k] = z0 + (j + (k>>1)) * ch;
+            }
+            ju32 t = GRID_ROOTS;
+            ju32 next = 0;
+            for (;;) {
+                ju32 c;
+                for (c=next; c<next+2; c++) {
+                    int k;
+                    for (k=0; k<4; k++) {
+                        if (!triangleContains(c, cx[k], cz[k])) break;
+                    }
+                    if (k == 4) break;
+                }
+                if (c == next+2) break;
+                t = c;
+                if (!(triangle[t].flags & TFLAG_HAS_CHILDREN)) break;
+                next = triangle[t].child;
+            }
+            height_grid[j*HEIGHT_GRID_SIZE + i] = t;
+        }
+    }
+    
+    setupMaxHeights();
+}
+
+// Builds the max-mip pyramid: level 0 holds for each cell of the height
+// grid the maximum height of the leaf triangles overlapping it, each
+// further level the maximum of four cells of the level below
+void LoDQuad::setupMaxHeights()
+{
+    int cells = 0;
+    for (int l=0; l<HEIGHT_GRID_LEVELS; l++) {
+        int size = HEIGHT_GRID_SIZE >> l;
+        cells += size*size;
+    }
+    max_height.assign(cells, -1e30f);
+    
+    for (int t=0; t<triangles; t++) {
+        if (triangle[t].flags & TFLAG_HAS_CHILDREN) continue;
+        const ju32 *vertex = tri_vertex[t];
+        float x0 = vertexX(vertex[0]), x1 = x0;
+        float z0 = vertexZ(vertex[0]), z1 = z0;
+        float y = vertexY(vertex[0]);
+        for (int k=1; k<3; k++) {
+            x0 = std::min(x0, vertexX(vertex[k]));
+            x1 = std::max(x1, vertexX(vertex[k]));
+            z0 = std::min(z0, vertexZ(vertex[k]));
+            z1 = std::max(z1, vertexZ(vertex[k]));
+            y = std::max(y, vertexY(vertex[k]));
+        }
+        int i0 = std::max(0, (int) ((x0 - grid_x0) * grid_scale_x));
+        int i1 = std::min(HEIGHT_GRID_SIZE-1, (int) ((x1 - grid_x0) * grid_scale_x));
+        int j0 = std::max(0, (int) ((z0 - grid_z0) * grid_scale_z));
+        int j1 = std::min(HEIGHT_GRID_SIZE-1, (int) ((z1 - grid_z0) * grid_scale_z));
+        for (int j=j0; j<=j1; j++) {
+            for (int i=i0; i<=i1; i++) {
+                float & m = max_height[j*HEIGHT_GRID_SIZE + i];
+                m = std::max(m, y);
+            }
+        }
+    }
+    
+    int offset = 0;
+    for (int l=1; l<HEIGHT_GRID_LEVELS; l++) {
+        int below = HEIGHT_GRID_SIZE >> (l-1);
+        int size = below / 2;
+        const float *src = &max_height[offset];
+        float *dst = &max_height[offset + below*below];
+        for (int j=0; j<size; j++) {
+            for (int i=0; i<size; i++) {
+                dst[j*size + i] = std::max(
+                        std::max(src[2*j*below + 2*i], src[2*j*below + 2*i+1]),
+                        std::max(src[(2*j+1)*below + 2*i],
+                                 src[(2*j+1)*below + 2*i+1]));
+            }
+        }
+        offset += below*below;
+    }
+}
+
+// Returns the triangle to start the search for (x/z) with
+ju32 LoDQuad::findStartTriangle(float x, float z)
+{
+    if (height_grid.empty()) return GRID_ROOTS;
+    int i = (int) ((x - grid_x0) * grid_scale_x);
+    int j = (int) ((z - grid_z0) * grid_scale_z);
+    i = std::max(0, std::min(HEIGHT_GRID_SIZE-1, i));
+    j = std::max(0, std::min(HEIGHT_GRID_SIZE-1, j));
+    return height_grid[j*HEIGHT_GRID_SIZE + i];
+}
+
+// Returns the leaf triangle containing (x/z), or GRID_ROOTS if there is none
+ju32 LoDQuad::findLeaf(float x, float z)
+{
+    ju32 t = findStartTriangle(x, z);
+    if (t == GRID_ROOTS) {
+        if (triangleContains(0, x, z)) t = 0;
+        else if (triangleContains(1, x, z)) t = 1;
+        else return GRID_ROOTS;
+    }
+    while (triangle[t].flags & TFLAG_HAS_CHILDREN) {
+        ju32 c = triangle[t].child;
+        t = triangleContains(c, x, z) ? c : c+1;
+    }
+    return t;
+}
+
 
-#define VSCALAR(x1,y1,x2,y2) ((x1)*(x2)+(y1)*(y2))
 // Returns false if (x/z) is not inside
 // Our triangle looks like this:
 //             2 p2
@@ -49,7 +293,7 @@ float LoDQuad::getHeightAt(float x, float z, Vector *out_normal)
 // 0 -------------- 1
 // p0      0 v0     p1
 
-bool LoDQuad::getHeightAtTriangle(LoDTriangle *tri, float x, float z, float *height, Vector *out_normal)
+bool LoDQuad::getHeightAtTriangle(ju32 tri, float x, float z, float *height, Vector *out_normal)
 {
     float px[3], py[3], pz[3]; // the triangle corners
     float vx[3], vz[3];        // Direction vectors of the tri edges
@@ -59,9 +303,9 @@ bool LoDQuad::getHeightAtTriangle(LoDTriangle *tri, float x, float z, float *hei
     bool all_positive;
     // Copy the triangle corner points
     for(int i=0; i<3; i++) {
-        px[i]=this->vx[tri->vertex[i]];
-        py[i]=this->vy[tri->vertex[i]];
-        pz[i]=this->vz[tri->vertex[i]];
+        px[i]=vertexX(tri_vertex[tri][i]);
+        py[i]=vertexY(tri_vertex[tri][i]);
+        pz[i]=vertexZ(tri_vertex[tri][i]);
         //ls_warning("px[%d] = %f\tpz[%d] = %f\n", i, px[i], i, pz[i]);
     }
     
@@ -98,9 +342,10 @@ bool LoDQuad::getHeightAtTriangle(LoDTriangle *tri, float x, float z, float *hei
     
     // Now, if the triangle has children, pass the test to them. Else, we have
     // to calculate the interpolated y value (height) of the tri at (x,z)
-    if (tri->flags & TFLAG_HAS_CHILDREN) {
-        return getHeightAtTriangle(tri->child[0], x, z, height, out_normal)
-                || getHeightAtTriangle(tri->child[1], x, z, height, out_normal);
+    if (triangle[tri].flags & TFLAG_HAS_CHILDREN) {
+        ju32 child = triangle[tri].child;
+        return getHeightAtTriangle(child, x, z, height, out_normal)
+                || getHeightAtTriangle(child+1, x, z, height, out_normal);
     } else {
         dp[1] = VSCALAR(nx[2], nz[2], px[1]-px[2], pz[1]-pz[2]);
         dp[0] = VSCALAR(nx[1], nz[1], px[0]-px[2], pz[0]-pz[2]);
@@ -163,9 +408,11 @@ bool LoDQuad::getHeightAtTriangle(LoDTriangle *tri, float x, float z, float *hei
 //     return true;
 // }
 
-bool LoDQuad::lineCollides(Vector a, Vector b, float * t, LoDTriangle * tri, Vector *out_normal)
+bool LoDQuad::lineCollides(Vector a, Vector b, float * t, ju32 idx, Vector *out_normal)
 {
     float t0, t1;
+    const LoDTriangle *tri = &triangle[idx];
+    const ju32 *vertex = tri_vertex[idx];
     
     if ((a-b).lengthSquare() < 1e-10) return false;
     
@@ -192,8 +439,8 @@ bool LoDQuad::lineCollides(Vector a, Vector b, float * t, LoDTriangle * tri, Vec
         t0 = std::max(0.0f, t0);
         t1 = std::min(1.0f, t1);
         */
-        Vector p0( vx[tri->vertex[0]], vy[tri->vertex[0]], vz[tri->vertex[0]]);
-        Vector p1( vx[tri->vertex[1]], vy[tri->vertex[1]], vz[tri->vertex[1]]);
+        Vector p0 = getVertex(vertex[0]);
+        Vector p1 = getVertex(vertex[1]);
         // using the line's direction we calculate which child triangle we have
         // to check first. If the lines's direction is from left to right,
         // it's the left triangle, if it's from right to left, it's the right
@@ -201,8 +448,8 @@ bool LoDQuad::lineCollides(Vector a, Vector b, float * t, LoDTriangle * tri, Vec
         bool left_first = (p1-p0) * (b-a) > 0.0f;
         /*
         bool c0, c1;
-        c0 = lineCollides(a, b, &t0, tri->child[0]);
-        c1 = lineCollides(a, b, &t1, tri->child[1]);
+        c0 = lineCollides(a, b, &t0, tri->child);
+        c1 = lineCollides(a, b, &t1, tri->child+1);
         if (c0 && c1) {
             *t = std::min(t0, t1);
             return true;
@@ -214,17 +461,17 @@ bool LoDQuad::lineCollides(Vector a, Vector b, float * t, LoDTriangle * tri, Vec
             return true;
         } else return false;
         */
-        if (lineCollides(a,b, t, tri->child[left_first?0:1], out_normal)) {
+        if (lineCollides(a,b, t, tri->child + (left_first?0:1), out_normal)) {
             return true;
-        } else if (lineCollides(a,b, t, tri->child[left_first?1:0], out_normal)) {
+        } else if (lineCollides(a,b, t, tri->child + (left_first?1:0), out_normal)) {
             return true;
         } else return false;
     }
     
     // plane collision test
-    Vector p0( vx[tri->vertex[0]], vy[tri->vertex[0]], vz[tri->vertex[0]]);
-    Vector p1( vx[tri->vertex[1]], vy[tri->vertex[1]], vz[tri->vertex[1]]);
-    Vector p2( vx[tri->vertex[2]], vy[tri->vertex[2]], vz[tri->vertex[2]]);
+    Vector p0 = getVertex(vertex[0]);
+    Vector p1 = getVertex(vertex[1]);
+    Vector p2 = getVertex(vertex[2]);
     Plane plane(p0,p2,p1);
     if (!Collide::lineOnPlane(Line::Between(a,b), plane, t)) {
         return false;
@@ -250,3 +497,132 @@ bool LoDQuad::lineCollides(Vector a, Vector b, float * t, LoDTriangle * tri, Vec
     else return false;
 }
 
+
+namespace {
+    // Narrows [*t0,*t1] to the part where a+t*d lies within the rectangle
+    // [x0,x1]x[z0,z1] of the x/z plane. Returns false if that is empty.
+    bool clipToRect(const Vector & a, const Vector & d,
+            float x0, float z0, float x1, float z1, float *t0, float *t1)
+    {
+        const float lo[2] = {x0, z0};
+        const float hi[2] = {x1, z1};
+        for (int k=0; k<2; k++) {
+            float p = a[2*k], v = d[2*k];
+            if (v == 0) {
+                if (p < lo[k] || p > hi[k]) return false;
+                continue;
+            }
+            float ta = (lo[k] - p) / v;
+            float tb = (hi[k] - p) / v;
+            if (ta > tb) std::swap(ta, tb);
+            *t0 = std::max(*t0, ta);
+            *t1 = std::min(*t1, tb);
+        }
+        return *t0 <= *t1;
+    }
+}
+
+// Finds the first point in the part [t0,t1] of the line from a to b where it
+// hits this quad. The line is marched through the max-mip pyramid, skipping
+// all cells it passes above; only the triangles under the cells it may hit
+// are tested.
+bool LoDQuad::castRay(const Vector & a, const Vector & b, float t0, float t1,
+                      float *t, Vector *out_normal)
+{
+    return castRayNode(HEIGHT_GRID_LEVELS-1, 0, 0, a, b, t0, t1, t, out_normal);
+}
+
+bool LoDQuad::castRayNode(int level, int i, int j,
+                          const Vector & a, const Vector & b, float t0, float t1,
+                          float *t, Vector *out_normal)
+{
+    Vector d = b - a;
+    float cw = (1 << level) / grid_scale_x;
+    float ch = (1 << level) / grid_scale_z;
+    float x0 = grid_x0 + i*cw;
+    float z0 = grid_z0 + j*ch;
+    if (!clipToRect(a, d, x0, z0, x0+cw, z0+ch, &t0, &t1)) return false;
+    
+    int offset = 0;
+    for (int l=0; l<level; l++) {
+        int size = HEIGHT_GRID_SIZE >> l;
+        offset += size*size;
+    }
+    int size = HEIGHT_GRID_SIZE >> level;
+    float y_min = std::min(a[1] + t0*d[1], a[1] + t1*d[1]);
+    if (y_min > max_height[offset + j*size + i]) return false;
+    
+    if (level == 0) {
+        float pad = CELL_PADDING / d.length();
+        float best = std::min(1.0f, t1 + pad);
+        t0 = std::max(0.0f, t0 - pad);
+        ju32 hit = GRID_ROOTS;
+        ju32 start = height_grid[j*HEIGHT_GRID_SIZE + i];
+        if (start == GRID_ROOTS) {
+            castRayTriangles(0, a, d, t0, &best, &hit);
+            castRayTriangles(1, a, d, t0, &best, &hit);
+        } else {
+            castRayTriangles(start, a, d, t0, &best, &hit);
+        }
+        if (hit == GRID_ROOTS) return false;
+        *t = best;
+        if (out_normal) *out_normal = tri_normal[hit];
+        return true;
+    }
+    
+    // Visit the four children in the order the line enters them
+    int first_i = d[0] < 0, first_j = d[2] < 0;
+    float tx = (d[0] != 0) ? (x0 + cw/2 - a[0]) / d[0] : 2.0f;
+    float tz = (d[2] != 0) ? (z0 + ch/2 - a[2]) / d[2] : 2.0f;
+    int order[4][2] = {
+        {first_i, first_j},
+        {tx < tz ? 1-first_i : first_i, tx < tz ? first_j : 1-first_j},
+        {tx < tz ? first_i : 1-first_i, tx < tz ? 1-first_j : first_j},
+        {1-first_i, 1-first_j}};
+    for (int k=0; k<4; k++) {
+        if (castRayNode(level-1, 2*i + order[k][0], 2*j + order[k][1],
+                a, b, t0, t1, t, out_normal))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Intersects the line a+t*d, t in [t0,*t1], with the leaf triangles below
+// tri. Stores the first hit in *t1 and *hit. Subtrees whose bounding sphere
+// the line misses are skipped.
+void LoDQuad::castRayTriangles(ju32 tri, const Vector & a, const Vector & d,
+                               float t0, float *t1, ju32 *hit)
+{
+    const LoDTriangle *lt = &triangle[tri];
+    Vector c = lt->bs_center - a;
+    float s = std::max(t0, std::min(*t1, (c*d) / d.lengthSquare()));
+    if ((c - s*d).lengthSquare() > lt->radius * lt->radius) return;
+    
+    if (lt->flags & TFLAG_HAS_CHILDREN) {
+        castRayTriangles(lt->child, a, d, t0, t1, hit);
+        castRayTriangles(lt->child+1, a, d, t0, t1, hit);
+        return;
+    }
+    
+    // Moeller-Trumbore line/triangle intersection
+    const ju32 *vertex = tri_vertex[tri];
+    Vector p0 = getVertex(vertex[0]);
+    Vector e1 = getVertex(vertex[1]) - p0;
+    Vector e2 = getVertex(vertex[2]) - p0;
+    Vector h = d % e2;
+    float det = e1 * h;
+    if (det == 0) return;
+    Vector r = a - p0;
+    float u = (r * h) / det;
+    if (u < 0 || u > 1) return;
+    Vector q = r % e1;
+    float v = (d * q) / det;
+    if (v < 0 || u + v > 1) return;
+    float t = (e2 * q) / det;
+    if (t >= t0 && t <= *t1) {
+        *t1 = t;
+        *hit = tri;
+    }
+}
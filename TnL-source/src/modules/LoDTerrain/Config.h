@@ -5,6 +5,7 @@
 #define ENABLE_SPHERE_DEBUGGING 0
 #define ENABLE_LIGHTMAP 1
 #define ENABLE_FOG_LAYER 1
+#define ENABLE_BATCHED_DRAWING 1
 
 #define ERROR_FACTOR 200.0
 //#define MAX_ERROR 0.005
@@ -25,3 +26,9 @@
 #define ENABLE_DETAIL_TEX 0
 
 #define TEX_MIN_RANGE 2500.0
+
+// How far the camera may move before the fog strengths of the terrain
+// vertices are recomputed. With the default fog ranges that changes them
+// by less than one step of an 8 bit alpha value, except along lines of
+// sight that graze the ground fog layer.
+#define FOG_CACHE_TOLERANCE 10.0
@@ -2,85 +2,195 @@
 #include <algorithm>
 #include "LoDTerrain.h"
 #include "Config.h"
-#include <interfaces/ICamera.h>
 
-void LoDQuad::draw(JRenderer *renderer)
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define USE_SSE2 1
+#else
+#define USE_SSE2 0
+#endif
+
+void LoDQuad::draw(JRenderer *renderer, const Vector &camera_pos)
 {
     renderer->setCullMode(JR_CULLMODE_CULL_POSITIVE);
     renderer->disableFog();
+    view_pos = camera_pos;
+    draw_calls = draw_triangles = 0;
+#if ENABLE_BATCHED_DRAWING
+    clearBatches();
+#endif
     float alpha[3];
 #if ENABLE_FOG_LAYER
+    updateFogCache();
     for(int i=0; i<3; i++) {
-        Vector v(
-                vx[triangle[0].vertex[i]],
-                vy[triangle[0].vertex[i]],
-                vz[triangle[0].vertex[i]]);
-        alpha[i] = environment->getFogStrengthAt(v);
+        alpha[i] = vfog[tri_vertex[0][i]];
     }
 #endif
-    drawRecursive(renderer,&triangle[0],
-            vy[triangle[0].vertex[0]],
-            vy[triangle[0].vertex[1]],
-            vy[triangle[0].vertex[2]], alpha);
+#if ENABLE_BATCHED_DRAWING
+    collectRecursive(0,
+            vertexY(tri_vertex[0][0]),
+            vertexY(tri_vertex[0][1]),
+            vertexY(tri_vertex[0][2]), alpha);
+#else
+    drawRecursive(renderer,0,
+            vertexY(tri_vertex[0][0]),
+            vertexY(tri_vertex[0][1]),
+            vertexY(tri_vertex[0][2]), alpha);
+#endif
 #if ENABLE_FOG_LAYER
     alpha[2] = alpha[0];
     alpha[0] = alpha[1];
     alpha[1] = alpha[2];
-    alpha[2] = environment->getFogStrengthAt( Vector(
-            vx[triangle[1].vertex[2]],
-            vy[triangle[1].vertex[2]],
-            vz[triangle[1].vertex[2]]));
+    alpha[2] = vfog[tri_vertex[1][2]];
+#endif
+#if ENABLE_BATCHED_DRAWING
+    collectRecursive(1,
+            vertexY(tri_vertex[1][0]),
+            vertexY(tri_vertex[1][1]),
+            vertexY(tri_vertex[1][2]), alpha);
+    drawBatches(renderer);
+#else
+    drawRecursive(renderer,1,
+            vertexY(tri_vertex[1][0]),
+            vertexY(tri_vertex[1][1]),
+            vertexY(tri_vertex[1][2]), alpha);
 #endif
-    drawRecursive(renderer,&triangle[1],
-            vy[triangle[1].vertex[0]],
-            vy[triangle[1].vertex[1]],
-            vy[triangle[1].vertex[2]], alpha);
     
     renderer->enableFog();
 }
 
+// Recomputes the fog strengths of all vertices if the fog parameters have
+// changed or the camera has moved by more than FOG_CACHE_TOLERANCE since
+// the last time. This is the same as Environment::getFogStrengthAt, but
+// with the part of the line of sight inside the ground fog layer found by
+// clipping its parameter instead of its end points, which can be done for
+// four vertices at once.
+void LoDQuad::updateFogCache()
+{
+    const Vector & p = environment->getFogOrigin();
+    float params[4] = {
+        environment->getGroundFogMin(),
+        environment->getGroundFogMax(),
+        environment->getGroundFogRange(),
+        environment->getClipMax()
+    };
+    if (fog_valid && (p - fog_view).length() <= FOG_CACHE_TOLERANCE
+        && std::equal(params, params+4, fog_params))
+    {
+        return;
+    }
+    fog_valid = true;
+    fog_view = p;
+    std::copy(params, params+4, fog_params);
+
+    int i = 0;
+#if USE_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 px = _mm_set1_ps(p[0]);
+    const __m128 py = _mm_set1_ps(p[1]);
+    const __m128 pz = _mm_set1_ps(p[2]);
+    // The bounds of the ground fog layer relative to the camera
+    const __m128 lo = _mm_set1_ps(params[0] - p[1]);
+    const __m128 hi = _mm_set1_ps(params[1] - p[1]);
+    const __m128 range = _mm_set1_ps(params[2]);
+    const __m128 clip = _mm_set1_ps(params[3]);
+    // Horizontal lines of sight are either inside the layer or not at all
+    bool inside = p[1] >= params[0] && p[1] <= params[1];
+    const __m128 flat_frac = inside ? one : zero;
+    for (; i+4 <= vertices; i+=4) {
+        __m128 x, y, z;
+        if (vh) {
+            // Four compact vertices are always in the same grid row
+            __m128i h = _mm_unpacklo_epi16(
+                    _mm_loadl_epi64((const __m128i*) (vh+i)),
+                    _mm_setzero_si128());
+            __m128i col = _mm_add_epi32(
+                    _mm_set1_epi32(i & ((1 << vgrid_shift) - 1)),
+                    _mm_set_epi32(3, 2, 1, 0));
+            x = _mm_add_ps(_mm_set1_ps(vgrid_x0), _mm_mul_ps(
+                    _mm_cvtepi32_ps(col), _mm_set1_ps(vgrid_dx)));
+            y = _mm_add_ps(_mm_set1_ps(vh_offset), _mm_mul_ps(
+                    _mm_cvtepi32_ps(h), _mm_set1_ps(vh_scale)));
+            z = _mm_set1_ps(vertexZ(i));
+        } else {
+            x = _mm_loadu_ps(vx+i);
+            y = _mm_loadu_ps(vy+i);
+            z = _mm_loadu_ps(vz+i);
+        }
+        __m128 dx = _mm_sub_ps(x, px);
+        __m128 dy = _mm_sub_ps(y, py);
+        __m128 dz = _mm_sub_ps(z, pz);
+        __m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+        
+        // The line of sight enters and leaves the layer at sa and sb, in
+        // fractions of its length
+        __m128 sa = _mm_div_ps(lo, dy);
+        __m128 sb = _mm_div_ps(hi, dy);
+        __m128 s0 = _mm_max_ps(zero, _mm_min_ps(sa, sb));
+        __m128 s1 = _mm_min_ps(one, _mm_max_ps(sa, sb));
+        __m128 frac = _mm_max_ps(zero, _mm_sub_ps(s1, s0));
+        __m128 flat = _mm_cmpeq_ps(dy, zero);
+        frac = _mm_or_ps(_mm_andnot_ps(flat, frac),
+                         _mm_and_ps(flat, flat_frac));
+        
+        __m128 ground = _mm_min_ps(one,
+                _mm_div_ps(_mm_mul_ps(frac, dist), range));
+        __m128 normal = _mm_min_ps(one, _mm_div_ps(dist, clip));
+        __m128 fog = _mm_sub_ps(one, _mm_mul_ps(
+                _mm_sub_ps(one, ground), _mm_sub_ps(one, normal)));
+        _mm_storeu_ps(vfog+i, fog);
+    }
+#endif
+    for (; i<vertices; i++) {
+        vfog[i] = environment->getFogStrengthAt(getVertex(i));
+    }
+}
+
 void LoDQuad::drawWire(JRenderer *renderer)
 {
     renderer->setCullMode(JR_CULLMODE_NO_CULLING);
     BorderSet bdrs_left  = {true, true, true};
     BorderSet bdrs_right = {true, true, false};
-    drawWireRecursive(renderer,&triangle[0], bdrs_left);
-    drawWireRecursive(renderer,&triangle[1], bdrs_right);
+    drawWireRecursive(renderer,0, bdrs_left);
+    drawWireRecursive(renderer,1, bdrs_right);
 }
 
-void LoDQuad::drawRecursive(JRenderer *r, LoDTriangle *tri,
+void LoDQuad::drawRecursive(JRenderer *r, ju32 idx,
         float y0, float y1, float y2, float * alpha)
 {
-    if(tri->morph < 0.0 || tri->morph > 1.0) ls_error("\bmorph:%f\n", tri->morph);
+    const LoDTriangle *tri = &triangle[idx];
+    const ju32 *vertex = tri_vertex[idx];
+    float morph = tri_morph[idx];
+    if(morph < 0.0 || morph > 1.0) ls_error("\bmorph:%f\n", morph);
     if(tri->flags & TFLAG_DONT_DRAW) return;
     
     int i;
     float y[3];
     y[0] = y0;
     y[1] = y1;
-    y[2] = tri->morph * vy[tri->vertex[2]] + (1.0 - tri->morph) * y2;
+    y[2] = morph * vertexY(vertex[2]) + (1.0 - morph) * y2;
     
     if (tri->flags & TFLAG_ENABLED) {
         // We make the backface culling test here because this almost impossible
         // during setup (without calculating morphed coords)
-        int vtx = tri->vertex[0];
-        Vector p0 = Vector(vx[vtx], y[0], vz[vtx]);
-        vtx = tri->vertex[1];
-        Vector p1 = Vector(vx[vtx], y[1], vz[vtx]);
-        vtx = tri->vertex[2];
-        Vector p2 = Vector(vx[vtx], y[2], vz[vtx]);
+        int vtx = vertex[0];
+        Vector p0 = Vector(vertexX(vtx), y[0], vertexZ(vtx));
+        vtx = vertex[1];
+        Vector p1 = Vector(vertexX(vtx), y[1], vertexZ(vtx));
+        vtx = vertex[2];
+        Vector p2 = Vector(vertexX(vtx), y[2], vertexZ(vtx));
         Vector d1 = p1 - p0;
         Vector d2 = p2 - p0;
         Vector n = d2 % d1;
-        Vector pos;
-        pos = game->getCamera()->getLocation();
-        if (n*(p2-pos) > 0) return;
+        if (n*(p2-view_pos) > 0) return;
     }
     
 #if ENABLE_FOG_LAYER
     float min_fog = std::min(alpha[0], std::min(alpha[1], alpha[2]));
     if ((tri->flags & TFLAG_ENABLED) && min_fog >= 1) {
-        drawFogTriangle(r, tri, y, alpha);
+        drawFogTriangle(r, idx, y, alpha);
         return;
     }
 #endif
@@ -97,38 +207,31 @@ void LoDQuad::drawRecursive(JRenderer *r, LoDTriangle *tri,
         for (i=0; i<3; i++) {
             Vector color(1,1,1);
             //if (tri->flags & TFLAG_DEBUG) color[1]=0;
-            int vtx = tri->vertex[i];
-            Vector v( vx[vtx], y[i], vz[vtx]);
-            Vector uvw( tex_u[vtx], tex_v[vtx], 0);
+            int vtx = vertex[i];
+            Vector v( vertexX(vtx), y[i], vertexZ(vtx));
+            Vector uvw( vertexU(vtx), vertexV(vtx), 0);
 
             r->setColor(color);
             r->setUVW(uvw);
             r->vertex(v);
         }
         r->end();
+        draw_calls++;
+        draw_triangles++;
 #endif
 #if ENABLE_NEIGHBOR_DEBUGGING
         ls_message("NEIGHBOR DEBUGGING.\n");
+        const ju32 *nbref = tri_neighbor[idx];
         for(int n=0; n<3; n++) {
-            ls_message("neighbor[%d]=%p\n", n, tri->neighbor[n]);
-            if (tri->neighbor[0]==tri->neighbor[1]
-                    && tri->neighbor[1]==tri->neighbor[2]) {
-                ls_warning("All neighbors are equal! %p\n", tri->neighbor[0]);
+            ls_message("neighbor[%d]=%08x\n", n, nbref[n]);
+            if (nbref[0]==nbref[1] && nbref[1]==nbref[2]) {
+                ls_warning("All neighbors are equal! %08x\n", nbref[0]);
             }
-            if (!tri->neighbor[n]) {
+            if (!nbref[n]) {
                 ls_warning("No neighbor!\n");
-                Vector p0 = Vector(
-                        vx[tri->vertex[0]],
-                        vy[tri->vertex[0]],
-                        vz[tri->vertex[0]]);
-                Vector p1 = Vector(
-                        vx[tri->vertex[1]],
-                        vy[tri->vertex[1]],
-                        vz[tri->vertex[1]]);
-                Vector p2 = Vector(
-                        vx[tri->vertex[2]],
-                        vy[tri->vertex[2]],
-                        vz[tri->vertex[2]]);
+                Vector p0 = getVertex(vertex[0]);
+                Vector p1 = getVertex(vertex[1]);
+                Vector p2 = getVertex(vertex[2]);
                 Vector m0 = (p0 + p1 + p2)/3 + Vector(0,1000,0);
                 Vector m1;
 
@@ -151,43 +254,23 @@ void LoDQuad::drawRecursive(JRenderer *r, LoDTriangle *tri,
                 *r << m0 << m1;
                 r->end();
             } else {
-                Vector p0 = (Vector(vx[tri->vertex[0]], vy[tri->vertex[0]], vz[tri->vertex[0]])
-                        + Vector(vx[tri->vertex[1]], vy[tri->vertex[1]], vz[tri->vertex[1]])
-                        + Vector(vx[tri->vertex[2]], vy[tri->vertex[2]], vz[tri->vertex[2]]))
+                Vector p0 = (getVertex(vertex[0])
+                        + getVertex(vertex[1])
+                        + getVertex(vertex[2]))
                         / 3;
-                float *vx=this->vx, *vy=this->vy, *vz=this->vz;
-                LoDTriangle * nb = tri->neighbor[n];
-                if (nb < triangle || nb >= triangle+triangles) {
-                    for(int i=0; i<4; i++) {
-                        if (neighbor[i] &&
-                            nb >= neighbor[i]->triangle &&
-                            nb  < neighbor[i]->triangle+neighbor[i]->triangles) {
-                            vx = neighbor[i]->vx;
-                            vy = neighbor[i]->vy;
-                            vz = neighbor[i]->vz;
-                            break;
-                        }
-                    }
-                }
-                Vector p4 = (Vector(vx[nb->vertex[0]], vy[nb->vertex[0]], vz[nb->vertex[0]])
-                        + Vector(vx[nb->vertex[1]], vy[nb->vertex[1]], vz[nb->vertex[1]])
-                        + Vector(vx[nb->vertex[2]], vy[nb->vertex[2]], vz[nb->vertex[2]]))
+                ju32 nb;
+                const LoDQuad *nq = resolve(nbref[n], &nb);
+                const ju32 *nv = nq->tri_vertex[nb];
+                Vector p4 = (nq->getVertex(nv[0])
+                        + nq->getVertex(nv[1])
+                        + nq->getVertex(nv[2]))
                         / 3;
-                ls_message("Neighbor %d is triangle at %p with midpoint at: ",
-                        n, nb);
+                ls_message("Neighbor %d is triangle %u of quad %p with midpoint at: ",
+                        n, nb, nq);
                 {
-                    Vector p0 = Vector(
-                            vx[nb->vertex[0]],
-                            vy[nb->vertex[0]],
-                            vz[nb->vertex[0]]);
-                    Vector p1 = Vector(
-                            vx[nb->vertex[1]],
-                            vy[nb->vertex[1]],
-                            vz[nb->vertex[1]]);
-                    Vector p2 = Vector(
-                            vx[nb->vertex[2]],
-                            vy[nb->vertex[2]],
-                            vz[nb->vertex[2]]);
+                    Vector p0 = nq->getVertex(nv[0]);
+                    Vector p1 = nq->getVertex(nv[1]);
+                    Vector p2 = nq->getVertex(nv[2]);
                     p0.dump();
                     p1.dump();
                     p2.dump();
@@ -223,7 +306,7 @@ void LoDQuad::drawRecursive(JRenderer *r, LoDTriangle *tri,
 #define PI 3.141593
 #define SPHERE_SEGMENTS 24
         {
-            Vector p = game->getCamera()->getLocation();
+            Vector p = view_pos;
             float d = (tri->bs_center - p).length();
             float rad = tri->radius;
             float e = rad*rad/d;
@@ -253,9 +336,9 @@ void LoDQuad::drawRecursive(JRenderer *r, LoDTriangle *tri,
         r->begin(JR_DRAWMODE_TRIANGLES);
         for (int x = 2<<(DETAIL_LAYERS-1); x >= 1; x/=2) {
             for (i=0; i<3; i++) {
-                v.p.x = vx[ tri->vertex[i] ];
-                v.p.y = vy[ tri->vertex[i] ];
-                v.p.z = vz[ tri->vertex[i] ];
+                v.p.x = vertexX(vertex[i]);
+                v.p.y = vertexY(vertex[i]);
+                v.p.z = vertexZ(vertex[i]);
 
                 v.txt.x=v.p.x * DETAIL_SCALE / (float)x;
                 v.txt.y=-v.p.z * DETAIL_SCALE / (float)x;
@@ -270,7 +353,7 @@ void LoDQuad::drawRecursive(JRenderer *r, LoDTriangle *tri,
 #endif
 #if ENABLE_TEXTURING
         if ((tri->flags & TFLAG_HAS_CHILDREN)==0) {
-            drawTexturedTriangle(r, tri, y);
+            drawTexturedTriangle(r, idx, y);
         }
 #endif
 #if ENABLE_LIGHTMAP
@@ -282,70 +365,67 @@ void LoDQuad::drawRecursive(JRenderer *r, LoDTriangle *tri,
         r->begin(JR_DRAWMODE_TRIANGLES);
         for (i=0; i<3; i++) {
             Vector color(1,1,1);
-            int vtx = tri->vertex[i];
-            Vector v( vx[vtx], y[i], vz[vtx]);
-            Vector uvw( tex_u[vtx], tex_v[vtx], 0);
+            int vtx = vertex[i];
+            Vector v( vertexX(vtx), y[i], vertexZ(vtx));
+            Vector uvw( vertexU(vtx), vertexV(vtx), 0);
             r->setColor(color);
             r->setAlpha(1);
             r->setUVW(uvw);
             r->vertex(v);
         }
         r->end();
+        draw_calls++;
+        draw_triangles++;
         r->setBlendMode(JR_BLENDMODE_BLEND);
 #endif
 #if ENABLE_FOG_LAYER
-        drawFogTriangle(r,tri,y,alpha);
+        drawFogTriangle(r,idx,y,alpha);
 #endif
     } else {
         float ym = (y[0] + y[1]) / 2.0;
         float a[3];
 #if ENABLE_FOG_LAYER
-        Vector v(
-                vx[tri->child[0]->vertex[2]],
-                vy[tri->child[0]->vertex[2]],
-                vz[tri->child[0]->vertex[2]]);
-        float fog = environment->getFogStrengthAt(v);
-        a[2]=(alpha[0]+alpha[1])/2 * (1-tri->child[0]->morph)
-                + fog * tri->child[0]->morph;
+        float fog = vfog[tri_vertex[tri->child][2]];
+        a[2]=(alpha[0]+alpha[1])/2 * (1-tri_morph[tri->child])
+                + fog * tri_morph[tri->child];
         a[0]=alpha[2];
         a[1]=alpha[0];
 #endif
         // left child
-        drawRecursive(r, tri->child[0], y[2], y[0], ym, a);
+        drawRecursive(r, tri->child, y[2], y[0], ym, a);
 #if ENABLE_FOG_LAYER
         a[0]=alpha[1];
         a[1]=alpha[2];
 #endif
         // right child
-        drawRecursive(r, tri->child[1], y[1], y[2], ym, a);
+        drawRecursive(r, tri->child+1, y[1], y[2], ym, a);
     }
 }
 
-void LoDQuad::drawWireBorder(JRenderer *r, LoDTriangle *tri, int i0, int i1)
+void LoDQuad::drawWireBorder(JRenderer *r, ju32 tri, int i0, int i1)
 {
+    const ju32 *vertex = tri_vertex[tri];
     jvertex_coltxt v;
     
     v.col.r = 0.0;
     v.col.g = 0.0;
     v.col.b = 0.0;
     
-    v.p.x = vx[ tri->vertex[i0] ];
-    v.p.y = vy[ tri->vertex[i0] ];
-    v.p.z = vz[ tri->vertex[i0] ];
+    v.p.x = vertexX(vertex[i0]);
+    v.p.y = vertexY(vertex[i0]);
+    v.p.z = vertexZ(vertex[i0]);
     r->addVertex(&v);
 
-    v.p.x = vx[ tri->vertex[i1] ];
-    v.p.y = vy[ tri->vertex[i1] ];
-    v.p.z = vz[ tri->vertex[i1] ];
+    v.p.x = vertexX(vertex[i1]);
+    v.p.y = vertexY(vertex[i1]);
+    v.p.z = vertexZ(vertex[i1]);
     r->addVertex(&v);
 }
     
         
-void LoDQuad::drawWireRecursive(JRenderer *r, LoDTriangle *tri, BorderSet bdrs)
+void LoDQuad::drawWireRecursive(JRenderer *r, ju32 tri, BorderSet bdrs)
 {
-    int i;
-    
-    if (tri->flags & TFLAG_ENABLED) {
+    if (triangle[tri].flags & TFLAG_ENABLED) {
         r->setVertexMode(JR_VERTEXMODE_GOURAUD);
         
         r->begin(JR_DRAWMODE_LINES);
@@ -366,8 +446,8 @@ void LoDQuad::drawWireRecursive(JRenderer *r, LoDTriangle *tri, BorderSet bdrs)
         child_bdrs[1].left = bdrs.bottom;
         child_bdrs[1].bottom = bdrs.right;
         
-        drawWireRecursive(r, tri->child[0], child_bdrs[0]);
-        drawWireRecursive(r, tri->child[1], child_bdrs[1]);
+        drawWireRecursive(r, triangle[tri].child, child_bdrs[0]);
+        drawWireRecursive(r, triangle[tri].child+1, child_bdrs[1]);
     }
 }
 
@@ -378,7 +458,7 @@ void LoDQuad::drawTexturedTriangle(JRenderer * r, LoDTriangle * tri, float * y)
 {
     Vector uvw[4];
     for(int i=0; i<3; i++) {
-        uvw[i] = Vector(tex_u[tri->vertex[i]], tex_v[tri->vertex[i]], 0);
+        uvw[i] = Vector(vertexU(tri->vertex[i]), vertexV(tri->vertex[i]), 0);
     }
     uvw[3][2]=0;
     if (uvw[2][0] == uvw[0][0]) uvw[3][0] = uvw[1][0]; else uvw[3][0] = uvw[0][0];
@@ -386,7 +466,7 @@ void LoDQuad::drawTexturedTriangle(JRenderer * r, LoDTriangle * tri, float * y)
     
     Vector v[3];
     for(int i=0; i<3; i++) {
-        v[i] = Vector(vx[tri->vertex[i]], y[i], vz[tri->vertex[i]]);
+        v[i] = Vector(vertexX(tri->vertex[i]), y[i], vertexZ(tri->vertex[i]));
     }
     
     int tex_indices[4];
@@ -477,17 +557,18 @@ void LoDQuad::drawTexturedTriangle(JRenderer * r, LoDTriangle * tri, float * y)
 #define SOUTHWEST 1
 
 
-void LoDQuad::drawTexturedTriangle(JRenderer * r, LoDTriangle * tri, float * y)
+void LoDQuad::drawTexturedTriangle(JRenderer * r, ju32 tri, float * y)
 {
+    const ju32 *vertex = tri_vertex[tri];
     Vector2 uv[3];
     for(int i=0; i<3; i++) {
-        uv[i] = Vector2(tex_u[tri->vertex[i]], tex_v[tri->vertex[i]]);
+        uv[i] = Vector2(vertexU(vertex[i]), vertexV(vertex[i]));
     }
     Vector2 midpt = 0.5f*(uv[0]+uv[1]);
     
     Vector vec[3];
     for(int i=0; i<3; i++) {
-        vec[i] = Vector(vx[tri->vertex[i]], y[i], vz[tri->vertex[i]]);
+        vec[i] = Vector(vertexX(vertex[i]), y[i], vertexZ(vertex[i]));
     }
     
     int tex_size = texmap->getWidth();
@@ -573,6 +654,8 @@ void LoDQuad::drawTexturedTriangle(JRenderer * r, LoDTriangle * tri, float * y)
         r->vertex(vec[i]);
     }
     r->end();
+    draw_calls++;
+    draw_triangles++;
     
     
     // Now paint each neighboring patch
@@ -607,6 +690,8 @@ void LoDQuad::drawTexturedTriangle(JRenderer * r, LoDTriangle * tri, float * y)
             }
             r->end();
         }
+        draw_calls++;
+        draw_triangles++;
     }
     
     // We're done! Restore renderer state to default.
@@ -614,16 +699,17 @@ void LoDQuad::drawTexturedTriangle(JRenderer * r, LoDTriangle * tri, float * y)
     r->disableTexturing();
 }
 
-void LoDQuad::drawFogTriangle(JRenderer * r, LoDTriangle * tri,
+void LoDQuad::drawFogTriangle(JRenderer * r, ju32 tri,
         float * y, float * alpha)
 {
+    const ju32 *vertex = tri_vertex[tri];
     float max_alpha = std::min(alpha[0], std::min(alpha[1],alpha[2]));
     //if (max_alpha < 0.05) return;
     
     Vector corner[3];
     for(int i=0; i<3; i++) {
-        int vtx = tri->vertex[i];
-        corner[i] = Vector(vx[vtx], y[i], vz[vtx]);
+        int vtx = vertex[i];
+        corner[i] = Vector(vertexX(vtx), y[i], vertexZ(vtx));
     }
     
     //r->disableFog();
@@ -639,6 +725,8 @@ void LoDQuad::drawFogTriangle(JRenderer * r, LoDTriangle * tri,
         r->vertex(corner[i]);
     }
     r->end();
+    draw_calls++;
+    draw_triangles++;
     r->disableAlphaBlending();
     //r->enableFog();
 }
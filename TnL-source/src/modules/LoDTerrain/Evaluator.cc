@@ -2,9 +2,23 @@
 #include "LoDTerrain.h"
 #include "Config.h"
 
-LoDQuad::Evaluator::Evaluator(const Vector & p, const float plane[6][4],
-        const float * vx, const float * vy, const float * vz, float focus)
-: pos(p), vx(vx), vy(vy), vz(vz), focus(focus)
+// The batch versions of evaluate and checkAgainstFrustum test four triangles
+// at once with SSE2, one per lane. Only the bounding sphere distance metric
+// has a vectorized version, the others use the single triangle code.
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define USE_SSE2 1
+#else
+#define USE_SSE2 0
+#endif
+
+#define VECTORIZED_METRIC (USE_SSE2 && USE_BOUNDING_SPHERE_DISTANCE_METRIC \
+        && !USE_Z_METRIC && !USE_BOUNDING_SPHERE_METRIC \
+        && !USE_DISTANCE_METRIC && !USE_ANGULAR_METRIC && !USE_EDGE_METRIC)
+
+LoDQuad::Evaluator::Evaluator(const LoDQuad * quad, const Vector & p,
+        const float plane[6][4], float focus, bool vectorized)
+: pos(p), quad(quad), focus(focus), vectorized(vectorized)
 {
     for(int i=0; i<6; i++) for (int j=0; j<4; j++)
         this->plane[i][j] = plane[i][j];
@@ -39,11 +53,18 @@ float LoDQuad::Evaluator::evaluate(LoDTriangle * tri)
     }
 #endif
 
+#if USE_DISTANCE_METRIC || USE_ANGULAR_METRIC || USE_EDGE_METRIC
+    // The metrics below need the cold data of the triangle
+    ju32 idx = tri - quad->triangle;
+    const ju32 *vertex = quad->tri_vertex[idx];
+    const Vector & normal = quad->tri_normal[idx];
+#endif
+
 #if USE_DISTANCE_METRIC
     {
-        Vector c0(vx[tri->vertex[0]], vy[tri->vertex[0]], vz[tri->vertex[0]]);
-        Vector c1(vx[tri->vertex[1]], vy[tri->vertex[1]], vz[tri->vertex[1]]);
-        Vector c2(vx[tri->vertex[2]], vy[tri->vertex[2]], vz[tri->vertex[2]]);
+        Vector c0 = quad->getVertex(vertex[0]);
+        Vector c1 = quad->getVertex(vertex[1]);
+        Vector c2 = quad->getVertex(vertex[2]);
         Vector c2c0 = c0 - c2;
         Vector c2c1 = c1 - c2;
         Vector c2pos = pos - c2;
@@ -51,14 +72,14 @@ float LoDQuad::Evaluator::evaluate(LoDTriangle * tri)
         float b = (c2c1 * c2pos) / (c2c1.lengthSquare());
         float dist2;
         if (a>=0 && b>=0 && a+b<=1) { // over triangle
-            dist2 = ((pos-c0) * tri->normal);
+            dist2 = ((pos-c0) * normal);
         } else {
             float d0 = (pos-c0).length();
             float d1 = (pos-c1).length();
             float d2 = (pos-c2).length();
             dist2 = std::min( std::min(d0,d1), d2 );
         }
-        //float dist2 = (Vector(vx[tri->vertex[2]], vy[tri->vertex[2]], vz[tri->vertex[2]])
+        //float dist2 = (quad->getVertex(vertex[2])
         //    - pos).length();
         error = error *
             (ERROR_FACTOR*ERROR_FACTOR) /
@@ -69,10 +90,8 @@ float LoDQuad::Evaluator::evaluate(LoDTriangle * tri)
 #if USE_ANGULAR_METRIC
     // We take into account that the error is perceived as smaller if
     // we look onto a triangle directly from top
-    Vector v0(vx[tri->vertex[0]],
-            vy[tri->vertex[0]],
-            vz[tri->vertex[0]]);
-    float scalar_prod = pow(abs(tri->normal * (v0 - pos).normalize()), 0.01);
+    Vector v0 = quad->getVertex(vertex[0]);
+    float scalar_prod = pow(abs(normal * (v0 - pos).normalize()), 0.01);
 
     error *= scalar_prod;
     //ls_error("scalar_prod: %f\n", scalar_prod);
@@ -82,18 +101,17 @@ float LoDQuad::Evaluator::evaluate(LoDTriangle * tri)
 #if USE_EDGE_METRIC
     // Lets give highly visible edges more detail
     {
-        Vector v(vx[tri->vertex[2]],vy[tri->vertex[2]],vz[tri->vertex[2]]);
+        Vector v = quad->getVertex(vertex[2]);
         v-=pos;
-        if (v * tri->normal < 0) {
+        if (v * normal < 0) {
             for(int i=0; i<3; i++) {
-                if (tri->neighbor[i]) {
-                    LoDTriangle * n = tri->neighbor[i];
-                    v = Vector(
-                            vx[n->vertex[2]],
-                            vy[n->vertex[2]],
-                            vz[n->vertex[2]]);
+                ju32 n;
+                LoDQuad *nq = quad->resolve(quad->tri_neighbor[idx][i], &n);
+                if (nq) {
+                    const ju32 *nvertex = nq->tri_vertex[n];
+                    v = nq->getVertex(nvertex[2]);
                     v-=pos;
-                    if( v * tri->neighbor[i]->normal > 0)
+                    if( v * nq->tri_normal[n] > 0)
                     {
                         error *= 3.0;
                         tri->flags |= TFLAG_DEBUG;
@@ -136,8 +154,10 @@ LoDQuad::Evaluator::checkAgainstFrustum( const LoDTriangle * tri )
 }
 
 bool LoDQuad::Evaluator::onFrontSide(const LoDTriangle * tri) {
-    int vtx = tri->vertex[2];
-    return (Vector(vx[vtx], vy[vtx], vz[vtx])-pos)*tri->normal <= 0;
+    ju32 idx = tri - quad->triangle;
+    int vtx = quad->tri_vertex[idx][2];
+    return (quad->getVertex(vtx)-pos)
+            * quad->tri_normal[idx] <= 0;
 }
 
 float LoDQuad::Evaluator::calcDistance(const Vector & point, const float *plane)
@@ -149,3 +169,87 @@ float LoDQuad::Evaluator::calcDistance(const Vector & point, const float *plane)
         plane[3];
 }
 
+
+#if USE_SSE2
+namespace {
+    // Loads the bounding spheres of four triangles into one lane each.
+    // radius follows bs_center in LoDTriangle, so each sphere is one load.
+    inline void loadSpheres(const LoDTriangle * const * tri, int n,
+            __m128 & x, __m128 & y, __m128 & z, __m128 & r)
+    {
+        // Unused lanes repeat the first triangle
+        x = _mm_loadu_ps(&tri[0]->bs_center[0]);
+        y = _mm_loadu_ps(&tri[n > 1 ? 1 : 0]->bs_center[0]);
+        z = _mm_loadu_ps(&tri[n > 2 ? 2 : 0]->bs_center[0]);
+        r = _mm_loadu_ps(&tri[n > 3 ? 3 : 0]->bs_center[0]);
+        _MM_TRANSPOSE4_PS(x, y, z, r);
+    }
+}
+#endif
+
+void LoDQuad::Evaluator::evaluate(LoDTriangle * const * tri, int n,
+                                  float *out_error)
+{
+#if VECTORIZED_METRIC
+    if (vectorized) {
+        __m128 x, y, z, r;
+        loadSpheres(tri, n, x, y, z, r);
+        float e[4];
+        for (int i=0; i<4; i++) e[i] = tri[i < n ? i : 0]->error;
+        __m128 error = _mm_max_ps(_mm_loadu_ps(e), _mm_set1_ps(MAX_ERROR));
+
+        // Same operations in the same order as evaluate, so that the
+        // results are bit for bit the same
+        x = _mm_sub_ps(x, _mm_set1_ps(pos[0]));
+        y = _mm_sub_ps(y, _mm_set1_ps(pos[1]));
+        z = _mm_sub_ps(z, _mm_set1_ps(pos[2]));
+        __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+        __m128 dist2 = _mm_max_ps(_mm_set1_ps(0.0001f), _mm_sub_ps(len, r));
+        dist2 = _mm_mul_ps(dist2, dist2);
+
+        // The scale is computed in double precision there
+        __m128d scale = _mm_set1_pd(focus * (ERROR_FACTOR*ERROR_FACTOR));
+        __m128d lo = _mm_mul_pd(_mm_cvtps_pd(error),
+                _mm_div_pd(scale, _mm_cvtps_pd(dist2)));
+        __m128d hi = _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(error, error)),
+                _mm_div_pd(scale, _mm_cvtps_pd(_mm_movehl_ps(dist2, dist2))));
+        _mm_storeu_ps(e, _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+        for (int i=0; i<n; i++) out_error[i] = e[i];
+        return;
+    }
+#endif
+    for (int i=0; i<n; i++) out_error[i] = evaluate(tri[i]);
+}
+
+void LoDQuad::Evaluator::checkAgainstFrustum(const LoDTriangle * const * tri,
+                                             int n, FrustumView *out_view)
+{
+#if USE_SSE2
+    if (vectorized) {
+        __m128 x, y, z, r;
+        loadSpheres(tri, n, x, y, z, r);
+        __m128 limit = _mm_sub_ps(_mm_sub_ps(_mm_setzero_ps(), r),
+                                  _mm_set1_ps(SAFETY_DIST));
+        __m128 partial = _mm_setzero_ps(), outside = _mm_setzero_ps();
+        for (int i=5; i >= 0; i--) {
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                    _mm_mul_ps(x, _mm_set1_ps(plane[i][0])),
+                    _mm_mul_ps(y, _mm_set1_ps(plane[i][1]))),
+                    _mm_mul_ps(z, _mm_set1_ps(plane[i][2]))),
+                    _mm_set1_ps(plane[i][3]));
+            partial = _mm_or_ps(partial, _mm_cmplt_ps(dist, r));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(dist, limit));
+        }
+        int partial_mask = _mm_movemask_ps(partial);
+        int outside_mask = _mm_movemask_ps(outside);
+        for (int i=0; i<n; i++) {
+            if (outside_mask & (1 << i)) out_view[i] = OUTSIDE;
+            else if (partial_mask & (1 << i)) out_view[i] = PARTIAL;
+            else out_view[i] = INSIDE;
+        }
+        return;
+    }
+#endif
+    for (int i=0; i<n; i++) out_view[i] = checkAgainstFrustum(tri[i]);
+}
@@ -1,26 +1,75 @@
 #include "LoDTerrain.h"
 #include <interfaces/IConfig.h>
 #include <interfaces/ICamera.h>
+#include <interfaces/IActor.h>
+#include <DataNode.h>
 #include <remap.h>
+#include <WorkerPool.h>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
 
 // BEGIN: LoDQuadManager methods
 
+// Loads the CPU side of one quad, possibly on a worker thread
+struct QuadLoadJob : public WorkerPool::Job {
+    LoDQuad *quad;
+    int u, v;
+    std::string quad_name;
+    std::string texmap_name;
+    bool use_cache;
+    bool compact_vertices;
+    std::string cache_dir;
+    bool ok;
+    std::string error;
+    LoDQuad::LoadTimes times;
+
+    virtual void run() {
+        times.geometry = times.texmap = 0;
+        error.clear();
+        try {
+            ok = quad->load(quad_name.c_str(), texmap_name.c_str(),
+                    use_cache, compact_vertices, &times, cache_dir.c_str());
+        } catch (std::exception & e) {
+            // Exceptions must not escape the worker thread; they are
+            // rethrown on the main thread
+            ok = false;
+            error = e.what();
+        }
+    }
+};
+
+// Tests a range of the segments handed to linesCollide
+struct SegmentJob : public WorkerPool::Job {
+    LoDQuadManager *manager;
+    TerrainSegment *segments;
+    const std::vector<std::pair<int, int> > *order;
+    int begin, end;
+
+    virtual void run() {
+        for (int i=begin; i<end; i++) {
+            TerrainSegment & s = segments[(*order)[i].second];
+            s.hit = manager->castRay(s.a, s.b, &s.x, 0);
+        }
+    }
+};
+
+// Segments per job of linesCollide
+#define SEGMENTS_PER_JOB 64
+
 LoDQuadManager::LoDQuadManager(IGame *the_game, Status & stat)
 {
     ls_message("<LoDQuadManager::LoDQuadManager>\n");
     
     int        u,v;
     char       buf[256];
-    std::ifstream   in;
-    LoDQuad*   (neighbor[4]);
-    TexPtr     main_tex;
-    TexPtr     detail_tex;
-    JSprite    spr;
 
     std::string terrain_prefix;
-    std::string texture_prefix;
     std::string texmap_prefix;
-    std::string lightmap_prefix;
     int quads_w;
     int quads_h;
     std::string detail_tex_name;
@@ -30,6 +79,8 @@ LoDQuadManager::LoDQuadManager(IGame *the_game, Status & stat)
     cfg    = game->getConfig();
     renderer = game->getRenderer();
 
+    Uint32 t_start = SDL_GetTicks();
+
     // Get the terrain and texture paths from the config
     terrain_prefix=cfg->query("LoDQuadManager_terrain_prefix");
     texture_prefix=cfg->query("LoDQuadManager_texture_prefix");
@@ -41,90 +92,142 @@ LoDQuadManager::LoDQuadManager(IGame *the_game, Status & stat)
     quads_w=atoi(cfg->query("LoDQuadManager_quads_w"));
     quads_h=atoi(cfg->query("LoDQuadManager_quads_h"));
 
+    bool use_cache = cfg->queryBool("LoDQuadManager_quad_cache", true);
+    // The caches go to the user's cache directory, if it can be made, and
+    // next to the .qad files otherwise
+    std::string cache_dir = cfg->query("LoDQuadManager_cache_dir", "");
+    if (use_cache && !cache_dir.empty()) {
+#ifdef _WIN32
+        _mkdir(cache_dir.c_str());
+#else
+        mkdir(cache_dir.c_str(), 0755);
+#endif
+    }
+    // Keep 16 bit heights instead of five float arrays per vertex
+    bool compact_vertices = cfg->queryBool(
+            "LoDQuadManager_compact_vertices", false);
+
+    // 0 means one thread per processor, 1 loads everything on this thread
+    int nthreads = cfg->queryInt("LoDQuadManager_load_threads", 0);
+    if (nthreads <= 0) nthreads = WorkerPool::getCPUCount();
+    nthreads = std::min(nthreads, quads_w * quads_h);
+
+    // The same for the segment tests of linesCollide, but most batches are
+    // too small to be worth spreading, so they run here by default
+    int segment_threads = cfg->queryInt("LoDQuadManager_segment_threads", 1);
+    if (segment_threads <= 0) segment_threads = WorkerPool::getCPUCount();
+
+    // The same for building the mesh from scratch. Only more than one
+    // thread sets the quads up in isolation and stitches them, see
+    // LoDQuadGrid::setupQuads
+    int setup_threads = cfg->queryInt("LoDQuadManager_setup_threads", 1);
+    if (setup_threads <= 0) setup_threads = WorkerPool::getCPUCount();
+    setup_threads = std::min(setup_threads, quads_w * quads_h);
+
+    // A page radius of 0 keeps all quads loaded all the time
+    page_radius = cfg->queryFloat("LoDQuadManager_page_radius", 0);
+    actor_page_radius = cfg->queryFloat(
+            "LoDQuadManager_actor_page_radius", 2000);
+    page_budget = (size_t) (1024.0 * 1024.0 * cfg->queryFloat(
+            "LoDQuadManager_page_budget", 512));
+    resident_bytes = 0;
+
+    // Incremental refinement changes the last frame's mesh instead of
+    // building it anew every frame
+    incremental_lod = cfg->queryBool("LoDQuadManager_incremental_lod", false);
+    lod_triangle_budget = cfg->queryInt(
+            "LoDQuadManager_triangle_budget", 100000);
+    lod_time_budget = (Uint32) cfg->queryInt(
+            "LoDQuadManager_lod_time_budget", 2);
+    mesh_valid = false;
+
     // First load the detail texture
     detail_tex = game->getTexMan()->query(
             detail_tex_name.c_str(), JR_HINT_GREYSCALE, 0, true);
 
-    width=quads_w;
-    height=quads_h;
-    quad=new LoDQuad[width*height];
+    setSize(quads_w, quads_h);
+    last_wanted.resize(width*height, -1);
+    counter=0;
 
-    stat.beginJob("Loading quads", width*height);
+    // The geometry and texmaps are loaded by the worker pool. Whenever a
+    // quad is done, its textures are created here on the main thread,
+    // since the renderer must not be used from other threads.
+    jobs = new QuadLoadJob[width*height];
+    pool = new WorkerPool(nthreads > 1 ? nthreads : 0);
+    segment_pool = new WorkerPool(segment_threads > 1 ? segment_threads : 0);
+    setup_pool = setup_threads > 1 ? new WorkerPool(setup_threads) : 0;
     for (v=0; v<height; v++) {
         for (u=0; u<width; u++) {
-            {
-                char buf[128];
-                snprintf(buf, 128, "Loading quad %d,%d", u,v);
-                stat.beginJob(buf,1);
-            }
-                
-            if (v>0) {
-                neighbor[QN_NORTH]=&quad[(v-1)*width + u];
-            } else {
-                neighbor[QN_NORTH]=0;
-            }
-
-            if (v<(height-1)) {
-                neighbor[QN_SOUTH]=&quad[(v+1)*width + u];
-            } else {
-                neighbor[QN_SOUTH]=0;
-            }
-
-            if (u>0) {
-                neighbor[QN_WEST]=&quad[v*width + u-1];
-            } else {
-                neighbor[QN_WEST]=0;
-            }
-
-            if (u<(width-1)) {
-                neighbor[QN_EAST]=&quad[v*width + u+1];
-            } else {
-                neighbor[QN_EAST]=0;
-            }
-
-            // DEBUG: set neighbors to zero and see if Landscape still crashes
-            //neighbor[QN_NORTH]=0;
-            //neighbor[QN_SOUTH]=0;
-            //neighbor[QN_EAST]=0;
-            //neighbor[QN_WEST]=0;
-
-            sprintf(buf,"%s-%d-%d.spr", texture_prefix.c_str(), u, v);
-            main_tex = game->getTexMan()->query(
-                    buf, JR_HINT_FULLOPACITY, 0, true);
-
+            QuadLoadJob & job = jobs[v*width + u];
+            job.quad = &quad[v*width + u];
+            job.u = u;
+            job.v = v;
+            job.use_cache = use_cache;
+            job.compact_vertices = compact_vertices;
+            job.cache_dir = cache_dir;
             sprintf(buf,"%s-%d-%d.qad", terrain_prefix.c_str(), u, v);
-            in.open(buf, std::ios::binary|std::ios::in);
-            if (!in) ls_error("LoDTerrain: Couldn't open %s\n", buf);
+            job.quad_name = buf;
             sprintf(buf,"%s-%d-%d.tga", texmap_prefix.c_str(), u, v);
-            char lbuf[256];
-            sprintf(lbuf, "%s-%d-%d.spr", lightmap_prefix.c_str(), u, v);
-    		ls_message("Initializing quad at %d:%d\n",u,v);
-            quad[v*width + u].init(the_game, in, neighbor, main_tex,
-                    detail_tex, buf, textures, lbuf, stat);
-    		ls_message("Done initializing quad at %d:%d\n",u,v);
-            in.close();
-
-            stat.endJob();
+            job.texmap_name = buf;
         }
     }
-    stat.endJob();
 
-    counter=0;
+    geometry_ms = texmap_ms = texture_ms = 0;
+
+    if (page_radius <= 0) {
+        stat.beginJob("Loading quads", width*height);
+        for (int i=0; i<width*height; i++) requestQuad(i);
+        while (QuadLoadJob *job = (QuadLoadJob*) pool->nextFinished()) {
+            finishQuad(job);
+            stat.stepFinished();
+        }
+        stat.endJob();
+    } else {
+        // The grid's layout is only known once a quad has been loaded
+        stat.beginJob("Loading quads around the camera");
+        for (int i=0; i<width*height && !have_layout; i++) makeResident(i);
+        updatePaging(true);
+        stat.endJob();
+    }
+
+    Uint32 t_quads = SDL_GetTicks();
 
     game->getEventRemapper()->map("debug",
             SigC::slot(*this, &LoDQuadManager::toggleDebugMode));
     debug_mode = false;
 
     loadTextures();
+
+    Uint32 t_end = SDL_GetTicks();
+
+    // Geometry and texmap times are summed over all quads and threads,
+    // the others are wall clock times
+    int loaded = 0;
+    for (int i=0; i<width*height; i++) {
+        if (quad_state[i] == QUAD_RESIDENT) loaded++;
+    }
+    ls_message("LoDQuadManager: Loaded %d of %d quads using %d threads:\n",
+            loaded, width*height, pool->getThreadCount());
+    ls_message("  geometry:      %6d ms (cpu)\n", geometry_ms);
+    ls_message("  texmaps:       %6d ms (cpu)\n", texmap_ms);
+    ls_message("  quad textures: %6d ms\n", texture_ms);
+    ls_message("  all quads:     %6d ms\n", t_quads - t_start);
+    ls_message("  tile textures: %6d ms\n", t_end - t_quads);
+    ls_message("  total:         %6d ms\n", t_end - t_start);
+
     ls_message("</ LoDQuadManager::LoDQuadManager>\n");
 }
 
 LoDQuadManager::~LoDQuadManager()
 {
+    // Wait for loads that are still in flight
+    delete pool;
+    delete segment_pool;
+    delete setup_pool;
     for (int i=0; i<(width*height); i++) {
         quad[i].done();
     }
-    delete[] quad;
+    delete[] jobs;
 }
 
 void LoDQuadManager::toggleDebugMode()
@@ -132,30 +235,196 @@ void LoDQuadManager::toggleDebugMode()
     debug_mode = !debug_mode;
 }
 
+void LoDQuadManager::requestQuad(int idx)
+{
+    if (quad_state[idx] != QUAD_UNLOADED) return;
+    quad_state[idx] = QUAD_LOADING;
+    pool->add(&jobs[idx]);
+}
+
+void LoDQuadManager::requestQuadsAround(float x, float z, float radius)
+{
+    int u0 = (int) floorf((x - radius - origin_x) / quad_dx);
+    int u1 = (int) floorf((x + radius - origin_x) / quad_dx);
+    int v0 = (int) floorf((z - radius - origin_z) / quad_dz);
+    int v1 = (int) floorf((z + radius - origin_z) / quad_dz);
+    // quad_dz may be negative
+    if (v0 > v1) std::swap(v0, v1);
+    u0 = std::max(u0, 0);
+    v0 = std::max(v0, 0);
+    u1 = std::min(u1, width-1);
+    v1 = std::min(v1, height-1);
+    for (int v=v0; v<=v1; v++) {
+        for (int u=u0; u<=u1; u++) {
+            // Distance between (x,z) and the quad's rectangle
+            float qx0 = origin_x + u*quad_dx;
+            float qz0 = origin_z + v*quad_dz;
+            float qz1 = qz0 + quad_dz;
+            if (qz0 > qz1) std::swap(qz0, qz1);
+            float dx = std::max(0.0f, std::max(qx0 - x, x - qx0 - quad_dx));
+            float dz = std::max(0.0f, std::max(qz0 - z, z - qz1));
+            if (dx*dx + dz*dz > radius*radius) continue;
+
+            int idx = v*width + u;
+            last_wanted[idx] = counter;
+            requestQuad(idx);
+        }
+    }
+}
+
+void LoDQuadManager::updatePaging(bool block)
+{
+    if (page_radius <= 0 || !have_layout) return;
+
+    Vector pos = game->getCamera()->getLocation();
+    requestQuadsAround(pos[0], pos[2], page_radius);
+
+    IActorStage::ActorVector actors;
+    game->queryActorsInBox(actors,
+            Vector(-1e30f, -1e30f, -1e30f), Vector(1e30f, 1e30f, 1e30f));
+    for (size_t i=0; i<actors.size(); i++) {
+        if (actors[i]->getState() != IActor::ALIVE) continue;
+        Vector p = actors[i]->getLocation();
+        requestQuadsAround(p[0], p[2], actor_page_radius);
+    }
+
+    while (QuadLoadJob *job = (QuadLoadJob*) pool->nextFinished(block)) {
+        finishQuad(job);
+    }
+
+    if (resident_bytes > page_budget) {
+        // Evict the quads that haven't been wanted for the longest time
+        std::vector<std::pair<int, int> > lru;
+        for (int i=0; i<width*height; i++) {
+            if (quad_state[i] == QUAD_RESIDENT && last_wanted[i] != counter) {
+                lru.push_back(std::make_pair(last_wanted[i], i));
+            }
+        }
+        std::sort(lru.begin(), lru.end());
+        for (size_t i=0; i<lru.size() && resident_bytes > page_budget; i++) {
+            evictQuad(lru[i].second);
+        }
+    }
+
+    game->getDebugData()->setInt("terrain_resident_kb", resident_bytes / 1024);
+}
+
+// Returns the quad with the given index, loading it right away if it
+// isn't resident yet. Returns 0 if the quad can't be loaded.
+LoDQuad * LoDQuadManager::makeResident(int idx)
+{
+    switch (quad_state[idx]) {
+    case QUAD_RESIDENT:
+        return &quad[idx];
+    case QUAD_MISSING:
+        return 0;
+    case QUAD_UNLOADED:
+        quad_state[idx] = QUAD_LOADING;
+        jobs[idx].run();
+        finishQuad(&jobs[idx]);
+        break;
+    case QUAD_LOADING:
+        // It is queued in the pool, wait until it arrives
+        while (quad_state[idx] == QUAD_LOADING) {
+            QuadLoadJob *job = (QuadLoadJob*) pool->nextFinished();
+            if (!job) break;
+            finishQuad(job);
+        }
+        break;
+    }
+    return quad_state[idx] == QUAD_RESIDENT ? &quad[idx] : 0;
+}
+
+void LoDQuadManager::finishQuad(QuadLoadJob *job)
+{
+    int u = job->u;
+    int v = job->v;
+    int idx = v*width + u;
+    if (!job->error.empty()) {
+        throw std::runtime_error(job->error);
+    }
+    if (!job->ok) {
+        quad_state[idx] = QUAD_MISSING;
+        return;
+    }
+    geometry_ms += job->times.geometry;
+    texmap_ms += job->times.texmap;
+
+    Uint32 t0 = SDL_GetTicks();
+
+    LoDQuad & q = quad[idx];
+    if (!have_layout) setLayout(idx);
+
+    LoDQuad *neighbor[4];
+    getNeighbors(idx, neighbor);
+
+    // DEBUG: set neighbors to zero and see if Landscape still crashes
+    //neighbor[QN_NORTH]=0;
+    //neighbor[QN_SOUTH]=0;
+    //neighbor[QN_EAST]=0;
+    //neighbor[QN_WEST]=0;
+
+    char buf[256];
+    sprintf(buf,"%s-%d-%d.spr", texture_prefix.c_str(), u, v);
+    TexPtr main_tex = game->getTexMan()->query(
+            buf, JR_HINT_FULLOPACITY, 0, true);
+
+    sprintf(buf, "%s-%d-%d.spr", lightmap_prefix.c_str(), u, v);
+    ls_message("Initializing quad at %d:%d\n",u,v);
+    q.init(game, neighbor, main_tex, detail_tex, textures, buf);
+    ls_message("Done initializing quad at %d:%d\n",u,v);
+
+    addResident(idx);
+    resident_bytes += q.getMemoryUsage();
+    mesh_valid = false;
+
+    texture_ms += SDL_GetTicks() - t0;
+}
+
+void LoDQuadManager::evictQuad(int idx)
+{
+    LoDQuad & q = quad[idx];
+    ls_message("Evicting quad at %d:%d\n", idx % width, idx / width);
+    removeResident(idx);
+    resident_bytes -= q.getMemoryUsage();
+    q.done();
+    mesh_valid = false;
+}
+
 // Begin: IDrawable method
 void LoDQuadManager::draw()
 {
     int i;
     float planes[6][4];
 
+    updatePaging(false);
+
     game->getCamera()->getFrustumPlanes(planes);
     float focus = game->getCamera()->getFocus();
     Vector pos = game->getCamera()->getLocation();
 
-    for (i=0; i<(width*height); i++) {
-        quad[i].presetup();
-    }
-    for (i=0; i<(width*height); i++) {
-        quad[i].setup(pos, planes, focus);
+    if (incremental_lod && mesh_valid) {
+        refine(pos, planes, focus);
+    } else {
+        // The mesh is built from scratch when the resident quads change,
+        // since their triangle links are reset by connect()
+        int splits = setupQuads(setup_pool, pos, planes, focus);
+        game->getDebugData()->setInt("terrain_stitch_splits", splits);
+        mesh_valid = true;
     }
+    int draw_calls = 0, draw_triangles = 0;
     for (i=0; i<(width*height); i++) {
-        quad[i].draw(renderer);
+        if (quad_state[i] != QUAD_RESIDENT) continue;
+        quad[i].draw(renderer, pos);
         if (debug_mode) quad[i].drawWire(renderer);
+        draw_calls += quad[i].draw_calls;
+        draw_triangles += quad[i].draw_triangles;
     }
+    game->getDebugData()->setInt("terrain_draw_calls", draw_calls);
+    game->getDebugData()->setInt("terrain_triangles", draw_triangles);
     counter++;
 }
 
-
 // BEGIN: ITerrain method
 float LoDQuadManager::getHeightAt(float x, float z, Vector *out_normal)
 {
@@ -168,6 +437,29 @@ float LoDQuadManager::getHeightAt(float x, float z, Vector *out_normal)
     }
 }
 
+void LoDQuadManager::getHeightsAt(int n, const float *x, const float *z,
+                                  float *out_height, Vector *out_normal)
+{
+    // Hand runs of points on the same quad to the quad at once
+    int i = 0;
+    while (i < n) {
+        int idx = getQuadIndexAt(x[i], z[i]);
+        int j = i+1;
+        while (j < n && getQuadIndexAt(x[j], z[j]) == idx) j++;
+        LoDQuad *q = getQuadAtPoint(x[i], z[i]);
+        if (q) {
+            q->getHeightsAt(j-i, x+i, z+i, out_height+i,
+                    out_normal ? out_normal+i : 0);
+        } else {
+            for (int k=i; k<j; k++) {
+                out_height[k] = 0.0;
+                if (out_normal) out_normal[k] = Vector(0,1,0);
+            }
+        }
+        i = j;
+    }
+}
+
 namespace {
     // next_edge assumes that (px,py) is contained in the rectangle (x,y,w,h).
     // Then it tries to walk from there in direction (vx, vy) until it hits an
@@ -247,45 +539,56 @@ namespace {
 // }
 
 bool LoDQuadManager::lineCollides(Vector a, Vector b, Vector * cx, Vector *out_normal) {
-    float t;
-    static int count = 0;
-    //ls_message("lineCollide for the %dth time.\n", ++count);
-    if (getHeightAt(a[0],a[2],out_normal) >= a[1]) {
-        *cx = a;
-        return true;
-    }
+    pageAlong(a, b);
+    return castRay(a, b, cx, out_normal);
+}
 
-    LoDQuad * quad = getQuadAtPoint(a[0], a[2]);
-    if (!quad) return false;
-    if (quad->lineCollides(a,b, &t, &quad->triangle[0], out_normal) ||
-        quad->lineCollides(a,b, &t, &quad->triangle[1], out_normal)) {
-        *cx = a + (b-a)*t;
-        //game->drawDebugTriangleAt(*cx);
-        return true;
+void LoDQuadManager::linesCollide(int n, TerrainSegment *segments)
+{
+    // Sort the segments by the quad they start on, for locality
+    std::vector<std::pair<int, int> > order(n);
+    for (int i=0; i<n; i++) {
+        order[i].first = getQuadIndexAt(segments[i].a[0], segments[i].a[2]);
+        order[i].second = i;
     }
-    
-    return false;
+    std::sort(order.begin(), order.end());
+
+    for (int i=0; i<n; i++) pageAlong(segments[i].a, segments[i].b);
+
+    std::vector<SegmentJob> jobs((n + SEGMENTS_PER_JOB - 1) / SEGMENTS_PER_JOB);
+    for (size_t j=0; j<jobs.size(); j++) {
+        jobs[j].manager = this;
+        jobs[j].segments = segments;
+        jobs[j].order = &order;
+        jobs[j].begin = j * SEGMENTS_PER_JOB;
+        jobs[j].end = std::min(n, (int) (j+1) * SEGMENTS_PER_JOB);
+        segment_pool->add(&jobs[j]);
+    }
+    segment_pool->wait();
 }
 
+// Marks the quads along the line from a to b as wanted and pages them in
+void LoDQuadManager::pageAlong(const Vector & a, const Vector & b)
+{
+    getQuadAtPoint(a[0], a[2]);
+    if (!have_layout) return;
+    for (QuadWalk walk(*this, a, b); !walk.done(); walk.next()) {
+        if ((walk.u>=0)&&(walk.u<width)&&(walk.v>=0)&&(walk.v<height)) {
+            int idx = walk.v*width + walk.u;
+            last_wanted[idx] = counter;
+            makeResident(idx);
+        }
+    }
+}
 
-// Returns the quad that lies under the given X/Z-Pair.
-// Returns 0 if there is none
+// Returns the quad that lies under the given X/Z-Pair, paging it in if
+// necessary. Returns 0 if there is none
 LoDQuad * LoDQuadManager::getQuadAtPoint(float x, float z)
 {
-    // northwest point of landscape
-    float qx=quad[0].vx[quad[0].triangle[0].vertex[2]];
-    float qz=quad[0].vz[quad[0].triangle[0].vertex[2]];
-    // tile width and length
-    float dx=quad[0].vx[quad[0].triangle[0].vertex[1]] - qx;
-    float dz=quad[0].vz[quad[0].triangle[0].vertex[0]] - qz;
-
-    int u = (int) floorf((x - qx) / dx);
-    int v = (int) floorf((z - qz) / dz);
-
-    if ((u>=0)&&(u<width)&&(v>=0)&&(v<height)) {
-        int idx = v*width + u;
-        return &quad[idx];
-    } else return 0;
+    int idx = getQuadIndexAt(x, z);
+    if (idx < 0) return 0;
+    last_wanted[idx] = counter;
+    return makeResident(idx);
 }
 
 
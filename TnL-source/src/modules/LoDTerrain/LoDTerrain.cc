@@ -1,6 +1,10 @@
 #include "LoDTerrain.h"
 #include "Config.h"
 #include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <interfaces/IConfig.h>
+#include <MappedFile.h>
 
 #define LEFT 0
 #define RIGHT 1
@@ -18,7 +22,13 @@ typedef struct {
 // BEGIN: LoDQuad methods
 
 LoDQuad::LoDQuad()
+:   game(0), triangle(0), tri_vertex(0), tri_normal(0), tri_parent(0),
+    tri_neighbor(0), tri_morph(0),
+    vx(0), vy(0), vz(0), tex_u(0), tex_v(0), vh(0), vfog(0),
+    triangles(0), vertices(0), cache_file(0), isolated(false),
+    fog_valid(false), draw_calls(0), draw_triangles(0)
 {
+    neighbor[0] = neighbor[1] = neighbor[2] = neighbor[3] = 0;
 }
 
 LoDQuad::~LoDQuad()
@@ -26,72 +36,150 @@ LoDQuad::~LoDQuad()
 }
 
 
-void LoDQuad::init (IGame * the_game, std::istream & in, LoDQuad ** neighbor,
-                    TexPtr main_tex, TexPtr detail_tex,
-                    const char * texmap_name, TexPtr (*textures)[16],
-                    const char * lightmap_name,
-                    Status & stat)
+bool LoDQuad::load(const char * quad_name, const char * texmap_name,
+                   bool use_cache, bool compact_vertices, LoadTimes * times,
+                   const char * cache_dir)
 {
-    ls_message("<LoDQuad::init>\n");
-    this->textures = textures;
-    LoDQuadFileHeader header;
-    LoDTriangleFileStruct ftriangle;
-    int i;
-    Vector v0, v1, v2;
+    Uint32 t0 = SDL_GetTicks();
+    
+    cache_file = 0;
+    
+    // Try the precomputed cache first. It is rebuilt from the .qad file
+    // whenever it is missing, stale or was written by another version.
+    std::string cache_name = cacheName(quad_name, cache_dir);
+    if (use_cache
+        && loadCache(cache_name.c_str(), quad_name, compact_vertices))
+    {
+        ls_message("Loaded quad from cache %s\n", cache_name.c_str());
+    } else {
+        std::ifstream in(quad_name, std::ios::binary|std::ios::in);
+        if (!in) {
+            ls_error("LoDTerrain: Couldn't open %s\n", quad_name);
+            return false;
+        }
+        readQuadFile(in, compact_vertices);
+        if (use_cache) {
+            saveCache(cache_name.c_str(), quad_name, compact_vertices);
+        }
+    }
+    setupHeightGrid();
+    
+    Uint32 t1 = SDL_GetTicks();
     
     texmap = new Image(texmap_name);
     //texmap->saveTo("test.tga");
     
+    if (times) {
+        times->geometry = t1 - t0;
+        times->texmap = SDL_GetTicks() - t1;
+    }
+    return true;
+}
+
+void LoDQuad::init (IGame * the_game, LoDQuad ** neighbor,
+                    TexPtr main_tex, TexPtr detail_tex,
+                    TexPtr (*textures)[16],
+                    const char * lightmap_name)
+{
     game=the_game;
+    init(neighbor, main_tex, detail_tex, textures,
+            game->getTexMan()->query(lightmap_name),
+            game->getEnvironment());
+}
+
+void LoDQuad::init (LoDQuad ** neighbor,
+                    TexPtr main_tex, TexPtr detail_tex,
+                    TexPtr (*textures)[16], TexPtr lightmap,
+                    Ptr<Environment> environment)
+{
+    this->textures = textures;
     
     this->main_tex=main_tex;
     this->detail_tex=detail_tex;
     
+    this->neighbor[0]=neighbor[0];
+    this->neighbor[1]=neighbor[1];
+    this->neighbor[2]=neighbor[2];
+    this->neighbor[3]=neighbor[3];
+    
+    this->lightmap = lightmap;
+    
+    this->environment = environment;
+}
+
+void LoDQuad::readQuadFile(std::istream & in, bool compact_vertices)
+{
+    LoDQuadFileHeader header;
+    int i;
+    Vector v0, v1, v2;
+    
     in.read((char*) &header, sizeof (LoDQuadFileHeader));
     
-    triangles=header.triangles;
+    std::vector<LoDTriangleFileStruct> ftriangle(header.triangles);
+    if (header.triangles) {
+        in.read((char*) &ftriangle[0],
+                sizeof(LoDTriangleFileStruct) * header.triangles);
+    }
+    
+    // Renumber the triangles depth first, keeping siblings together.
+    // order maps the new indices to the ones in the file.
+    std::vector<ju32> order;
+    std::vector<ju32> first_child;
+    order.reserve(header.triangles);
+    order.push_back(0);
+    order.push_back(1);
+    std::vector<ju32> stack;
+    stack.push_back(1);
+    stack.push_back(0);
+    first_child.resize(header.triangles, 0);
+    while (!stack.empty()) {
+        ju32 t = stack.back();
+        stack.pop_back();
+        const LoDTriangleFileStruct & ft = ftriangle[order[t]];
+        if (ft.flags & TFLAG_HAS_CHILDREN) {
+            ju32 c = order.size();
+            first_child[t] = c;
+            order.push_back(ft.child[0]);
+            order.push_back(ft.child[1]);
+            stack.push_back(c+1);
+            stack.push_back(c);
+        }
+    }
+    
+    triangles=order.size();
     vertices=header.vertices;
     
     triangle = new LoDTriangle[triangles];
+    ju32 (*tri_vertex)[3] = new ju32[triangles][3];
+    Vector *tri_normal = new Vector[triangles];
+    this->tri_vertex = tri_vertex;
+    this->tri_normal = tri_normal;
     //ls_warning("Init %p: (vertices=%d)\n", this, vertices);
-    vx = new float[vertices];
-    vy = new float[vertices];
-    vz = new float[vertices];
-    tex_u = new float[vertices];
-    tex_v = new float[vertices];
+    float *vx = new float[vertices];
+    float *vy = new float[vertices];
+    float *vz = new float[vertices];
+    float *tex_u = new float[vertices];
+    float *tex_v = new float[vertices];
+    this->vx = vx;
+    this->vy = vy;
+    this->vz = vz;
+    this->tex_u = tex_u;
+    this->tex_v = tex_v;
     
-    stat.beginJob("Initializing LOD quad", 7);
-    
-    stat.beginJob("Loading triangle data", triangles);
     for (i=0; i<triangles; i++) {
-        in.read((char*) &ftriangle, sizeof(LoDTriangleFileStruct));
+        const LoDTriangleFileStruct & ft = ftriangle[order[i]];
 
-        triangle[i].error = ftriangle.error;
-        triangle[i].flags = ftriangle.flags;
-        
-        if (triangle[i].flags & TFLAG_HAS_CHILDREN) {
-            triangle[i].child[0] = &triangle[ftriangle.child[0]];
-            triangle[i].child[1] = &triangle[ftriangle.child[1]];
-        } else {
-            triangle[i].child[0] = 0;
-            triangle[i].child[1] = 0;
-        }
+        triangle[i].error = ft.error;
+        triangle[i].flags = ft.flags;
+        triangle[i].child = first_child[i];
         
-        triangle[i].vertex[0] = ftriangle.vertex[0];
-        triangle[i].vertex[1] = ftriangle.vertex[1];
-        triangle[i].vertex[2] = ftriangle.vertex[2];
-        
-        stat.stepFinished();
+        tri_vertex[i][0] = ft.vertex[0];
+        tri_vertex[i][1] = ft.vertex[1];
+        tri_vertex[i][2] = ft.vertex[2];
     }
-    stat.endJob();
-    
-    stat.beginJob("Loading vertex data", 3);
     in.read((char*) vx, sizeof(float) * vertices);
-    stat.stepFinished();
     in.read((char*) vz, sizeof(float) * vertices);
-    stat.stepFinished();
     in.read((char*) vy, sizeof(float) * vertices);
-    stat.endJob();
     
     for (i=0; i<vertices; i++) {
         vz[i]=-vz[i];
@@ -99,142 +187,265 @@ void LoDQuad::init (IGame * the_game, std::istream & in, LoDQuad ** neighbor,
         //vy[i]*=3.0;
         //vy[i] *= 2;
     }
-    stat.stepFinished();
     
     // Measure dimensions and calc texture coords
-    float x0 = vx[triangle[0].vertex[2]];
-    float z0 = vz[triangle[0].vertex[0]];
-    float dx = vx[triangle[0].vertex[1]] - x0;
-    float dz = vz[triangle[0].vertex[2]] - z0;
-    stat.beginJob("Calculating texture coordinates", vertices);
+    float x0 = vx[tri_vertex[0][2]];
+    float z0 = vz[tri_vertex[0][0]];
+    float dx = vx[tri_vertex[0][1]] - x0;
+    float dz = vz[tri_vertex[0][2]] - z0;
     for (i=0; i<vertices; i++) {
         tex_u[i] = (vx[i] - x0) / dx;
         tex_v[i] = (vz[i] - z0) / dz;
-        stat.stepFinished();
     }
-    stat.endJob();
     
-    stat.beginJob("Calculating bounding spheres", 2);
-    setupBoundingSpheres(&triangle[0]);
-    stat.stepFinished();
-    setupBoundingSpheres(&triangle[1]);
-    stat.endJob();
+    if (compact_vertices && !compactVertices(tri_vertex)) {
+        ls_warning("LoDTerrain: The vertices don't form a grid, "
+                "keeping them uncompressed\n");
+    }
+    allocSideArrays();
+    
+    setupBoundingSpheres(0);
+    setupBoundingSpheres(1);
     
-    stat.beginJob("Calculating triangle normals", triangles);
     for (i=0; i<triangles; i++) {
         //triangle[i].radius = calcRadius( &triangle[i] );
         /*if (i % 1000 == 0) {
             ls_message("radius for tri #%d is %f\n", i, triangle[i].radius);
         }*/
-        v0 = Vector(vx[triangle[i].vertex[0]],
-                vy[triangle[i].vertex[0]],
-                vz[triangle[i].vertex[0]]);
-        v1 = Vector(vx[triangle[i].vertex[1]], 
-                vy[triangle[i].vertex[1]], 
-                vz[triangle[i].vertex[1]]);
-        v2 = Vector(vx[triangle[i].vertex[2]], 
-                vy[triangle[i].vertex[2]], 
-                vz[triangle[i].vertex[2]]);
-        triangle[i].normal= ((v2 - v0) % (v1 - v0)).normalize();
-        stat.stepFinished();
+        v0 = getVertex(tri_vertex[i][0]);
+        v1 = getVertex(tri_vertex[i][1]);
+        v2 = getVertex(tri_vertex[i][2]);
+        tri_normal[i]= ((v2 - v0) % (v1 - v0)).normalize();
     }
-    stat.endJob();
     
-    this->neighbor[0]=neighbor[0];
-    this->neighbor[1]=neighbor[1];
-    this->neighbor[2]=neighbor[2];
-    this->neighbor[3]=neighbor[3];
+    homogenizeError(0);
+    homogenizeError(1);
+}
+
+// The side arrays which are never part of the cache: the parents, which
+// are cheap to derive, and the per-frame neighbors, morph values and fog
+// strengths
+void LoDQuad::allocSideArrays()
+{
+    tri_parent = new ju32[triangles];
+    tri_neighbor = new ju32[triangles][3];
+    tri_morph = new float[triangles];
+    vfog = new float[vertices];
+    fog_valid = false;
+    tri_parent[0] = tri_parent[1] = 0;
+    for (int i=0; i<triangles; i++) {
+        if (triangle[i].flags & TFLAG_HAS_CHILDREN) {
+            tri_parent[triangle[i].child] = i;
+            tri_parent[triangle[i].child+1] = i;
+        }
+        tri_neighbor[i][0] = tri_neighbor[i][1] = tri_neighbor[i][2] = 0;
+        tri_morph[i] = 1.0;
+    }
+}
+
+// Replaces the float vertex arrays with compact ones, if the vertices form
+// a full grid of 2^k+1 rows and columns, and renumbers the corner vertices
+// of the triangles to match. Returns false if they don't form a grid.
+bool LoDQuad::compactVertices(ju32 (*tri_vertex)[3])
+{
+    int side = (int) floor(sqrt((double) vertices) + 0.5);
+    if (side < 3 || side*side != vertices || ((side-1) & (side-2))) {
+        return false;
+    }
+    int shift = 0;
+    while ((1 << shift) < side) shift++;
+    
+    // Find each vertex' row and column from its texture coordinates,
+    // which run from 0 to 1 across the quad
+    float cells = side - 1;
+    std::vector<ju32> index(vertices);
+    std::vector<bool> used(side << shift, false);
+    float y_min = vy[0], y_max = vy[0];
+    for (int i=0; i<vertices; i++) {
+        float u = tex_u[i] * cells;
+        float v = tex_v[i] * cells;
+        int col = (int) floorf(u + 0.5f);
+        int row = (int) floorf(v + 0.5f);
+        if (col < 0 || col >= side || row < 0 || row >= side
+            || fabsf(u - col) > 1e-3f || fabsf(v - row) > 1e-3f)
+        {
+            return false;
+        }
+        index[i] = (row << shift) | col;
+        if (used[index[i]]) return false;
+        used[index[i]] = true;
+        y_min = std::min(y_min, vy[i]);
+        y_max = std::max(y_max, vy[i]);
+    }
     
-    stat.beginJob("Homogenizing error value", 2);
-    homogenizeError(&triangle[0]);
-    stat.stepFinished();
-    homogenizeError(&triangle[1]);
-    stat.endJob();
+    // The columns of a row are padded to a power of two, so the padding
+    // vertices are unused
+    ju16 *h = new ju16[side << shift];
+    std::fill(h, h + (side << shift), 0);
+    float scale = (y_max - y_min) / 65535;
+    for (int i=0; i<vertices; i++) {
+        h[index[i]] = scale > 0 ? (ju16) floorf((vy[i]-y_min)/scale + 0.5f) : 0;
+    }
+    vgrid_x0 = vx[tri_vertex[0][2]];
+    vgrid_z0 = vz[tri_vertex[0][0]];
+    vgrid_dx = (vx[tri_vertex[0][1]] - vgrid_x0) / cells;
+    vgrid_dz = (vz[tri_vertex[0][2]] - vgrid_z0) / cells;
     
-    lightmap = game->getTexMan()->query(lightmap_name);
+    for (int i=0; i<triangles; i++) {
+        for (int j=0; j<3; j++) tri_vertex[i][j] = index[tri_vertex[i][j]];
+    }
     
-    environment = game->getEnvironment();
+    vgrid_du = 1.0f / cells;
+    vgrid_shift = shift;
+    vh_offset = y_min;
+    vh_scale = scale;
     
-    stat.endJob();
-    ls_message("</LoDQuad::init>\n");
-}
-
-void LoDQuad::done()
-{
     delete[] vx;
     delete[] vy;
     delete[] vz;
-    delete[] triangle;
+    delete[] tex_u;
+    delete[] tex_v;
+    vx = vy = vz = tex_u = tex_v = 0;
+    vh = h;
+    vertices = side << shift;
+    return true;
 }
 
-
-void LoDQuad::connect()
+void LoDQuad::done()
 {
-    if (neighbor[QN_WEST]) {
-        triangle[0].neighbor[0] = &neighbor[QN_WEST]->triangle[1];
+    if (cache_file) {
+        // The vertex arrays live inside the mapped cache file
+        delete cache_file;
+        cache_file = 0;
     } else {
-        triangle[0].neighbor[0] = 0;
+        delete[] vx;
+        delete[] vy;
+        delete[] vz;
+        delete[] tex_u;
+        delete[] tex_v;
+        delete[] vh;
+        delete[] tri_vertex;
+        delete[] tri_normal;
     }
+    delete[] triangle;
+    delete[] tri_parent;
+    delete[] tri_neighbor;
+    delete[] tri_morph;
+    delete[] vfog;
+    
+    // Leave the quad in a state where it can be loaded again
+    triangle = 0;
+    tri_vertex = 0;
+    tri_normal = 0;
+    tri_parent = 0;
+    tri_neighbor = 0;
+    tri_morph = 0;
+    vfog = 0;
+    fog_valid = false;
+    vx = vy = vz = tex_u = tex_v = 0;
+    vh = 0;
+    triangles = vertices = 0;
+    std::vector<ju32>().swap(height_grid);
+    std::vector<float>().swap(max_height);
+    neighbor[0] = neighbor[1] = neighbor[2] = neighbor[3] = 0;
+    texmap = 0;
+    lightmap = 0;
+    main_tex = 0;
+    detail_tex = 0;
+    environment = 0;
+    main_batch = lightmap_batch = fog_batch = LoDBatch();
+    tile_batches.clear();
+    patch_batches.clear();
+}
 
-    if (neighbor[QN_NORTH]) {
-        triangle[0].neighbor[1] = &neighbor[QN_NORTH]->triangle[1];
+size_t LoDQuad::getMemoryUsage()
+{
+    size_t bytes = triangles * (sizeof(LoDTriangle) + sizeof(*tri_parent)
+            + sizeof(*tri_neighbor) + sizeof(*tri_morph));
+    bytes += vertices * sizeof(*vfog);
+    bytes += height_grid.size() * sizeof(ju32);
+    bytes += max_height.size() * sizeof(float);
+    // Mapped pages are shared, but count them anyway since they are what
+    // keeps the quad resident
+    if (cache_file) {
+        bytes += cache_file->getSize();
     } else {
-        triangle[0].neighbor[1] = 0;
+        bytes += vh ? vertices*sizeof(*vh) : 5*vertices*sizeof(float);
+        bytes += triangles * (sizeof(*tri_vertex) + sizeof(*tri_normal));
     }
-
-    if (neighbor[QN_EAST]) {
-        triangle[1].neighbor[0] = &neighbor[QN_EAST]->triangle[0];
-    } else {
-        triangle[1].neighbor[0] = 0;
+    if (texmap) {
+        bytes += texmap->getWidth() * texmap->getHeight();
+        if (!texmap->isGreyscale()) bytes += MAX_COLORS * sizeof(int);
     }
-
-    if (neighbor[QN_SOUTH]) {
-        triangle[1].neighbor[1] = &neighbor[QN_SOUTH]->triangle[0];
-    } else {
-        triangle[1].neighbor[1] = 0;
+    // Textures are estimated as RGBA with a full mipmap chain
+    TexPtr tex[2] = { main_tex, lightmap };
+    for (int i=0; i<2; i++) {
+        if (tex[i]) bytes += tex[i]->getWidth() * tex[i]->getHeight() * 4 * 4/3;
     }
+    return bytes;
+}
 
-    triangle[0].neighbor[2] = &triangle[1];
-    triangle[1].neighbor[2] = &triangle[0];
+
+void LoDQuad::connect()
+{
+    tri_neighbor[0][0] = neighbor[QN_WEST]  ? (TREF_WEST  | 1) : 0;
+    tri_neighbor[0][1] = neighbor[QN_NORTH] ? (TREF_NORTH | 1) : 0;
+    tri_neighbor[1][0] = neighbor[QN_EAST]  ? (TREF_EAST  | 0) : 0;
+    tri_neighbor[1][1] = neighbor[QN_SOUTH] ? (TREF_SOUTH | 0) : 0;
+
+    tri_neighbor[0][2] = TREF_THIS | 1;
+    tri_neighbor[1][2] = TREF_THIS | 0;
 }
 
-void LoDQuad::presetup() {
+void LoDQuad::presetup(const Vector &pos, const float planes[6][4],
+                       float focus, bool vectorized)
+{
+    evaluator = Evaluator(this, pos, planes, focus, vectorized);
     triangle[0].flags |= TFLAG_ENABLED;
     triangle[1].flags |= TFLAG_ENABLED;
     connect();
+
+    // The roots are evaluated here rather than in setup, since the setup
+    // of a neighbor may split them first
+    LoDTriangle *root[2] = {&triangle[0], &triangle[1]};
+    float error[2];
+    evaluator.evaluate(root, 2, error);
+    triangle[0].dyn_error = error[0];
+    triangle[1].dyn_error = error[1];
+    
+    tri_morph[0] = tri_morph[1] = 1.0;
 }
 
-void LoDQuad::setup(Vector &pos, const float planes[6][4], float focus)
+void LoDQuad::setup(bool isolated)
 {
-    evaluator = Evaluator(pos, planes, vx, vy, vz, focus);
+    this->isolated = isolated;
 
-    triangle[0].dyn_error = evaluator.evaluate(&triangle[0]);
-    triangle[1].dyn_error = evaluator.evaluate(&triangle[1]);
-    
-    triangle[0].morph = triangle[1].morph = 1.0;
-    
-    setupRecursive(&triangle[0], true);
-    setupRecursive(&triangle[1], true);
+    setupRecursive(0, true);
+    setupRecursive(1, true);
+    this->isolated = false;
 }
 
 
-void LoDQuad::setupBoundingSpheres(LoDTriangle * tri)
+void LoDQuad::setupBoundingSpheres(ju32 t)
 {
+    LoDTriangle *tri = &triangle[t];
     if (tri->flags & TFLAG_HAS_CHILDREN) {
-        setupBoundingSpheres(tri->child[0]);
-        setupBoundingSpheres(tri->child[1]);
-        Vector c0(tri->child[0]->bs_center);
-        Vector c1(tri->child[1]->bs_center);
+        LoDTriangle *child = &triangle[tri->child];
+        setupBoundingSpheres(tri->child);
+        setupBoundingSpheres(tri->child+1);
+        Vector c0(child[0].bs_center);
+        Vector c1(child[1].bs_center);
         Vector d = (c1 - c0).normalize();
-        c0 -= tri->child[0]->radius * d;
-        c1 += tri->child[1]->radius * d;
+        c0 -= child[0].radius * d;
+        c1 += child[1].radius * d;
         tri->bs_center = (c0 + c1) / 2.0;
         tri->radius = (c1 - c0).length() / 2.0;
     } else {
         // TODO: compute minimal enclosing Sphere for triangle
-        Vector p0(vx[tri->vertex[0]], vy[tri->vertex[0]], vz[tri->vertex[0]]);
-        Vector p1(vx[tri->vertex[1]], vy[tri->vertex[1]], vz[tri->vertex[1]]);
-        Vector p2(vx[tri->vertex[2]], vy[tri->vertex[2]], vz[tri->vertex[2]]);
+        const ju32 *vertex = tri_vertex[t];
+        Vector p0 = getVertex(vertex[0]);
+        Vector p1 = getVertex(vertex[1]);
+        Vector p2 = getVertex(vertex[2]);
         tri->bs_center = (p0 + p1) / 2.0;
         float d1 = (p1 - tri->bs_center).length();
         float d2 = (p2 - tri->bs_center).length();
@@ -242,10 +453,32 @@ void LoDQuad::setupBoundingSpheres(LoDTriangle * tri)
     }
 }
 
-// split2 enables a triangle's children, computes their error value and
-// sets their morph factor to the maximum value
-void LoDQuad::split2(LoDTriangle *tri)
+// Computes the errors of the children of a triangle and of those of its
+// bottom neighbor b in bq, if there is one, in one batch where possible
+void LoDQuad::evaluateChildren(ju32 t, LoDQuad *bq, ju32 b)
+{
+    LoDTriangle *tri[Evaluator::BATCH_SIZE];
+    float error[Evaluator::BATCH_SIZE];
+    int n = 0;
+    ju32 c = triangle[t].child;
+    tri[n++] = &triangle[c];
+    tri[n++] = &triangle[c+1];
+    if (bq == this) {
+        ju32 bc = triangle[b].child;
+        tri[n++] = &triangle[bc];
+        tri[n++] = &triangle[bc+1];
+    } else if (bq) {
+        bq->evaluateChildren(b, 0, 0);
+    }
+    evaluator.evaluate(tri, n, error);
+    for (int i=0; i<n; i++) tri[i]->dyn_error = error[i];
+}
+
+// split2 enables a triangle's children, whose error values must have been
+// computed, and sets their morph factor to the maximum value
+void LoDQuad::split2(ju32 t)
 {
+    LoDTriangle *tri = &triangle[t];
     if (! (tri->flags & TFLAG_HAS_CHILDREN)) {
         ls_warning("Triangle doesn't have children! Aborting!\n");
         return;
@@ -256,107 +489,127 @@ void LoDQuad::split2(LoDTriangle *tri)
         
         );*/
     
-    // calculate error and morph strength for children
-    float error0, error1, morph;
-    error0 = evaluator.evaluate(tri->child[0]);
-    error1 = evaluator.evaluate(tri->child[1]);
+    // calculate morph strength for children
+    ju32 c = tri->child;
+    LoDTriangle *child = &triangle[c];
+    tri_morph[c] = tri_morph[c+1] = calcMorph(t);
+    
+    tri->flags &= ~(TFLAG_ENABLED);
+    child[0].flags &= ~(TFLAG_DONT_DRAW);
+    child[1].flags &= ~(TFLAG_DONT_DRAW);
+    child[0].flags |= TFLAG_ENABLED | (tri->flags & TFLAG_DONT_DRAW);
+    child[1].flags |= TFLAG_ENABLED | (tri->flags & TFLAG_DONT_DRAW);
+    
+    ju32 *nb = tri_neighbor[t];
+    tri_neighbor[c+LEFT][BOTTOM] = nb[LEFT];
+    tri_neighbor[c+RIGHT][BOTTOM] = nb[RIGHT];
     
-    tri->child[0]->dyn_error = error0;
-    tri->child[1]->dyn_error = error1;
+    tri_neighbor[c+LEFT][LEFT] = TREF_THIS | (c+RIGHT);
+    tri_neighbor[c+RIGHT][RIGHT] = TREF_THIS | (c+LEFT);
     
-    error0 = std::max(error0, error1);
+    replaceNeighbor(nb[LEFT], t, c+LEFT);
+    replaceNeighbor(nb[RIGHT], t, c+RIGHT);
+}
+
+// Returns the morph factor for the children of a split triangle, derived
+// from their screen errors. Children that appear worse than their parent
+// get the parent's error.
+float LoDQuad::calcMorph(ju32 t)
+{
+    LoDTriangle *tri = &triangle[t];
+    LoDTriangle *child = &triangle[tri->child];
+    float error0 = std::max(child[0].dyn_error, child[1].dyn_error);
     if (error0 > tri->dyn_error) {
-        tri->child[0]->flags |= TFLAG_DEBUG;
-        tri->child[1]->flags |= TFLAG_DEBUG;
+        child[0].flags |= TFLAG_DEBUG;
+        child[1].flags |= TFLAG_DEBUG;
         error0 = tri->dyn_error;
-        tri->child[0]->dyn_error = error0;
-        tri->child[1]->dyn_error = error0;
-    }
-    morph = 1.0 - (MAX_ERROR - error0) / (tri->dyn_error - error0);
-    morph = std::min(1.0f, std::max(0.0f, morph));
-    tri->child[0]->morph = tri->child[1]->morph = morph;
-    
-    tri->flags &= ~(TFLAG_ENABLED);
-    tri->child[0]->flags &= ~(TFLAG_DONT_DRAW);
-    tri->child[1]->flags &= ~(TFLAG_DONT_DRAW);
-    tri->child[0]->flags |= TFLAG_ENABLED | (tri->flags & TFLAG_DONT_DRAW);
-    tri->child[1]->flags |= TFLAG_ENABLED | (tri->flags & TFLAG_DONT_DRAW);
-    
-    tri->child[LEFT]->neighbor[BOTTOM] = tri->neighbor[LEFT];
-    tri->child[RIGHT]->neighbor[BOTTOM] = tri->neighbor[RIGHT];
-    
-    tri->child[LEFT]->neighbor[LEFT] = tri->child[RIGHT];
-    tri->child[RIGHT]->neighbor[RIGHT] = tri->child[LEFT];
-    
-    if (tri->neighbor[LEFT]) {
-        if (tri == tri->neighbor[LEFT]->neighbor[BOTTOM] ) {
-            tri->neighbor[LEFT]->neighbor[BOTTOM] = tri->child[LEFT];
-        } else if (tri == tri->neighbor[LEFT]->neighbor[RIGHT] ) {
-            tri->neighbor[LEFT]->neighbor[RIGHT] = tri->child[LEFT];
-        } else {
-            tri->neighbor[LEFT]->neighbor[LEFT] = tri->child[LEFT];
-        }
+        child[0].dyn_error = error0;
+        child[1].dyn_error = error0;
     }
-    
-    if (tri->neighbor[RIGHT]) {
-        if (tri == tri->neighbor[RIGHT]->neighbor[BOTTOM] ) {
-            tri->neighbor[RIGHT]->neighbor[BOTTOM] = tri->child[RIGHT];
-        } else if (tri == tri->neighbor[RIGHT]->neighbor[RIGHT] ) {
-            tri->neighbor[RIGHT]->neighbor[RIGHT] = tri->child[RIGHT];
-        } else {
-            tri->neighbor[RIGHT]->neighbor[LEFT] = tri->child[RIGHT];
-        }
+    float morph = 1.0 - (MAX_ERROR - error0) / (tri->dyn_error - error0);
+    return std::min(1.0f, std::max(0.0f, morph));
+}
+
+// Makes the triangle referenced by ref point to new_tri of this quad where
+// it pointed to old_tri before
+void LoDQuad::replaceNeighbor(ju32 ref, ju32 old_tri, ju32 new_tri)
+{
+    ju32 n;
+    LoDQuad *q = resolve(ref, &n);
+    if (!q || (isolated && q != this)) return;
+    ju32 old_ref = q->refTo(this, old_tri);
+    ju32 new_ref = q->refTo(this, new_tri);
+    ju32 *nb = q->tri_neighbor[n];
+    if (nb[BOTTOM] == old_ref) {
+        nb[BOTTOM] = new_ref;
+    } else if (nb[RIGHT] == old_ref) {
+        nb[RIGHT] = new_ref;
+    } else {
+        nb[LEFT] = new_ref;
     }
 }
 
-void LoDQuad::split(LoDTriangle *tri)
+// Splits a triangle of the mesh along with its bottom neighbor, which may
+// have to be split first to form a diamond. Returns the number of
+// triangles added to the mesh.
+int LoDQuad::split(ju32 t)
 {
     // Don't split triangles that have already been split
-    if ((tri->flags & TFLAG_ENABLED) == 0) {
-        ls_error("Trying to split triangle@%p which has already been split!\n",
-                tri);
-        return;
+    if ((triangle[t].flags & TFLAG_ENABLED) == 0) {
+        ls_error("Trying to split triangle #%u which has already been split!\n",
+                t);
+        return 0;
     }
     
-    if (tri->neighbor[BOTTOM]) {
-        if (tri != tri->neighbor[BOTTOM]->neighbor[BOTTOM]) {
-            split(tri->neighbor[BOTTOM]);
+    int added = 0;
+    
+    // An isolated quad treats the triangles of other quads as missing,
+    // see Stitching.cc
+    ju32 b;
+    LoDQuad *bq = resolve(tri_neighbor[t][BOTTOM], &b);
+    if (isolated && bq != this) bq = 0;
+    if (bq) {
+        if (bq->tri_neighbor[b][BOTTOM] != bq->refTo(this, t)) {
+            added += bq->split(b);
+            // That replaced our bottom neighbor with one of its children
+            bq = resolve(tri_neighbor[t][BOTTOM], &b);
         }
         // Now we have a diamond configuration:
         //    /\
         //   /__\  <- our triangle tri
-        //   \  /  <- tri->neighbor[BOTTOM]
+        //   \  /  <- its bottom neighbor b
         //    \/
-        split2(tri);
-        split2(tri->neighbor[BOTTOM]);
+        evaluateChildren(t, bq, b);
+        split2(t);
+        bq->split2(b);
+        added += 2;
         
         // Make sure the diamond has a uniform morph value in all four
         // triangles. Since split2 gives the two children of a triangle already
         // a uniform morph value, we just have to find which triangle's
         // children have the bigger value and then copy it to the other
         // triangle's children.
-        if (tri->child[0]->morph > tri->neighbor[BOTTOM]->child[0]->morph) {
-            tri->neighbor[BOTTOM]->child[0]->morph =
-                    tri->neighbor[BOTTOM]->child[1]->morph =
-                    tri->child[0]->morph;
+        ju32 c = triangle[t].child;
+        ju32 bc = bq->triangle[b].child;
+        if (tri_morph[c] > bq->tri_morph[bc]) {
+            bq->tri_morph[bc] = bq->tri_morph[bc+1] = tri_morph[c];
         } else {
-            tri->child[0]->morph = tri->child[1]->morph =
-                    tri->neighbor[BOTTOM]->child[0]->morph;
+            tri_morph[c] = tri_morph[c+1] = bq->tri_morph[bc];
         }
         
-        tri->child[LEFT]->neighbor[RIGHT]=
-            tri->neighbor[BOTTOM]->child[RIGHT];
-        tri->child[RIGHT]->neighbor[LEFT]=
-            tri->neighbor[BOTTOM]->child[LEFT];
-        tri->neighbor[BOTTOM]->child[LEFT]->neighbor[RIGHT]=
-            tri->child[RIGHT];
-        tri->neighbor[BOTTOM]->child[RIGHT]->neighbor[LEFT]=
-            tri->child[LEFT];
+        tri_neighbor[c+LEFT][RIGHT] = refTo(bq, bc+RIGHT);
+        tri_neighbor[c+RIGHT][LEFT] = refTo(bq, bc+LEFT);
+        bq->tri_neighbor[bc+LEFT][RIGHT] = bq->refTo(this, c+RIGHT);
+        bq->tri_neighbor[bc+RIGHT][LEFT] = bq->refTo(this, c+LEFT);
     } else {
-        split2(tri);
-        tri->child[LEFT]->neighbor[RIGHT]=0;
-        tri->child[RIGHT]->neighbor[LEFT]=0;
+        evaluateChildren(t, 0, 0);
+        split2(t);
+        added += 1;
+        ju32 c = triangle[t].child;
+        tri_neighbor[c+LEFT][RIGHT] = 0;
+        tri_neighbor[c+RIGHT][LEFT] = 0;
     }
+    return added;
 }
 
 
@@ -369,65 +622,110 @@ void LoDQuad::split(LoDTriangle *tri)
 #define OUTMASK_PLUS_Z   ( 2 << PLANE_PLUS_Z  )
 
 
-void LoDQuad::setupRecursive (LoDTriangle *tri, bool partially_obscured)
+void LoDQuad::setupRecursive (ju32 t, bool partially_obscured)
 {
-    float error;
-    Evaluator::FrustumView frustum_view;
-    
-    // We clear all flags that might still be set from the previous setup
-    tri->flags &= ~(TFLAG_DETAIL_TEX | TFLAG_DEBUG | TFLAG_DONT_DRAW);
+    LoDTriangle *tri = &triangle[t];
     
     if ((tri->flags & TFLAG_ENABLED) == 0) {
-        setupRecursive(tri->child[0], true);
-        setupRecursive(tri->child[1], true);
+        // We clear all flags that might still be set from the previous setup
+        tri->flags &= ~(TFLAG_DETAIL_TEX | TFLAG_DEBUG | TFLAG_DONT_DRAW);
+        
+        setupRecursive(tri->child, true);
+        setupRecursive(tri->child+1, true);
         
         // if both child triangles are invisible then also dont draw this one
         tri->flags |= TFLAG_DONT_DRAW
-                & tri->child[0]->flags & tri->child[1]->flags;
+                & triangle[tri->child].flags & triangle[tri->child+1].flags;
         
+    } else if (partially_obscured) {
+        setupEnabled(t, evaluator.checkAgainstFrustum(tri));
     } else {
-        if (partially_obscured) {
-            frustum_view = evaluator.checkAgainstFrustum(tri);
-            partially_obscured = (frustum_view == Evaluator::PARTIAL);
-            if (frustum_view == Evaluator::OUTSIDE) {
-                tri->flags |= TFLAG_DONT_DRAW | TFLAG_ENABLED;
-                return;
+        setupEnabled(t, Evaluator::INSIDE);
+    }
+}
+
+// setupEnabled continues setupRecursive for a triangle of the mesh whose
+// frustum view is known
+void LoDQuad::setupEnabled(ju32 t, Evaluator::FrustumView frustum_view)
+{
+    LoDTriangle *tri = &triangle[t];
+    
+    // We clear all flags that might still be set from the previous setup
+    tri->flags &= ~(TFLAG_DETAIL_TEX | TFLAG_DEBUG | TFLAG_DONT_DRAW);
+    
+    if (frustum_view == Evaluator::OUTSIDE) {
+        tri->flags |= TFLAG_DONT_DRAW | TFLAG_ENABLED;
+        return;
+    }
+    
+    // Now frustum_view is either INSIDE or PARTIAL
+    
+    float error = tri->dyn_error;
+
+    if ((error > MAX_ERROR) && (tri->flags & TFLAG_HAS_CHILDREN))
+    {
+        split(t);
+        
+        // Test both children against the frustum at once. One of them may
+        // be split by its sibling's subtree before we get to it.
+        ju32 c = tri->child;
+        Evaluator::FrustumView view[2] = {Evaluator::INSIDE, Evaluator::INSIDE};
+        if (frustum_view == Evaluator::PARTIAL) {
+            const LoDTriangle *child[2] = {&triangle[c], &triangle[c+1]};
+            evaluator.checkAgainstFrustum(child, 2, view);
+        }
+        for (int i=0; i<2; i++) {
+            if (triangle[c+i].flags & TFLAG_ENABLED) {
+                setupEnabled(c+i, view[i]);
+            } else {
+                setupRecursive(c+i, true);
             }
-        } else {
-            frustum_view = Evaluator::INSIDE;
         }
-        
-        // Now frustum_view is either INSIDE or PARTIAL
-        
-        error = tri->dyn_error;
 
-        if ((error > MAX_ERROR) && (tri->flags & TFLAG_HAS_CHILDREN))
+        // if both child triangles are invisible then also dont draw
+        // this one
+        tri->flags |= TFLAG_DONT_DRAW
+                & triangle[c].flags & triangle[c+1].flags;
+    } else {
+        // Test wether the triangle's front side is visible
+        //if (!evaluator.onFrontSide(tri))
+        //    tri->flags |= TFLAG_DONT_DRAW;
+        
+        // Test whether at least one corner is visible above the ocean.
+        // If yes, enable. Else, don't draw.
+        const ju32 *vertex = tri_vertex[t];
+        if (vertexY(vertex[0]) >= 0 ||
+            vertexY(vertex[1]) >= 0 ||
+            vertexY(vertex[2]) >= 0)
         {
-            split(tri);
-            setupRecursive(tri->child[0], partially_obscured);
-            setupRecursive(tri->child[1], partially_obscured);
-
-            // if both child triangles are invisible then also dont draw
-            // this one
-            tri->flags |= TFLAG_DONT_DRAW
-                    & tri->child[0]->flags & tri->child[1]->flags;
+            tri->flags |= TFLAG_ENABLED;
         } else {
-            // Test wether the triangle's front side is visible
-            //if (!evaluator.onFrontSide(tri))
-            //    tri->flags |= TFLAG_DONT_DRAW;
-            
-            // Test whether at least one corner is visible above the ocean.
-            // If yes, enable. Else, don't draw.
-            if (vy[tri->vertex[0]] >= 0 ||
-                vy[tri->vertex[1]] >= 0 ||
-                vy[tri->vertex[2]] >= 0)
-            {
-                tri->flags |= TFLAG_ENABLED;
-            } else {
-                tri->flags |= TFLAG_DONT_DRAW;
-            }
+            tri->flags |= TFLAG_DONT_DRAW;
         }
-        
+    }
+}
+
+void LoDQuad::getMesh(std::vector<ju32> & triangles, std::vector<ju32> & drawn)
+{
+    getMeshRecursive(0, triangles, drawn);
+    getMeshRecursive(1, triangles, drawn);
+}
+
+void LoDQuad::getCorners(ju32 t, Vector *p) const
+{
+    for (int i=0; i<3; i++) p[i] = getVertex(tri_vertex[t][i]);
+}
+
+void LoDQuad::getMeshRecursive(ju32 t, std::vector<ju32> & triangles,
+                               std::vector<ju32> & drawn)
+{
+    const LoDTriangle *tri = &triangle[t];
+    if (tri->flags & TFLAG_ENABLED) {
+        triangles.push_back(t);
+        if (!(tri->flags & TFLAG_DONT_DRAW)) drawn.push_back(t);
+    } else {
+        getMeshRecursive(tri->child, triangles, drawn);
+        getMeshRecursive(tri->child+1, triangles, drawn);
     }
 }
 
@@ -435,13 +733,13 @@ void LoDQuad::setupRecursive (LoDTriangle *tri, bool partially_obscured)
 
 #define HOMOGENIZE_DELTA 0.05f
 
-float LoDQuad::homogenizeError(LoDTriangle * tri) {
+float LoDQuad::homogenizeError(ju32 t) {
+    LoDTriangle *tri = &triangle[t];
     if (tri->flags & TFLAG_HAS_CHILDREN) {
         float max_child_error = std::max(
-                homogenizeError(tri->child[0]),
-                homogenizeError(tri->child[1]));
+                homogenizeError(tri->child),
+                homogenizeError(tri->child+1));
         tri->error = std::max( tri->error, HOMOGENIZE_DELTA + max_child_error);
         return tri->error;
     } else return tri->error;
 }
-
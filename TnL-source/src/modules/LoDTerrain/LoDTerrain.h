@@ -3,10 +3,13 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <map>
 #include <cstdio>
 #include <cstdlib>
 #include <cmath>
 //#include <unistd.h>
+#include <SDL.h>
 
 #include <tnl.h>
 #include <interfaces/ILoDQuadManager.h>
@@ -20,6 +23,8 @@
 #include <modules/ui/status.h>
 #include "image.h"
 
+class MappedFile;
+
 /*
 Triangle references contain a triangle's index in the triangle list of a quad.
 The 3 most significant bits of such an index determine whether the triangle
@@ -27,11 +32,11 @@ is a member of the current quad's triangle list or one of the quads neighbors.
 */
 #define TREF_MASK  0xe0000000
 #define TREF_INDEX 0x1fffffff
-#define TREF_THIS  (5 << 29)
-#define TREF_NORTH (1 << 29)
-#define TREF_SOUTH (2 << 29)
-#define TREF_WEST  (3 << 29)
-#define TREF_EAST  (4 << 29)
+#define TREF_THIS  (5u << 29)
+#define TREF_NORTH (1u << 29)
+#define TREF_SOUTH (2u << 29)
+#define TREF_WEST  (3u << 29)
+#define TREF_EAST  (4u << 29)
 
 /*
 Triangle flags control the behavior of triangles.
@@ -77,112 +82,474 @@ typedef struct {
     ju32 flags;       /* The triangle's flags                           */
 } LoDTriangleFileStruct;
 
-typedef struct _LoDTriangle {
-    struct _LoDTriangle *child[2];    /* The triangles children  */
-    struct _LoDTriangle *neighbor[3]; /* The triangles neighbors */
-    ju32 vertex[3];    /* The indices of the triangle's vertices */
-    float error;       /* The geometry error of this triangle    */
-    ju32 flags;        /* The triangle's flags                   */
-    Vector bs_center;  /* The bounding sphere's center           */
-    float radius;      /* The radius of a sphere that contains
-                          the triangle. The sphere's origin is
-                          bs_center                               */
-    Vector normal;     /* The triangle's normal, pointing upwards */
-    float morph;       /* [0..1] 1 if triangle has full shape     */
-    float dyn_error;   /* Error of the triangle on the screen     */
+/*
+The triangle tree is split into a hot part, which the per-frame LoD
+traversal touches, and side arrays for everything else. All of them are
+indexed by the same 32-bit triangle index.
+
+The triangles are ordered depth first, and the two children of a
+triangle are stored next to each other, so child and child+1 are the
+children and each subtree occupies a mostly contiguous range. The two
+root triangles are 0 and 1.
+*/
+typedef struct {
+    Vector bs_center;  /* The bounding sphere's center                */
+    float radius;      /* The radius of a sphere that contains the
+                          triangle. The sphere's origin is bs_center.
+                          Must follow bs_center, see Evaluator.cc     */
+    float error;       /* The geometry error of this triangle         */
+    float dyn_error;   /* Error of the triangle on the screen         */
+    ju32 flags;        /* The triangle's flags                        */
+    ju32 child;        /* Index of the left child, if there are any;
+                          the right child is child+1                  */
 } LoDTriangle;
 
 typedef struct {
     bool left:1, right:1, bottom:1;
 } BorderSet;
 
+/*
+A batch collects the vertices of one renderer draw call. xyz holds three
+floats per vertex, uv two and rgba four. Batches that are drawn with the
+current color leave rgba empty, untextured ones leave uv empty.
+*/
+struct LoDBatch {
+    std::vector<float> xyz;
+    std::vector<float> uv;
+    std::vector<float> rgba;
+
+    inline void clear() { xyz.clear(); uv.clear(); rgba.clear(); }
+    inline bool empty() const { return xyz.empty(); }
+    inline int size() const { return xyz.size() / 3; }
+
+    inline void addVertex(const Vector & p) {
+        xyz.push_back(p[0]);
+        xyz.push_back(p[1]);
+        xyz.push_back(p[2]);
+    }
+    inline void addUV(float u, float v) {
+        uv.push_back(u);
+        uv.push_back(v);
+    }
+    inline void addColor(const Vector & col, float alpha) {
+        rgba.push_back(col[0]);
+        rgba.push_back(col[1]);
+        rgba.push_back(col[2]);
+        rgba.push_back(alpha);
+    }
+};
+
+/*
+An entry of the incremental refinement queues. Triangles are identified by
+their quad and index, the priority is the triangle's screen error.
+*/
+struct LoDQueueEntry {
+    float priority;
+    LoDQuad *quad;
+    ju32 tri;
+
+    inline LoDQueueEntry(float priority, LoDQuad *quad, ju32 tri)
+    :   priority(priority), quad(quad), tri(tri) { }
+    inline bool operator< (const LoDQueueEntry & o) const {
+        return priority < o.priority;
+    }
+    inline bool operator> (const LoDQueueEntry & o) const {
+        return priority > o.priority;
+    }
+};
+
 class LoDQuad
 {
     friend class Evaluator;
     class Evaluator {
         Vector pos;
         float plane[6][4];
-        const float *vx, *vy, *vz;
+        const LoDQuad *quad;
         float focus;
+        bool vectorized;
     public:
         enum FrustumView {INSIDE, OUTSIDE, PARTIAL};
+        // The most triangles the batch versions below take at once
+        enum {BATCH_SIZE = 4};
     
         inline Evaluator() { }
-        Evaluator(const Vector & p, const float plane[6][4],
-            const float * vx, const float * vy, const float * vz,
-            float focus);
+        Evaluator(const LoDQuad * quad, const Vector & p,
+            const float plane[6][4], float focus, bool vectorized=true);
         float evaluate(LoDTriangle * tri);
         FrustumView checkAgainstFrustum(const LoDTriangle * tri);
         bool onFrontSide(const LoDTriangle * tri);
+        
+        // Batch versions for up to BATCH_SIZE triangles, which test all of
+        // them at once with SIMD instructions where available. They give
+        // exactly the same results as the single triangle versions.
+        void evaluate(LoDTriangle * const * tri, int n, float *out_error);
+        void checkAgainstFrustum(const LoDTriangle * const * tri, int n,
+                                 FrustumView *out_view);
     private:
         static float calcDistance(const Vector & point, const float *plane);
     };
     
     friend class LoDQuadManager;
+    friend class LoDQuadGrid;
     
 public:
     typedef enum {ABOVE, INSIDE, BELOW} CoordRel;
     LoDQuad();
     ~LoDQuad();
     
+    // Time spent in the phases of load(), in milliseconds
+    struct LoadTimes {
+        Uint32 geometry;
+        Uint32 texmap;
+    };
+    
+    // load does the CPU side of loading a quad: geometry, normals, bounding
+    // spheres and the texmap. It doesn't touch the renderer or any other
+    // game state, so it may run on a worker thread. compact_vertices
+    // selects the compact vertex storage, see getVertex. The cache is kept
+    // in cache_dir, or next to the .qad file if there is none.
+    bool load(const char    * quad_name,
+              const char    * texmap_name,
+              bool            use_cache,
+              bool            compact_vertices=false,
+              LoadTimes     * times=0,
+              const char    * cache_dir=0);
+    // init finishes loading on the main thread
     void init(IGame         * the_game,
-              std::istream  & in,
               LoDQuad      ** neighbor,
               TexPtr          main_tex,
               TexPtr          detail_tex,
-              const char    * texmap_name,
               TexPtr        (*textures)[16],
-              const char    * lightmap_name,
-              Status        & stat);
+              const char    * lightmap_name);
+    // The same for tools that run without a game, such as the benchmarks
+    // in tests/, which pass the lightmap and environment themselves
+    void init(LoDQuad      ** neighbor,
+              TexPtr          main_tex,
+              TexPtr          detail_tex,
+              TexPtr        (*textures)[16],
+              TexPtr          lightmap,
+              Ptr<Environment> environment);
     void done();
     
+    // Approximate number of bytes the loaded quad occupies
+    size_t getMemoryUsage();
+    
     void connect();
     
-    void presetup();
-    void setup(Vector &pos, const float planes[6][4], float focus);
-    void draw(JRenderer *renderer);
+    // presetup must have been called on all quads before setup is called
+    // on any of them, since setup may split triangles of neighbor quads,
+    // whose root errors presetup computes
+    // With vectorized false, setup uses the scalar evaluator code only
+    void presetup(const Vector &pos, const float planes[6][4], float focus,
+                  bool vectorized=true);
+    // An isolated setup leaves the neighbor quads alone, so that quads can
+    // be set up in parallel. stitch then joins the mesh to that of the
+    // neighbor on the side QN_EAST or QN_SOUTH and returns the number of
+    // triangles it had to split, see Stitching.cc
+    void setup(bool isolated=false);
+    int stitch(int side);
+    // Appends the triangles of the current mesh to triangles, and the ones
+    // that are drawn to drawn, in tree order
+    void getMesh(std::vector<ju32> & triangles, std::vector<ju32> & drawn);
+    // The corners and the morph value of a triangle of the mesh
+    void getCorners(ju32 tri, Vector *p) const;
+    inline float getMorph(ju32 tri) const { return tri_morph[tri]; }
+    // camera_pos is the location of the camera the frame is drawn for
+    void draw(JRenderer *renderer, const Vector &camera_pos);
     void drawWire(JRenderer *renderer);
     CoordRel getCoordRelX(float x);
     CoordRel getCoordRelZ(float z);
+    // The rectangle in the x/z plane covered by the quad
+    void getExtent(float *x0, float *z0, float *x1, float *z1);
     float getHeightAt(float x, float z, Vector *out_normal=0);
-    bool getHeightAtTriangle(LoDTriangle *tri, float x, float z, float *height, Vector *out_normal=0);
+    bool getHeightAtTriangle(ju32 tri, float x, float z, float *height, Vector *out_normal=0);
+    // Heights and optionally normals of n points on this quad
+    void getHeightsAt(int n, const float *x, const float *z,
+                      float *out_height, Vector *out_normal=0);
+    // Finds the first point in the part [t0,t1] of the line from a to b
+    // where it hits this quad and stores its line parameter in *t
+    bool castRay(const Vector & a, const Vector & b, float t0, float t1,
+                 float *t, Vector *out_normal);
+    
+    // Triangle references are relative to the quad that holds them.
+    // resolve returns the quad owning the referenced triangle and stores
+    // its index in *idx, or returns 0 for a null reference. refTo makes a
+    // reference from this quad to a triangle of owner.
+    inline LoDQuad *resolve(ju32 ref, ju32 *idx) const;
+    inline ju32 refTo(const LoDQuad *owner, ju32 idx) const;
+    
+    // The vertices are either kept in five float arrays, or, if the quad
+    // was loaded with compact_vertices and its vertices form a full grid,
+    // as 16 bit heights alone. A compact vertex index holds the vertex'
+    // grid row and column, from which x, z and the texture coordinates
+    // follow, and the heights are quantized between the lowest and the
+    // highest vertex of the quad. Everything else, including the normals
+    // and bounding spheres, is derived from the dequantized vertices.
+    inline float vertexX(ju32 i) const;
+    inline float vertexY(ju32 i) const;
+    inline float vertexZ(ju32 i) const;
+    inline float vertexU(ju32 i) const;
+    inline float vertexV(ju32 i) const;
+    inline Vector getVertex(ju32 i) const;
     
 private:
-    void drawRecursive(JRenderer *r, LoDTriangle *tri,
+    void drawRecursive(JRenderer *r, ju32 tri,
         float y0, float y1, float y2, float *alpha);
-    void drawWireBorder(JRenderer *r, LoDTriangle *tri, int i0, int i1);
-    void drawWireRecursive(JRenderer *r, LoDTriangle *tri, BorderSet);
+    void drawWireBorder(JRenderer *r, ju32 tri, int i0, int i1);
+    void drawWireRecursive(JRenderer *r, ju32 tri, BorderSet);
+    void updateFogCache();
+
+    // Batched drawing: the tree is walked once per frame, collecting the
+    // morphed triangles of every layer into per-texture batches, which are
+    // then drawn with one call each.
+    void collectRecursive(ju32 tri,
+        float y0, float y1, float y2, float *alpha);
+    void collectTiles(ju32 tri, const Vector *p);
+    void addTriangle(LoDBatch & batch, ju32 tri, const Vector *p);
+    void drawBatch(JRenderer *r, LoDBatch & batch);
+    void drawBatches(JRenderer *r);
+    void clearBatches();
+
+    void readQuadFile(std::istream & in, bool compact_vertices);
+    static std::string cacheName(const char *quad_name,
+                                 const char *cache_dir);
+    bool loadCache(const char *cache_name, const char *quad_name,
+                   bool compact_vertices);
+    void saveCache(const char *cache_name, const char *quad_name,
+                   bool compact_vertices);
 
-    void setupBoundingSpheres(LoDTriangle *tri);
+    void allocSideArrays();
+    bool compactVertices(ju32 (*tri_vertex)[3]);
+    void setupBoundingSpheres(ju32 tri);
+    void setupHeightGrid();
+    bool triangleContains(ju32 tri, float x, float z);
+    ju32 findStartTriangle(float x, float z);
+    ju32 findLeaf(float x, float z);
+    void setupMaxHeights();
+    bool castRayNode(int level, int i, int j,
+                     const Vector & a, const Vector & b, float t0, float t1,
+                     float *t, Vector *out_normal);
+    void castRayTriangles(ju32 tri, const Vector & a, const Vector & d,
+                          float t0, float *t1, ju32 *hit);
     
-    void split2(LoDTriangle *tri);
-    void split(LoDTriangle *tri);
+    void split2(ju32 tri);
+    int split(ju32 tri);
+    void replaceNeighbor(ju32 ref, ju32 old_tri, ju32 new_tri);
+    float calcMorph(ju32 tri);
     
-    void setupRecursive(LoDTriangle *tri, bool partially_obscured);
+    void setupRecursive(ju32 tri, bool partially_obscured);
+    int stitchEdge(ju32 x, int sx, LoDQuad *q, ju32 y, int sy);
+    void setupEnabled(ju32 tri, Evaluator::FrustumView view);
+    void evaluateChildren(ju32 tri, LoDQuad *bq, ju32 b);
+    void getMeshRecursive(ju32 tri, std::vector<ju32> & triangles,
+                          std::vector<ju32> & drawn);
     
-    float homogenizeError(LoDTriangle * tri);
-    bool lineCollides(Vector a, Vector b, float * t, LoDTriangle * tri, Vector *out_normal);
-    void drawTexturedTriangle(JRenderer *r, LoDTriangle * tri, float *y);
-    void drawFogTriangle(JRenderer *r, LoDTriangle * tri, float *y, float *alpha);
+    // Incremental refinement keeps the mesh of the last frame and is
+    // driven by LoDQuadManager::refine, see Refinement.cc
+    void beginRefinement(const Vector &pos, const float planes[6][4],
+                         float focus);
+    int collectQueues(std::vector<LoDQueueEntry> & splits,
+                      std::vector<LoDQueueEntry> & merges);
+    int queueRecursive(ju32 tri, Evaluator::FrustumView view,
+                       std::vector<LoDQueueEntry> & splits,
+                       std::vector<LoDQueueEntry> & merges);
+    bool isMeshLeaf(ju32 tri);
+    bool isMergeable(ju32 tri);
+    bool canMerge2(ju32 tri);
+    int merge(ju32 tri);
+    void merge2(ju32 tri);
+    void refresh();
+    void refreshRecursive(ju32 tri, bool partially_obscured);
+    
+    float homogenizeError(ju32 tri);
+    bool lineCollides(Vector a, Vector b, float * t, ju32 tri, Vector *out_normal);
+    void drawTexturedTriangle(JRenderer *r, ju32 tri, float *y);
+    void drawFogTriangle(JRenderer *r, ju32 tri, float *y, float *alpha);
 
 private:
     IGame *game;
     LoDQuad *neighbor[4];
-    LoDTriangle *triangle;
-    float *vx, *vy, *vz;
-    float *tex_u, *tex_v;
+    LoDTriangle *triangle;          /* The hot part of the triangles     */
+    const ju32 (*tri_vertex)[3];    /* The triangles' corner vertices    */
+    const Vector *tri_normal;       /* The triangles' upward normals     */
+    ju32 *tri_parent;               /* The triangles' parents            */
+    ju32 (*tri_neighbor)[3];        /* TREFs to the neighbors, kept up
+                                       to date by splits and merges      */
+    float *tri_morph;               /* [0..1] 1 if triangle has full shape */
+    const float *vx, *vy, *vz;
+    const float *tex_u, *tex_v;
+    const ju16 *vh;                 /* Compact heights, see getVertex     */
+    int vgrid_shift;                /* Bits of the column of a compact
+                                       vertex index                      */
+    float vgrid_x0, vgrid_z0;       /* Position of grid vertex 0         */
+    float vgrid_dx, vgrid_dz;       /* Distance of the grid columns/rows */
+    float vgrid_du;                 /* Texture distance of the columns
+                                       and rows                          */
+    float vh_offset, vh_scale;      /* Dequantize the compact heights    */
+    float *vfog;                    /* The vertices' fog strengths, see
+                                       updateFogCache                    */
     int triangles, vertices;
+    std::vector<ju32> height_grid;  /* Start triangles for height queries,
+                                       see setupHeightGrid               */
+    float grid_x0, grid_z0, grid_scale_x, grid_scale_z;
+    std::vector<float> max_height;  /* Max-mip pyramid over the height
+                                       grid, finest level first          */
+    MappedFile *cache_file; /* Backs the vertex arrays, the corner vertices
+                               and normals if loaded from cache */
     TexPtr main_tex;
     TexPtr detail_tex;
     Evaluator evaluator;
+    bool isolated;          /* Leave the other quads alone, see setup   */
     TexPtr (*textures)[16];
     Ptr<Image> texmap;
     TexPtr lightmap;
     Ptr<Environment> environment;
+    
+    Vector view_pos;        /* Camera location of the frame being drawn */
+    bool fog_valid;         /* Whether vfog matches fog_view and        */
+    Vector fog_view;        /* fog_params, the inputs of the fog        */
+    float fog_params[4];    /* strengths it was computed from           */
+    int draw_calls;         /* Renderer calls made by the last draw()   */
+    int draw_triangles;     /* Triangles submitted by the last draw()   */
+    
+    LoDBatch main_batch;
+    LoDBatch lightmap_batch;
+    LoDBatch fog_batch;
+    std::map<int, LoDBatch> tile_batches;  /* Opaque base tiles by texture */
+    std::map<int, LoDBatch> patch_batches; /* Blended tile patches         */
+};
+
+inline float LoDQuad::vertexX(ju32 i) const
+{
+    if (!vh) return vx[i];
+    return vgrid_x0 + (i & ((1 << vgrid_shift) - 1)) * vgrid_dx;
+}
+
+inline float LoDQuad::vertexY(ju32 i) const
+{
+    if (!vh) return vy[i];
+    return vh_offset + vh[i] * vh_scale;
+}
+
+inline float LoDQuad::vertexZ(ju32 i) const
+{
+    if (!vh) return vz[i];
+    return vgrid_z0 + (i >> vgrid_shift) * vgrid_dz;
+}
+
+inline float LoDQuad::vertexU(ju32 i) const
+{
+    if (!vh) return tex_u[i];
+    return (i & ((1 << vgrid_shift) - 1)) * vgrid_du;
+}
+
+inline float LoDQuad::vertexV(ju32 i) const
+{
+    if (!vh) return tex_v[i];
+    return (i >> vgrid_shift) * vgrid_du;
+}
+
+inline Vector LoDQuad::getVertex(ju32 i) const
+{
+    return Vector(vertexX(i), vertexY(i), vertexZ(i));
+}
+
+inline LoDQuad *LoDQuad::resolve(ju32 ref, ju32 *idx) const
+{
+    *idx = ref & TREF_INDEX;
+    switch (ref & TREF_MASK) {
+    case TREF_THIS:  return const_cast<LoDQuad*>(this);
+    case TREF_NORTH: return neighbor[QN_NORTH];
+    case TREF_SOUTH: return neighbor[QN_SOUTH];
+    case TREF_WEST:  return neighbor[QN_WEST];
+    case TREF_EAST:  return neighbor[QN_EAST];
+    default:         return 0;
+    }
+}
+
+inline ju32 LoDQuad::refTo(const LoDQuad *owner, ju32 idx) const
+{
+    if (owner == this) return TREF_THIS | idx;
+    if (owner == neighbor[QN_NORTH]) return TREF_NORTH | idx;
+    if (owner == neighbor[QN_SOUTH]) return TREF_SOUTH | idx;
+    if (owner == neighbor[QN_WEST]) return TREF_WEST | idx;
+    if (owner == neighbor[QN_EAST]) return TREF_EAST | idx;
+    return 0;
+}
+
+class WorkerPool;
+struct QuadLoadJob;
+struct SegmentJob;
+
+/*
+The grid of quads that makes up a landscape: the layout of the grid, the
+links between neighbor quads, the mesh setup and the queries. Loading,
+paging and textures are left to LoDQuadManager, so that tools without a
+game, such as the benchmarks in tests/, can use it as well. Only resident
+quads are linked, set up and queried.
+*/
+class LoDQuadGrid
+{
+public:
+    enum QuadState {QUAD_UNLOADED, QUAD_LOADING, QUAD_RESIDENT, QUAD_MISSING};
+
+    // Steps through the quads along the line from a to b in order, which
+    // needs the layout. [t0,t1] is the part of the line within quad (u,v),
+    // which may lie outside the grid.
+    struct QuadWalk {
+        int u, v, step_u, step_v;
+        float next_u, next_v, delta_u, delta_v;
+        float t0, t1;
+
+        QuadWalk(const LoDQuadGrid & grid, const Vector & a, const Vector & b);
+        inline bool done() const { return t0 >= 1; }
+        void next();
+    };
+
+    LoDQuadGrid();
+    ~LoDQuadGrid();
+
+    // Allocates width*height unloaded quads
+    void setSize(int width, int height);
+    // Takes the layout of the grid from the loaded quad idx
+    void setLayout(int idx);
+    inline bool haveLayout() const { return have_layout; }
+
+    // Fills in the resident neighbors of quad idx for LoDQuad::init
+    void getNeighbors(int idx, LoDQuad **neighbor) const;
+    // Links the initialized quad idx back from its neighbors and marks it
+    // resident. removeResident unlinks it again.
+    void addResident(int idx);
+    void removeResident(int idx);
+
+    // Returns the index of the quad that lies under the given X/Z-Pair, or
+    // -1 if there is none
+    int getQuadIndexAt(float x, float z) const;
+
+    // Builds the mesh of all resident quads from scratch, on the threads of
+    // pool if there is one, and returns the number of splits made by
+    // stitching them
+    int setupQuads(WorkerPool *pool, const Vector &pos,
+                   const float planes[6][4], float focus);
+
+    float getHeightAt(float x, float z, Vector *out_normal=0);
+    bool castRay(const Vector & a, const Vector & b,
+                 Vector * cx, Vector *out_normal);
+
+    LoDQuad *quad;
+    int width, height;
+    std::vector<int> quad_state;
+
+protected:
+    bool have_layout;              /* Set once the first quad is loaded */
+    float origin_x, origin_z;      /* Northwest point of the landscape  */
+    float quad_dx, quad_dz;        /* Tile width and length             */
 };
 
-class LoDQuadManager: public ILoDQuadManager, virtual public SigObject
+class LoDQuadManager: public ILoDQuadManager, virtual public SigObject,
+                      private LoDQuadGrid
 {
+    friend struct SegmentJob;
 public:
     LoDQuadManager(IGame *the_game, Status &);
     virtual ~LoDQuadManager();
@@ -192,21 +559,63 @@ public:
     virtual void draw();
     
     virtual float getHeightAt(float x, float z, Vector *out_normal=0);
+    virtual void getHeightsAt(int n, const float *x, const float *z,
+            float *out_height, Vector *out_normal=0);
     virtual bool lineCollides(Vector a, Vector b, Vector * x, Vector *out_normal=0);
+    virtual void linesCollide(int n, TerrainSegment *segments);
     
 private:
     LoDQuad *getQuadAtPoint(float x, float z);
+    
+    // Line tests are split into paging in the quads along the line, which
+    // must happen on the main thread, and the test itself, castRay, which
+    // only looks at resident quads and may run on any thread
+    void pageAlong(const Vector & a, const Vector & b);
     void loadTextures();
+    
+    // Paging: quads near the camera and the active actors are kept
+    // resident, the others are evicted when the byte budget is exceeded.
+    void updatePaging(bool block);
+    void requestQuadsAround(float x, float z, float radius);
+    void requestQuad(int idx);
+    LoDQuad *makeResident(int idx);
+    void finishQuad(QuadLoadJob *job);
+    void evictQuad(int idx);
+    
+    // Changes the mesh of the last frame within the budgets, see
+    // Refinement.cc
+    void refine(const Vector &pos, const float planes[6][4], float focus);
 
 private:
     IGame *game;
     JRenderer *renderer;
     Ptr<IConfig> cfg;
-    LoDQuad *quad;
-    int width, height;
     int counter;
     bool debug_mode;
     TexPtr textures[256][16];
+    
+    TexPtr detail_tex;
+    std::string texture_prefix;
+    std::string lightmap_prefix;
+    
+    QuadLoadJob *jobs;
+    WorkerPool *pool;
+    WorkerPool *segment_pool;      /* Runs the tests of linesCollide    */
+    WorkerPool *setup_pool;        /* Runs the setup of the quads, or 0 */
+    std::vector<int> last_wanted;  /* value of counter when last wanted */
+    
+    float page_radius;             /* 0 means that paging is disabled   */
+    float actor_page_radius;
+    size_t page_budget;
+    size_t resident_bytes;
+    
+    bool incremental_lod;
+    int lod_triangle_budget;
+    Uint32 lod_time_budget;        /* milliseconds per frame            */
+    bool mesh_valid;               /* false after the quad set changed  */
+    std::vector<LoDQueueEntry> split_queue, merge_queue;
+    
+    Uint32 geometry_ms, texmap_ms, texture_ms; /* for the timing report */
 };
 
 #endif
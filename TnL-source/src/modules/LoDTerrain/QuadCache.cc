@@ -0,0 +1,325 @@
+#include "LoDTerrain.h"
+#include <MappedFile.h>
+#include <cstring>
+#include <cstdio>
+
+/*
+The quad cache holds everything LoDQuad::init derives from a .qad file:
+the homogenized error values, bounding spheres, normals, the transformed
+vertex coordinates and the texture coordinates, or the compact heights in
+their place. It is written on first load, into the user's cache directory
+where there is one, since the terrain data may be read-only, and mapped
+read-only afterwards, so the vertex
+arrays, the corner vertices and the normals are used in place and shared
+between processes. Only the hot triangle records, which carry per-frame
+flags, are copied into the quad.
+
+All references inside the file are indices and byte offsets, never
+pointers, so the file can be mapped at any address. The source file's size
+and modification time are recorded to detect stale caches.
+*/
+
+#define LODQUAD_CACHE_MAGIC   "LQDC"
+#define LODQUAD_CACHE_VERSION 3
+#define LODQUAD_CACHE_BYTE_ORDER 0x01020304
+#define LODQUAD_CACHE_ALIGN   16
+
+typedef struct {
+    char magic[4];
+    ju32 version;
+    ju32 byte_order;      /* Detects caches written on other platforms */
+    ju32 triangles;
+    ju32 vertices;
+    ju32 source_size;     /* Size of the .qad file the cache was made of */
+    ju32 source_mtime;    /* Modification time of that .qad file         */
+    ju32 triangle_offset; /* Byte offset of the triangle records          */
+    ju32 corner_offset;   /* Byte offset of the corner vertex indices     */
+    ju32 normal_offset;   /* Byte offset of the triangle normals          */
+    ju32 vertex_offset;   /* Byte offset of the vertex arrays             */
+    ju32 file_size;       /* Expected size of the whole cache file        */
+    ju32 compact;         /* Whether compact vertices were asked for      */
+    ju32 grid_shift;      /* Column bits of compact vertex indices, 0 if
+                             the vertices are kept in float arrays        */
+    float grid[7];        /* The grid and height parameters, see
+                             LoDQuad::getVertex                           */
+} LoDQuadCacheHeader;
+
+typedef struct {
+    float bs_center[3];   /* The bounding sphere                        */
+    float radius;
+    float error;          /* The homogenized geometry error             */
+    ju32 flags;           /* The triangle's static flags                */
+    ju32 child;           /* Index of the left child, the right follows */
+} LoDTriangleCacheStruct;
+
+namespace {
+    inline ju32 align(ju32 offset) {
+        return (offset + LODQUAD_CACHE_ALIGN - 1)
+                & ~(ju32) (LODQUAD_CACHE_ALIGN - 1);
+    }
+
+    inline void calcLayout(LoDQuadCacheHeader & header) {
+        header.triangle_offset = align(sizeof(LoDQuadCacheHeader));
+        header.corner_offset = align(header.triangle_offset
+                + header.triangles * sizeof(LoDTriangleCacheStruct));
+        header.normal_offset = align(header.corner_offset
+                + header.triangles * 3 * sizeof(ju32));
+        header.vertex_offset = align(header.normal_offset
+                + header.triangles * 3 * sizeof(float));
+        // The vertex arrays are vx, vy, vz, tex_u and tex_v, each aligned,
+        // or the compact heights
+        if (header.grid_shift) {
+            header.file_size = header.vertex_offset
+                    + align(header.vertices * sizeof(ju16));
+        } else {
+            header.file_size = header.vertex_offset
+                    + 5 * align(header.vertices * sizeof(float));
+        }
+    }
+
+    inline bool write(FILE *out, const void *data, size_t size) {
+        return size == 0 || fwrite(data, size, 1, out) == 1;
+    }
+
+    inline bool writePadding(FILE *out, size_t size) {
+        static const char zeros[LODQUAD_CACHE_ALIGN] = {0};
+        return write(out, zeros, size);
+    }
+}
+
+// Caches in a cache directory are named after the whole path of the .qad
+// file, so that terrains with the same file names don't share them
+std::string LoDQuad::cacheName(const char *quad_name, const char *cache_dir)
+{
+    if (!cache_dir || !*cache_dir) return std::string(quad_name) + ".cache";
+    std::string name = std::string(cache_dir) + "/";
+    for (const char *p=quad_name; *p; p++) {
+        name += (*p == '/' || *p == '\\' || *p == ':') ? '_' : *p;
+    }
+    return name + ".cache";
+}
+
+bool LoDQuad::loadCache(const char *cache_name, const char *quad_name,
+                        bool compact_vertices)
+{
+    size_t source_size;
+    time_t source_mtime;
+    if (!MappedFile::getFileInfo(quad_name, &source_size, &source_mtime)) {
+        return false;
+    }
+
+    MappedFile *file = new MappedFile;
+    if (!file->open(cache_name)) {
+        delete file;
+        return false;
+    }
+
+    const char *data = file->getData();
+    LoDQuadCacheHeader header;
+    if (file->getSize() < sizeof(LoDQuadCacheHeader)) {
+        ls_warning("LoDTerrain: Ignoring truncated cache %s\n", cache_name);
+        delete file;
+        return false;
+    }
+    memcpy(&header, data, sizeof(LoDQuadCacheHeader));
+
+    if (0 != memcmp(header.magic, LODQUAD_CACHE_MAGIC, 4)
+        || header.version != LODQUAD_CACHE_VERSION
+        || header.byte_order != LODQUAD_CACHE_BYTE_ORDER
+        || header.source_size != (ju32) source_size
+        || header.source_mtime != (ju32) source_mtime
+        || header.compact != (ju32) compact_vertices)
+    {
+        ls_message("LoDTerrain: Cache %s is out of date\n", cache_name);
+        delete file;
+        return false;
+    }
+
+    LoDQuadCacheHeader expected = header;
+    calcLayout(expected);
+    if (header.triangles < 2 || header.grid_shift > 16
+        || header.triangle_offset != expected.triangle_offset
+        || header.corner_offset != expected.corner_offset
+        || header.normal_offset != expected.normal_offset
+        || header.vertex_offset != expected.vertex_offset
+        || header.file_size != expected.file_size
+        || file->getSize() < header.file_size)
+    {
+        ls_warning("LoDTerrain: Ignoring damaged cache %s\n", cache_name);
+        delete file;
+        return false;
+    }
+
+    triangles = header.triangles;
+    vertices = header.vertices;
+
+    // The vertex arrays are used right where they are mapped
+    const char *varray = data + header.vertex_offset;
+    if (header.grid_shift) {
+        vh = (const ju16*) varray;
+        vgrid_shift = header.grid_shift;
+        vgrid_x0  = header.grid[0];
+        vgrid_z0  = header.grid[1];
+        vgrid_dx  = header.grid[2];
+        vgrid_dz  = header.grid[3];
+        vgrid_du  = header.grid[4];
+        vh_offset = header.grid[5];
+        vh_scale  = header.grid[6];
+    } else {
+        ju32 stride = align(vertices * sizeof(float));
+        vx    = (const float*) (varray + 0 * stride);
+        vy    = (const float*) (varray + 1 * stride);
+        vz    = (const float*) (varray + 2 * stride);
+        tex_u = (const float*) (varray + 3 * stride);
+        tex_v = (const float*) (varray + 4 * stride);
+    }
+
+    // So are the corner vertices and normals, which are never written
+    tri_vertex = (const ju32 (*)[3]) (data + header.corner_offset);
+    tri_normal = (const Vector*) (data + header.normal_offset);
+    for (int i=0; i<triangles; i++) {
+        if (tri_vertex[i][0] >= (ju32) vertices
+            || tri_vertex[i][1] >= (ju32) vertices
+            || tri_vertex[i][2] >= (ju32) vertices)
+        {
+            ls_warning("LoDTerrain: Ignoring damaged cache %s\n",
+                    cache_name);
+            tri_vertex = 0;
+            tri_normal = 0;
+            vx = vy = vz = tex_u = tex_v = 0;
+            vh = 0;
+            delete file;
+            return false;
+        }
+    }
+
+    // The hot records carry per-frame state, so they are copied in a
+    // single linear pass without any recomputation.
+    const LoDTriangleCacheStruct *ctri =
+            (const LoDTriangleCacheStruct*) (data + header.triangle_offset);
+    triangle = new LoDTriangle[triangles];
+    for (int i=0; i<triangles; i++, ctri++) {
+        LoDTriangle & tri = triangle[i];
+        tri.flags = ctri->flags;
+        if ((tri.flags & TFLAG_HAS_CHILDREN)
+            && (ctri->child == 0 || ctri->child+1 >= (ju32) triangles))
+        {
+            ls_warning("LoDTerrain: Ignoring damaged cache %s\n",
+                    cache_name);
+            delete[] triangle;
+            triangle = 0;
+            tri_vertex = 0;
+            tri_normal = 0;
+            delete file;
+            return false;
+        }
+        tri.child = (tri.flags & TFLAG_HAS_CHILDREN) ? ctri->child : 0;
+        tri.error = ctri->error;
+        tri.dyn_error = 0;
+        tri.bs_center = Vector(ctri->bs_center[0],
+                ctri->bs_center[1], ctri->bs_center[2]);
+        tri.radius = ctri->radius;
+    }
+    allocSideArrays();
+
+    cache_file = file;
+    return true;
+}
+
+void LoDQuad::saveCache(const char *cache_name, const char *quad_name,
+                        bool compact_vertices)
+{
+    size_t source_size;
+    time_t source_mtime;
+    if (!MappedFile::getFileInfo(quad_name, &source_size, &source_mtime)) {
+        return;
+    }
+
+    LoDQuadCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LODQUAD_CACHE_MAGIC, 4);
+    header.version = LODQUAD_CACHE_VERSION;
+    header.byte_order = LODQUAD_CACHE_BYTE_ORDER;
+    header.triangles = triangles;
+    header.vertices = vertices;
+    header.source_size = source_size;
+    header.source_mtime = source_mtime;
+    header.compact = compact_vertices;
+    if (vh) {
+        header.grid_shift = vgrid_shift;
+        header.grid[0] = vgrid_x0;
+        header.grid[1] = vgrid_z0;
+        header.grid[2] = vgrid_dx;
+        header.grid[3] = vgrid_dz;
+        header.grid[4] = vgrid_du;
+        header.grid[5] = vh_offset;
+        header.grid[6] = vh_scale;
+    }
+    calcLayout(header);
+
+    // Write to a temporary file first, so that a crash or a concurrently
+    // starting game never sees a half-written cache. Without a writable
+    // place for it, the quad is just loaded from the .qad file every time.
+    std::string tmp_name = std::string(cache_name) + ".tmp";
+    FILE *out = fopen(tmp_name.c_str(), "wb");
+    if (!out) return;
+
+    bool ok = write(out, &header, sizeof(header))
+            && writePadding(out, header.triangle_offset - sizeof(header));
+
+    LoDTriangleCacheStruct ctri;
+    for (int i=0; ok && i<triangles; i++) {
+        const LoDTriangle & tri = triangle[i];
+        memset(&ctri, 0, sizeof(ctri));
+        if (tri.flags & TFLAG_HAS_CHILDREN) ctri.child = tri.child;
+        ctri.error = tri.error;
+        ctri.flags = tri.flags & (TFLAG_HAS_CHILDREN | TFLAG_ALWAYS_SUBDIVIDE);
+        for (int j=0; j<3; j++) {
+            ctri.bs_center[j] = tri.bs_center[j];
+        }
+        ctri.radius = tri.radius;
+        ok = write(out, &ctri, sizeof(ctri));
+    }
+
+    ju32 pos = header.triangle_offset
+            + triangles * sizeof(LoDTriangleCacheStruct);
+    ok = ok && writePadding(out, header.corner_offset - pos)
+            && write(out, tri_vertex, triangles * 3 * sizeof(ju32));
+
+    pos = header.corner_offset + triangles * 3 * sizeof(ju32);
+    ok = ok && writePadding(out, header.normal_offset - pos);
+    float normal[3];
+    for (int i=0; ok && i<triangles; i++) {
+        for (int j=0; j<3; j++) normal[j] = tri_normal[i][j];
+        ok = write(out, normal, sizeof(normal));
+    }
+
+    pos = header.normal_offset + triangles * 3 * sizeof(float);
+    ok = ok && writePadding(out, header.vertex_offset - pos);
+
+    if (vh) {
+        ju32 array_size = vertices * sizeof(ju16);
+        ok = ok && write(out, vh, array_size)
+            && writePadding(out, align(array_size) - array_size);
+    } else {
+        const float *arrays[5] = { vx, vy, vz, tex_u, tex_v };
+        ju32 array_size = vertices * sizeof(float);
+        for (int i=0; ok && i<5; i++) {
+            ok = write(out, arrays[i], array_size)
+                && writePadding(out, align(array_size) - array_size);
+        }
+    }
+
+    ok = (fclose(out) == 0) && ok;
+    if (ok) {
+        // rename doesn't replace existing files on every platform
+        remove(cache_name);
+        ok = (rename(tmp_name.c_str(), cache_name) == 0);
+    }
+    if (ok) {
+        ls_message("LoDTerrain: Wrote quad cache %s\n", cache_name);
+    } else {
+        ls_warning("LoDTerrain: Can't write quad cache %s\n", cache_name);
+        remove(tmp_name.c_str());
+    }
+}
@@ -0,0 +1,218 @@
+#include "LoDTerrain.h"
+#include <WorkerPool.h>
+#include <vector>
+#include <algorithm>
+
+// BEGIN: LoDQuadGrid methods
+
+// Builds the mesh of one quad without touching its neighbors, see
+// LoDQuadGrid::setupQuads
+struct SetupJob : public WorkerPool::Job {
+    LoDQuad *quad;
+
+    virtual void run() {
+        quad->setup(true);
+    }
+};
+
+LoDQuadGrid::QuadWalk::QuadWalk(const LoDQuadGrid & grid,
+                                const Vector & a, const Vector & b)
+{
+    // Coordinates are in units of quads relative to the origin of the
+    // landscape
+    float gu = (a[0] - grid.origin_x) / grid.quad_dx;
+    float gv = (a[2] - grid.origin_z) / grid.quad_dz;
+    float du = (b[0] - a[0]) / grid.quad_dx;
+    float dv = (b[2] - a[2]) / grid.quad_dz;
+    u = (int) floorf(gu);
+    v = (int) floorf(gv);
+    step_u = du > 0 ? 1 : -1;
+    step_v = dv > 0 ? 1 : -1;
+    next_u = du != 0 ? (u + (du > 0) - gu) / du : 2.0f;
+    next_v = dv != 0 ? (v + (dv > 0) - gv) / dv : 2.0f;
+    delta_u = du != 0 ? step_u / du : 2.0f;
+    delta_v = dv != 0 ? step_v / dv : 2.0f;
+    t0 = 0;
+    t1 = std::min(1.0f, std::min(next_u, next_v));
+}
+
+void LoDQuadGrid::QuadWalk::next()
+{
+    if (next_u < next_v) {
+        u += step_u;
+        next_u += delta_u;
+    } else {
+        v += step_v;
+        next_v += delta_v;
+    }
+    t0 = t1;
+    t1 = std::min(1.0f, std::min(next_u, next_v));
+}
+
+LoDQuadGrid::LoDQuadGrid()
+:   quad(0), width(0), height(0), have_layout(false)
+{ }
+
+LoDQuadGrid::~LoDQuadGrid()
+{
+    delete[] quad;
+}
+
+void LoDQuadGrid::setSize(int w, int h)
+{
+    delete[] quad;
+    width = w;
+    height = h;
+    quad = new LoDQuad[width*height];
+    quad_state.assign(width*height, QUAD_UNLOADED);
+    have_layout = false;
+}
+
+void LoDQuadGrid::setLayout(int idx)
+{
+    LoDQuad & q = quad[idx];
+    // northwest point of the quad and tile width and length
+    float qx=q.vertexX(q.tri_vertex[0][2]);
+    float qz=q.vertexZ(q.tri_vertex[0][2]);
+    quad_dx=q.vertexX(q.tri_vertex[0][1]) - qx;
+    quad_dz=q.vertexZ(q.tri_vertex[0][0]) - qz;
+    origin_x = qx - (idx % width)*quad_dx;
+    origin_z = qz - (idx / width)*quad_dz;
+    have_layout = true;
+}
+
+// Only resident quads are linked as neighbors. Links are patched as quads
+// come and go; the triangle level links are rebuilt from them by connect()
+// and the splits of every frame.
+void LoDQuadGrid::getNeighbors(int idx, LoDQuad **neighbor) const
+{
+    int u = idx % width;
+    int v = idx / width;
+    neighbor[QN_NORTH] = (v>0 && quad_state[idx-width] == QUAD_RESIDENT)
+            ? &quad[idx-width] : 0;
+    neighbor[QN_SOUTH] = (v<height-1 && quad_state[idx+width] == QUAD_RESIDENT)
+            ? &quad[idx+width] : 0;
+    neighbor[QN_WEST] = (u>0 && quad_state[idx-1] == QUAD_RESIDENT)
+            ? &quad[idx-1] : 0;
+    neighbor[QN_EAST] = (u<width-1 && quad_state[idx+1] == QUAD_RESIDENT)
+            ? &quad[idx+1] : 0;
+}
+
+void LoDQuadGrid::addResident(int idx)
+{
+    LoDQuad & q = quad[idx];
+    // QN_NORTH^1 == QN_SOUTH and QN_EAST^1 == QN_WEST
+    for (int i=0; i<4; i++) {
+        if (q.neighbor[i]) q.neighbor[i]->neighbor[i^1] = &q;
+    }
+    quad_state[idx] = QUAD_RESIDENT;
+}
+
+void LoDQuadGrid::removeResident(int idx)
+{
+    LoDQuad & q = quad[idx];
+    for (int i=0; i<4; i++) {
+        if (q.neighbor[i]) q.neighbor[i]->neighbor[i^1] = 0;
+    }
+    quad_state[idx] = QUAD_UNLOADED;
+}
+
+int LoDQuadGrid::getQuadIndexAt(float x, float z) const
+{
+    if (!have_layout) return -1;
+
+    int u = (int) floorf((x - origin_x) / quad_dx);
+    int v = (int) floorf((z - origin_z) / quad_dz);
+
+    if ((u>=0)&&(u<width)&&(v>=0)&&(v<height)) {
+        return v*width + u;
+    } else return -1;
+}
+
+// Without a pool, the quads are set up one after the other, each splitting
+// its neighbors as needed. With a pool, they are set up in isolation on its
+// threads and then stitched together here, which gives the same mesh, see
+// Stitching.cc
+int LoDQuadGrid::setupQuads(WorkerPool *pool, const Vector &pos,
+                            const float planes[6][4], float focus)
+{
+    int i;
+    for (i=0; i<(width*height); i++) {
+        if (quad_state[i] != QUAD_RESIDENT) continue;
+        quad[i].presetup(pos, planes, focus);
+    }
+    if (!pool) {
+        for (i=0; i<(width*height); i++) {
+            if (quad_state[i] != QUAD_RESIDENT) continue;
+            quad[i].setup();
+        }
+        return 0;
+    }
+
+    std::vector<SetupJob> setup_jobs;
+    setup_jobs.reserve(width*height);
+    for (i=0; i<(width*height); i++) {
+        if (quad_state[i] != QUAD_RESIDENT) continue;
+        SetupJob job;
+        job.quad = &quad[i];
+        setup_jobs.push_back(job);
+    }
+    for (i=0; i<(int)setup_jobs.size(); i++) pool->add(&setup_jobs[i]);
+    pool->wait();
+
+    // Stitching a border may split triangles along the other borders of
+    // the quads, so repeat until the borders match. This ends, since
+    // stitching only ever splits, and every pass but the last splits at
+    // least one of the finitely many triangles of the trees.
+    int splits, total_splits = 0;
+    do {
+        splits = 0;
+        for (i=0; i<(width*height); i++) {
+            if (quad_state[i] != QUAD_RESIDENT) continue;
+            splits += quad[i].stitch(QN_EAST);
+            splits += quad[i].stitch(QN_SOUTH);
+        }
+        total_splits += splits;
+    } while (splits > 0);
+    return total_splits;
+}
+
+float LoDQuadGrid::getHeightAt(float x, float z, Vector *out_normal)
+{
+    int idx = getQuadIndexAt(x, z);
+    if (idx >= 0 && quad_state[idx] == QUAD_RESIDENT) {
+        return quad[idx].getHeightAt(x, z, out_normal);
+    } else {
+        if (out_normal) *out_normal = Vector(0,1,0);
+        return 0.0;
+    }
+}
+
+// castRay tests whether an object going from a to b hits the terrain and
+// returns the point where this happens
+bool LoDQuadGrid::castRay(const Vector & a, const Vector & b,
+                          Vector * cx, Vector *out_normal)
+{
+    float t;
+    if (LoDQuadGrid::getHeightAt(a[0], a[2], out_normal) >= a[1]) {
+        *cx = a;
+        return true;
+    }
+
+    if (!have_layout) return false;
+
+    // Walk the quads along the line in order
+    for (QuadWalk walk(*this, a, b); !walk.done(); walk.next()) {
+        if ((walk.u<0)||(walk.u>=width)||(walk.v<0)||(walk.v>=height)) {
+            continue;
+        }
+        int idx = walk.v*width + walk.u;
+        if (quad_state[idx] != QUAD_RESIDENT) continue;
+        if (quad[idx].castRay(a, b, walk.t0, walk.t1, &t, out_normal)) {
+            *cx = a + (b-a)*t;
+            return true;
+        }
+    }
+
+    return false;
+}
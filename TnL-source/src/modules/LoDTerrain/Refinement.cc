@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <functional>
+#include <DataNode.h>
+#include "LoDTerrain.h"
+#include "Config.h"
+
+/*
+Incremental refinement, in the style of ROAM's split and merge queues.
+
+Instead of rebuilding the mesh from the two root triangles every frame, the
+mesh of the last frame is kept. Every frame the screen errors of the
+triangles in the mesh are evaluated again, and
+    - the leaves whose error exceeds MAX_ERROR go into the split queue,
+    - the split triangles whose children are leaves go into the merge
+      queue, keyed on their own error.
+The manager then merges the least important diamonds and splits the most
+important leaves until the queues are done or the triangle or time budget
+is used up. A sudden camera move is caught up with over several frames
+instead of stalling one.
+
+A merge undoes a split: a triangle and its bottom neighbor, whose
+children must all be leaves, become leaves again.
+*/
+
+#define LEFT 0
+#define RIGHT 1
+#define BOTTOM 2
+
+void LoDQuad::beginRefinement(const Vector &pos, const float planes[6][4],
+                              float focus)
+{
+    evaluator = Evaluator(this, pos, planes, focus);
+}
+
+// Evaluates the mesh and queues its split and merge candidates. Returns the
+// number of triangles in the mesh.
+int LoDQuad::collectQueues(std::vector<LoDQueueEntry> & splits,
+                           std::vector<LoDQueueEntry> & merges)
+{
+    return queueRecursive(0, Evaluator::PARTIAL, splits, merges)
+            + queueRecursive(1, Evaluator::PARTIAL, splits, merges);
+}
+
+int LoDQuad::queueRecursive(ju32 t, Evaluator::FrustumView view,
+                            std::vector<LoDQueueEntry> & splits,
+                            std::vector<LoDQueueEntry> & merges)
+{
+    LoDTriangle *tri = &triangle[t];
+    if (view == Evaluator::PARTIAL) view = evaluator.checkAgainstFrustum(tri);
+    // Parts of the mesh outside the frustum are merged first and never split
+    tri->dyn_error = (view == Evaluator::OUTSIDE) ? 0 : evaluator.evaluate(tri);
+
+    if (tri->flags & TFLAG_ENABLED) {
+        if ((tri->flags & TFLAG_HAS_CHILDREN) && tri->dyn_error > MAX_ERROR) {
+            splits.push_back(LoDQueueEntry(tri->dyn_error, this, t));
+        }
+        return 1;
+    }
+
+    int n = queueRecursive(tri->child, view, splits, merges)
+          + queueRecursive(tri->child+1, view, splits, merges);
+    if (triangle[tri->child].flags & triangle[tri->child+1].flags
+            & TFLAG_ENABLED)
+    {
+        merges.push_back(LoDQueueEntry(tri->dyn_error, this, t));
+    }
+    return n;
+}
+
+// Queue entries go stale when the mesh changes around them. A triangle that
+// was a leaf stays enabled when its parent is merged, so a leaf of the mesh
+// is an enabled triangle whose parent is split.
+bool LoDQuad::isMeshLeaf(ju32 t)
+{
+    return (triangle[t].flags & TFLAG_ENABLED)
+            && (t < 2 || !(triangle[tri_parent[t]].flags & TFLAG_ENABLED));
+}
+
+// Tests whether the triangle is split into two leaves
+bool LoDQuad::canMerge2(ju32 t)
+{
+    const LoDTriangle *tri = &triangle[t];
+    return (tri->flags & TFLAG_HAS_CHILDREN)
+            && !(tri->flags & TFLAG_ENABLED)
+            && (triangle[tri->child].flags & triangle[tri->child+1].flags
+                & TFLAG_ENABLED);
+}
+
+// Tests whether the diamond of the triangle and its bottom neighbor can be
+// merged
+bool LoDQuad::isMergeable(ju32 t)
+{
+    if (!canMerge2(t)) return false;
+    ju32 b;
+    LoDQuad *bq = resolve(tri_neighbor[t][BOTTOM], &b);
+    if (!bq) return true;
+    return bq->tri_neighbor[b][BOTTOM] == bq->refTo(this, t)
+            && bq->canMerge2(b);
+}
+
+// Merges a diamond. Returns the number of triangles removed from the mesh.
+int LoDQuad::merge(ju32 t)
+{
+    ju32 b;
+    LoDQuad *bq = resolve(tri_neighbor[t][BOTTOM], &b);
+    merge2(t);
+    if (!bq) return 1;
+    bq->merge2(b);
+    return 2;
+}
+
+// Makes a triangle a leaf again. Its children keep their enabled flag, see
+// isMeshLeaf.
+void LoDQuad::merge2(ju32 t)
+{
+    LoDTriangle *tri = &triangle[t];
+    ju32 c = tri->child;
+    ju32 *nb = tri_neighbor[t];
+
+    // The outer neighbors of the children may have changed since the split
+    nb[LEFT] = tri_neighbor[c+LEFT][BOTTOM];
+    nb[RIGHT] = tri_neighbor[c+RIGHT][BOTTOM];
+    replaceNeighbor(nb[LEFT], c+LEFT, t);
+    replaceNeighbor(nb[RIGHT], c+RIGHT, t);
+
+    tri->flags |= TFLAG_ENABLED;
+}
+
+// Sets up the flags and morph values of the mesh for drawing, like
+// setupRecursive but without changing the mesh
+void LoDQuad::refresh()
+{
+    tri_morph[0] = tri_morph[1] = 1.0;
+    refreshRecursive(0, true);
+    refreshRecursive(1, true);
+}
+
+void LoDQuad::refreshRecursive(ju32 t, bool partially_obscured)
+{
+    LoDTriangle *tri = &triangle[t];
+    tri->flags &= ~(TFLAG_DETAIL_TEX | TFLAG_DEBUG | TFLAG_DONT_DRAW);
+
+    if (tri->flags & TFLAG_ENABLED) {
+        if (partially_obscured &&
+            evaluator.checkAgainstFrustum(tri) == Evaluator::OUTSIDE)
+        {
+            tri->flags |= TFLAG_DONT_DRAW;
+            return;
+        }
+        // See setupRecursive
+        const ju32 *vertex = tri_vertex[t];
+        if (vertexY(vertex[0]) < 0 && vertexY(vertex[1]) < 0 && vertexY(vertex[2]) < 0) {
+            tri->flags |= TFLAG_DONT_DRAW;
+        }
+        return;
+    }
+
+    // Keep the morph value uniform in all four triangles of the diamond,
+    // see split
+    ju32 c = tri->child;
+    float morph = calcMorph(t);
+    ju32 b;
+    LoDQuad *bq = resolve(tri_neighbor[t][BOTTOM], &b);
+    if (bq && !(bq->triangle[b].flags & TFLAG_ENABLED)) {
+        morph = std::max(morph, bq->calcMorph(b));
+    }
+    tri_morph[c] = tri_morph[c+1] = morph;
+
+    if (partially_obscured) {
+        partially_obscured = evaluator.checkAgainstFrustum(tri)
+                != Evaluator::INSIDE;
+    }
+    refreshRecursive(c, partially_obscured);
+    refreshRecursive(c+1, partially_obscured);
+
+    // if both child triangles are invisible then also dont draw this one
+    tri->flags |= TFLAG_DONT_DRAW
+            & triangle[c].flags & triangle[c+1].flags;
+}
+
+
+void LoDQuadManager::refine(const Vector &pos, const float planes[6][4],
+                            float focus)
+{
+    Uint32 t_start = SDL_GetTicks();
+    int i;
+
+    split_queue.clear();
+    merge_queue.clear();
+    int mesh_triangles = 0;
+    for (i=0; i<(width*height); i++) {
+        if (quad_state[i] != QUAD_RESIDENT) continue;
+        quad[i].beginRefinement(pos, planes, focus);
+        mesh_triangles += quad[i].collectQueues(split_queue, merge_queue);
+    }
+
+    // Merge first, so that the budget is freed for the splits. Diamonds
+    // below the error threshold are always merged, the least important
+    // others only while the mesh is over budget.
+    int merges = 0;
+    std::greater<LoDQueueEntry> lowest_first;
+    std::make_heap(merge_queue.begin(), merge_queue.end(), lowest_first);
+    while (!merge_queue.empty()
+           && SDL_GetTicks() - t_start < lod_time_budget)
+    {
+        LoDQueueEntry e = merge_queue.front();
+        if (e.priority > MAX_ERROR && mesh_triangles <= lod_triangle_budget) {
+            break;
+        }
+        std::pop_heap(merge_queue.begin(), merge_queue.end(), lowest_first);
+        merge_queue.pop_back();
+        if (!e.quad->isMergeable(e.tri)) continue;
+
+        mesh_triangles -= e.quad->merge(e.tri);
+        merges++;
+
+        // That may have made the parent mergeable
+        if (e.tri >= 2) {
+            ju32 p = e.quad->tri_parent[e.tri];
+            if (e.quad->isMergeable(p)) {
+                merge_queue.push_back(LoDQueueEntry(
+                        e.quad->triangle[p].dyn_error, e.quad, p));
+                std::push_heap(merge_queue.begin(), merge_queue.end(),
+                        lowest_first);
+            }
+        }
+    }
+
+    int splits = 0;
+    std::make_heap(split_queue.begin(), split_queue.end());
+    while (!split_queue.empty()
+           && mesh_triangles < lod_triangle_budget
+           && SDL_GetTicks() - t_start < lod_time_budget)
+    {
+        LoDQueueEntry e = split_queue.front();
+        std::pop_heap(split_queue.begin(), split_queue.end());
+        split_queue.pop_back();
+        if (!e.quad->isMeshLeaf(e.tri)) continue;
+
+        mesh_triangles += e.quad->split(e.tri);
+        splits++;
+
+        // split has evaluated the children. The children of triangles that
+        // were split to form a diamond are queued in the next frame.
+        ju32 c = e.quad->triangle[e.tri].child;
+        for (ju32 j=c; j<c+2; j++) {
+            const LoDTriangle & child = e.quad->triangle[j];
+            if ((child.flags & TFLAG_HAS_CHILDREN)
+                && child.dyn_error > MAX_ERROR)
+            {
+                split_queue.push_back(LoDQueueEntry(
+                        child.dyn_error, e.quad, j));
+                std::push_heap(split_queue.begin(), split_queue.end());
+            }
+        }
+    }
+
+    for (i=0; i<(width*height); i++) {
+        if (quad_state[i] != QUAD_RESIDENT) continue;
+        quad[i].refresh();
+    }
+
+    game->getDebugData()->setInt("terrain_lod_splits", splits);
+    game->getDebugData()->setInt("terrain_lod_merges", merges);
+    game->getDebugData()->setInt("terrain_mesh_triangles", mesh_triangles);
+}
@@ -0,0 +1,85 @@
+#include "LoDTerrain.h"
+#include "Config.h"
+
+/*
+Stitching the meshes of isolated quads.
+
+setup splits triangles of the neighbor quads to keep the mesh free of
+cracks, which ties the quads together. An isolated setup treats the other
+quads as missing instead, so all quads can be set up at the same time, but
+leaves their borders unmatched: a triangle may be split on one side of a
+border and not on the other, and the links across the border are stale.
+
+stitch walks the triangles along a border from the root triangles down,
+on both sides at once. Wherever one side is split finer than the other, the
+coarser triangle is split as well, and every pair of triangles sharing an
+edge is linked to each other. Those splits are again isolated, so they may
+leave cracks along the other borders of the quad, which is why the borders
+are stitched until no more splits happen. The links of the last pass are
+those of a mesh without cracks.
+
+The result only depends on the order in which the borders are stitched,
+not on the order in which the quads were set up.
+*/
+
+#define LEFT 0
+#define RIGHT 1
+#define BOTTOM 2
+
+int LoDQuad::stitch(int side)
+{
+    LoDQuad *q = neighbor[side];
+    if (!q) return 0;
+    // The roots meet their neighbors with their legs, see connect
+    if (side == QN_EAST) {
+        return stitchEdge(1, LEFT, q, 0, LEFT);
+    } else {
+        return stitchEdge(1, RIGHT, q, 0, RIGHT);
+    }
+}
+
+// Stitches the edge that side sx of triangle x shares with side sy of
+// triangle y of q. Returns the number of splits.
+int LoDQuad::stitchEdge(ju32 x, int sx, LoDQuad *q, ju32 y, int sy)
+{
+    // A split triangle hands its legs to its children, as their bottom
+    // sides. Move down to the triangles that hold the whole edge.
+    while (!(triangle[x].flags & TFLAG_ENABLED) && sx != BOTTOM) {
+        x = triangle[x].child + sx;
+        sx = BOTTOM;
+    }
+    while (!(q->triangle[y].flags & TFLAG_ENABLED) && sy != BOTTOM) {
+        y = q->triangle[y].child + sy;
+        sy = BOTTOM;
+    }
+    bool x_split = !(triangle[x].flags & TFLAG_ENABLED);
+    bool y_split = !(q->triangle[y].flags & TFLAG_ENABLED);
+
+    if (x_split && y_split) {
+        // A diamond across the border. Give it a uniform morph value, see
+        // split, and stitch the halves of the edge.
+        tri_neighbor[x][BOTTOM] = refTo(q, y);
+        q->tri_neighbor[y][BOTTOM] = q->refTo(this, x);
+        ju32 c = triangle[x].child;
+        ju32 bc = q->triangle[y].child;
+        float morph = std::max(tri_morph[c], q->tri_morph[bc]);
+        tri_morph[c] = tri_morph[c+1] = morph;
+        q->tri_morph[bc] = q->tri_morph[bc+1] = morph;
+        return stitchEdge(c+LEFT, RIGHT, q, bc+RIGHT, LEFT)
+             + stitchEdge(c+RIGHT, LEFT, q, bc+LEFT, RIGHT);
+    }
+
+    // Split the coarser side to match the finer one, unless the tree ends
+    LoDQuad *coarse = x_split ? q : y_split ? this : 0;
+    ju32 t = x_split ? y : x;
+    if (coarse && (coarse->triangle[t].flags & TFLAG_HAS_CHILDREN)) {
+        coarse->isolated = true;
+        int splits = coarse->split(t);
+        coarse->isolated = false;
+        return splits + stitchEdge(x, sx, q, y, sy);
+    }
+
+    tri_neighbor[x][sx] = refTo(q, y);
+    q->tri_neighbor[y][sy] = q->refTo(this, x);
+    return 0;
+}
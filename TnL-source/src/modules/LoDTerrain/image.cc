@@ -159,7 +159,7 @@ Image::Image(const char *filename)
     header.image_bpp = BYTE;
     header.descriptor = BYTE;
     
-    printf("idlength=%d ct=%d it=%d cmo=%d cml=%d cme=%d xo=%d yo=%d w=%d h=%d bpp=%d des=%d\n",
+    ls_message("idlength=%d ct=%d it=%d cmo=%d cml=%d cme=%d xo=%d yo=%d w=%d h=%d bpp=%d des=%d\n",
         (int)header.idlength, (int)header.cmap_type, (int)header.image_type, (int)header.cmap_origin,
         (int)header.cmap_length,
         (int)header.cmap_entry_size, (int)header.image_x_origin, (int)header.image_y_origin,
@@ -195,7 +195,7 @@ Image::Image(const char *filename)
                 palette[i] = 0xff000000 | RGB3;
             }
         } else {
-            printf("Unsupported color map format: %d\n", header.cmap_entry_size);
+            ls_warning("Unsupported color map format: %d\n", header.cmap_entry_size);
         }
     }
 
@@ -15,6 +15,7 @@ RigidActor::RigidActor(Ptr<IGame> game, Ptr<BoundingGeometry> bgeom)
 	rigid_engine = new RigidEngine(game);
 	setRigidBody(&*rigid_engine);
 	setActor(this);
+	setSleepAllowed(true);
 	game->getCollisionMan()->add(this);
 	setEngine(rigid_engine);
 	rigid_engine->setLinearMomentum(Vector(0,0,0));
@@ -38,3 +39,8 @@ void RigidActor::update(float delta_t, const Transform * new_transforms) {
 	rigid_engine->update(delta_t, new_transforms);
 }
 
+bool RigidActor::isDisturbed(float max_acceleration,
+                             float max_angular_acceleration)
+{
+	return rigid_engine->isDisturbed(max_acceleration, max_angular_acceleration);
+}
@@ -22,6 +22,8 @@ public:
     
     virtual void integrate(float delta_t, Transform * transforms);
     virtual void update(float delta_t, const Transform * new_transforms);
+    virtual bool isDisturbed(float max_acceleration,
+                             float max_angular_acceleration);
 };
 
 
@@ -169,6 +169,7 @@ void Drone::init() {
     setBoundingGeometry(bounds);
     setRigidBody(&*engine);
     setActor(this);
+    setSleepAllowed(true);
     
     // Tail hook
     hook = new Effectors::TailHook(
@@ -501,6 +502,12 @@ void Drone::update(float delta_t, const Transform * new_transforms) {
     skeleton->setBoneTransform("Body",new_transforms[0]);
 }
 
+bool Drone::isDisturbed(float max_acceleration,
+                        float max_angular_acceleration)
+{
+    return engine->isDisturbed(max_acceleration, max_angular_acceleration);
+}
+
 void Drone::collide(const Collide::Contact & c) {
     Ptr<Collidable> partner = c.collidables[1];
     
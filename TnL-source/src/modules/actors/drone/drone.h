@@ -51,6 +51,8 @@ public:
     virtual void integrate(float delta_t, Transform * transforms);
     virtual void update(float delta_t, const Transform * new_transforms);
     virtual void collide(const Collide::Contact & c);
+    virtual bool isDisturbed(float max_acceleration,
+                             float max_angular_acceleration);
     
     virtual int getNumViews();
     virtual Ptr<IView> getView(int n);
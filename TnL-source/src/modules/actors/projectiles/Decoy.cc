@@ -28,6 +28,7 @@ Decoy::Decoy(Ptr<IGame> thegame, Ptr<IActor>, Ptr<IActor> source)
     setBoundingGeometry(new Collide::BoundingGeometry(1,1));
     getBoundingGeometry()->setBoundingRadius(0.1f);
     setRigidBody(&*engine);
+    setTerrainTest(true);
     setActor(this);
 }
 
@@ -102,7 +103,8 @@ void Decoy::integrate(float delta_t, Transform * transforms) {
 }
 
 void Decoy::update(float delta_t, const Transform * new_transforms) {
-    // And a cheap-ass terrain collision test
+    // And a cheap-ass terrain collision test. The collision manager has
+    // already tested the path to new_transforms against the terrain.
     Vector p_old = getLocation();
     Vector p = new_transforms[0].vec();
 
@@ -111,7 +113,7 @@ void Decoy::update(float delta_t, const Transform * new_transforms) {
         setLocation(p);
         die();
         return;
-    } else if (thegame->getTerrain()->lineCollides(p_old, p, &p)) {
+    } else if (hitTerrain(&p)) {
         setLocation(p);
         die();
         return;
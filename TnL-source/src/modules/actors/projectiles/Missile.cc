@@ -54,6 +54,7 @@ Missile::Missile(Ptr<IGame> thegame, Ptr<IActor> source, const char *cfg_prefix)
     setBoundingGeometry(new Collide::BoundingGeometry(1,1));
     getBoundingGeometry()->setBoundingRadius(1.0f);
     setRigidBody(ptr(engine));
+    setTerrainTest(true);
     setActor(this);
     
     engine_sound_src = thegame->getSoundMan()->requestSource();
@@ -168,7 +169,8 @@ void Missile::integrate(float delta_t, Transform * transforms) {
 }
 
 void Missile::update(float delta_t, const Transform * new_transforms) {
-    // And a cheap-ass terrain collision test
+    // And a cheap-ass terrain collision test. The collision manager has
+    // already tested the path to new_transforms against the terrain.
     Vector p_old = getLocation();
     Vector p = new_transforms[0].vec();
 
@@ -178,7 +180,7 @@ void Missile::update(float delta_t, const Transform * new_transforms) {
         setLocation(p);
         explode();
         return;
-    } else if (terrain->lineCollides(p_old, p, &p)) {
+    } else if (hitTerrain(&p)) {
         ls_message("Missile: killed by collision with ground.\n");
         setLocation(p);
         explode();
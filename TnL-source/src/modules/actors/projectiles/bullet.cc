@@ -39,6 +39,8 @@ Bullet::Bullet(IGame *thegame, Ptr<IActor> source, float factor)
     setBoundingGeometry(new Collide::BoundingGeometry(1,1));
     getBoundingGeometry()->setBoundingRadius(0.01f);
     setRigidBody(&*engine);
+    setTerrainTest(true);
+    setSweptPoint(true);
 #ifdef HAVE_IO
     setActor(this);
 #endif    
@@ -110,7 +112,8 @@ void Bullet::integrate(float delta_t, Transform * transforms) {
 }
 
 void Bullet::update(float delta_t, const Transform * new_transforms) {
-    // And a cheap-ass terrain collision test
+    // And a cheap-ass terrain collision test. The collision manager has
+    // already tested the path to new_transforms against the terrain.
     Vector p_old = getLocation();
     Vector p = new_transforms[0].vec();
 
@@ -119,7 +122,7 @@ void Bullet::update(float delta_t, const Transform * new_transforms) {
         setLocation(p);
         explode();
         return;
-    } else if (terrain->lineCollides(p_old, p, &p)) {
+    } else if (hitTerrain(&p)) {
         setLocation(p);
         explode();
         return;
@@ -1,4 +1,7 @@
+#include <cstring>
 #include <vector>
+#include <MappedFile.h>
+#include <debug.h>
 #include "BoundingGeometry.h"
 
 #define expect(in, what) {                                  \
@@ -14,8 +17,248 @@
 //#define check(in) if (!in) std::cerr << "Bad stream at " << __LINE__ << std::endl;
 
 
+/*
+The bounding geometry cache holds the domain names, the transform parents
+and the node block of a geometry, see BoundingNode. It is written next to
+the text file on first load and mapped read-only afterwards, so the
+hierarchy is used in place and shared between processes. The source
+file's size and modification time are recorded to detect stale caches.
+*/
+
+#define BOUNDS_CACHE_MAGIC      "TLBG"
+#define BOUNDS_CACHE_VERSION    1
+#define BOUNDS_CACHE_BYTE_ORDER 0x01020304
+#define BOUNDS_CACHE_ALIGN      16
+
+typedef struct {
+    char magic[4];
+    int version;
+    int byte_order;         /* Detects caches written on other platforms  */
+    int node_size;          /* sizeof(BoundingNode), detects other layouts */
+    int source_size;        /* Size of the file the cache was made of      */
+    int source_mtime;       /* Modification time of that file              */
+    float bounding_radius;
+    int domains;
+    int transforms;
+    int name_offset;        /* Byte offset of the domain names, each one   */
+    int name_size;          /* terminated by a 0                           */
+    int parent_offset;      /* Byte offset of the transform parents        */
+    int node_offset;        /* Byte offset of the node block               */
+    int node_size_total;    /* Size of the node block                      */
+    int file_size;          /* Expected size of the whole cache file       */
+} BoundsCacheHeader;
+
+namespace {
+    inline int align(int offset) {
+        return (offset + BOUNDS_CACHE_ALIGN - 1) & ~(BOUNDS_CACHE_ALIGN - 1);
+    }
+
+    inline void calcLayout(BoundsCacheHeader & header) {
+        header.name_offset = align(sizeof(BoundsCacheHeader));
+        header.parent_offset = align(header.name_offset + header.name_size);
+        header.node_offset = align(header.parent_offset
+                + header.transforms * sizeof(int));
+        header.file_size = header.node_offset + header.node_size_total;
+    }
+
+    inline bool write(FILE *out, const void *data, size_t size) {
+        return size == 0 || fwrite(data, size, 1, out) == 1;
+    }
+
+    inline bool writePadding(FILE *out, size_t size) {
+        static const char zeros[BOUNDS_CACHE_ALIGN] = {0};
+        return write(out, zeros, size);
+    }
+}
+
 namespace Collide {
 
+BoundingGeometry::BoundingGeometry()
+:   bounding_radius(0), cache_file(0)
+{
+    clearNodes();
+}
+
+BoundingGeometry::BoundingGeometry(int d, int p)
+:   bounding_radius(0), cache_file(0)
+{
+    clearNodes();
+    while(d--) domains.push_back("default");
+    while(p--) transform_parents.push_back(0);
+}
+
+BoundingGeometry::~BoundingGeometry() {
+    delete cache_file;
+}
+
+// Leaves just an empty root node
+void BoundingGeometry::clearNodes() {
+    delete cache_file;
+    cache_file = 0;
+    nodes.assign(sizeof(BoundingNode), 0);
+    BoundingNode *none = (BoundingNode *) &nodes[0];
+    none->type = BoundingNode::NONE;
+    none->size = sizeof(BoundingNode);
+    root = none;
+}
+
+bool BoundingGeometry::loadCache(const char *cache_name,
+                                 const char *source_name)
+{
+    size_t source_size;
+    time_t source_mtime;
+    if (!MappedFile::getFileInfo(source_name, &source_size, &source_mtime)) {
+        return false;
+    }
+
+    MappedFile *file = new MappedFile;
+    if (!file->open(cache_name)) {
+        delete file;
+        return false;
+    }
+
+    const char *data = file->getData();
+    BoundsCacheHeader header;
+    if (file->getSize() < sizeof(BoundsCacheHeader)) {
+        ls_warning("BoundingGeometry: Ignoring truncated cache %s\n",
+                cache_name);
+        delete file;
+        return false;
+    }
+    memcpy(&header, data, sizeof(BoundsCacheHeader));
+
+    if (0 != memcmp(header.magic, BOUNDS_CACHE_MAGIC, 4)
+        || header.version != BOUNDS_CACHE_VERSION
+        || header.byte_order != BOUNDS_CACHE_BYTE_ORDER
+        || header.node_size != (int) sizeof(BoundingNode)
+        || header.source_size != (int) source_size
+        || header.source_mtime != (int) source_mtime)
+    {
+        ls_message("BoundingGeometry: Cache %s is out of date\n", cache_name);
+        delete file;
+        return false;
+    }
+
+    BoundsCacheHeader expected = header;
+    bool ok = header.domains >= 0 && header.transforms >= 0
+        && header.name_size >= 0 && header.node_size_total > 0
+        && header.name_size <= (int) file->getSize()
+        && header.transforms <= (int) file->getSize()
+        && header.node_size_total <= (int) file->getSize();
+    if (ok) {
+        calcLayout(expected);
+        ok = header.name_offset == expected.name_offset
+            && header.parent_offset == expected.parent_offset
+            && header.node_offset == expected.node_offset
+            && header.file_size == expected.file_size
+            && file->getSize() >= (size_t) header.file_size;
+    }
+
+    // Each domain name ends with a 0 within the names
+    std::vector<std::string> new_domains;
+    const char *name = data + header.name_offset;
+    const char *names_end = name + header.name_size;
+    for (int i=0; ok && i<header.domains; i++) {
+        const char *name_end = (const char *) memchr(name, 0, names_end - name);
+        if (!name_end) {
+            ok = false;
+            break;
+        }
+        new_domains.push_back(std::string(name, name_end));
+        name = name_end + 1;
+    }
+
+    const BoundingNode *new_root = (const BoundingNode *) (data + header.node_offset);
+    ok = ok && isValidBoundingNode(new_root,
+            data + header.node_offset + header.node_size_total,
+            header.domains, header.transforms)
+        && new_root->size == header.node_size_total;
+    if (!ok) {
+        ls_warning("BoundingGeometry: Ignoring damaged cache %s\n",
+                cache_name);
+        delete file;
+        return false;
+    }
+
+    const int *parents = (const int *) (data + header.parent_offset);
+    bounding_radius = header.bounding_radius;
+    domains.swap(new_domains);
+    transform_parents.assign(parents, parents + header.transforms);
+
+    // The hierarchy is used right where it is mapped
+    delete cache_file;
+    cache_file = file;
+    nodes.clear();
+    root = new_root;
+    return true;
+}
+
+bool BoundingGeometry::saveCache(const char *cache_name,
+                                 const char *source_name) const
+{
+    size_t source_size;
+    time_t source_mtime;
+    if (!MappedFile::getFileInfo(source_name, &source_size, &source_mtime)) {
+        return false;
+    }
+
+    std::string names;
+    for (size_t i=0; i<domains.size(); i++) {
+        names += domains[i];
+        names += '\0';
+    }
+
+    BoundsCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BOUNDS_CACHE_MAGIC, 4);
+    header.version = BOUNDS_CACHE_VERSION;
+    header.byte_order = BOUNDS_CACHE_BYTE_ORDER;
+    header.node_size = sizeof(BoundingNode);
+    header.source_size = source_size;
+    header.source_mtime = source_mtime;
+    header.bounding_radius = bounding_radius;
+    header.domains = domains.size();
+    header.transforms = transform_parents.size();
+    header.name_size = names.size();
+    header.node_size_total = root->size;
+    calcLayout(header);
+
+    // Write to a temporary file first, so that a crash or a concurrently
+    // starting game never sees a half-written cache.
+    std::string tmp_name = std::string(cache_name) + ".tmp";
+    FILE *out = fopen(tmp_name.c_str(), "wb");
+    if (!out) {
+        ls_warning("BoundingGeometry: Can't write cache %s\n", cache_name);
+        return false;
+    }
+
+    int parents_size = header.transforms * sizeof(int);
+    bool ok = write(out, &header, sizeof(header))
+        && writePadding(out, header.name_offset - sizeof(header))
+        && write(out, names.data(), names.size())
+        && writePadding(out, header.parent_offset
+            - header.name_offset - header.name_size)
+        && (parents_size == 0
+            || write(out, &transform_parents[0], parents_size))
+        && writePadding(out, header.node_offset
+            - header.parent_offset - parents_size)
+        && write(out, root, root->size);
+
+    ok = (fclose(out) == 0) && ok;
+    if (ok) {
+        // rename doesn't replace existing files on every platform
+        remove(cache_name);
+        ok = (rename(tmp_name.c_str(), cache_name) == 0);
+    }
+    if (ok) {
+        ls_message("BoundingGeometry: Wrote cache %s\n", cache_name);
+    } else {
+        ls_warning("BoundingGeometry: Can't write cache %s\n", cache_name);
+        remove(tmp_name.c_str());
+    }
+    return ok;
+}
+
 std::ostream & operator<< (std::ostream & out, const BoundingGeometry & bg) {
     out << "Geometry( " << bg.bounding_radius << std::endl;
     out << "(" << std::endl;
@@ -29,7 +272,7 @@ std::ostream & operator<< (std::ostream & out, const BoundingGeometry & bg) {
         out << bg.transform_parents[i] << " ";
     out << ")" << std::endl;
 
-    out << bg.root << std::endl;
+    out << *bg.root << std::endl;
     out << ")";
 
     return out;
@@ -59,8 +302,12 @@ std::istream & operator>> (std::istream & in, BoundingGeometry & bg) {
         bg.transform_parents.push_back(atoi(s.c_str()));
     }
 
-    in >> bg.root;
+    std::vector<char> nodes;
+    readBoundingNode(in, nodes);
     expect(in, ")");
+    bg.clearNodes();
+    bg.nodes.swap(nodes);
+    bg.root = (const BoundingNode *) &bg.nodes[0];
 
     check(in);
     return in;
@@ -1,28 +1,36 @@
 #ifndef COLLIDE_BOUNDINGGEOMETRY_H
 #define COLLIDE_BOUNDINGGEOMETRY_H
 
+#include <string>
+#include <vector>
 #include <modules/math/Vector.h>
 #include "BoundingNode.h"
 
+class MappedFile;
+
 namespace Collide {
 
 class  BoundingGeometry : virtual public Object {
     float bounding_radius;
-    BoundingNode root;
+    std::vector<char> nodes;    // The hierarchy, unless it is mapped
+    MappedFile *cache_file;     // The cache the hierarchy is mapped from
+    const BoundingNode *root;
     std::vector<std::string> domains;
     std::vector<int> transform_parents;
-public:
-    inline BoundingGeometry() : bounding_radius(0)
-    { }
 
-    inline BoundingGeometry(int d, int p) {
-        while(d--) domains.push_back("default");
-        while(p--) transform_parents.push_back(0);
-    }
+    void clearNodes();
+
+    // The root points into nodes or the cache file
+    BoundingGeometry(const BoundingGeometry &);
+    BoundingGeometry & operator= (const BoundingGeometry &);
+public:
+    BoundingGeometry();
+    BoundingGeometry(int d, int p);
+    ~BoundingGeometry();
 
     inline float getBoundingRadius() const { return bounding_radius; }
     inline void setBoundingRadius(float r) { bounding_radius = r; }
-    inline const BoundingNode * getRootNode() const { return &root; }
+    inline const BoundingNode * getRootNode() const { return root; }
 
     inline int getNumOfDomains() const { return domains.size(); }
     inline const std::string & getDomainName(int i) const { return domains[i]; }
@@ -35,6 +43,18 @@ public:
     inline int getNumOfTransforms() const { return transform_parents.size(); }
     inline int getParentOfTransform(int i) const { return transform_parents[i]; }
 
+    /// The binary cache of a bounding geometry file is kept next to it
+    static inline std::string getCacheName(const std::string & source_name) {
+        return source_name + ".cache";
+    }
+
+    /// Maps the geometry from a cache written by saveCache. Fails if the
+    /// cache is missing, damaged or older than the source file it was made
+    /// of, leaving the geometry as it was.
+    bool loadCache(const char *cache_name, const char *source_name);
+    /// Writes the geometry to a cache for the source file it was read from
+    bool saveCache(const char *cache_name, const char *source_name) const;
+
     friend std::ostream & operator<< (std::ostream & out, const BoundingGeometry & bg);
     friend std::istream & operator>> (std::istream & in, BoundingGeometry & bg);
 };
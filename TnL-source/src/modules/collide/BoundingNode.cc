@@ -1,3 +1,5 @@
+#include <cstring>
+#include <cstddef>
 #include "BoundingNode.h"
 
 #define expect(in, what) {                                  \
@@ -15,28 +17,35 @@
 
 namespace Collide {
 
-void BoundingNode::cleanup() {
-    switch(type) {
-    case BoundingNode::NONE: break;
-    case BoundingNode::LEAF:
-        delete [] data.leaf.vertices;
-        break;
-    case BoundingNode::INNER:
-        delete data.inner.children[0];
-        delete data.inner.children[1];
-        break;
-    case BoundingNode::NEWDOMAIN:
-        delete data.domain.child;
-        break;
-    case BoundingNode::TRANSFORM:
-        delete data.transform.child;
-        break;
-    case BoundingNode::GATE:
-        delete [] data.gate.children;
-    }
-    type = BoundingNode::NONE;
+namespace {
+inline BoundingNode & nodeAt(std::vector<char> & block, size_t offset) {
+    return *(BoundingNode *) &block[offset];
 }
 
+// Appends a node without children and returns its offset in block
+size_t appendNode(std::vector<char> & block, int type) {
+    size_t offset = block.size();
+    block.resize(offset + sizeof(BoundingNode), 0);
+    BoundingNode & node = nodeAt(block, offset);
+    node.type = type;
+    node.size = sizeof(BoundingNode);
+    return offset;
+}
+
+// Whether n subtrees follow node and fill it exactly
+bool hasValidChildren(const BoundingNode * node, int n,
+                      int n_domains, int n_transforms)
+{
+    const char *end = (const char *) node + node->size;
+    const BoundingNode *child = node->child();
+    for (int i=0; i<n; i++) {
+        if (!isValidBoundingNode(child, end, n_domains, n_transforms))
+            return false;
+        child = child->next();
+    }
+    return (const char *) child == end;
+}
+}
 
 std::ostream & operator<< (std::ostream & out, const BoundingNode & bn) {
     switch(bn.type) {
@@ -58,28 +67,28 @@ std::ostream & operator<< (std::ostream & out, const BoundingNode & bn) {
         out << "L ";
         out << bn.data.leaf.n_triangles << " ";
         for(int i=0; i<bn.data.leaf.n_triangles * 3; i++) {
-            out << bn.data.leaf.vertices[i];
+            out << bn.vertices()[i];
             if(i % 3 == 0) out << std::endl;
             else out << " ";
         }
         break;
     case BoundingNode::INNER:
         out << "I" << std::endl;
-        out << *bn.data.inner.children[0] << std:: endl;
-        out << *bn.data.inner.children[1] << std:: endl;
+        out << *bn.child(0) << std:: endl;
+        out << *bn.child(1) << std:: endl;
         break;
     case BoundingNode::NEWDOMAIN:
         out << "D " << bn.data.domain.domain_id << std::endl;
-        out << *bn.data.domain.child << std::endl;
+        out << *bn.child() << std::endl;
         break;
     case BoundingNode::TRANSFORM:
         out << "T " << bn.data.transform.transform_id << std::endl;
-        out << *bn.data.transform.child << std::endl;
+        out << *bn.child() << std::endl;
         break;
     case BoundingNode::GATE:
         out << bn.data.gate.n_children << std::endl;
         for(int i=0; i<bn.data.gate.n_children; ++i) {
-            out << bn.data.gate.children[i] << std::endl;
+            out << *bn.child(i) << std::endl;
         }
         break;
     }
@@ -88,11 +97,9 @@ std::ostream & operator<< (std::ostream & out, const BoundingNode & bn) {
     return out;
 }
 
-std::istream & operator>> (std::istream & in, BoundingNode & bn) {
+std::istream & readBoundingNode(std::istream & in, std::vector<char> & block) {
     std::istream::sentry sentry(in);
 
-    bn.cleanup();
-
     std::string s;
     char c;
     int n;
@@ -104,19 +111,23 @@ std::istream & operator>> (std::istream & in, BoundingNode & bn) {
         return in;
     }
     
+    // The block may move while the children are appended, so the node is
+    // only ever accessed through its offset
+    size_t offset = appendNode(block, BoundingNode::NONE);
     if (s == "Gate(") {
-        bn.type = BoundingNode::GATE;
         in >> n;
-        bn.data.gate.n_children = n;
-        bn.data.gate.children = new BoundingNode[n];
+        nodeAt(block, offset).type = BoundingNode::GATE;
+        nodeAt(block, offset).data.gate.n_children = n;
         for (int i=0; i<n; ++i) {
-            in >> bn.data.gate.children[i];
+            readBoundingNode(in, block);
             check(in);
         }
     } else {
 
         check(in);
-        in >> bn.box;
+        BoundingBox box;
+        in >> box;
+        nodeAt(block, offset).box = box;
         check(in);
 
         in >> s;
@@ -125,31 +136,38 @@ std::istream & operator>> (std::istream & in, BoundingNode & bn) {
         case 'N':
             break;
         case 'L':
-            bn.type = BoundingNode::LEAF;
             in >> n;
-            bn.data.leaf.n_triangles = n;
+            if (!in || n < 0) {
+                in.setstate(std::ios_base::failbit);
+                return in;
+            }
+            nodeAt(block, offset).type = BoundingNode::LEAF;
+            nodeAt(block, offset).data.leaf.n_triangles = n;
             //ls_message("reading %d triangles:\n",n);
-            bn.data.leaf.vertices = new Vector[n*3];
-            for(int i=0; i<n*3; i++)
-                in >> bn.data.leaf.vertices[i];
+            for(int i=0; i<n*3; i++) {
+                Vector v;
+                in >> v;
+                size_t end = block.size();
+                block.resize(end + sizeof(Vector));
+                memcpy(&block[end], &v, sizeof(Vector));
+            }
             break;
         case 'I':
-            bn.type = BoundingNode::INNER;
-            bn.data.inner.children[0] = new BoundingNode;
-            bn.data.inner.children[1] = new BoundingNode;
-            in >> *bn.data.inner.children[0] >> *bn.data.inner.children[1];
+            nodeAt(block, offset).type = BoundingNode::INNER;
+            readBoundingNode(in, block);
+            readBoundingNode(in, block);
             break;
         case 'D':
-            bn.type = BoundingNode::NEWDOMAIN;
-            in >> bn.data.domain.domain_id;
-            bn.data.domain.child = new BoundingNode;
-            in >> *bn.data.domain.child;
+            in >> n;
+            nodeAt(block, offset).type = BoundingNode::NEWDOMAIN;
+            nodeAt(block, offset).data.domain.domain_id = n;
+            readBoundingNode(in, block);
             break;
         case 'T':
-            bn.type = BoundingNode::TRANSFORM;
-            in >> bn.data.transform.transform_id;
-            bn.data.transform.child = new BoundingNode;
-            in >> *bn.data.transform.child;
+            in >> n;
+            nodeAt(block, offset).type = BoundingNode::TRANSFORM;
+            nodeAt(block, offset).data.transform.transform_id = n;
+            readBoundingNode(in, block);
             break;
         default:
             std::cerr << "Bad node type: " << s << std::endl;
@@ -161,7 +179,45 @@ std::istream & operator>> (std::istream & in, BoundingNode & bn) {
     
     in >> c; // The closing brace ')'
     check(in);
+    nodeAt(block, offset).size = block.size() - offset;
     return in;
 }
 
+bool isValidBoundingNode(const BoundingNode * node, const char * end,
+                         int n_domains, int n_transforms)
+{
+    const char *begin = (const char *) node;
+    if (end - begin < (ptrdiff_t) sizeof(BoundingNode)
+        || node->size < (int) sizeof(BoundingNode)
+        || node->size > end - begin
+        || node->size % sizeof(float) != 0)
+        return false;
+
+    switch(node->type) {
+    case BoundingNode::NONE:
+        return node->size == sizeof(BoundingNode);
+    case BoundingNode::LEAF:
+        return node->data.leaf.n_triangles >= 0
+            && node->data.leaf.n_triangles
+                <= (end - begin) / (int) (3*sizeof(Vector))
+            && node->size == (int) (sizeof(BoundingNode)
+                + 3*node->data.leaf.n_triangles*sizeof(Vector));
+    case BoundingNode::INNER:
+        return hasValidChildren(node, 2, n_domains, n_transforms);
+    case BoundingNode::NEWDOMAIN:
+        return node->data.domain.domain_id >= 0
+            && node->data.domain.domain_id < n_domains
+            && hasValidChildren(node, 1, n_domains, n_transforms);
+    case BoundingNode::TRANSFORM:
+        return node->data.transform.transform_id >= 0
+            && node->data.transform.transform_id < n_transforms
+            && hasValidChildren(node, 1, n_domains, n_transforms);
+    case BoundingNode::GATE:
+        return node->data.gate.n_children >= 0
+            && hasValidChildren(node, node->data.gate.n_children,
+                                n_domains, n_transforms);
+    }
+    return false;
+}
+
 } // namespace Collide
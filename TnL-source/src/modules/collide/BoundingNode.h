@@ -2,52 +2,77 @@
 #define COLLIDE_BOUNDINGNODE_H
 
 #include <iostream>
+#include <vector>
 #include <modules/math/Vector.h>
 #include "BoundingBox.h"
 
 namespace Collide {
 
+/// A node of the bounding volume hierarchy of a BoundingGeometry.
+/// The whole hierarchy is laid out depth-first in one block of memory: the
+/// children of a node follow it one subtree after the other, and the
+/// vertices of a leaf follow it in place of children. size skips a node
+/// with its subtree. There are no pointers in the block, so it can be used
+/// right where it is mapped from a cache file.
 struct BoundingNode {
-    inline BoundingNode() : type(NONE) { }
-    inline ~BoundingNode() { cleanup(); }
-    void cleanup();
-
     enum { NONE,
            LEAF,
            INNER,
            NEWDOMAIN,
            TRANSFORM,
-           GATE } type;
+           GATE };
+    int type;
+    int size;   ///< Bytes from this node to the end of its subtree
     BoundingBox box;
     union {
         struct {
             int n_triangles;
-            Vector * vertices;
         } leaf;
-        struct {
-            BoundingNode * children[2];
-        } inner;
         struct {
             int domain_id;
-            BoundingNode * child;
         } domain;
         struct {
             int transform_id;
-            BoundingNode * child;
         } transform;
         struct {
             int n_children;
-            BoundingNode *children;
         } gate;
     } data;
-    
+
+    /// The 3*n_triangles vertices of a leaf
+    inline const Vector * vertices() const {
+        return (const Vector *) (this + 1);
+    }
+
+    /// The first child of an inner, domain, transform or gate node
+    inline const BoundingNode * child() const { return this + 1; }
+
+    /// The i-th child, inner nodes have two and gates n_children
+    inline const BoundingNode * child(int i) const {
+        const BoundingNode *c = child();
+        while (i--) c = c->next();
+        return c;
+    }
+
+    /// The node after the subtree of this one, i.e. its next sibling
+    inline const BoundingNode * next() const {
+        return (const BoundingNode *) ((const char *) this + size);
+    }
+
     /// Returns whether the specific node type has a valid bounding box.
     inline bool isValidBoundingBox() const
     { return type == LEAF || type == INNER; }
 };
 
 std::ostream & operator<< (std::ostream & out, const BoundingNode & bn);
-std::istream & operator>> (std::istream & in, BoundingNode & bn);
+
+/// Reads a node with its subtree in the text format and appends it to block
+std::istream & readBoundingNode(std::istream & in, std::vector<char> & block);
+
+/// Checks the subtree at node, which must end at or before end, so that a
+/// damaged block can't send a traversal astray
+bool isValidBoundingNode(const BoundingNode * node, const char * end,
+                         int n_domains, int n_transforms);
 
 } // namespace Collide
 
@@ -0,0 +1,151 @@
+#include <algorithm>
+#include "BroadPhase.h"
+
+namespace Collide {
+
+BroadPhase::BroadPhase(Method method, float cell_size)
+:   method(method), n_static(0), sweep_xyz(false), grid(cell_size),
+    grid_current(false)
+{ }
+
+int BroadPhase::add(const Vector & min, const Vector & max)
+{
+    int id;
+    if (free_ids.empty()) {
+        id = boxes.size();
+        boxes.push_back(Box());
+        handles.push_back(-1);
+    } else {
+        id = free_ids.back();
+        free_ids.pop_back();
+    }
+    boxes[id].used = true;
+    boxes[id].is_static = false;
+    grid_current = false;
+
+    if (method == SWEEP_XYZ) {
+        SweepNPrune3D::Handle h = sweep_xyz.add(min, max);
+        handles[id] = h;
+        if ((int) ids.size() <= h) ids.resize(h+1);
+        ids[h] = id;
+        boxes[id].min = min;
+        boxes[id].max = max;
+    } else {
+        move(id, min, max);
+    }
+    return id;
+}
+
+void BroadPhase::set(int id, const Vector & min, const Vector & max)
+{
+    // Static collidables set the same box in every step
+    const Box & box = boxes[id];
+    if (box.min[0] == min[0] && box.min[1] == min[1] && box.min[2] == min[2]
+        && box.max[0] == max[0] && box.max[1] == max[1]
+        && box.max[2] == max[2])
+    {
+        return;
+    }
+    move(id, min, max);
+}
+
+void BroadPhase::move(int id, const Vector & min, const Vector & max)
+{
+    boxes[id].min = min;
+    boxes[id].max = max;
+    grid_current = false;
+    switch (method) {
+    case SWEEP_X:
+        sweep_x.set(id, min[0], max[0]);
+        break;
+    case SWEEP_XYZ:
+        sweep_xyz.set(handles[id], min, max);
+        break;
+    case GRID:
+        break;
+    }
+}
+
+void BroadPhase::remove(int id)
+{
+    switch (method) {
+    case SWEEP_X:
+        sweep_x.remove(id);
+        break;
+    case SWEEP_XYZ:
+        sweep_xyz.remove(handles[id]);
+        handles[id] = -1;
+        break;
+    case GRID:
+        break;
+    }
+    setStatic(id, false);
+    boxes[id].used = false;
+    free_ids.push_back(id);
+    grid_current = false;
+}
+
+void BroadPhase::setStatic(int id, bool is_static)
+{
+    if (boxes[id].is_static == is_static) return;
+    boxes[id].is_static = is_static;
+    n_static += is_static ? 1 : -1;
+}
+
+void BroadPhase::findPairs(PairList & pairs)
+{
+    size_t first = pairs.size();
+    switch (method) {
+    case SWEEP_X:
+        sweep_x_contacts.clear();
+        sweep_x.findContacts(sweep_x_contacts);
+        for (size_t i=0; i<sweep_x_contacts.size(); i++) {
+            int a = sweep_x_contacts[i].first, b = sweep_x_contacts[i].second;
+            if (overlaps(a, b)) pairs.push_back(makePair(a, b));
+        }
+        break;
+    case SWEEP_XYZ:
+        sweep_xyz_contacts.clear();
+        sweep_xyz.findContacts(sweep_xyz_contacts);
+        for (size_t i=0; i<sweep_xyz_contacts.size(); i++) {
+            pairs.push_back(makePair(ids[sweep_xyz_contacts[i].first],
+                                     ids[sweep_xyz_contacts[i].second]));
+        }
+        break;
+    case GRID:
+        fillGrid();
+        grid.findContacts(pairs);
+        grid_current = true;
+        break;
+    }
+    if (n_static > 1) {
+        pairs.erase(std::remove_if(pairs.begin() + first, pairs.end(),
+                                   BothStatic(boxes)),
+                    pairs.end());
+    }
+    std::sort(pairs.begin() + first, pairs.end());
+}
+
+void BroadPhase::prepareSegments()
+{
+    if (grid_current) return;
+    fillGrid();
+    grid.build();
+    grid_current = true;
+}
+
+void BroadPhase::findSegment(const Vector & a, const Vector & b,
+                             std::vector<int> & ids) const
+{
+    grid.findSegment(a, b, ids);
+}
+
+void BroadPhase::fillGrid()
+{
+    grid.clear();
+    for (size_t i=0; i<boxes.size(); i++) {
+        if (boxes[i].used) grid.add(i, boxes[i].min, boxes[i].max);
+    }
+}
+
+} // namespace Collide
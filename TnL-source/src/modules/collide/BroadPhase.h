@@ -0,0 +1,105 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include <vector>
+#include <tnl.h>
+#include "SweepNPrune.h"
+#include "SweepNPrune3D.h"
+#include "UniformGrid.h"
+
+namespace Collide {
+
+/// Finds the pairs of overlapping boxes with one of several methods.
+///
+/// Boxes are identified by dense ids, which are reused after a box is
+/// removed. Whatever the method, findPairs reports exactly the pairs of
+/// boxes that overlap on all axes, lower id first and in sorted order, so
+/// the methods can be exchanged without changing the result. Pairs of two
+/// static boxes are left out, they can't touch each other.
+///
+/// Segments are looked up in a UniformGrid over the boxes, whatever the
+/// method. GRID shares it with findPairs, the sweeps build it when a
+/// segment is looked up after the boxes have changed.
+class BroadPhase {
+public:
+    enum Method {
+        SWEEP_X,    ///< SweepNPrune on the x axis, the rest tested per pair
+        SWEEP_XYZ,  ///< SweepNPrune3D
+        GRID        ///< UniformGrid over x/z, built anew for every query
+    };
+
+    typedef std::pair<int, int> Pair;
+    typedef std::vector<Pair> PairList;
+
+    /// The cell size is only used by GRID, see UniformGrid
+    BroadPhase(Method method=SWEEP_X, float cell_size=0);
+
+    int add(const Vector & min, const Vector & max);
+    void set(int id, const Vector & min, const Vector & max);
+    void remove(int id);
+    /// Marks a box as static or not, boxes are added as not static
+    void setStatic(int id, bool is_static);
+
+    /// Appends the pairs of overlapping boxes
+    void findPairs(PairList & pairs);
+
+    /// Brings the grid that findSegment looks in up to date with the boxes
+    void prepareSegments();
+    /// Appends the ids of the boxes that the segment from a to b passes
+    /// through, in no particular order. Only reads the grid, which must
+    /// have been prepared since the boxes last changed, so it may run on
+    /// several threads at once.
+    void findSegment(const Vector & a, const Vector & b,
+                     std::vector<int> & ids) const;
+
+    inline Method getMethod() const { return method; }
+
+private:
+    struct Box {
+        Vector min, max;
+        bool used;
+        bool is_static;
+    };
+
+    Method method;
+    std::vector<Box> boxes;
+    std::vector<int> free_ids;
+    int n_static;
+
+    SweepNPrune<int, float> sweep_x;
+    SweepNPrune<int, float>::ContactList sweep_x_contacts;
+
+    SweepNPrune3D sweep_xyz;
+    SweepNPrune3D::PairList sweep_xyz_contacts;
+    std::vector<SweepNPrune3D::Handle> handles; // By id
+    std::vector<int> ids;                       // By handle
+
+    UniformGrid grid;
+    bool grid_current;  // Holds the boxes as they are now
+
+    void move(int id, const Vector & min, const Vector & max);
+    void fillGrid();
+
+    inline bool overlaps(int a, int b) const {
+        for (int k=0; k<3; k++) {
+            if (boxes[a].min[k] > boxes[b].max[k]) return false;
+            if (boxes[b].min[k] > boxes[a].max[k]) return false;
+        }
+        return true;
+    }
+    inline static Pair makePair(int a, int b) {
+        return a < b ? Pair(a, b) : Pair(b, a);
+    }
+
+    struct BothStatic {
+        const std::vector<Box> & boxes;
+        BothStatic(const std::vector<Box> & boxes) : boxes(boxes) { }
+        inline bool operator() (const Pair & p) const {
+            return boxes[p.first].is_static && boxes[p.second].is_static;
+        }
+    };
+};
+
+} // namespace Collide
+
+#endif
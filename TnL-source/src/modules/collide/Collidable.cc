@@ -4,3 +4,9 @@ void Collide::Collidable::collide(const Contact & c) {
     // do nothing in default implementation
 }
 
+bool Collide::Collidable::isDisturbed(float max_acceleration,
+                                      float max_angular_acceleration)
+{
+    return false;
+}
+
@@ -23,11 +23,29 @@ class Collidable : virtual public Object{
     Ptr<Collidable> ncparent, ncpartner;
     void *nctag;
     bool enabled;
+    bool terrain_test, terrain_hit;
+    Vector terrain_point;
+    bool sleep_allowed, sleeping;
+    float rest_time;    // Seconds below the sleep velocities
+    bool swept_point;
+
+    // Index of the geometry instance in the CollisionManager, -1 if none
+    int handle;
+
+    // Set by the CollisionManager before it calls update()
+    friend class CollisionManager;
+    inline void setTerrainHit(bool hit, const Vector & x) {
+        terrain_hit = hit;
+        terrain_point = x;
+    }
 protected:
     inline Collidable(Ptr<BoundingGeometry> b=0,
                       RigidBody *r=0, IActor *a=0,
                       Ptr<Collidable> ncparent=0)
-    :   bounding(b), rigid(r), actor(a), ncparent(ncparent), ncpartner(0), nctag(0), enabled(true)
+    :   bounding(b), rigid(r), actor(a), ncparent(ncparent), ncpartner(0), nctag(0), enabled(true),
+        terrain_test(false), terrain_hit(false),
+        sleep_allowed(false), sleeping(false), rest_time(0),
+        swept_point(false), handle(-1)
     { }
 protected:
     inline void setBoundingGeometry(Ptr<BoundingGeometry> b) {
@@ -39,6 +57,28 @@ protected:
     inline void setActor(IActor *a) {
         this->actor = a;
     }
+    /// Has the CollisionManager test the path of the collidable against
+    /// the terrain in each step, see hitTerrain. Default is false.
+    inline void setTerrainTest(bool b) {
+        this->terrain_test = b;
+    }
+    /// Has the CollisionManager treat the collidable as a point, the origin
+    /// of its first transform, that moves along a segment in each step.
+    /// The segment is tested against the triangles of the other
+    /// collidables, rather than the bounding geometry in the narrow phase.
+    /// Swept points don't hit each other, and their contacts don't apply
+    /// impulses. Has to be set before the collidable is added. Default is
+    /// false.
+    inline void setSweptPoint(bool b) {
+        this->swept_point = b;
+    }
+    /// Lets the CollisionManager put the collidable to sleep while it
+    /// rests, see isSleeping. Only for collidables with a rigid body that
+    /// all of their transforms follow from. Default is false.
+    inline void setSleepAllowed(bool b) {
+        this->sleep_allowed = b;
+        if (!b) wake();
+    }
     
     inline Collidable* getNoCollideRoot() {
     	Collidable *root = this;
@@ -53,8 +93,42 @@ public:
     /// Sets wether this collidable is enabled for collisions. Default is true.
     void setCollidingEnabled(bool b) { enabled = b; }
 
+    /// Returns wether the path of this collidable is tested against the
+    /// terrain
+    inline bool isTerrainTested() const { return terrain_test; }
+    /// Returns wether the path of the update() in progress hits the terrain,
+    /// and the point where it does in x. All terrain tested collidables are
+    /// tested at once before their update() is called.
+    inline bool hitTerrain(Vector *x) const {
+        if (terrain_hit) *x = terrain_point;
+        return terrain_hit;
+    }
+
+    /// Returns wether the collidable is a swept point, see setSweptPoint
+    inline bool isSweptPoint() const { return swept_point; }
+
+    /// Returns wether the collidable is asleep. It has rested for a while,
+    /// so the CollisionManager neither integrates nor updates it, and
+    /// doesn't test it against static or other sleeping collidables.
+    /// It wakes up when a contact or an impulse moves it, when it is moved
+    /// to another place, or when isDisturbed says so.
+    inline bool isSleeping() const { return sleeping; }
+    /// Wakes the collidable, for changes the CollisionManager can't see
+    inline void wake() {
+        sleeping = false;
+        rest_time = 0;
+    }
+
+    /// Whether the forces on the collidable would move it out of its rest,
+    /// asked of sleeping collidables in each step, where integrate() would
+    /// be called. The default implementation returns false.
+    virtual bool isDisturbed(float max_acceleration,
+                             float max_angular_acceleration);
+
     /// returns associated bounding geometry.
-    inline Ptr<BoundingGeometry>
+    /// Returned by reference, so that the narrow phase threads can use it
+    /// without touching the reference count.
+    inline const Ptr<BoundingGeometry> &
     getBoundingGeometry() { return bounding; }
 
     /// returns an associated rigid body.
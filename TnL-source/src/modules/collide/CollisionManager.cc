@@ -1,7 +1,12 @@
 #include <string>
+#include <algorithm>
 #include <typeinfo>
 #include <fstream>
 #include <cstdio>
+#include <stdexcept>
+#if !defined(_MSC_VER) && !defined(__MINGW32__)
+#include <sys/time.h>
+#endif
 #include <modules/math/Interval.h>
 #include <modules/actors/fx/DebugObject.h>
 #include <game.h>
@@ -29,24 +34,114 @@ typedef XTransform<Interval> ITransform;
 typedef XVector<3,Interval> IVector;
 typedef XMatrix<3,Interval> IMatrix3;
 
+// Line queries per job of lineQueries
+#define LINE_QUERIES_PER_JOB 64
+
+namespace {
+// A clock for timing the phases of a step, SDL_GetTicks is too coarse
+inline Uint32 microseconds() {
+#if !defined(_MSC_VER) && !defined(__MINGW32__)
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return (Uint32) tv.tv_sec * 1000000u + (Uint32) tv.tv_usec;
+#else
+    return SDL_GetTicks() * 1000u;
+#endif
+}
+}
+
 
 namespace Collide {
 
-CollisionManager::CollisionManager() {
+// Resolves a range of the queries handed to lineQueries, or of the swept
+// points. The jobs are kept from one batch to the next, so that their
+// candidate lists can reuse their storage.
+struct LineQueryJob : public WorkerPool::Job {
+    CollisionManager *manager;
+    LineQuery *queries;
+    SweptPoint *points;         // If there are no queries
+    int n;
+    std::vector<int> handles;
+    std::vector<std::pair<float, int> > candidates; // Entry, handle
+
+    void run() {
+        if (queries) {
+            for (int i=0; i<n; i++) manager->resolveLineQuery(queries[i], *this);
+        } else {
+            for (int i=0; i<n; i++) manager->resolveSweptPoint(points[i], *this);
+        }
+    }
+};
+
+namespace {
+BroadPhase::Method broadPhaseMethod(Ptr<IConfig> config) {
+    if (!config) return BroadPhase::SWEEP_X;
+    std::string name = config->query("CollisionManager_broadphase", "sweep");
+    if (name == "sweep") return BroadPhase::SWEEP_X;
+    if (name == "sweep3d") return BroadPhase::SWEEP_XYZ;
+    if (name == "grid") return BroadPhase::GRID;
+    ls_warning("CollisionManager: Unknown broad phase %s, using sweep.\n",
+        name.c_str());
+    return BroadPhase::SWEEP_X;
+}
+}
+
+CollisionManager::CollisionManager(Ptr<IConfig> config)
+:   running(false),
+    broad_phase(broadPhaseMethod(config),
+        config ? config->queryFloat("CollisionManager_grid_cell_size", 0) : 0),
+    contact_time_tolerance(config
+        ? config->queryFloat("CollisionManager_contact_time_tolerance", 1e-4f)
+        : 1e-4f),
+    earliest_mutex(0),
+    use_geometry_cache(config
+        ? config->queryBool("CollisionManager_geometry_cache", true) : true),
+    line_query_boxes(true),
+    step_count(0),
+    trace_min_iterations(config
+        ? config->queryInt("CollisionManager_trace_min_iterations", 256) : 256),
+    sleep_time(config
+        ? config->queryFloat("CollisionManager_sleep_time", 2.0f) : 2.0f),
+    sleep_velocity(config
+        ? config->queryFloat("CollisionManager_sleep_velocity", 0.05f) : 0.05f),
+    sleep_angular_velocity(config
+        ? config->queryFloat("CollisionManager_sleep_angular_velocity", 0.05f)
+        : 0.05f),
+    wake_acceleration(config
+        ? config->queryFloat("CollisionManager_wake_acceleration", 0.5f)
+        : 0.5f),
+    wake_angular_acceleration(config
+        ? config->queryFloat("CollisionManager_wake_angular_acceleration", 0.5f)
+        : 0.5f)
+{
 	ls_message("Initializing CollisionManager... ");
+    // 0 means one thread per processor, 1 tests all pairs on this thread
+    int nthreads = config
+        ? config->queryInt("CollisionManager_narrowphase_threads", 1) : 1;
+    if (nthreads <= 0) nthreads = WorkerPool::getCPUCount();
+    narrowphase_pool = new WorkerPool(nthreads > 1 ? nthreads : 0);
+    if (narrowphase_pool->getThreadCount() > 0)
+        earliest_mutex = SDL_CreateMutex();
+    stats.clear();
+    const char *trace_name = config
+        ? config->query("CollisionManager_trace", "") : "";
+    if (trace_name && *trace_name) trace.open(trace_name);
 	ls_message("done.\n");
 }
 
 CollisionManager::~CollisionManager() {
 	ls_message("Deleting CollisionManager %p with %d refs\n", this, getRefs());
 	Object::backtrace();
-	ls_message("Got %d geometry instances to delete.\n", geom_instances.size());
-	for (GeomIter i=geom_instances.begin(); i!= geom_instances.end(); ++i) {
-		ls_message("deleting geometry instance %p.\n", i->second);
-		delete i->second;
-		ls_message("done\n");
+	ls_message("Got %d geometry instances to delete.\n",
+		instances.size() - free_instances.size());
+	for (size_t i=0; i<instances.size(); i++) {
+		if (instances[i].collidable) instances[i].collidable->handle = -1;
 	}
 	ls_message("Now cleaning up the rest.\n");
+	for (size_t j=0; j<jobs.size(); j++) delete jobs[j];
+	for (size_t j=0; j<line_query_jobs.size(); j++) delete line_query_jobs[j];
+	delete narrowphase_pool;
+	if (earliest_mutex) SDL_DestroyMutex(earliest_mutex);
 }
 
 Ptr<BoundingGeometry>
@@ -56,17 +151,27 @@ CollisionManager::queryGeometry(const std::string & name) {
     Iter i = bounding_geometries.find(name);
     if (i == bounding_geometries.end()) {
         Ptr<BoundingGeometry> bg = new BoundingGeometry();
-        ifstream in(name.c_str());
-        if (!in) {
-            ls_error("CollisionManager: Error opening\n  %s\n",
-                name.c_str());
-            return 0;
-        }
-        in >> *bg;
-        if (!in) {
-            ls_error("CollisionManager: Error reading\n  %s\n",
-                name.c_str());
-            return 0;
+        // Try the compiled cache first. It is rebuilt from the text file
+        // whenever it is missing, stale or was written by another version.
+        std::string cache_name = BoundingGeometry::getCacheName(name);
+        if (!use_geometry_cache
+            || !bg->loadCache(cache_name.c_str(), name.c_str()))
+        {
+            ifstream in(name.c_str());
+            if (!in) {
+                ls_error("CollisionManager: Error opening\n  %s\n",
+                    name.c_str());
+                return 0;
+            }
+            in >> *bg;
+            if (!in) {
+                ls_error("CollisionManager: Error reading\n  %s\n",
+                    name.c_str());
+                return 0;
+            }
+            if (use_geometry_cache) {
+                bg->saveCache(cache_name.c_str(), name.c_str());
+            }
         }
         bounding_geometries.insert(std::make_pair(name, bg));
         return bg;
@@ -76,16 +181,132 @@ CollisionManager::queryGeometry(const std::string & name) {
 }
 
 void CollisionManager::add(Ptr<Collidable> c) {
-	GeometryInstance *instance = new GeometryInstance(c);
-    geom_instances.insert(make_pair(c, instance));
-    //ls_message("Added geometry instance %p\n", instance);
+    if (c->handle >= 0) return;
+    if (running) {
+        // Growing the tables would move the transforms under run()
+        if (std::find(pending.begin(), pending.end(), c) == pending.end())
+            pending.push_back(c);
+        return;
+    }
+    addInstance(c);
+}
+
+void CollisionManager::addInstance(Ptr<Collidable> c) {
+    const Ptr<BoundingGeometry> & bounds = c->getBoundingGeometry();
+    if (!bounds) {
+        throw std::invalid_argument("Add Collidable without BoundingGeometry");
+    }
+    int n = bounds->getNumOfTransforms();
+
+    int handle;
+    if (free_instances.empty()) {
+        handle = instances.size();
+        instances.push_back(GeometryInstance());
+    } else {
+        handle = free_instances.back();
+        free_instances.pop_back();
+    }
+
+    // transforms_0 and transforms_1 of an instance lie next to each other
+    if ((int) free_transforms.size() <= n) free_transforms.resize(n+1);
+    int index;
+    if (free_transforms[n].empty()) {
+        index = transforms.size();
+        const Transform *old_transforms = transforms.empty() ? 0 : &transforms[0];
+        transforms.resize(index + 2*n);
+        if (!transforms.empty() && &transforms[0] != old_transforms) {
+            for (size_t i=0; i<instances.size(); i++) {
+                GeometryInstance & other = instances[i];
+                if (!other.collidable) continue;
+                int m = other.collidable->getBoundingGeometry()->getNumOfTransforms();
+                other.transforms_0 = &transforms[other.transform_index];
+                other.transforms_1 = &transforms[other.transform_index + m];
+            }
+        }
+    } else {
+        index = free_transforms[n].back();
+        free_transforms[n].pop_back();
+    }
+
+    GeometryInstance & instance = instances[handle];
+    instance.collidable = c;
+    instance.transform_index = index;
+    instance.transforms_0 = n ? &transforms[index] : 0;
+    instance.transforms_1 = n ? &transforms[index + n] : 0;
+    instance.broad_phase_id = -1;
+    c->handle = handle;
+    c->wake();
+    if (c->isSweptPoint()) point_handles.push_back(handle);
+    else unindexed.push_back(handle);
 }
 
 void CollisionManager::remove(Ptr<Collidable> c) {
-    //ls_message("Removed geometry instance %p\n", geom_instances[c]);
-    delete geom_instances[c];
-    geom_instances.erase(c);
-    sweep_n_prune.remove(c);
+    if (c->handle < 0) {
+        std::vector<Ptr<Collidable> >::iterator i =
+            std::find(pending.begin(), pending.end(), c);
+        if (i != pending.end()) pending.erase(i);
+        return;
+    }
+    GeometryInstance & instance = instances[c->handle];
+    if (instance.broad_phase_id >= 0) {
+        broad_phase.remove(instance.broad_phase_id);
+        broad_phase_instances[instance.broad_phase_id] = -1;
+    } else {
+        std::vector<int> & handles =
+            c->isSweptPoint() ? point_handles : unindexed;
+        std::vector<int>::iterator i =
+            std::find(handles.begin(), handles.end(), c->handle);
+        if (i != handles.end()) handles.erase(i);
+    }
+    int n = c->getBoundingGeometry()->getNumOfTransforms();
+    free_transforms[n].push_back(instance.transform_index);
+    free_instances.push_back(c->handle);
+    c->handle = -1;
+    instance = GeometryInstance();
+}
+
+// Whether a sleeping collidable stays asleep for now. Impulses and changes
+// of its place or orientation from outside wake it.
+bool CollisionManager::keepsSleeping(const GeometryInstance & instance) {
+    RigidBody *rigid = instance.collidable->getRigid();
+    if (rigid->getLinearVelocity().length() > sleep_velocity
+        || rigid->getAngularVelocity().length() > sleep_angular_velocity)
+        return false;
+
+    const RigidBodyState & state = rigid->getState();
+    const Transform & t = instance.transforms_0[0];
+    Quaternion q = state.q.normalize();
+    for (int k=0; k<3; k++) {
+        if (state.x[k] != t.vec()[k] || q.imag()[k] != t.quat().imag()[k])
+            return false;
+    }
+    return q.real() == t.quat().real();
+}
+
+// Counts the time a rigid collidable rests and puts it to sleep when it has
+// rested for sleep_time. It sleeps from where it is at the beginning of the
+// step, with its remaining momentum taken away.
+bool CollisionManager::fallsAsleep(GeometryInstance & instance, float delta_t) {
+    Collidable *collidable = ptr(instance.collidable);
+    RigidBody *rigid = collidable->getRigid();
+    if (sleep_time <= 0 || !collidable->sleep_allowed
+        || rigid->getLinearVelocity().length() > sleep_velocity
+        || rigid->getAngularVelocity().length() > sleep_angular_velocity)
+    {
+        collidable->rest_time = 0;
+        return false;
+    }
+    collidable->rest_time += delta_t;
+    if (collidable->rest_time < sleep_time) return false;
+
+    collidable->sleeping = true;
+    rigid->setLinearMomentum(Vector(0,0,0));
+    rigid->setAngularMomentum(Vector(0,0,0));
+    int n = collidable->getBoundingGeometry()->getNumOfTransforms();
+    for(int j=0; j<n; ++j) {
+        instance.transforms_1[j] = instance.transforms_0[j];
+    }
+    return true;
 }
 
 namespace {
@@ -97,14 +318,14 @@ void visualize_geometry(Ptr<IGame> game, const BoundingNode * node,
     case (BoundingNode::NEWDOMAIN): break;
     case (BoundingNode::TRANSFORM): break;
     case (BoundingNode::INNER):
-        visualize_geometry(game, node->data.inner.children[0], instance);
-        visualize_geometry(game, node->data.inner.children[1], instance);
+        visualize_geometry(game, node->child(0), instance);
+        visualize_geometry(game, node->child(1), instance);
         break;
     case (BoundingNode::LEAF):
         for(int i=0; i<node->data.leaf.n_triangles; i++) {
             Transform & t = instance->transforms_0[0];
             for(int j=0; j<3; j++) {
-                Vector p = t(node->data.leaf.vertices[3*i + j]);
+                Vector p = t(node->vertices()[3*i + j]);
                 new DebugActor(game, p, "leaf", 0.01);
             }
         }
@@ -114,32 +335,55 @@ void visualize_geometry(Ptr<IGame> game, const BoundingNode * node,
 }
 }
 
-#define TIME_EPS 0.01
-
-#define NUM_CONTACTS 1
+#define PAIRS_PER_JOB 8
 
 void CollisionManager::run(Ptr<IGame> game, float delta_t) {
     float stop_time;
-    Contact contact[NUM_CONTACTS];
-    PossibleContact possible;
-    Hints hints;
-
     int found_contacts;
+    bool first_pass = true;
+    running = true;
+    stats.clear();
+    swept_points.clear();
+    step_count++;
+    float step_delta_t = delta_t;
 
-    // get current transforms
-    for(GeomIter i=geom_instances.begin(); i!=geom_instances.end(); i++) {
-        Ptr<Collidable> collidable = i->first;
-        GeometryInstance & instance = *i->second;
+    // get current transforms. Sleeping collidables still have theirs.
+    for(size_t h=0; h<instances.size(); h++) {
+        GeometryInstance & instance = instances[h];
+        Collidable *collidable = ptr(instance.collidable);
+        if (!collidable) continue;
 
+        if (collidable->sleeping) {
+            if (keepsSleeping(instance)) continue;
+            collidable->wake();
+        }
         collidable->integrate(0.0f, instance.transforms_0);
     }
-    
-    // compute destination transforms at delta_t
-    for(GeomIter i=geom_instances.begin(); i!=geom_instances.end(); i++) {
-        Ptr<Collidable> collidable = i->first;
-        GeometryInstance & instance = *i->second;
+    // The broad phase boxes are those of the last step until the first
+    // pass, line queries from integrate() have to refresh them
+    line_query_boxes = false;
+
+    // compute destination transforms at delta_t. Those of sleeping
+    // collidables are the same as at 0.
+    for(size_t h=0; h<instances.size(); h++) {
+        GeometryInstance & instance = instances[h];
+        Collidable *collidable = ptr(instance.collidable);
+        if (!collidable) continue;
 
+        if (collidable->sleeping) {
+            if (!collidable->isDisturbed(wake_acceleration,
+                                         wake_angular_acceleration))
+            {
+                stats.sleeping++;
+                continue;
+            }
+            collidable->wake();
+        }
         if (collidable->getRigid()) {
+            if (fallsAsleep(instance, delta_t)) {
+                stats.sleeping++;
+                continue;
+            }
             collidable->integrate(delta_t, instance.transforms_1);
         } else {
             // non-rigid collidables are treated as static, which we enforce 
@@ -151,157 +395,178 @@ void CollisionManager::run(Ptr<IGame> game, float delta_t) {
         }
     }
 
+    // The response to the contacts of a pass is timed up to the next one
+    Uint32 t = microseconds(), now;
     while (delta_t > 0) {
-        // First update the sweep'n'prune structure for finding test candidates
-        for(GeomIter i=geom_instances.begin(); i!=geom_instances.end(); i++) {
-            float min_x = i->second->transforms_0[0].vec()[0],
-                max_x = i->second->transforms_1[0].vec()[0];
-            if (min_x > max_x) swap(min_x, max_x);
-            float r = i->first->getBoundingGeometry()->getBoundingRadius();
-
-            sweep_n_prune.set(i->first, min_x - r, max_x + r);
+        float start = 1 - delta_t / step_delta_t;  // Fraction of the step
+        if (stats.passes++ > 0) {
+            now = microseconds();
+            stats.response_us += now - t;
+            t = now;
         }
 
-        ContactList possible_contacts;
-        sweep_n_prune.findContacts(possible_contacts);
-        debug_msg("SweepNPrune found %d contact candidates.\n", possible_contacts.size());
+        // First update the broad phase for finding test candidates. Each
+        // collidable is bounded by the box around its bounding sphere at
+        // both ends of the interval. After the first pass, only the paths
+        // of the collidables touched by a contact have changed, the boxes
+        // of the others still bound the rest of their paths. Static and
+        // sleeping collidables are static in the broad phase, it doesn't
+        // pair them with each other.
+        for(size_t h=0; h<instances.size(); h++) {
+            GeometryInstance *instance = &instances[h];
+            if (!instance->collidable || instance->collidable->isSweptPoint())
+                continue;
+            if (!first_pass && instance->broad_phase_id >= 0
+                && !touched[instance->broad_phase_id])
+                continue;
+            const Vector & p0 = instance->transforms_0[0].vec();
+            const Vector & p1 = instance->transforms_1[0].vec();
+            float r = instance->collidable->getBoundingGeometry()->getBoundingRadius();
+            Vector box_min, box_max;
+            for(int k=0; k<3; k++) {
+                box_min[k] = std::min(p0[k], p1[k]) - r;
+                box_max[k] = std::max(p0[k], p1[k]) + r;
+            }
 
-        // Now that we have our test candidates we feed them into the collision
-        // queue
-        while(!queue.empty()) queue.pop();
-        possible.t0 = 0.0f;
-        possible.t1 = delta_t;
+            int & id = instance->broad_phase_id;
+            if (id < 0) {
+                id = broad_phase.add(box_min, box_max);
+                if ((int) broad_phase_instances.size() <= id) {
+                    broad_phase_instances.resize(id+1);
+                    touched.resize(id+1);
+                }
+                broad_phase_instances[id] = h;
+                touched[id] = true;
+            } else {
+                broad_phase.set(id, box_min, box_max);
+            }
+            broad_phase.setStatic(id, !instance->collidable->getRigid()
+                                      || instance->collidable->sleeping);
+        }
+        line_query_boxes = true;
+        unindexed.clear();
+
+        possible_contacts.clear();
+        broad_phase.findPairs(possible_contacts);
+        debug_msg("Broad phase found %d contact candidates.\n", possible_contacts.size());
+        stats.candidates += possible_contacts.size();
+        testSweptPoints(first_pass, start, delta_t);
+        now = microseconds();
+        stats.broadphase_us += now - t;
+        t = now;
+
+        // Now that we have our test candidates we set up their tests. After
+        // the first pass, a pair is tested again only if one of its partners
+        // was touched by a contact or its test didn't finish.
+        int n_tests = 0;
         for(ContactIter i=possible_contacts.begin(); i!= possible_contacts.end(); i++) {
-            if (!i->first->isCollidingEnabled() || !i->second->isCollidingEnabled())
+            if (!first_pass && !touched[i->first] && !touched[i->second]
+                && !std::binary_search(unresolved.begin(), unresolved.end(), *i))
                 continue;
-        	if (i->first->noCollideWith(i->second))
+            GeometryInstance *first = &instances[broad_phase_instances[i->first]];
+            GeometryInstance *second = &instances[broad_phase_instances[i->second]];
+            if (!first->collidable->isCollidingEnabled() || !second->collidable->isCollidingEnabled())
+                continue;
+        	if (first->collidable->noCollideWith(second->collidable))
         		continue;
-            if (!i->first->getRigid() && !i->second->getRigid())
+            if (!first->collidable->getRigid() && !second->collidable->getRigid())
                 continue;
-            possible.setPartner(0, geom_instances[i->first]);
-            possible.setPartner(1, geom_instances[i->second]);
-            queue.push(possible);
+            if (n_tests == (int) tests.size()) tests.push_back(PairTest());
+            PairTest & test = tests[n_tests++];
+            test.pair = *i;
+            test.start.t0 = 0.0f;
+            test.start.t1 = delta_t;
+            test.start.setPartner(0, first);
+            test.start.setPartner(1, second);
         }
         
-        debug_msg("%d elements in queue.\n", (int)queue.size());
+        debug_msg("%d pairs to test.\n", n_tests);
+        std::fill(touched.begin(), touched.end(), false);
+        first_pass = false;
+
+        // The pairs are tested independently on the narrow phase pool. Each
+        // test stops at the first contact of its pair. Since every test pops
+        // its contacts in order of time, a test may also stop once its next
+        // contact begins later than contact_time_tolerance after the earliest
+        // contact found by any test, it couldn't be resolved in this pass.
+        EarliestContact earliest;
+        earliest.mutex = earliest_mutex;
+        earliest.t = delta_t;
+        int n_jobs = (n_tests + PAIRS_PER_JOB - 1) / PAIRS_PER_JOB;
+        while ((int) jobs.size() < n_jobs) jobs.push_back(new NarrowPhaseJob());
+        for (int j=0; j<n_jobs; j++) {
+            jobs[j]->tests = &tests[j*PAIRS_PER_JOB];
+            jobs[j]->n = std::min(n_tests - j*PAIRS_PER_JOB, PAIRS_PER_JOB);
+            jobs[j]->delta_t = delta_t;
+            jobs[j]->tolerance = contact_time_tolerance;
+            jobs[j]->earliest = &earliest;
+            narrowphase_pool->add(jobs[j]);
+        }
+        narrowphase_pool->wait();
+        for (int j=0; j<n_jobs; j++) stats += jobs[j]->stats;
+        now = microseconds();
+        stats.narrowphase_us += now - t;
+        t = now;
+        if (trace.isOpen()) tracePairs(n_tests, delta_t);
 
-        // We have fed our queue and the main algorithm can start now.
+        // Now we pick the contacts. The earliest one determines the stop
+        // time, contacts that begin within contact_time_tolerance of it are
+        // resolved together with it, as long as their partners don't take
+        // part in an earlier contact. Their impulses are applied at the stop
+        // time too, before their partners meet. Which tests stopped early depends on
+        // the timing of the threads, but the contacts picked don't.
+        contacts.clear();
         found_contacts = 0;
         stop_time = delta_t;
-        bool found = false;
-        int max_iters = 2048;
-        int iter_count = 0;
-        int count_subdiv_time = 0;
-        int count_subdiv_space = 0;
-        while(!queue.empty()) {
-            if (iter_count++ == max_iters) {
+        unresolved.clear();
+        contact_tests.clear();
+        for (int i=0; i<n_tests; i++) {
+            if (tests[i].aborted)
                 ls_warning("Aborting collsion test because of number of iterations.\n");
-                break;
-            }
-            PossibleContact pc(queue.top());
-            queue.pop();
-
-            if (found_contacts>0 && pc.t0 > stop_time) break;
-
-            if (pc.mustSubdivide()) {
-                debug_msg("[% 8d]: must subdivide %s <-> %s\n",
-                          pc.identifier,
-                          pc.partners[0].isTriangle()?"Triangle":(pc.partners[0].isNode()?"Node":"Sphere"),
-                          pc.partners[1].isTriangle()?"Triangle":(pc.partners[1].isNode()?"Node":"Sphere"));
-                ++count_subdiv_space;
-                debug_msg("  -> subdivide space\n");
-                pc.subdivide(queue);
+            if (tests[i].result == PairTest::CONTACT)
+                contact_tests.push_back(i);
+            else if (tests[i].result == PairTest::UNRESOLVED)
+                unresolved.push_back(tests[i].pair);
+        }
+        std::sort(contact_tests.begin(), contact_tests.end(),
+                  EarlierContact(tests));
+        for (size_t i=0; i<contact_tests.size(); i++) {
+            PairTest & test = tests[contact_tests[i]];
+            if ((found_contacts>0
+                 && test.pc.t0 > stop_time + contact_time_tolerance)
+                || touched[test.pair.first] || touched[test.pair.second])
+            {
+                unresolved.push_back(test.pair);
                 continue;
             }
 
-            bool collision = pc.collide(delta_t, hints);
-            debug_msg("[% 8d]: %s collision test %s <-> %s\n",
-                pc.identifier,
-                collision?"positive":"negative",
-                pc.partners[0].isTriangle()?"Triangle":(pc.partners[0].isNode()?"Node":"Sphere"),
-                pc.partners[1].isTriangle()?"Triangle":(pc.partners[1].isNode()?"Node":"Sphere"));
-            
-            if (collision) {
-                if (pc.shouldDivideTime(hints)) {
-                    ++count_subdiv_time;
-                    debug_msg("  -> subdivide time\n");
-                    pc.divideTime(queue);
-                    continue;
-                }
-                if (pc.canSubdivide()) {
-                    ++count_subdiv_space;
-                    debug_msg("  -> subdivide space\n");
-                    pc.subdivide(queue);
-                    continue;
-                }
-                debug_msg("  -> apply contact\n");
-
-                if (pc.makeContact(contact[found_contacts], delta_t, hints)) {
-                    Contact & c = contact[found_contacts++];
-                    /*
-                    char buf[256];
-                    snprintf(buf, 256, "contact: %s / %s hints: %s",
-                        pc.partners[0].isTriangle()?"Triangle":
-                        (pc.partners[0].isBox()?"Box":"Sphere"),
-                        pc.partners[1].isTriangle()?"Triangle":
-                        (pc.partners[1].isBox()?"Box":"Sphere"),
-                        hints.triangle_triangle.type==Hints::TriTri::VERTEX_TRIANGLE?"vertex-triangle":
-                        (hints.triangle_triangle.type==Hints::TriTri::TRIANGLE_VERTEX?"triangle-vertex":
-                        "edge-edge")
-                        );
-                    new DebugActor(game, c.p, buf);*/
-                    if (pc.partners[0].isTriangle() && pc.partners[1].isTriangle()) {
-                        for(int j=0; j<2; j++) {
-                            ContactPartner & partner = pc.partners[j];
-                            /*
-                            for(int i=0; i<3; i++) {
-                                Vector p = partner.instance->transforms_0[partner.transform]
-                                    (partner.data.triangle[i]);
-                                //snprintf(buf, 256, "Triangle %d point %d", j, i);
-                                //new DebugActor(game, p, buf);
-                            }*/
-                            GeometryInstance *instance = partner.instance;
-                            Ptr<BoundingGeometry> bounding = instance->collidable->getBoundingGeometry();
-                            Transform & transform = instance->transforms_0[partner.transform];
-                            //debug_msg("transform[%d]: quat(%f, %f, %f, %f)\n",
-                            //    j, transform.quat().real(),transform.quat().imag()[0],transform.quat().imag()[1],transform.quat().imag()[2]);
-                            //visualize_geometry(game, bounding->getRootNode(), instance);
-                        }
-                    }
-
-
-                    stop_time = (pc.t0 + pc.t1)/2;
-                    /*
-                    ls_warning("Found first contact #%d!\n", found_contacts);
-                    ls_warning("t0:%f t1:%f\n", pc.t0, pc.t1);
-                    ls_warning("p: %f %f %f\n",
-                        c.p[0],c.p[1],c.p[2]);
-                    ls_warning("n: %f %f %f\n",
-                        c.n[0],c.n[1],c.n[2]);
-                    ls_warning("v[0]: %f v[1]: %f\n", c.v[0], c.v[1]);
-                    */
-                    //Game::the_game->togglePauseMode();
-
-                    if (found_contacts == NUM_CONTACTS)
-                        break;
-
-                } else {
-                    ls_warning("Sorry, this ain't no first contact.\n");
-                }
+            contacts.push_back(Contact());
+            if (test.pc.makeContact(contacts.back(), delta_t, test.hints)) {
+                found_contacts++;
+                touched[test.pair.first] = true;
+                touched[test.pair.second] = true;
+                if (found_contacts == 1) stop_time = test.mid();
+            } else {
+                contacts.pop_back();
+                ls_warning("Sorry, this ain't no first contact.\n");
             }
         }
-        
-        debug_msg("Finished collision detection after %d iterations with %d contacts\n",
-            iter_count-1, found_contacts);
-        debug_msg("  Time subdivs:  %d\n", count_subdiv_time);
-        debug_msg("  Space subdivs: %d\n", count_subdiv_space);
+        // The pairs that were stopped early are tested again in the next pass
+        std::sort(unresolved.begin(), unresolved.end());
+
+        stats.contacts += found_contacts;
+        debug_msg("Finished collision detection of %d pairs with %d contacts\n",
+            n_tests, found_contacts);
         
         // If there was no collision we integrate up to delta_t and break
         if (found_contacts == 0) {
-            for(GeomIter i=geom_instances.begin(); i!=geom_instances.end(); i++) {
-                Ptr<Collidable> collidable = i->first;
-                GeometryInstance & instance = *i->second;
-                collidable->update(delta_t, instance.transforms_1);
+            testTerrain(game, start, 1.0f);
+            stopSweptPoints(start, 1.0f);
+            for(size_t h=0; h<instances.size(); h++) {
+                GeometryInstance & instance = instances[h];
+                if (!instance.collidable || instance.collidable->sleeping)
+                    continue;
+                instance.collidable->update(delta_t, instance.transforms_1);
             }
             break;
         }
@@ -309,18 +574,21 @@ void CollisionManager::run(Ptr<IGame> game, float delta_t) {
         // So there was a collision. We have to interpolate up to the point where it
         // happened.
         float u = stop_time / delta_t;
-        for(GeomIter i=geom_instances.begin(); i!=geom_instances.end(); i++) {
-            Ptr<Collidable> collidable = i->first;
-            GeometryInstance & instance = *i->second;
+        testTerrain(game, start, u);
+        stopSweptPoints(start, start + u * (1 - start));
+        for(size_t h=0; h<instances.size(); h++) {
+            GeometryInstance & instance = instances[h];
+            Collidable *collidable = ptr(instance.collidable);
+            if (!collidable || collidable->sleeping) continue;
             int n = collidable->getBoundingGeometry()->getNumOfTransforms();
             for(int j=0; j<n; j++)
                 instance.transforms_0[j] = interp(
                     u, instance.transforms_0[j], instance.transforms_1[j]);
             /*for(int c=0; c<found_contacts; c++) {
-                if(collidable == contact[c].collidables[0]) {
-                    instance.transforms_0[0] *= Transform(Quaternion(1,0,0,0), 0.05*contact[c].n);
-                } else if (collidable == contact[c].collidables[1]) {
-                    instance.transforms_0[0] *= Transform(Quaternion(1,0,0,0),-0.05*contact[c].n);
+                if(collidable == contacts[c].collidables[0]) {
+                    instance.transforms_0[0] *= Transform(Quaternion(1,0,0,0), 0.05*contacts[c].n);
+                } else if (collidable == contacts[c].collidables[1]) {
+                    instance.transforms_0[0] *= Transform(Quaternion(1,0,0,0),-0.05*contacts[c].n);
                 }
             }*/
             collidable->update(delta_t, instance.transforms_0);
@@ -331,90 +599,536 @@ void CollisionManager::run(Ptr<IGame> game, float delta_t) {
         for(int c = 0; c<found_contacts; c++) {
             ls_message("Contact %d of %d between %p and %p\n",
                 c+1, found_contacts,
-                ptr(contact[c].collidables[0]),
-                ptr(contact[c].collidables[1]));
-            contact[c].applyCollisionImpulse();
-            for(int i=0; i<2; i++)
-                contact[c].collidables[i]->integrate(stop_time,
-                    geom_instances[contact[c].collidables[i]]->transforms_1);
-            Contact c_reverse = contact[c];
+                ptr(contacts[c].collidables[0]),
+                ptr(contacts[c].collidables[1]));
+            contacts[c].applyCollisionImpulse();
+            for(int i=0; i<2; i++) {
+                Collidable *collidable = ptr(contacts[c].collidables[i]);
+                // It may have been removed by an earlier contact
+                if (collidable->handle < 0) continue;
+                if (collidable->sleeping) collidable->wake();
+                collidable->integrate(stop_time,
+                    instances[collidable->handle].transforms_1);
+            }
+            Contact c_reverse = contacts[c];
             c_reverse.swap();
-            contact[c].collidables[0]->collide(contact[c]);
-            contact[c].collidables[1]->collide(c_reverse);
+            contacts[c].collidables[0]->collide(contacts[c]);
+            contacts[c].collidables[1]->collide(c_reverse);
         }
 
         delta_t -= stop_time;
     } // while delta_t > 0
+    collideSweptPoints();
+    stats.response_us += microseconds() - t;
+    publishStats(game, step_delta_t);
+
+    running = false;
+    for (size_t i=0; i<pending.size(); i++) addInstance(pending[i]);
+    pending.clear();
 }
 
-Ptr<Collidable> CollisionManager::lineQuery(
-    const Vector &a,
-    const Vector &b,
-    Vector * out_x,
-    Vector * out_normal,
-    Ptr<Collidable> nocollide)
+// Puts the counters of the step into the debug data, for the profiling
+// graph and scripts, and into the trace
+void CollisionManager::publishStats(Ptr<IGame> game, float delta_t) {
+    if (trace.isOpen()) {
+        CollisionTraceStep step;
+        step.step = step_count;
+        step.delta_t = delta_t;
+        step.stats = stats;
+        trace.writeStep(step);
+    }
+    if (!game) return;
+    Ptr<DataNode> data = game->getDebugData();
+    if (!data) return;
+    data->setInt("collide_restarts", stats.passes > 0 ? stats.passes - 1 : 0);
+    data->setInt("collide_candidates", stats.candidates);
+    data->setInt("collide_tests", stats.tests);
+    data->setInt("collide_iterations", stats.iterations);
+    data->setInt("collide_queue_peak", stats.queue_peak);
+    data->setInt("collide_aborted", stats.aborted);
+    data->setInt("collide_contacts", stats.contacts);
+    data->setInt("collide_sleeping", stats.sleeping);
+    data->setInt("collide_points", stats.points);
+    data->setInt("collide_subdiv_time", stats.subdiv_time);
+    data->setInt("collide_subdiv_sphere", stats.subdiv_space[BoundingNode::NONE]);
+    data->setInt("collide_subdiv_leaf", stats.subdiv_space[BoundingNode::LEAF]);
+    data->setInt("collide_subdiv_inner", stats.subdiv_space[BoundingNode::INNER]);
+    data->setInt("collide_subdiv_domain", stats.subdiv_space[BoundingNode::NEWDOMAIN]);
+    data->setInt("collide_subdiv_transform", stats.subdiv_space[BoundingNode::TRANSFORM]);
+    data->setInt("collide_subdiv_gate", stats.subdiv_space[BoundingNode::GATE]);
+    data->setInt("collide_broadphase_us", stats.broadphase_us);
+    data->setInt("collide_narrowphase_us", stats.narrowphase_us);
+    data->setInt("collide_response_us", stats.response_us);
+}
+
+// Writes the pair tests of the pass that took trace_min_iterations or ran
+// out of them to the trace
+void CollisionManager::tracePairs(int n_tests, float delta_t) {
+    for (int i=0; i<n_tests; i++) {
+        const PairTest & test = tests[i];
+        if (test.iterations < trace_min_iterations && !test.aborted) continue;
+
+        CollisionTracePair pair;
+        pair.step = step_count;
+        pair.pass = stats.passes - 1;
+        pair.delta_t = delta_t;
+        for (int k=0; k<2; k++) {
+            int id = k ? test.pair.second : test.pair.first;
+            const GeometryInstance & instance =
+                instances[broad_phase_instances[id]];
+            Collidable *collidable = ptr(instance.collidable);
+            pair.handles[k] = collidable->handle;
+            pair.geometries[k] =
+                traceGeometry(ptr(collidable->getBoundingGeometry()));
+            const Transform *ends[2] =
+                { &instance.transforms_0[0], &instance.transforms_1[0] };
+            float *dst[2] = { pair.from[k], pair.to[k] };
+            for (int e=0; e<2; e++) {
+                dst[e][0] = ends[e]->quat().real();
+                for (int j=0; j<3; j++) {
+                    dst[e][1+j] = ends[e]->quat().imag()[j];
+                    dst[e][4+j] = ends[e]->vec()[j];
+                }
+            }
+        }
+        pair.result = test.result;
+        pair.aborted = test.aborted;
+        pair.iterations = test.iterations;
+        pair.queue_peak = test.queue_peak;
+        pair.subdiv_time = test.subdiv_time;
+        pair.subdiv_space = test.subdiv_space;
+        trace.writePair(pair);
+    }
+}
+
+int CollisionManager::traceGeometry(const BoundingGeometry *bg) {
+    int id = trace.findGeometry(bg);
+    if (id >= 0) return id;
+    // Geometries that weren't loaded by queryGeometry have no name
+    std::string name;
+    typedef std::map<std::string, Ptr<BoundingGeometry> >::const_iterator Iter;
+    for (Iter i=bounding_geometries.begin(); i!=bounding_geometries.end(); ++i) {
+        if (ptr(i->second) == bg) name = i->first;
+    }
+    return trace.addGeometry(bg, name);
+}
+
+// Tests the paths of all terrain tested collidables from transforms_0 to the
+// interpolation at u between transforms_0 and transforms_1 in one batch.
+// The pass begins at the fraction start of the step.
+void CollisionManager::testTerrain(Ptr<IGame> game, float start, float u) {
+    terrain_segments.clear();
+    terrain_tested.clear();
+    for(size_t h=0; h<instances.size(); h++) {
+        GeometryInstance & instance = instances[h];
+        Collidable *collidable = ptr(instance.collidable);
+        if (!collidable || !collidable->isTerrainTested()
+            || collidable->isSweptPoint()) continue;
+
+        TerrainSegment segment;
+        segment.a = instance.transforms_0[0].vec();
+        segment.b = u < 1.0f
+            ? interp(u, instance.transforms_0[0], instance.transforms_1[0]).vec()
+            : instance.transforms_1[0].vec();
+        segment.hit = false;
+        terrain_segments.push_back(segment);
+        terrain_tested.push_back(collidable);
+    }
+    // The paths of the swept points end where they hit something
+    float end = start + u * (1 - start);
+    for(size_t i=0; i<swept_points.size(); i++) {
+        const SweptPoint & point = swept_points[i];
+        GeometryInstance & instance = instances[point.handle];
+        Collidable *collidable = ptr(instance.collidable);
+        if (!collidable || !collidable->isTerrainTested()) continue;
+
+        TerrainSegment segment;
+        segment.a = instance.transforms_0[0].vec();
+        if (point.target >= 0 && point.t <= end) {
+            segment.b = point.t > start ? point.x : segment.a;
+        } else {
+            segment.b = u < 1.0f
+                ? interp(u, instance.transforms_0[0], instance.transforms_1[0]).vec()
+                : instance.transforms_1[0].vec();
+        }
+        segment.hit = false;
+        terrain_segments.push_back(segment);
+        terrain_tested.push_back(collidable);
+    }
+    if (terrain_segments.empty()) return;
+
+    Ptr<ITerrain> terrain = game->getTerrain();
+    if (terrain) {
+        terrain->linesCollide(terrain_segments.size(), &terrain_segments[0]);
+    }
+    for(size_t i=0; i<terrain_tested.size(); i++) {
+        const TerrainSegment & segment = terrain_segments[i];
+        terrain_tested[i]->setTerrainHit(segment.hit, segment.x);
+    }
+}
+
+namespace {
+// Whether the segment from a to a+d passes through the sphere, and where
+// along it it enters, at 0 if it starts inside
+bool entersSphere(const Vector & a, const Vector & d,
+                  const Vector & center, float r, float *t)
 {
-    BoundingBox box;
-    box.pos =(a+b)/2;
-    for(int i=0; i<3; ++i) box.dim[i] = std::abs(a[i]-b[i])/2;
-    
-    Ptr<Collidable> best_collidable;
-    Vector best_x, best_normal;
-    
-    for(GeomIter i=geom_instances.begin(); i!=geom_instances.end(); ++i) {
-        if (i->first == nocollide) {
-            continue;
+    Vector m = a - center;
+    float c = m*m - r*r;
+    if (c <= 0) {
+        *t = 0;
+        return true;
+    }
+    float md = m*d;
+    if (md >= 0) return false;
+    float dd = d*d;
+    float disc = md*md - dd*c;
+    if (disc < 0) return false;
+    *t = (-md - sqrtf(disc)) / dd;
+    return *t <= 1;
+}
+
+#define SWEPT_POINT_TOLERANCE 0.01f // Off the relative path, in meters
+#define SWEPT_POINT_MAX_PIECES 32
+
+// Where the path from a to b first hits an instance that moves from its
+// transforms_0 to its transforms_1 in the same time. The path is followed
+// relative to the instance and tested against it at transforms_0. Where
+// the instance turns, the relative path is curved, it is split into pieces
+// that stay within SWEPT_POINT_TOLERANCE of it. Returns the fraction of the
+// path up to the hit, the normal at the hit at that time, and how far the
+// point of the instance that is hit moves in the whole interval.
+bool hitsMovingInstance(const Vector & a, const Vector & b,
+                        const GeometryInstance & instance,
+                        float *out_s, Vector *out_normal, int *out_domain,
+                        Vector *out_v)
+{
+    Transform T0 = instance.transforms_0[0], T1 = instance.transforms_1[0];
+    T0.normalize();
+    T1.normalize();
+    float cos_half = fabsf(real(T0.quat() * T1.quat().conj()));
+    float angle = 2 * acosf(std::min(cos_half, 1.0f));
+    const BoundingGeometry *geometry =
+        ptr(instance.collidable->getBoundingGeometry());
+    Vector d = b - a;
+    // A piece that turns by w strays about w (length + r) / 8 off it
+    float length = (d - T1.vec() + T0.vec()).length();
+    float r = geometry->getBoundingRadius();
+    int n = 1;
+    while (n < SWEPT_POINT_MAX_PIECES
+           && angle / n * (length / n + r) > 8 * SWEPT_POINT_TOLERANCE)
+        n++;
+    Transform inv0 = T0.inv();
+    const BoundingNode *root = geometry->getRootNode();
+
+    Vector p = a;               // On the path relative to the instance at T0
+    for(int i=1; i<=n; i++) {
+        float s1 = (float) i / n;
+        Transform T = interp(s1, T0, T1);
+        T.normalize();
+        Vector q = T0(T.inv()(a + s1 * d));
+        Vector x, normal;
+        int domain;
+        if (intersectLineNode(p, q, 0, instance.transforms_0[0], &instance,
+                              root, &x, &normal, 0, &domain))
+        {
+            Vector e = q - p;
+            float ee = e*e;
+            float s = (i - 1 + (ee > 0 ? (x - p) * e / ee : 0)) / n;
+            T = interp(s, T0, T1);
+            T.normalize();
+            Vector local = inv0(x);
+            *out_s = s;
+            *out_normal = T.quat().rot(inv0.quat().rot(normal));
+            *out_domain = domain;
+            *out_v = T1(local) - T0(local);
+            return true;
         }
-        float r = i->first->getBoundingGeometry()->getBoundingRadius();
-        Vector d = i->second->transforms_0[0].vec() - box.pos;
-        
-        // We try to sort out non-intersecting objects as fast as we can
-        // by performing an AABB-AABB test. The second AABB wraps
-        // the tested object's bounding sphere.
-        for(int j=0; j<3; ++j) {
-            if (std::abs(d[j]) > r + box.dim[j]) {
-                continue;
-            }
+        p = q;
+    }
+    return false;
+}
+}
+
+// Makes the broad phase ready for line queries. Until the first pass of
+// run(), its boxes are those of the last step, which needn't hold the
+// bounding spheres at transforms_0 anymore, so they are set to those.
+void CollisionManager::prepareLineQueries() {
+    if (!line_query_boxes) {
+        for(size_t h=0; h<instances.size(); h++) {
+            GeometryInstance & instance = instances[h];
+            if (!instance.collidable || instance.broad_phase_id < 0) continue;
+            const Vector & p = instance.transforms_0[0].vec();
+            float r = instance.collidable->getBoundingGeometry()->getBoundingRadius();
+            Vector dim(r, r, r);
+            broad_phase.set(instance.broad_phase_id, p - dim, p + dim);
         }
-        
-        // If we have come so far, we might still sort out an object with a
-        // separating axis test, i.e. a real AABB<->sphere test.
-        float d_len = d.length();
-        if (d_len > 1e-5) {
-            d /= d_len;
-            float dim_dot_abs_d =
-                box.dim[0]*std::abs(d[0]) +
-                box.dim[1]*std::abs(d[1]) +
-                box.dim[2]*std::abs(d[2]);
-            if (dim_dot_abs_d + r < d_len) {
-                continue;
-            }
+        line_query_boxes = true;
+    }
+    broad_phase.prepareSegments();
+}
+
+// The candidates are the collidables whose broad phase boxes the segment
+// passes through, and those that aren't in the broad phase yet. They are
+// tested in the order the segment enters their bounding spheres, until the
+// next sphere lies behind the first hit found. Only reads the instances and
+// the broad phase, so that lineQueries can run it on several threads.
+void CollisionManager::resolveLineQuery(LineQuery & query, LineQueryJob & job)
+{
+    const Vector & a = query.a, & b = query.b;
+    Vector d = b - a;
+
+    job.handles.clear();
+    broad_phase.findSegment(a, b, job.handles);
+    for(size_t i=0; i<job.handles.size(); i++) {
+        job.handles[i] = broad_phase_instances[job.handles[i]];
+    }
+    job.handles.insert(job.handles.end(), unindexed.begin(), unindexed.end());
+
+    job.candidates.clear();
+    for(size_t i=0; i<job.handles.size(); i++) {
+        const GeometryInstance & instance = instances[job.handles[i]];
+        Collidable *collidable = ptr(instance.collidable);
+        if (!collidable || collidable == query.nocollide) continue;
+        float r = collidable->getBoundingGeometry()->getBoundingRadius();
+        float t;
+        if (entersSphere(a, d, instance.transforms_0[0].vec(), r, &t)) {
+            job.candidates.push_back(std::make_pair(t, job.handles[i]));
         }
-        
-        // If we have come he we must perform a fine-grained intersection test
-        Vector new_x;
-        Vector new_normal;
+    }
+    std::sort(job.candidates.begin(), job.candidates.end());
+
+    query.collidable = 0;
+    float best_t = 0, dd = d*d;
+    for(size_t i=0; i<job.candidates.size(); i++) {
+        if (query.collidable && job.candidates[i].first > best_t) break;
+        const GeometryInstance *instance = &instances[job.candidates[i].second];
+        Vector x, normal;
+        int domain;
         bool intersect = intersectLineNode(
             a,b,
-            0, i->second->transforms_0[0],                  // xform_id, xform
-            i->second,                                      // geom_instance
-            i->first->getBoundingGeometry()->getRootNode(), // node
-            &new_x, &new_normal);
-            
-        
-        if (intersect && (!best_collidable || (new_x-best_x) * (b-a) < 0)) {
-            best_collidable = i->first;
-            best_x = new_x;
-            best_normal = new_normal;
+            0, instance->transforms_0[0],                    // xform_id, xform
+            instance,                                        // geom_instance
+            instance->collidable->getBoundingGeometry()->getRootNode(), // node
+            &x, &normal, 0, &domain);
+        if (!intersect) continue;
+        float t = dd > 0 ? (x - a) * d / dd : 0;
+        if (!query.collidable || t < best_t) {
+            query.collidable = ptr(instance->collidable);
+            query.x = x;
+            query.normal = normal;
+            query.domain = domain;
+            best_t = t;
         }
     }
-    
-    if (best_collidable) {
-        if (out_x) *out_x = best_x;
-        if (out_normal) *out_normal = best_normal;
+}
+
+// Like resolveLineQuery for the rest of the path of a swept point. The
+// candidates are the collidables whose broad phase boxes the path passes
+// through, which hold their paths for the rest of the step. Each one is
+// tested as it moves along its path at the same time, see
+// hitsMovingInstance. After the first pass, the point is only tested again
+// if it may hit a collidable touched by a contact, the paths of the others
+// are the same.
+void CollisionManager::resolveSweptPoint(SweptPoint & point,
+                                         LineQueryJob & job)
+{
+    if (!point.test) return;
+    GeometryInstance & source = instances[point.handle];
+    const Vector & a = point.a;
+    Vector d = point.b - a;
+
+    job.handles.clear();
+    broad_phase.findSegment(a, point.b, job.handles);
+    if (point.start > 0) {
+        bool changed = false;
+        if (point.target >= 0) {
+            const GeometryInstance & target = instances[point.target];
+            changed = !target.collidable || touched[target.broad_phase_id];
+        }
+        for(size_t i=0; i<job.handles.size() && !changed; i++) {
+            changed = touched[job.handles[i]];
+        }
+        if (!changed) return;
+    }
+    job.candidates.clear();
+    for(size_t i=0; i<job.handles.size(); i++) {
+        int h = broad_phase_instances[job.handles[i]];
+        GeometryInstance & instance = instances[h];
+        Collidable *collidable = ptr(instance.collidable);
+        if (!collidable || !collidable->isCollidingEnabled()
+            || source.collidable->noCollideWith(instance.collidable))
+            continue;
+        // The center of the bounding sphere moves straight along
+        Vector shift = instance.transforms_1[0].vec()
+                     - instance.transforms_0[0].vec();
+        float r = collidable->getBoundingGeometry()->getBoundingRadius();
+        float t;
+        if (entersSphere(a, d - shift, instance.transforms_0[0].vec(), r, &t))
+        {
+            job.candidates.push_back(std::make_pair(t, h));
+        }
+    }
+    std::sort(job.candidates.begin(), job.candidates.end());
+
+    point.target = -1;
+    float best_s = 0;
+    for(size_t i=0; i<job.candidates.size(); i++) {
+        if (point.target >= 0 && job.candidates[i].first > best_s) break;
+        const GeometryInstance & instance = instances[job.candidates[i].second];
+        float s;
+        Vector normal, v;
+        int domain;
+        if (!hitsMovingInstance(a, point.b, instance, &s, &normal, &domain, &v))
+            continue;
+        if (point.target < 0 || s < best_s) {
+            point.target = job.candidates[i].second;
+            best_s = s;
+            point.t = point.start + s * (1 - point.start);
+            point.x = a + s * d;
+            // Towards the point, as Contact::n is towards collidables[0]
+            point.normal = normal * (d - v) > 0 ? -normal : normal;
+            point.domain = domain;
+            point.v[0] = d * point.normal / point.duration;
+            point.v[1] = v * point.normal / point.duration;
+        }
+    }
+}
+
+// Tests the rest of the paths of the swept points from start, while the
+// broad phase boxes hold the paths of the others. The first pass sets up
+// the points, the later ones test again those that haven't hit anything
+// yet. Until a point is stopped, its transforms hold its whole path.
+void CollisionManager::testSweptPoints(bool first_pass, float start,
+                                       float duration)
+{
+    if (first_pass) {
+        swept_points.clear();
+        for(size_t i=0; i<point_handles.size(); i++) {
+            SweptPoint point;
+            point.handle = point_handles[i];
+            point.target = -1;
+            swept_points.push_back(point);
+        }
+    }
+    bool any = false;
+    for(size_t i=0; i<swept_points.size(); i++) {
+        SweptPoint & point = swept_points[i];
+        const GeometryInstance & instance = instances[point.handle];
+        point.test = instance.collidable
+            && instance.collidable->isCollidingEnabled()
+            && (point.target < 0 || point.t > start);
+        if (!point.test) continue;
+        if (first_pass) stats.points++;
+        point.start = start;
+        point.duration = duration;
+        point.a = instance.transforms_0[0].vec();
+        point.b = instance.transforms_1[0].vec();
+        any = true;
+    }
+    if (!any) return;
+
+    broad_phase.prepareSegments();
+    runLineQueryJobs(swept_points.size(), 0, &swept_points[0]);
+}
+
+// Stops the swept points that hit something between the fractions start
+// and end of the step where they hit it
+void CollisionManager::stopSweptPoints(float start, float end) {
+    for(size_t i=0; i<swept_points.size(); i++) {
+        const SweptPoint & point = swept_points[i];
+        if (point.target < 0 || point.t <= start || point.t > end) continue;
+        GeometryInstance & instance = instances[point.handle];
+        if (!instance.collidable) continue;
+        float u = (point.t - start) / (1 - start);
+        int n = instance.collidable->getBoundingGeometry()->getNumOfTransforms();
+        for(int j=0; j<n; j++) {
+            instance.transforms_0[j] = instance.transforms_1[j] = interp(u,
+                instance.transforms_0[j], instance.transforms_1[j]);
+        }
+    }
+}
+
+// Applies the impulses of the swept points that hit something in this step
+// and calls collide() of them and of what they hit, as for other contacts
+void CollisionManager::collideSweptPoints() {
+    for(size_t i=0; i<swept_points.size(); i++) {
+        const SweptPoint & point = swept_points[i];
+        if (point.target < 0) continue;
+        // Either may have been removed by an earlier contact
+        const Ptr<Collidable> & source = instances[point.handle].collidable;
+        const Ptr<Collidable> & target = instances[point.target].collidable;
+        if (!source || !target) continue;
+
+        Contact c;
+        c.collidables[0] = source;
+        c.collidables[1] = target;
+        c.domains[0] = 0;
+        c.domains[1] = point.domain;
+        c.p = point.x;
+        c.n = point.normal;
+        c.v[0] = point.v[0];
+        c.v[1] = point.v[1];
+        c.applyCollisionImpulse();
+        if (target->sleeping) target->wake();
+        Contact c_reverse = c;
+        c_reverse.swap();
+        c.collidables[0]->collide(c);
+        c.collidables[1]->collide(c_reverse);
+        stats.contacts++;
+    }
+}
+
+Ptr<Collidable> CollisionManager::lineQuery(
+    const Vector &a,
+    const Vector &b,
+    Vector * out_x,
+    Vector * out_normal,
+    Ptr<Collidable> nocollide)
+{
+    LineQuery query;
+    query.a = a;
+    query.b = b;
+    query.nocollide = ptr(nocollide);
+
+    prepareLineQueries();
+    if (line_query_jobs.empty()) line_query_jobs.push_back(new LineQueryJob);
+    resolveLineQuery(query, *line_query_jobs[0]);
+
+    if (query.collidable) {
+        if (out_x) *out_x = query.x;
+        if (out_normal) *out_normal = query.normal;
+    }
+    return query.collidable;
+}
+
+void CollisionManager::lineQueries(int n, LineQuery *queries) {
+    if (n <= 0) return;
+    prepareLineQueries();
+    runLineQueryJobs(n, queries, 0);
+}
+
+// Resolves the queries or, if there are none, the swept points on the
+// narrow phase pool
+void CollisionManager::runLineQueryJobs(int n, LineQuery *queries,
+                                        SweptPoint *points)
+{
+    // Without threads, a single job resolves them all
+    int per_job = narrowphase_pool->getThreadCount() > 0
+        ? LINE_QUERIES_PER_JOB : n;
+    int n_jobs = (n + per_job - 1) / per_job;
+    while ((int) line_query_jobs.size() < n_jobs) {
+        line_query_jobs.push_back(new LineQueryJob);
+    }
+    for(int j=0; j<n_jobs; j++) {
+        LineQueryJob *job = line_query_jobs[j];
+        job->manager = this;
+        job->queries = queries ? queries + j*per_job : 0;
+        job->points = points ? points + j*per_job : 0;
+        job->n = std::min(per_job, n - j*per_job);
+        narrowphase_pool->add(job);
     }
-    
-    return best_collidable;
+    narrowphase_pool->wait();
 }
 
 } // namespace Collide
@@ -1,19 +1,25 @@
 #ifndef COLLISIONMANAGER_H
 #define COLLISIONMANAGER_H
 
-#include <queue>
 #include <map>
 #include <vector>
 #include <tnl.h>
+#include <WorkerPool.h>
 #include <modules/physics/RigidBody.h>
 #include <modules/math/Transform.h>
 #include "BoundingBox.h"
 #include "Collidable.h"
 #include "Contact.h"
 #include "PossibleContact.h"
-#include "SweepNPrune.h"
+#include "BroadPhase.h"
+#include "CollisionStats.h"
+#include "CollisionTrace.h"
+#include "GeometryInstance.h"
+#include "NarrowPhase.h"
 #include <interfaces/IActor.h>
+#include <interfaces/IConfig.h>
 #include <interfaces/IGame.h>
+#include <interfaces/ITerrain.h>
 
 
 namespace Collide {
@@ -24,30 +30,120 @@ struct Contact;
 struct GeometryInstance;
 struct PossibleContact;
 union Hints; // defined in Primitive.h
+struct LineQueryJob;
+
+/// A segment for CollisionManager::lineQueries, with the first collidable
+/// it hits. The collidables are plain pointers, so that the queries can be
+/// resolved on other threads without touching their reference counts.
+struct LineQuery {
+    Vector a, b;                // the segment to test
+    Collidable *nocollide;      // ignored by the test, may be 0
+    Collidable *collidable;     // set to the first one hit, 0 if none
+    Vector x, normal;           // set to the point and normal of the hit
+    int domain;                 // set to the domain of the hit
+};
+
+/// The path of a swept point collidable in a step, and its first hit
+struct SweptPoint {
+    int handle;
+    bool test;                  // Whether to test the path in this pass
+    float start;                // Fraction of the step before the path
+    float duration;             // Seconds from a to b
+    Vector a, b;                // The rest of the path in the step
+    int target;                 // Handle of the collidable hit, -1 if none
+    float t;                    // Fraction of the step up to the hit
+    Vector x, normal;
+    int domain;
+    float v[2];                 // Velocities along the normal, as in Contact
+};
 
 
 class CollisionManager : virtual public Object {
-    typedef std::map<Ptr<Collidable>, GeometryInstance *> GeomInstances;
-    typedef GeomInstances::iterator GeomIter;
-    typedef Ptr<Collidable> Key;
-    typedef std::vector<std::pair<Key, Key> > ContactList;
+    typedef BroadPhase::PairList ContactList;
     typedef ContactList::iterator ContactIter;
 
-    GeomInstances geom_instances;
-    std::priority_queue<PossibleContact> queue;
-    SweepNPrune<Ptr<Collidable>, float> sweep_n_prune;
+    // The geometry instances by Collidable::handle, with their transforms in
+    // one pool. Nothing here is freed between steps, so that a step doesn't
+    // allocate unless the world has grown.
+    std::vector<GeometryInstance> instances;
+    std::vector<int> free_instances;
+    std::vector<Transform> transforms;
+    std::vector<std::vector<int> > free_transforms; // By number of transforms
+    std::vector<Ptr<Collidable> > pending;  // Added during run()
+    bool running;
+
+    BroadPhase broad_phase;
+    std::vector<int> broad_phase_instances;     // By id, handles
+    ContactList possible_contacts;
+    ContactList unresolved;             // Pairs to test again in the next pass
+    std::vector<bool> touched;          // By id, partners of the last contacts
+    float contact_time_tolerance;
+    WorkerPool *narrowphase_pool;       // Tests the candidate pairs
+    SDL_mutex *earliest_mutex;          // Guards the earliest contact found
+    std::vector<PairTest> tests;
+    std::vector<NarrowPhaseJob *> jobs;
+    std::vector<int> contact_tests;
+    std::vector<Contact> contacts;
     std::map<std::string, Ptr<BoundingGeometry> > bounding_geometries;
+    bool use_geometry_cache;
+    std::vector<TerrainSegment> terrain_segments;
+    std::vector<Collidable *> terrain_tested;
+    // Whether the broad phase boxes hold the bounding spheres at
+    // transforms_0, which line queries look for their candidates in
+    bool line_query_boxes;
+    std::vector<int> unindexed;         // Handles not in the broad phase
+    std::vector<int> point_handles;     // Of the swept points
+    std::vector<SweptPoint> swept_points;
+    std::vector<LineQueryJob *> line_query_jobs;
+    CollisionStats stats;               // Of the last step
+    int step_count;
+    CollisionTrace trace;
+    int trace_min_iterations;           // Of the pair tests traced
+    // Collidables that move slower than the sleep velocities for sleep_time
+    // seconds fall asleep, until they are accelerated by more than the wake
+    // accelerations. A sleep_time of 0 keeps them all awake.
+    float sleep_time;
+    float sleep_velocity, sleep_angular_velocity;
+    float wake_acceleration, wake_angular_acceleration;
+
+    void testTerrain(Ptr<IGame> game, float start, float u);
+    void addInstance(Ptr<Collidable> c);
+    bool keepsSleeping(const GeometryInstance & instance);
+    bool fallsAsleep(GeometryInstance & instance, float delta_t);
+    void prepareLineQueries();
+    void resolveLineQuery(LineQuery & query, LineQueryJob & job);
+    void resolveSweptPoint(SweptPoint & point, LineQueryJob & job);
+    void runLineQueryJobs(int n, LineQuery *queries, SweptPoint *points);
+    void testSweptPoints(bool first_pass, float start, float duration);
+    void stopSweptPoints(float start, float end);
+    void collideSweptPoints();
+    friend struct LineQueryJob;
+    void publishStats(Ptr<IGame> game, float delta_t);
+    void tracePairs(int n_tests, float delta_t);
+    int traceGeometry(const BoundingGeometry *bg);
 
 public:
-	CollisionManager();
+    /// Reads the CollisionManager_* keys of the config, if given
+	CollisionManager(Ptr<IConfig> config=0);
 	~CollisionManager();
 
     Ptr<BoundingGeometry> queryGeometry(const std::string & name);
 
+    /// Collidables added during run() take part from the next step on.
+    /// Swept points, see Collidable::setSweptPoint, are tested against
+    /// the paths of the others in the first pass of a step, and again in
+    /// the passes after contacts changed the paths they may hit. They get
+    /// their collide() calls at the end of the step.
+    /// Those that allow it fall asleep when they rest, see
+    /// Collidable::isSleeping.
     void add(Ptr<Collidable> c);
     void remove(Ptr<Collidable> c);
 
     void run(Ptr<IGame> game, float delta_t);
+
+    /// What the last run() did. It is also put into the game's debug data
+    /// as collide_* values.
+    inline const CollisionStats & getStats() const { return stats; }
     
     /// Static line intersection test.
     /// Finds the first intersection on a line from a to b.
@@ -67,6 +163,10 @@ public:
         Vector * x=0,
         Vector * normal=0,
         Ptr<Collidable> nocollide=0);
+
+    /// Resolves n line queries at once, like lineQuery. They are spread
+    /// over the narrow phase threads, if there are any.
+    void lineQueries(int n, LineQuery *queries);
 };
 
 
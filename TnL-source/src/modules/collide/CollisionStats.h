@@ -0,0 +1,54 @@
+#ifndef COLLIDE_COLLISIONSTATS_H
+#define COLLIDE_COLLISIONSTATS_H
+
+#include <cstring>
+#include "BoundingNode.h"
+
+namespace Collide {
+
+/// What CollisionManager::run did in one step. The narrow phase jobs count
+/// their share on their own, it is added up after each pass. Plain data, so
+/// that it can be written to a trace as it is.
+struct CollisionStats {
+    int passes;         ///< One plus the restarts after contacts
+    int candidates;     ///< Pairs found by the broad phase, in all passes
+    int tests;          ///< Pairs tested by the narrow phase, in all passes
+    int iterations;     ///< Possible contacts taken from the queues
+    int queue_peak;     ///< Longest queue of a single test
+    int aborted;        ///< Tests that ran out of iterations
+    int subdiv_time;
+    /// Subdivisions in space by the BoundingNode type of the subdivided
+    /// node. Bounding spheres count as NONE, NONE nodes can't be divided.
+    int subdiv_space[BoundingNode::GATE + 1];
+    int contacts;
+    int sleeping;       ///< Collidables that slept through the integration
+    int points;         ///< Swept points tested
+    int broadphase_us;  ///< Microseconds spent in the broad phase,
+    int narrowphase_us; ///< the narrow phase and the collision response
+    int response_us;    ///< including the terrain tests
+
+    inline void clear() { memset(this, 0, sizeof(*this)); }
+
+    inline CollisionStats & operator+= (const CollisionStats & s) {
+        passes += s.passes;
+        candidates += s.candidates;
+        tests += s.tests;
+        iterations += s.iterations;
+        if (s.queue_peak > queue_peak) queue_peak = s.queue_peak;
+        aborted += s.aborted;
+        subdiv_time += s.subdiv_time;
+        for (int i=0; i<=BoundingNode::GATE; i++)
+            subdiv_space[i] += s.subdiv_space[i];
+        contacts += s.contacts;
+        sleeping += s.sleeping;
+        points += s.points;
+        broadphase_us += s.broadphase_us;
+        narrowphase_us += s.narrowphase_us;
+        response_us += s.response_us;
+        return *this;
+    }
+};
+
+} // namespace Collide
+
+#endif
@@ -0,0 +1,97 @@
+#include <cstring>
+#include <debug.h>
+#include "BoundingGeometry.h"
+#include "CollisionTrace.h"
+
+namespace Collide {
+
+CollisionTrace::CollisionTrace()
+:   out(0)
+{ }
+
+CollisionTrace::~CollisionTrace()
+{
+    close();
+}
+
+bool CollisionTrace::open(const char *name)
+{
+    close();
+    out = fopen(name, "wb");
+    if (!out) {
+        ls_warning("CollisionTrace: Can't write %s\n", name);
+        return false;
+    }
+
+    CollisionTraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COLLISION_TRACE_MAGIC, 4);
+    header.version = COLLISION_TRACE_VERSION;
+    header.byte_order = COLLISION_TRACE_BYTE_ORDER;
+    if (fwrite(&header, sizeof(header), 1, out) != 1) {
+        ls_warning("CollisionTrace: Can't write %s\n", name);
+        close();
+        return false;
+    }
+    ls_message("CollisionTrace: Writing %s\n", name);
+    return true;
+}
+
+void CollisionTrace::close()
+{
+    if (out) fclose(out);
+    out = 0;
+    geometries.clear();
+}
+
+bool CollisionTrace::write(int type, const void *data, int size,
+                           const void *extra, int extra_size)
+{
+    if (!out) return false;
+    CollisionTraceRecord record;
+    record.type = type;
+    record.size = size + extra_size;
+    bool ok = fwrite(&record, sizeof(record), 1, out) == 1
+        && fwrite(data, size, 1, out) == 1
+        && (extra_size == 0 || fwrite(extra, extra_size, 1, out) == 1);
+    if (!ok) {
+        // Most likely the disk is full, don't keep trying every step
+        ls_warning("CollisionTrace: Write failed, stopping the trace\n");
+        close();
+    }
+    return ok;
+}
+
+int CollisionTrace::findGeometry(const BoundingGeometry *bg) const
+{
+    std::map<const BoundingGeometry *, int>::const_iterator i =
+        geometries.find(bg);
+    return i == geometries.end() ? -1 : i->second;
+}
+
+int CollisionTrace::addGeometry(const BoundingGeometry *bg,
+                                const std::string & name)
+{
+    int id = geometries.size();
+    geometries[bg] = id;
+
+    CollisionTraceGeometry geometry;
+    geometry.id = id;
+    geometry.bounding_radius = bg->getBoundingRadius();
+    geometry.name_size = name.size();
+    write(TRACE_GEOMETRY, &geometry, sizeof(geometry),
+          name.data(), name.size());
+    return id;
+}
+
+void CollisionTrace::writePair(const CollisionTracePair & pair)
+{
+    write(TRACE_PAIR, &pair, sizeof(pair));
+}
+
+void CollisionTrace::writeStep(const CollisionTraceStep & step)
+{
+    write(TRACE_STEP, &step, sizeof(step));
+}
+
+} // namespace Collide
@@ -0,0 +1,105 @@
+#ifndef COLLIDE_COLLISIONTRACE_H
+#define COLLIDE_COLLISIONTRACE_H
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include "CollisionStats.h"
+
+/*
+A collision trace records what CollisionManager::run did in every step, and
+the pair tests that took many iterations, so that the pairs which run into
+NarrowPhaseJob::MAX_ITERATIONS can be found and replayed. It is written when
+CollisionManager_trace names a file, tnl-collidetrace prints it.
+
+The file begins with a CollisionTraceHeader. Records follow one after the
+other, each one a CollisionTraceRecord with the type and size of the data
+that follows it, so that readers can skip types they don't know. Everything
+is in the byte order of the machine that wrote it.
+*/
+
+#define COLLISION_TRACE_MAGIC      "TLCT"
+#define COLLISION_TRACE_VERSION    3
+#define COLLISION_TRACE_BYTE_ORDER 0x01020304
+
+namespace Collide {
+
+class BoundingGeometry;
+
+typedef struct {
+    char magic[4];
+    int version;
+    int byte_order;         /* Detects traces written on other platforms  */
+} CollisionTraceHeader;
+
+enum CollisionTraceType {
+    TRACE_GEOMETRY = 1,     /* A CollisionTraceGeometry and its name       */
+    TRACE_PAIR,             /* A CollisionTracePair                        */
+    TRACE_STEP              /* A CollisionTraceStep, after its pairs       */
+};
+
+typedef struct {
+    int type;
+    int size;               /* Of the data that follows                   */
+} CollisionTraceRecord;
+
+/* Written before the first pair that uses the geometry */
+typedef struct {
+    int id;
+    float bounding_radius;
+    int name_size;          /* The name follows, without a terminating 0  */
+} CollisionTraceGeometry;
+
+typedef struct {
+    int step, pass;
+    float delta_t;          /* Of the pass                                 */
+    int handles[2];         /* Collidable::handle of the partners          */
+    int geometries[2];
+    float from[2][7];       /* The root transforms of the partners at the  */
+    float to[2][7];         /* beginning and the end of the pass, each one */
+                            /* a quaternion w x y z and a position         */
+    int result;             /* PairTest::Result                            */
+    int aborted;
+    int iterations;
+    int queue_peak;
+    int subdiv_time;
+    int subdiv_space;
+} CollisionTracePair;
+
+typedef struct {
+    int step;
+    float delta_t;
+    CollisionStats stats;
+} CollisionTraceStep;
+
+/// Writes a collision trace
+class CollisionTrace {
+    FILE *out;
+    std::map<const BoundingGeometry *, int> geometries;
+
+    bool write(int type, const void *data, int size,
+               const void *extra=0, int extra_size=0);
+
+    CollisionTrace(const CollisionTrace &);
+    CollisionTrace & operator= (const CollisionTrace &);
+public:
+    CollisionTrace();
+    ~CollisionTrace();
+
+    /// Starts a new trace, closing the current one
+    bool open(const char *name);
+    void close();
+    inline bool isOpen() const { return out != 0; }
+
+    /// The id of a geometry written before, or -1
+    int findGeometry(const BoundingGeometry *bg) const;
+    /// Writes a geometry and returns its id
+    int addGeometry(const BoundingGeometry *bg, const std::string & name);
+
+    void writePair(const CollisionTracePair & pair);
+    void writeStep(const CollisionTraceStep & step);
+};
+
+} // namespace Collide
+
+#endif
@@ -28,7 +28,7 @@ struct ContactPartner {
         data.triangle = t;
     }
 
-    inline ContactPartner(GeometryInstance * g, BoundingNode * n, int dom=0, int tr=0)
+    inline ContactPartner(GeometryInstance * g, const BoundingNode * n, int dom=0, int tr=0)
     :   instance(g), type(NODE),
         domain(dom), transform(tr)
     {
@@ -7,18 +7,17 @@
 
 namespace Collide {
 
+/// The CollisionManager's state of a collidable. The instances are kept in
+/// a table indexed by Collidable::handle, their transforms in a pool shared
+/// by all of them.
 struct GeometryInstance {
-    Ptr<Collidable> collidable;
+    Ptr<Collidable> collidable; // 0 if the table entry is unused
     Transform * transforms_0; // The state at the beginning and the end of the
     Transform * transforms_1; // active time interval
+    int transform_index;      // Of transforms_0 in the pool
+    int broad_phase_id;       // -1 until the CollisionManager assigns one
 
     GeometryInstance();
-    GeometryInstance(Ptr<Collidable> c);
-    GeometryInstance(const GeometryInstance & g);
-
-    ~GeometryInstance();
-
-    GeometryInstance & operator=(const GeometryInstance & g);
 };
 
 } // namespace Collide
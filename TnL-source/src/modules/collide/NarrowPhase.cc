@@ -0,0 +1,64 @@
+#include "NarrowPhase.h"
+
+namespace Collide {
+
+void NarrowPhaseJob::run() {
+    stats.clear();
+    earliest_t = earliest->get();
+    for (int i=0; i<n; i++) test(tests[i]);
+}
+
+void NarrowPhaseJob::test(PairTest & test) {
+    queue.clear();
+    queue.push(test.start);
+    test.result = PairTest::NO_CONTACT;
+    test.aborted = false;
+    test.iterations = test.queue_peak = 0;
+    test.subdiv_time = test.subdiv_space = 0;
+    while (!queue.empty()) {
+        if ((int) queue.size() > test.queue_peak)
+            test.queue_peak = queue.size();
+        if (test.iterations == MAX_ITERATIONS) {
+            test.aborted = true;
+            test.result = PairTest::UNRESOLVED;
+            break;
+        }
+        if (test.iterations % EARLIEST_INTERVAL == 0)
+            earliest_t = earliest->get();
+        // Contacts popped later won't begin any earlier
+        if (queue.top().t0 > earliest_t + tolerance) {
+            test.result = PairTest::UNRESOLVED;
+            break;
+        }
+        PossibleContact & pc = queue.pop();
+        test.iterations++;
+
+        if (pc.mustSubdivide()) {
+            subdivide(test, pc);
+            continue;
+        }
+        if (!pc.collide(delta_t, test.hints)) continue;
+        if (pc.shouldDivideTime(test.hints)) {
+            ++test.subdiv_time;
+            pc.divideTime(queue);
+            continue;
+        }
+        if (pc.canSubdivide()) {
+            subdivide(test, pc);
+            continue;
+        }
+
+        test.pc = pc;
+        test.result = PairTest::CONTACT;
+        earliest_t = earliest->publish(test.mid());
+        break;
+    }
+
+    stats.tests++;
+    stats.iterations += test.iterations;
+    if (test.queue_peak > stats.queue_peak) stats.queue_peak = test.queue_peak;
+    if (test.aborted) stats.aborted++;
+    stats.subdiv_time += test.subdiv_time;
+}
+
+} // namespace Collide
@@ -0,0 +1,99 @@
+#ifndef COLLIDE_NARROWPHASE_H
+#define COLLIDE_NARROWPHASE_H
+
+#include <vector>
+#include <WorkerPool.h>
+#include "BroadPhase.h"
+#include "CollisionStats.h"
+#include "PossibleContact.h"
+#include "Primitive.h"
+
+namespace Collide {
+
+/// The earliest contact time found by any of the pair tests so far. Pair
+/// tests stop as soon as they can't find a contact that would be resolved
+/// together with it. The tests only read it every few iterations, so
+/// reading takes the lock as well.
+struct EarliestContact {
+    SDL_mutex *mutex;   ///< 0 if all tests run on one thread
+    float t;
+
+    inline float get() const {
+        if (mutex) SDL_LockMutex(mutex);
+        float result = t;
+        if (mutex) SDL_UnlockMutex(mutex);
+        return result;
+    }
+    /// Returns the earliest time, which may be before u
+    inline float publish(float u) {
+        if (mutex) SDL_LockMutex(mutex);
+        if (u < t) t = u;
+        float result = t;
+        if (mutex) SDL_UnlockMutex(mutex);
+        return result;
+    }
+};
+
+/// The narrow phase test of one candidate pair
+struct PairTest {
+    enum Result {
+        NO_CONTACT,     ///< Doesn't collide before delta_t
+        CONTACT,        ///< First contact in pc and hints
+        UNRESOLVED      ///< Stopped before the end
+    };
+
+    BroadPhase::Pair pair;
+    PossibleContact start;
+    PossibleContact pc;
+    Hints hints;
+    Result result;
+    bool aborted;       ///< Ran out of iterations
+    int iterations;
+    int queue_peak;
+    int subdiv_time, subdiv_space;
+
+    inline float mid() const { return (pc.t0 + pc.t1)/2; }
+};
+
+/// Orders the contacts found by time, and those at the same time by pair,
+/// so that the contacts chosen don't depend on the order the tests finished
+/// in
+struct EarlierContact {
+    const std::vector<PairTest> & tests;
+    EarlierContact(const std::vector<PairTest> & tests) : tests(tests) { }
+    inline bool operator() (int a, int b) const {
+        float ta = tests[a].mid(), tb = tests[b].mid();
+        return ta < tb || (ta == tb && tests[a].pair < tests[b].pair);
+    }
+};
+
+/// Tests a range of pairs, each with a queue of its own. The tests only
+/// read the geometry instances, everything they find is applied by
+/// CollisionManager::run. The jobs are kept from one step to the next, so
+/// that their queues can reuse their storage. Each job counts what its
+/// tests did in stats, which CollisionManager::run adds up.
+struct NarrowPhaseJob : public WorkerPool::Job {
+    enum { MAX_ITERATIONS = 2048 };     ///< Per pair
+    enum { EARLIEST_INTERVAL = 16 };    ///< Iterations between reads of earliest
+
+    PairTest *tests;
+    int n;
+    float delta_t;
+    float tolerance;
+    EarliestContact *earliest;
+    float earliest_t;   ///< Copy of earliest->t, refreshed now and then
+    ContactQueue queue;
+    CollisionStats stats;
+
+    void run();
+    void test(PairTest & test);
+
+    inline void subdivide(PairTest & test, PossibleContact & pc) {
+        ++test.subdiv_space;
+        ++stats.subdiv_space[pc.subdivide(queue)];
+    }
+};
+
+} // namespace Collide
+
+#endif
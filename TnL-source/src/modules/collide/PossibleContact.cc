@@ -20,6 +20,19 @@
     #define debug_msg(...)
 #endif
 
+namespace Collide {
+
+#ifdef DEBUG_MESSAGES
+static int next_identifier = 0;
+inline void PossibleContact::newIdentifier() {
+    identifier = next_identifier++;
+}
+#else
+inline void PossibleContact::newIdentifier() { }
+#endif
+
+} // namespace Collide
+
 
 using namespace std;
 
@@ -82,7 +95,7 @@ template<class T>
 XTransform<T> get_transform(const T & u, int i,
                             Collide::GeometryInstance * instance)
 {
-    Ptr<Collide::BoundingGeometry> geom =
+    const Ptr<Collide::BoundingGeometry> & geom =
         instance->collidable->getBoundingGeometry();
     XTransform<T> transform = interp(u,
         (XTransform<T>) instance->transforms_0[i],
@@ -98,12 +111,12 @@ XTransform<T> get_transform(const T & u, int i,
 }
 
 template<class T>
-std::vector<XTransform<T> >
-get_transform_stack(const T & u, int i,
-                    Collide::GeometryInstance * instance)
+void get_transform_stack(const T & u, int i,
+                         Collide::GeometryInstance * instance,
+                         std::vector<XTransform<T> > & stack)
 {
-    std::vector<XTransform<T> > stack;
-    Ptr<Collide::BoundingGeometry> geom =
+    stack.clear();
+    const Ptr<Collide::BoundingGeometry> & geom =
         instance->collidable->getBoundingGeometry();
     
     stack.push_back(interp(u,
@@ -118,7 +131,6 @@ get_transform_stack(const T & u, int i,
     }
     
     std::reverse(stack.begin(), stack.end());
-    return stack;
 }
 
 template<class T>
@@ -157,19 +169,17 @@ void divide_transform_stack(
     }
 }
 
-Collide::TransformInterval
-make_transform_interval(
+void make_transform_interval(
     int xform_id,
     Collide::GeometryInstance * instance,
     float t0,
-    float t1)
+    float t1,
+    Collide::TransformInterval & result)
 {
-    Collide::TransformInterval result;
-    result.xforms_at_t0 = get_transform_stack(t0, xform_id, instance);
-    result.xforms_at_t1 = get_transform_stack(t1, xform_id, instance);
+    get_transform_stack(t0, xform_id, instance, result.xforms_at_t0);
+    get_transform_stack(t1, xform_id, instance, result.xforms_at_t1);
     result.xform_in_interval = get_inbetween_xform(
         result.xforms_at_t0, result.xforms_at_t1);
-    return result;
 }
 
 /*
@@ -177,7 +187,7 @@ template<class T>
 XVector<3,T> get_velocity(XVector<3,T> x, const T & u, int i,
                           Collide::GeometryInstance * instance)
 {
-    Ptr<Collide::BoundingGeometry> geom =
+    const Ptr<Collide::BoundingGeometry> & geom =
         instance->collidable->getBoundingGeometry();
     XVector<3,T> a(1,1,1), b(1,1,1), c;
 
@@ -216,6 +226,7 @@ void TransformInterval::subdivide(
 }
 
 void PossibleContact::setPartner(int i, GeometryInstance * instance) {
+	if (i == 0) newIdentifier();
 	partners[i] = ContactPartner(
 		instance,
 		ptr(instance->collidable->getBoundingGeometry()));
@@ -233,7 +244,7 @@ bool PossibleContact::mustSubdivide() {
     return false;
 }
 
-void PossibleContact::subdivide(std::priority_queue<PossibleContact> & q) {
+int PossibleContact::subdivide(ContactQueue & q) {
     if (!partners[1].canSubdivide()) {
         swap(partners[0], partners[1]);
         swap(ti[0], ti[1]);
@@ -247,7 +258,7 @@ void PossibleContact::subdivide(std::priority_queue<PossibleContact> & q) {
             swap(ti[0], ti[1]);
         }
     }
-    PossibleContact new_contact;
+    PossibleContact & new_contact = q.scratch(0);
     new_contact.t0 = t0;
     new_contact.t1 = t1;
     new_contact.partners[1] = partners[0];
@@ -271,7 +282,7 @@ void PossibleContact::subdivide(std::priority_queue<PossibleContact> & q) {
                 debug_msg(" -> triangle contact_%d\n", new_contact.identifier);
 
                 new_contact.partners[0].data.triangle =
-                    & node.data.leaf.vertices[i];
+                    node.vertices() + i;
                 assert(new_contact.partners[1].type == partners[0].type);
 			    assert(new_contact.partners[0].instance->collidable->getActor()
 			    	!= new_contact.partners[1].instance->collidable->getActor());
@@ -284,7 +295,7 @@ void PossibleContact::subdivide(std::priority_queue<PossibleContact> & q) {
                 new_contact.newIdentifier();
                 debug_msg(" -> node contact_%d\n", new_contact.identifier);
                 
-                new_contact.partners[0].data.node = node.data.inner.children[i];
+                new_contact.partners[0].data.node = node.child(i);
                 assert(new_contact.partners[1].type == partners[0].type);
 			    assert(new_contact.partners[0].instance->collidable->getActor()
 			    	!= new_contact.partners[1].instance->collidable->getActor());
@@ -294,7 +305,7 @@ void PossibleContact::subdivide(std::priority_queue<PossibleContact> & q) {
         case BoundingNode::NEWDOMAIN:
             debug_msg(" -> node contact_%d with new domain %d\n", new_contact.identifier, node.data.domain.domain_id);
             new_contact.partners[0].type = ContactPartner::NODE;
-            new_contact.partners[0].data.node = node.data.domain.child;
+            new_contact.partners[0].data.node = node.child();
             new_contact.partners[0].domain = node.data.domain.domain_id;
             assert(new_contact.partners[1].type == partners[0].type);
 		    assert(new_contact.partners[0].instance->collidable->getActor()
@@ -304,13 +315,14 @@ void PossibleContact::subdivide(std::priority_queue<PossibleContact> & q) {
         case BoundingNode::TRANSFORM:
             debug_msg(" -> node contact_%d with new transform %d\n", new_contact.identifier, node.data.transform.transform_id);
             new_contact.partners[0].type = ContactPartner::NODE;
-            new_contact.partners[0].data.node = node.data.transform.child;
+            new_contact.partners[0].data.node = node.child();
             new_contact.partners[0].transform = node.data.transform.transform_id;
             
-            new_contact.ti[0] = make_transform_interval(
+            make_transform_interval(
                 new_contact.partners[0].transform, // the transform id
                 new_contact.partners[0].instance,  // the geometry instance with link to the collidable (which has BoundingGeometry)
-                new_contact.t0, new_contact.t1);   // the relevant time interval
+                new_contact.t0, new_contact.t1,    // the relevant time interval
+                new_contact.ti[0]);
             
             debug_msg("  ->xforms_at_t0:      \n\t%s\n", dump_vector_transform(new_contact.ti[0].xforms_at_t0).c_str());
             debug_msg("  ->xforms_at_t1:      \n\t%s\n", dump_vector_transform(new_contact.ti[0].xforms_at_t1).c_str());
@@ -323,11 +335,12 @@ void PossibleContact::subdivide(std::priority_queue<PossibleContact> & q) {
             break;
         case BoundingNode::GATE:
             new_contact.partners[0].type = ContactPartner::NODE;
-            for(int i=0; i<node.data.gate.n_children; ++i) {
+            for(const BoundingNode *child = node.child();
+                child != node.next(); child = child->next()) {
                 new_contact.newIdentifier();
                 debug_msg(" -> node contact_%d (via gate)\n", new_contact.identifier);
 
-                new_contact.partners[0].data.node = &node.data.gate.children[i];
+                new_contact.partners[0].data.node = child;
                 assert(new_contact.partners[1].type == partners[0].type);
 			    assert(new_contact.partners[0].instance->collidable->getActor()
 			    	!= new_contact.partners[1].instance->collidable->getActor());
@@ -337,6 +350,7 @@ void PossibleContact::subdivide(std::priority_queue<PossibleContact> & q) {
         case BoundingNode::NONE:
             break;
         }
+        return node.type;
     } else {
         // isSphere() == true
         debug_msg(" -> box contact_%d from sphere\n", new_contact.identifier);
@@ -346,6 +360,7 @@ void PossibleContact::subdivide(std::priority_queue<PossibleContact> & q) {
 	    assert(new_contact.partners[0].instance->collidable->getActor()
 	    	!= new_contact.partners[1].instance->collidable->getActor());
         q.push(new_contact);
+        return BoundingNode::NONE;
     }
 }
 
@@ -384,9 +399,12 @@ bool PossibleContact::shouldDivideTime(const Hints & hints) {
     return t1 - t0 > 0.001f;
 }
 
-void PossibleContact::divideTime(std::priority_queue<PossibleContact> & q) {
+void PossibleContact::divideTime(ContactQueue & q) {
     float t_mid = 0.5f*(t0+t1);
-    PossibleContact new_0, new_1;
+    PossibleContact & new_0 = q.scratch(0);
+    PossibleContact & new_1 = q.scratch(1);
+    new_0.newIdentifier();
+    new_1.newIdentifier();
     debug_msg("contact_%d dividing time: %f-%f (new midpoint:%f)\n", identifier, t0, t1, t_mid);
     debug_msg("New contacts: contact_%d, contact_%d\n", new_0.identifier, new_1.identifier);
     ti[0].subdivide(new_0.ti[0], new_1.ti[0]);
@@ -474,20 +492,10 @@ bool PossibleContact::collide(float delta_t, Hints & hints) {
 
     debug_msg("PossibleContact contact_%d performing collision test:\n", identifier);
     if (partners[0].isNode() && partners[1].isNode()) {
-        IVector orient0[3], orient1[3];
-        orient0[0] = T0.quat().rot(IVector(1,0,0));
-        orient0[1] = T0.quat().rot(IVector(0,1,0));
-        orient0[2] = T0.quat().rot(IVector(0,0,1));
-        orient1[0] = T1.quat().rot(IVector(1,0,0));
-        orient1[1] = T1.quat().rot(IVector(0,1,0));
-        orient1[2] = T1.quat().rot(IVector(0,0,1));
-
         // bounding box intersection test
         return intersectBoxBox(
-            partners[0].data.node->box,
-            T0((IVector) partners[0].data.node->box.pos), orient0,
-            partners[1].data.node->box,
-            T1((IVector) partners[1].data.node->box.pos), orient1,
+            partners[0].data.node->box, PackedITransform(T0),
+            partners[1].data.node->box, PackedITransform(T1),
             hints);
     }
 
@@ -719,4 +727,33 @@ bool PossibleContact::makeContact(Contact & c, float delta_t,
 }
 	
 	
+void ContactQueue::push(const PossibleContact & c) {
+    PossibleContact *slot;
+    if (unused.empty()) {
+        contacts.push_back(c);
+        slot = &contacts.back();
+    } else {
+        slot = unused.back();
+        unused.pop_back();
+        *slot = c;
+    }
+    heap.push_back(slot);
+    std::push_heap(heap.begin(), heap.end(), Later());
+}
+
+PossibleContact & ContactQueue::pop() {
+    if (popped) unused.push_back(popped);
+    std::pop_heap(heap.begin(), heap.end(), Later());
+    popped = heap.back();
+    heap.pop_back();
+    return *popped;
+}
+
+void ContactQueue::clear() {
+    heap.clear();
+    unused.clear();
+    for (size_t i=0; i<contacts.size(); i++) unused.push_back(&contacts[i]);
+    popped = 0;
+}
+
 }
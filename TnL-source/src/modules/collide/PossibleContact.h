@@ -1,8 +1,9 @@
 #ifndef COLLIDE_POSSIBLECONTACT_H
 #define COLLIDE_POSSIBLECONTACT_H
 
+#include <algorithm>
+#include <deque>
 #include <vector>
-#include <queue>
 
 #include <modules/math/Interval.h>
 #include "ContactPartner.h"
@@ -20,15 +21,14 @@ struct TransformInterval {
 	void subdivide(TransformInterval & ti0, TransformInterval & ti1);
 };
 
+class ContactQueue;
+
 struct PossibleContact {
-    // Debug identifier to trace contacts
-    inline PossibleContact() {
-        newIdentifier();
-    }
-    inline void newIdentifier() {
-        static int _next_identifier = 0;
-        identifier = _next_identifier++;
-    }
+    inline PossibleContact() : identifier(0) { }
+    // Debug identifier to trace contacts. Only numbers the contacts if
+    // PossibleContact.cc is compiled with DEBUG_MESSAGES, the counter isn't
+    // thread safe.
+    void newIdentifier();
     int identifier;
     float t0, t1;
     
@@ -48,13 +48,67 @@ struct PossibleContact {
         return partners[0].canSubdivide() || partners[1].canSubdivide();
     }
     bool mustSubdivide();
-    void subdivide(std::priority_queue<PossibleContact> & q);
+    /// Returns the BoundingNode type of the node that was divided, NONE
+    /// for a bounding sphere
+    int subdivide(ContactQueue & q);
     bool shouldDivideTime(const Hints & hints);
-    void divideTime(std::priority_queue<PossibleContact> & q);
+    void divideTime(ContactQueue & q);
     bool collide(float delta_t, Hints & hints);
     bool makeContact(Contact & c, float delta_t, const Hints & hints);
 };
 
+/// Priority queue of possible contacts, earliest first.
+///
+/// Works like a std::priority_queue<PossibleContact>, but keeps the contacts
+/// in storage of its own. Contacts are pushed by assigning them to ones
+/// that were popped before, which reuses the storage of their transform
+/// intervals, so that a queue in steady use doesn't allocate.
+class ContactQueue {
+    struct Later {
+        inline bool operator() (const PossibleContact * a,
+                                const PossibleContact * b) const {
+            return *a < *b;
+        }
+    };
+
+    std::deque<PossibleContact> contacts;   // Never shrinks
+    std::vector<PossibleContact*> unused;
+    std::vector<PossibleContact*> heap;
+    PossibleContact *popped;
+    PossibleContact scratch_contacts[2];
+
+    // The contacts point into the storage of the queue
+    ContactQueue(const ContactQueue &);
+    ContactQueue & operator= (const ContactQueue &);
+
+public:
+    inline ContactQueue() : popped(0) { }
+
+    inline bool empty() const { return heap.empty(); }
+    inline size_t size() const { return heap.size(); }
+    inline const PossibleContact & top() const { return *heap.front(); }
+
+    void push(const PossibleContact & c);
+    /// Removes the earliest contact and returns it. It stays valid until
+    /// the next pop() or clear().
+    PossibleContact & pop();
+    void clear();
+
+    /// Contacts to build the ones to push in, kept here for their storage
+    inline PossibleContact & scratch(int i) { return scratch_contacts[i]; }
+};
+
 } // namespace Collide
 
+namespace std {
+/// Exchanges the transforms without copying them
+template<> inline void swap(Collide::TransformInterval & a,
+                            Collide::TransformInterval & b)
+{
+    a.xforms_at_t0.swap(b.xforms_at_t0);
+    a.xforms_at_t1.swap(b.xforms_at_t1);
+    swap(a.xform_in_interval, b.xform_in_interval);
+}
+} // namespace std
+
 #endif
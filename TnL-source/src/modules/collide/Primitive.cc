@@ -75,6 +75,107 @@ bool intersectBoxBox(const BoundingBox & box1,
     return true;
 }
 
+// q v q* as a matrix, for a quaternion q = (w,x,y,z) that doesn't need to
+// have unit length
+PackedITransform::PackedITransform(const ITransform & T)
+{
+    const Interval & w = T.quat().real();
+    const IVector & v = T.quat().imag();
+    Interval zero(0);
+
+    Interval sq[4];             // ww xx yy zz
+    square(PackedInterval(w, v[0], v[1], v[2])).store(sq);
+    PackedInterval e = PackedInterval(v[0], v[0], v[1], zero)
+                     * PackedInterval(v[1], v[2], v[2], zero);
+    PackedInterval f = PackedInterval(w, w, w, zero)
+                     * PackedInterval(v[2], v[1], v[0], zero);
+
+    Interval diag[4], plus[4], minus[4];
+    (PackedInterval(sq[0]) + PackedInterval(sq[1], -sq[1], -sq[1], zero)
+        + PackedInterval(-sq[2], sq[2], -sq[2], zero)
+        + PackedInterval(-sq[3], -sq[3], sq[3], zero)).store(diag);
+    ((e + f) * 2.0f).store(plus);       // xy+wz xz+wy yz+wx
+    ((e - f) * 2.0f).store(minus);      // xy-wz xz-wy yz-wx
+
+    axes[0] = PackedInterval(diag[0], plus[0], minus[1], zero);
+    axes[1] = PackedInterval(minus[0], diag[1], plus[2], zero);
+    axes[2] = PackedInterval(plus[1], minus[2], diag[2], zero);
+    q = PackedInterval(w, v[0], v[1], v[2]);
+    t = PackedInterval(T.vec(), zero);
+}
+
+PackedInterval PackedITransform::operator() (const Vector & v) const
+{
+    // r = q (0,v), with r_w in lane 0
+    PackedInterval r =
+          shuffle<1,0,0,0>(q) * PackedInterval(Vector(-v[0], v[0], v[1]), v[2])
+        + shuffle<2,2,3,1>(q) * PackedInterval(Vector(-v[1], v[2], v[0]), v[1])
+        + shuffle<3,3,1,2>(q) * PackedInterval(Vector(-v[2],-v[1],-v[2]),-v[0]);
+    // The imaginary part of r q*, that is w r_v - r_w q_v - r_v x q_v
+    return splat<0>(q) * shuffle<1,2,3,0>(r) - splat<0>(r) * shuffle<1,2,3,0>(q)
+        + (shuffle<3,1,2,0>(r) * shuffle<2,3,1,0>(q)
+           - shuffle<2,3,1,0>(r) * shuffle<3,1,2,0>(q))
+        + t;
+}
+
+namespace {
+
+// Tests axis I of the box whose axes are in axis_rows. Row k holds component
+// k of the three axes of a box in lanes 0 to 2. The rows of the first box
+// have the distance between the boxes in lane 3.
+template<int I>
+inline bool separates(const PackedInterval * axis_rows,
+                      const PackedInterval * rows1,
+                      const PackedInterval * rows2,
+                      PackedLanes::Floats dim1, PackedLanes::Floats dim2)
+{
+    PackedInterval a0 = splat<I>(axis_rows[0]);
+    PackedInterval a1 = splat<I>(axis_rows[1]);
+    PackedInterval a2 = splat<I>(axis_rows[2]);
+    PackedInterval d1 = abs(a0*rows1[0] + a1*rows1[1] + a2*rows1[2]);
+    PackedInterval d2 = abs(a0*rows2[0] + a1*rows2[1] + a2*rows2[2]);
+    Interval B = sum3(mulPositive(d1, dim1) + mulPositive(d2, dim2));
+    return d1[3] > B;
+}
+
+} // namespace
+
+bool intersectBoxBox(const BoundingBox & box1, const PackedITransform & T1,
+                     const BoundingBox & box2, const PackedITransform & T2,
+                     Hints & hints)
+{
+    PackedInterval pos1 = T1(box1.pos), pos2 = T2(box2.pos);
+    PackedInterval rows1[4] = {
+        T1.axes[0], T1.axes[1], T1.axes[2], pos2 - pos1 };
+    PackedInterval rows2[4] = {
+        T2.axes[0], T2.axes[1], T2.axes[2], PackedInterval(Interval(0)) };
+    transpose(rows1[0], rows1[1], rows1[2], rows1[3]);
+    transpose(rows2[0], rows2[1], rows2[2], rows2[3]);
+    PackedLanes::Floats dim1 =
+        PackedLanes::set(box1.dim[0], box1.dim[1], box1.dim[2], 0);
+    PackedLanes::Floats dim2 =
+        PackedLanes::set(box2.dim[0], box2.dim[1], box2.dim[2], 0);
+
+    if (separates<0>(rows1, rows1, rows2, dim1, dim2) ||
+        separates<1>(rows1, rows1, rows2, dim1, dim2) ||
+        separates<2>(rows1, rows1, rows2, dim1, dim2) ||
+        separates<0>(rows2, rows1, rows2, dim1, dim2) ||
+        separates<1>(rows2, rows1, rows2, dim1, dim2) ||
+        separates<2>(rows2, rows1, rows2, dim1, dim2))
+    {
+        return false;
+    }
+
+    hints.box.exactness = (pos1 + pos2).maxLength3();
+    for(int i=0; i<3; i++) {
+        if (i==0 || box1.dim[i] > hints.box.max_box_dim)
+            hints.box.max_box_dim = box1.dim[i];
+        if (box2.dim[i] > hints.box.max_box_dim)
+            hints.box.max_box_dim = box2.dim[i];
+    }
+    return true;
+}
+
 bool intersectBoxSphere(const BoundingBox & box,
                         const IVector & pos1, const IVector * orient1,
                         float radius, const IVector & pos2,
@@ -374,7 +475,9 @@ bool intersectTriangleTriangle(const Vector * triangle1,
 
 Transform get_transform(int xform_id, const Collide::GeometryInstance * geom_instance)
 {
-    Ptr<BoundingGeometry> geom = geom_instance->collidable->getBoundingGeometry();
+    // By reference, line queries may run on several threads
+    const Ptr<BoundingGeometry> & geom =
+        geom_instance->collidable->getBoundingGeometry();
     Transform xform = geom_instance->transforms_0[xform_id];
     
     int new_id;
@@ -415,7 +518,7 @@ bool isPointInPrism(const Vector &p3d, const Vector *tri, const Vector & normal)
 }
 
 bool intersectLineTriangle(const Vector &a, const Vector &b,
-                           Vector * tri_lcs,
+                           const Vector * tri_lcs,
                            const Transform & xform,
                            Vector *out_x, Vector *out_normal)
 {
@@ -445,7 +548,7 @@ bool intersectLineTriangle(const Vector &a, const Vector &b,
 
 bool earliestIntersectionLineTriangle(bool previous_result,
                                       const Vector &a, const Vector &b,
-                                      Vector * tri_lcs,
+                                      const Vector * tri_lcs,
                                       const Transform & xform,
                                       Vector *inout_x, Vector *out_normal)
 {
@@ -578,7 +681,8 @@ bool intersectLineNode(const Vector &a, const Vector &b,
                        const Transform & xform,
                        const GeometryInstance * geom_instance,
                        const BoundingNode * node,
-                       Vector * out_x, Vector *out_normal)
+                       Vector * out_x, Vector *out_normal,
+                       int domain, int *out_domain)
 {
     begin_func
     debug_msg("Testing line %.2f %.2f %.2f -> %.2f %.2f %.2f against:\n",
@@ -636,13 +740,14 @@ bool intersectLineNode(const Vector &a, const Vector &b,
                 intersect = earliestIntersectionLineTriangle(
                     intersect,
                     a,b,
-                    node->data.leaf.vertices+3*i,
+                    node->vertices()+3*i,
                     xform,
                     &x, &normal);
             }
             if (intersect) {
                 if (out_x) *out_x = x;
                 if (out_normal) *out_normal = normal;
+                if (out_domain) *out_domain = domain;
             }
             debug_msg(" -> %s\n", intersect?"INTERSECT":"nothing");
             end_func
@@ -661,24 +766,29 @@ bool intersectLineNode(const Vector &a, const Vector &b,
             
             bool found = false;
             Vector best_x, best_normal;
+            int best_domain = domain;
             for (int i=0; i<2; ++i) {
                 Vector new_x, new_normal;
+                int new_domain;
                 bool res = intersectLineNode(
                     a,b,
                     xform_id, xform,
                     geom_instance,
-                    node->data.inner.children[i],
-                    &new_x, &new_normal);
+                    node->child(i),
+                    &new_x, &new_normal,
+                    domain, &new_domain);
                 
                 if (res && (!found || (new_x-best_x) * (b-a) < 0)) {
                     found = true;
                     best_x = new_x;
                     best_normal = new_normal;
+                    best_domain = new_domain;
                 }
             }
             if (found) {
                 if (out_x) *out_x = best_x;
                 if (out_normal) *out_normal = best_normal;
+                if (out_domain) *out_domain = best_domain;
             }
             debug_msg(" -> %s\n", found?"INTERSECT":"nothing");
             end_func
@@ -691,8 +801,9 @@ bool intersectLineNode(const Vector &a, const Vector &b,
                 xform_id,
                 xform,
                 geom_instance,
-                node->data.domain.child,
-                out_x, out_normal);
+                node->child(),
+                out_x, out_normal,
+                node->data.domain.domain_id, out_domain);
             debug_msg(" -> %s\n", intersect?"INTERSECT":"nothing");
             end_func
             return intersect;
@@ -704,8 +815,9 @@ bool intersectLineNode(const Vector &a, const Vector &b,
                 node->data.transform.transform_id,
                 get_transform(node->data.transform.transform_id, geom_instance),
                 geom_instance,
-                node->data.transform.child,
-                out_x, out_normal);
+                node->child(),
+                out_x, out_normal,
+                domain, out_domain);
             debug_msg(" -> %s\n", intersect?"INTERSECT":"nothing");
             end_func
             return intersect;
@@ -714,24 +826,30 @@ bool intersectLineNode(const Vector &a, const Vector &b,
         {
             bool found = false;
             Vector best_x, best_normal;
-            for (int i=0; i<node->data.gate.n_children; ++i) {
+            int best_domain = domain;
+            for (const BoundingNode *child = node->child();
+                 child != node->next(); child = child->next()) {
                 Vector new_x, new_normal;
+                int new_domain;
                 bool res = intersectLineNode(
                     a,b,
                     xform_id, xform,
                     geom_instance,
-                    &node->data.gate.children[i],
-                    &new_x, &new_normal);
+                    child,
+                    &new_x, &new_normal,
+                    domain, &new_domain);
                 
                 if (res && (!found || (new_x-best_x) * (b-a) < 0)) {
                     found = true;
                     best_x = new_x;
                     best_normal = new_normal;
+                    best_domain = new_domain;
                 }
             }
             if (found) {
                 if (out_x) *out_x = best_x;
                 if (out_normal) *out_normal = best_normal;
+                if (out_domain) *out_domain = best_domain;
             }
             debug_msg(" -> %s\n", found?"INTERSECT":"nothing");
             end_func
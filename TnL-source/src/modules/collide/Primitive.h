@@ -4,6 +4,7 @@
 #include <tnl.h>
 #include <modules/collide/BoundingBox.h>
 #include <modules/math/Interval.h>
+#include <modules/math/PackedInterval.h>
 #include <modules/math/Transform.h>
 
 namespace Collide {
@@ -14,6 +15,19 @@ typedef XVector<3,Interval> IVector;
 class BoundingNode;
 struct GeometryInstance;
 
+/// An ITransform in packed intervals, with its rotated axes
+struct PackedITransform {
+    PackedInterval q;           ///< w x y z
+    PackedInterval t;
+    PackedInterval axes[3];     ///< The rotated x, y and z axes
+
+    PackedITransform(const ITransform & T);
+
+    /// The transformed vector in lanes 0 to 2. Like ITransform, this
+    /// rotates by q v q*, which gives narrower intervals than the axes.
+    PackedInterval operator() (const Vector & v) const;
+};
+
 union Hints {
     struct {
         float exactness;
@@ -40,6 +54,12 @@ bool intersectBoxBox(const BoundingBox & box1,
                      const IVector & pos2, const IVector * orient2,
                      Hints & hints);
 
+/// The same test with packed intervals. The results are rounded outward,
+/// so they may differ from the above by a few ulps.
+bool intersectBoxBox(const BoundingBox & box1, const PackedITransform & T1,
+                     const BoundingBox & box2, const PackedITransform & T2,
+                     Hints & hints);
+
 bool intersectBoxSphere(const BoundingBox & box,
                         const IVector & pos1, const IVector * orient1,
                         float radius, const IVector & pos2,
@@ -62,13 +82,13 @@ bool intersectTriangleTriangle(const Vector * triangle1,
 bool isPointInPrism(const Vector &p3d, const Vector *tri, const Vector & normal);
 
 bool intersectLineTriangle(const Vector &a, const Vector &b,
-                           Vector * tri_lcs,
+                           const Vector * tri_lcs,
                            const Transform & xform,
                            Vector *out_x=0, Vector *out_normal=0);
 
 bool earliestIntersectionLineTriangle(bool previous_result,
                                       const Vector &a, const Vector &b,
-                                      Vector * tri_lcs,
+                                      const Vector * tri_lcs,
                                       const Transform & xform,
                                       Vector *inout_x, Vector *out_normal=0);
 
@@ -78,12 +98,16 @@ bool intersectLineBox(bool solid_box,
                       const Transform & xform,
                       Vector *out_x=0, Vector *out_normal=0);
                                
+/// Finds the first hit of the segment from a to b in the subtree of node.
+/// out_domain is set to the domain of the hit, domain being the domain of
+/// node.
 bool intersectLineNode(const Vector &a, const Vector &b,
                        int xform_id,
                        const Transform & xform,
                        const GeometryInstance * geom_instance,
                        const BoundingNode * node,
-                       Vector * out_x=0, Vector *out_normal=0);
+                       Vector * out_x=0, Vector *out_normal=0,
+                       int domain=0, int *out_domain=0);
 
 } // namespace Collide
 
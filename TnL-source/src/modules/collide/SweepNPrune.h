@@ -1,9 +1,9 @@
 #ifndef SWEEPNPRUNE_H
 #define SWEEPNPRUNE_H
 
+#include <algorithm>
 #include <iostream>
 #include <map>
-#include <set>
 #include <vector>
 
 namespace Collide {
@@ -17,7 +17,8 @@ class SweepNPrune {
         Val val;
     };
 
-    typedef std::set<Key> ActiveSet;
+    // Sorted, a vector keeps its storage from one query to the next
+    typedef std::vector<Key> ActiveSet;
     typedef typename ActiveSet::iterator ActiveIter;
     typedef std::vector<Bound> BoundList;
     typedef typename BoundList::iterator BoundIter;
@@ -68,11 +69,12 @@ public:
     inline void findContacts(ContactList & contacts) {
         active_set.clear();
         for(BoundIter i=bounds.begin(); i!=bounds.end(); i++) {
-            ActiveIter ai = active_set.find(i->key);
-            if (ai == active_set.end()) {
-                for(ai = active_set.begin(); ai!=active_set.end(); ai++)
-                    contacts.push_back(std::make_pair(*ai, i->key));
-                active_set.insert(i->key);
+            ActiveIter ai = std::lower_bound(
+                active_set.begin(), active_set.end(), i->key);
+            if (ai == active_set.end() || *ai != i->key) {
+                for(ActiveIter aj = active_set.begin(); aj!=active_set.end(); aj++)
+                    contacts.push_back(std::make_pair(*aj, i->key));
+                active_set.insert(ai, i->key);
             } else {
                 active_set.erase(ai);
                 continue;
@@ -0,0 +1,228 @@
+#include <algorithm>
+#include "SweepNPrune3D.h"
+
+namespace Collide {
+
+SweepNPrune3D::SweepNPrune3D(bool track_changes)
+:   table(16, -1), table_mask(15), track_changes(track_changes)
+{ }
+
+SweepNPrune3D::Handle SweepNPrune3D::add(const Vector & min,
+                                         const Vector & max)
+{
+    Handle h;
+    if (free_handles.empty()) {
+        h = boxes.size();
+        boxes.push_back(Box());
+    } else {
+        h = free_handles.back();
+        free_handles.pop_back();
+    }
+
+    // The new endpoints start at the end of the axes, where the box
+    // overlaps nothing, and are sorted down into place
+    for (int k=0; k<3; k++) {
+        Endpoint e;
+        e.val = min[k];
+        e.data = h << 1;
+        axis[k].push_back(e);
+        e.val = max[k];
+        e.data = h << 1 | MAX_BIT;
+        axis[k].push_back(e);
+        boxes[h].pos[k][0] = axis[k].size() - 2;
+        boxes[h].pos[k][1] = axis[k].size() - 1;
+    }
+    for (int k=0; k<3; k++) {
+        sortDown(k, boxes[h].pos[k][0], true);
+        sortDown(k, boxes[h].pos[k][1], true);
+    }
+    return h;
+}
+
+void SweepNPrune3D::set(Handle h, const Vector & min, const Vector & max)
+{
+    for (int k=0; k<3; k++) updateAxis(k, h, min[k], max[k]);
+}
+
+void SweepNPrune3D::remove(Handle h)
+{
+    // Moving the minimum on the first axis past the end takes it past the
+    // maximum of every box the box overlaps, which removes all its pairs.
+    // The maximum goes first, so that it doesn't pass any minimum.
+    for (int k=0; k<3; k++) {
+        int n = axis[k].size();
+        for (int i=boxes[h].pos[k][1]; i+1<n; i++) swap(k, i, false);
+        for (int i=boxes[h].pos[k][0]; i+2<n; i++) swap(k, i, k == 0);
+        axis[k].resize(n-2);
+    }
+    // Until the next flush, the handle still names the box in the pairs
+    // that were removed
+    if (track_changes) {
+        removed_handles.push_back(h);
+    } else {
+        free_handles.push_back(h);
+    }
+}
+
+void SweepNPrune3D::flushChanges(PairList & added, PairList & removed)
+{
+    for (size_t i=0; i<removed_pairs.size(); i++) {
+        const Pair & p = removed_pairs[i];
+        int j = table[findSlot(p.first, p.second)];
+        if (j < 0) {
+            removed.push_back(p);
+        } else {
+            // Removed and added again
+            pairs[j].born = false;
+        }
+    }
+    removed_pairs.clear();
+    free_handles.insert(free_handles.end(),
+            removed_handles.begin(), removed_handles.end());
+    removed_handles.clear();
+    for (size_t i=0; i<pairs.size(); i++) {
+        if (pairs[i].born) {
+            added.push_back(pairs[i].pair);
+            pairs[i].born = false;
+        }
+    }
+}
+
+void SweepNPrune3D::findContacts(PairList & contacts) const
+{
+    for (size_t i=0; i<pairs.size(); i++) contacts.push_back(pairs[i].pair);
+}
+
+void SweepNPrune3D::updateAxis(int k, Handle h, float min, float max)
+{
+    axis[k][boxes[h].pos[k][0]].val = min;
+    axis[k][boxes[h].pos[k][1]].val = max;
+    // Either endpoint stops at the other one of the same box, since a
+    // minimum goes before a maximum of the same value
+    sortDown(k, boxes[h].pos[k][0], true);
+    sortUp(k, boxes[h].pos[k][0], true);
+    sortDown(k, boxes[h].pos[k][1], true);
+    sortUp(k, boxes[h].pos[k][1], true);
+}
+
+void SweepNPrune3D::sortDown(int k, int i, bool events)
+{
+    while (i > 0 && before(axis[k][i], axis[k][i-1])) {
+        swap(k, i-1, events);
+        --i;
+    }
+}
+
+void SweepNPrune3D::sortUp(int k, int i, bool events)
+{
+    int n = axis[k].size();
+    while (i+1 < n && before(axis[k][i+1], axis[k][i])) {
+        swap(k, i, events);
+        ++i;
+    }
+}
+
+// Swaps the endpoints i and i+1 of axis k. If a minimum and a maximum of
+// different boxes trade places, the boxes begin or stop overlapping on
+// this axis.
+void SweepNPrune3D::swap(int k, int i, bool events)
+{
+    Endpoint & l = axis[k][i];
+    Endpoint & r = axis[k][i+1];
+    Handle hl = l.handle(), hr = r.handle();
+    boxes[hl].pos[k][l.isMax()] = i+1;
+    boxes[hr].pos[k][r.isMax()] = i;
+    std::swap(l, r);
+
+    if (!events || hl == hr || l.isMax() == r.isMax()) return;
+    if (l.isMax()) {
+        // A minimum moved past a maximum to the right. The boxes had a pair
+        // only if they overlap on the other axes.
+        if (overlaps(hl, hr, k)) removePair(hl, hr);
+    } else if (overlaps(hl, hr)) {
+        addPair(hl, hr);
+    }
+}
+
+unsigned int SweepNPrune3D::hash(Handle a, Handle b)
+{
+    unsigned int h = (unsigned int) a * 0x9e3779b1u ^ (unsigned int) b;
+    return h ^ (h >> 15);
+}
+
+// Returns the slot of the table that holds the pair a, b, or the empty
+// slot where it would go
+int SweepNPrune3D::findSlot(Handle a, Handle b) const
+{
+    if (a > b) std::swap(a, b);
+    unsigned int s = hash(a, b) & table_mask;
+    while (table[s] >= 0) {
+        const Pair & p = pairs[table[s]].pair;
+        if (p.first == a && p.second == b) break;
+        s = (s+1) & table_mask;
+    }
+    return s;
+}
+
+void SweepNPrune3D::addPair(Handle a, Handle b)
+{
+    if (a > b) std::swap(a, b);
+    int s = findSlot(a, b);
+    if (table[s] >= 0) return;
+
+    PairEntry e;
+    e.pair = Pair(a, b);
+    e.born = track_changes;
+    table[s] = pairs.size();
+    pairs.push_back(e);
+    if (2*pairs.size() > table.size()) growTable();
+}
+
+void SweepNPrune3D::removePair(Handle a, Handle b)
+{
+    if (a > b) std::swap(a, b);
+    unsigned int s = findSlot(a, b);
+    int j = table[s];
+    if (j < 0) return;
+
+    if (track_changes && !pairs[j].born) {
+        removed_pairs.push_back(pairs[j].pair);
+    }
+
+    // Move the last pair into the hole
+    int last = pairs.size() - 1;
+    if (j != last) {
+        const Pair & p = pairs[last].pair;
+        table[findSlot(p.first, p.second)] = j;
+        pairs[j] = pairs[last];
+    }
+    pairs.pop_back();
+
+    // Shift the following slots of the probe sequence back into the hole
+    unsigned int hole = s;
+    for (unsigned int t = (s+1) & table_mask; table[t] >= 0;
+         t = (t+1) & table_mask)
+    {
+        const Pair & p = pairs[table[t]].pair;
+        unsigned int home = hash(p.first, p.second) & table_mask;
+        // Slots from home to t are occupied; move unless the hole is
+        // outside of that range
+        if (((t - home) & table_mask) >= ((t - hole) & table_mask)) {
+            table[hole] = table[t];
+            hole = t;
+        }
+    }
+    table[hole] = -1;
+}
+
+void SweepNPrune3D::growTable()
+{
+    table.assign(2*table.size(), -1);
+    table_mask = table.size() - 1;
+    for (size_t i=0; i<pairs.size(); i++) {
+        const Pair & p = pairs[i].pair;
+        table[findSlot(p.first, p.second)] = i;
+    }
+}
+
+} // namespace Collide
@@ -0,0 +1,103 @@
+#ifndef SWEEPNPRUNE3D_H
+#define SWEEPNPRUNE3D_H
+
+#include <vector>
+#include <tnl.h>
+
+namespace Collide {
+
+/// Sweep and prune over the x, y and z axes.
+///
+/// The boxes are identified by dense integer handles, which are reused
+/// after a box is removed. Each axis keeps the boxes' endpoints in one
+/// sorted array, which set() repairs by insertion sort. Every swap of a
+/// minimum and a maximum endpoint changes whether the two boxes overlap on
+/// that axis, so the set of overlapping pairs is kept up to date during the
+/// sort instead of being searched anew. Boxes are closed, i.e. boxes that
+/// touch overlap.
+///
+/// With change tracking, flushChanges reports the pairs that began and
+/// stopped overlapping since its last call, and the handles of removed
+/// boxes are only reused after that.
+class SweepNPrune3D {
+public:
+    typedef int Handle;
+    /// Pairs have the lower handle first
+    typedef std::pair<Handle, Handle> Pair;
+    typedef std::vector<Pair> PairList;
+
+    SweepNPrune3D(bool track_changes=true);
+
+    Handle add(const Vector & min, const Vector & max);
+    void set(Handle h, const Vector & min, const Vector & max);
+    void remove(Handle h);
+
+    /// Appends the pairs that overlap now but didn't at the last call to
+    /// added, and the ones that did but don't anymore to removed
+    void flushChanges(PairList & added, PairList & removed);
+    /// Appends all overlapping pairs
+    void findContacts(PairList & contacts) const;
+
+    inline int getNumOfPairs() const { return pairs.size(); }
+
+private:
+    enum { MAX_BIT = 1 };
+
+    struct Endpoint {
+        float val;
+        unsigned int data;  // handle << 1 | MAX_BIT for maxima
+        inline Handle handle() const { return data >> 1; }
+        inline bool isMax() const { return data & MAX_BIT; }
+    };
+
+    struct Box {
+        int pos[3][2];      // Index of the minimum and maximum per axis
+    };
+
+    // Pairs in one array for iteration, found through an open addressing
+    // hash table of indices into it
+    struct PairEntry {
+        Pair pair;
+        bool born;          // Added since the last flushChanges
+    };
+
+    std::vector<Endpoint> axis[3];
+    std::vector<Box> boxes;
+    std::vector<Handle> free_handles;
+    std::vector<Handle> removed_handles;  // Freed at the next flush
+
+    std::vector<PairEntry> pairs;
+    std::vector<int> table;  // -1 for empty slots
+    unsigned int table_mask;
+
+    bool track_changes;
+    PairList removed_pairs;  // Pairs that existed at the last flush
+
+    inline static bool before(const Endpoint & a, const Endpoint & b) {
+        return a.val < b.val || (a.val == b.val && !a.isMax() && b.isMax());
+    }
+    // Whether the boxes overlap on all axes except skip
+    inline bool overlaps(Handle a, Handle b, int skip=-1) const {
+        for (int k=0; k<3; k++) {
+            if (k == skip) continue;
+            if (boxes[a].pos[k][0] > boxes[b].pos[k][1]) return false;
+            if (boxes[b].pos[k][0] > boxes[a].pos[k][1]) return false;
+        }
+        return true;
+    }
+
+    void sortDown(int k, int i, bool events);
+    void sortUp(int k, int i, bool events);
+    void swap(int k, int i, bool events);
+    void updateAxis(int k, Handle h, float min, float max);
+
+    static unsigned int hash(Handle a, Handle b);
+    int findSlot(Handle a, Handle b) const;
+    void addPair(Handle a, Handle b);
+    void removePair(Handle a, Handle b);
+    void growTable();
+};
+
+} // namespace Collide
+
+#endif
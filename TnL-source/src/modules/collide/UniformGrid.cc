@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <cstdlib>
+#include "UniformGrid.h"
+
+namespace Collide {
+
+UniformGrid::UniformGrid(float cell_size)
+:   cell_size(cell_size), current_cell_size(cell_size)
+{ }
+
+void UniformGrid::clear()
+{
+    boxes.clear();
+}
+
+void UniformGrid::add(int id, const Vector & min, const Vector & max)
+{
+    Box b;
+    b.min = min;
+    b.max = max;
+    b.id = id;
+    b.large = false;
+    boxes.push_back(b);
+}
+
+void UniformGrid::chooseCellSize()
+{
+    if (cell_size > 0 || boxes.empty()) {
+        current_cell_size = cell_size > 0 ? cell_size : 1.0f;
+        return;
+    }
+    extents.clear();
+    for (size_t i=0; i<boxes.size(); i++) {
+        const Box & b = boxes[i];
+        extents.push_back(std::max(b.max[0] - b.min[0], b.max[2] - b.min[2]));
+    }
+    std::vector<float>::iterator median = extents.begin() + extents.size()/2;
+    std::nth_element(extents.begin(), median, extents.end());
+    current_cell_size = std::max(*median, 1e-3f);
+}
+
+void UniformGrid::build()
+{
+    chooseCellSize();
+
+    entries.clear();
+    large.clear();
+    for (size_t i=0; i<boxes.size(); i++) {
+        Box & b = boxes[i];
+        int x0 = cellOf(b.min[0]), x1 = cellOf(b.max[0]);
+        int z0 = cellOf(b.min[2]), z1 = cellOf(b.max[2]);
+        if ((x1 - x0 + 1.0f) * (z1 - z0 + 1.0f) > MAX_CELLS) {
+            b.large = true;
+            large.push_back(i);
+            continue;
+        }
+        b.large = false;
+        Entry e;
+        e.box = i;
+        for (int x=x0; x<=x1; x++) {
+            for (int z=z0; z<=z1; z++) {
+                e.cell = key(x, z);
+                entries.push_back(e);
+            }
+        }
+    }
+    std::sort(entries.begin(), entries.end());
+}
+
+void UniformGrid::findContacts(PairList & contacts)
+{
+    build();
+
+    for (size_t begin=0, end; begin<entries.size(); begin=end) {
+        unsigned long long cell = entries[begin].cell;
+        for (end=begin+1; end<entries.size() && entries[end].cell == cell;
+             end++);
+        for (size_t i=begin; i<end; i++) {
+            const Box & a = boxes[entries[i].box];
+            for (size_t j=i+1; j<end; j++) {
+                const Box & b = boxes[entries[j].box];
+                if (!overlaps(a, b)) continue;
+                float x = std::max(a.min[0], b.min[0]);
+                float z = std::max(a.min[2], b.min[2]);
+                if (key(cellOf(x), cellOf(z)) != cell) continue;
+                contacts.push_back(makePair(a.id, b.id));
+            }
+        }
+    }
+
+    for (size_t i=0; i<large.size(); i++) {
+        const Box & a = boxes[large[i]];
+        for (size_t j=0; j<boxes.size(); j++) {
+            const Box & b = boxes[j];
+            // Pairs of large boxes are found from the first one
+            if (b.large && (int) j <= large[i]) continue;
+            if (overlaps(a, b)) contacts.push_back(makePair(a.id, b.id));
+        }
+    }
+}
+
+namespace {
+    // Orders the entries by cell alone, for looking up a cell
+    struct EntryCell {
+        template<class E>
+        inline bool operator() (const E & e, unsigned long long cell) const {
+            return e.cell < cell;
+        }
+        template<class E>
+        inline bool operator() (unsigned long long cell, const E & e) const {
+            return cell < e.cell;
+        }
+    };
+}
+
+void UniformGrid::findSegment(const Vector & a, const Vector & b,
+                              std::vector<int> & ids) const
+{
+    for (size_t i=0; i<large.size(); i++) {
+        const Box & box = boxes[large[i]];
+        if (crosses(box, a, b)) ids.push_back(box.id);
+    }
+
+    // A segment that crosses more cells than there are boxes is cheaper to
+    // test against every box
+    int x = cellOf(a[0]), z = cellOf(a[2]);
+    int x_end = cellOf(b[0]), z_end = cellOf(b[2]);
+    if (std::abs(x_end - x) + std::abs(z_end - z) + 1.0f
+        > (float) boxes.size())
+    {
+        for (size_t i=0; i<boxes.size(); i++) {
+            const Box & box = boxes[i];
+            if (!box.large && crosses(box, a, b)) ids.push_back(box.id);
+        }
+        return;
+    }
+
+    // Walk the cells like LoDQuadManager::pageAlong walks the quads
+    float gx = a[0] / current_cell_size, gz = a[2] / current_cell_size;
+    float dx = (b[0] - a[0]) / current_cell_size;
+    float dz = (b[2] - a[2]) / current_cell_size;
+    int step_x = dx > 0 ? 1 : -1, step_z = dz > 0 ? 1 : -1;
+    float next_x = dx != 0 ? (x + (dx > 0) - gx) / dx : 2.0f;
+    float next_z = dz != 0 ? (z + (dz > 0) - gz) / dz : 2.0f;
+    float delta_x = dx != 0 ? step_x / dx : 2.0f;
+    float delta_z = dz != 0 ? step_z / dz : 2.0f;
+    int prev_x = x, prev_z = z;
+    for (bool first=true; ; first=false) {
+        std::pair<std::vector<Entry>::const_iterator,
+                  std::vector<Entry>::const_iterator> cell = std::equal_range(
+            entries.begin(), entries.end(), key(x, z), EntryCell());
+        for (; cell.first != cell.second; ++cell.first) {
+            const Box & box = boxes[cell.first->box];
+            // Already seen in the last cell
+            if (!first && covers(box, prev_x, prev_z)) continue;
+            if (crosses(box, a, b)) ids.push_back(box.id);
+        }
+
+        if (std::min(next_x, next_z) >= 1 || (x == x_end && z == z_end))
+            break;
+        prev_x = x;
+        prev_z = z;
+        if (next_x < next_z) {
+            x += step_x;
+            next_x += delta_x;
+        } else {
+            z += step_z;
+            next_z += delta_z;
+        }
+    }
+}
+
+} // namespace Collide
@@ -0,0 +1,117 @@
+#ifndef UNIFORMGRID_H
+#define UNIFORMGRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <tnl.h>
+
+namespace Collide {
+
+/// Hashed uniform grid over the x/z plane.
+///
+/// The grid is built anew from the boxes added since the last clear(). A
+/// box is entered into every cell it covers, and the entries are sorted by
+/// cell, so the cells need no storage of their own. A pair is reported only
+/// from the cell that holds the minimum corner of the intersection of the
+/// two boxes, which both of them cover, so no pair is reported twice.
+/// Boxes that would cover more than MAX_CELLS cells are tested against all
+/// others instead. Boxes are closed, i.e. boxes that touch overlap.
+///
+/// Segments are walked through the cells they cross. A box is reported from
+/// the first of its cells on the walk, the walk goes through its cells in
+/// one run because it is monotonous on both axes.
+class UniformGrid {
+public:
+    typedef std::pair<int, int> Pair;
+    typedef std::vector<Pair> PairList;
+
+    enum { MAX_CELLS = 16 };
+
+    /// A cell size of 0 uses the median x/z extent of the boxes
+    UniformGrid(float cell_size=0);
+
+    void clear();
+    void add(int id, const Vector & min, const Vector & max);
+
+    /// Sorts the boxes added since the last clear() into the cells
+    void build();
+
+    /// Builds the grid and appends the pairs of ids whose boxes overlap,
+    /// lower id first
+    void findContacts(PairList & contacts);
+
+    /// Appends the ids of the boxes that the segment from a to b passes
+    /// through. Uses the grid as of the last build(), and only reads it, so
+    /// it may run on several threads at once.
+    void findSegment(const Vector & a, const Vector & b,
+                     std::vector<int> & ids) const;
+
+    inline float getCellSize() const { return current_cell_size; }
+
+private:
+    struct Box {
+        Vector min, max;
+        int id;
+        bool large;
+    };
+    struct Entry {
+        unsigned long long cell;
+        int box;
+        inline bool operator< (const Entry & e) const {
+            return cell < e.cell || (cell == e.cell && box < e.box);
+        }
+    };
+
+    float cell_size;
+    float current_cell_size;
+    std::vector<Box> boxes;
+    std::vector<Entry> entries;
+    std::vector<int> large;
+    std::vector<float> extents;
+
+    inline int cellOf(float x) const {
+        return (int) floorf(x / current_cell_size);
+    }
+    inline static unsigned long long key(int ix, int iz) {
+        return (unsigned long long) (unsigned int) ix << 32
+             | (unsigned int) iz;
+    }
+    inline static bool overlaps(const Box & a, const Box & b) {
+        for (int k=0; k<3; k++) {
+            if (a.min[k] > b.max[k] || b.min[k] > a.max[k]) return false;
+        }
+        return true;
+    }
+    inline bool covers(const Box & box, int x, int z) const {
+        return cellOf(box.min[0]) <= x && x <= cellOf(box.max[0])
+            && cellOf(box.min[2]) <= z && z <= cellOf(box.max[2]);
+    }
+    // Slab test of the segment from a to b against the box
+    inline static bool crosses(const Box & box, const Vector & a,
+                               const Vector & b) {
+        float t0 = 0, t1 = 1;
+        for (int k=0; k<3; k++) {
+            float d = b[k] - a[k];
+            if (d == 0) {
+                if (a[k] < box.min[k] || a[k] > box.max[k]) return false;
+                continue;
+            }
+            float u0 = (box.min[k] - a[k]) / d, u1 = (box.max[k] - a[k]) / d;
+            if (u0 > u1) std::swap(u0, u1);
+            if (u0 > t0) t0 = u0;
+            if (u1 < t1) t1 = u1;
+            if (t0 > t1) return false;
+        }
+        return true;
+    }
+    inline static Pair makePair(int a, int b) {
+        return a < b ? Pair(a, b) : Pair(b, a);
+    }
+
+    void chooseCellSize();
+};
+
+} // namespace Collide
+
+#endif
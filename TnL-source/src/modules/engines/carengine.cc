@@ -76,12 +76,18 @@ void CarEngine::update() {
     Vector2 f(front[0],front[2]);
     Vector2 r(f[1], -f[0]);
     Vector rotated_tripod[3];
+    // Query the heights under the tripod and the center at once
+    float qx[4], qz[4], qh[4];
     for(int i=0; i<3; i++) {
         Vector2 x = Vector2(p[0],p[2]) + r*tripod[i][0] + f*tripod[i][2];
-        rotated_tripod[i] = Vector(
-            x[0],
-            terrain->getHeightAt(x[0], x[1]),
-            x[1]);
+        qx[i] = x[0];
+        qz[i] = x[1];
+    }
+    qx[3] = p[0];
+    qz[3] = p[2];
+    terrain->getHeightsAt(4, qx, qz, qh);
+    for(int i=0; i<3; i++) {
+        rotated_tripod[i] = Vector(qx[i], qh[i], qz[i]);
         // Cheap-ass buoyancy simulation, i.e. a tank/car/whatever will stay
         // over water with 1m penetration
         if (rotated_tripod[i][1] < -1) {
@@ -95,5 +101,5 @@ void CarEngine::update() {
     front = right % up;
     front.normalize();
 
-    p[1] = std::max(-1.0f, terrain->getHeightAt(p[0], p[2])+0.1f);
+    p[1] = std::max(-1.0f, qh[3]+0.1f);
 }
@@ -208,6 +208,14 @@ void RigidEngine::update(float delta_t, const Transform * new_transforms) {
     //dump_state(getState(), "    ");
 }
 
+bool RigidEngine::isDisturbed(float max_acceleration,
+                              float max_angular_acceleration)
+{
+    clearAndApplyEffectors();
+    return getLinearAcceleration().length() > max_acceleration
+        || getAngularAcceleration().length() > max_angular_acceleration;
+}
+
 void RigidEngine::addEffector(Ptr<IEffector> effector) {
     effectors.push_back(effector);
 }
@@ -49,6 +49,9 @@ public:
     // Collidable helpers
     void integrate(float delta_t, Transform * transforms);
     void update(float delta_t, const Transform * new_transforms);
+    /// Whether the effectors accelerate the body by more than the given
+    /// amounts in its current state, for Collidable::isDisturbed
+    bool isDisturbed(float max_acceleration, float max_angular_acceleration);
     
     // Effectors management
     void addEffector(Ptr<IEffector> effector);
@@ -38,6 +38,12 @@ Environment::Environment(Ptr<IGame> game)
     update(0);
 }
 
+Environment::Environment(Ptr<IConfig> cfg)
+:   cfg(cfg)
+{
+    update(0);
+}
+
 void Environment::update(Ptr<IPositionProvider> pp) {
     clip_min = cfg->queryFloat("Environment_clip_min", CLIP_MIN_RANGE);
     clip_max = cfg->queryFloat("Environment_clip_max", CLIP_MAX_RANGE);
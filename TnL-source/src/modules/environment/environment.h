@@ -16,6 +16,8 @@ class Environment : public Object {
     
 public:
     Environment(Ptr<IGame> game);
+    // Reads the settings from cfg alone, for tools that run without a game
+    Environment(Ptr<IConfig> cfg);
     
     void update(Ptr<IPositionProvider>);
 
@@ -29,6 +31,8 @@ public:
     inline float getGroundFogMin() { return ground_fog_min; }
     inline float getGroundFogMax() { return ground_fog_max; }
     inline float getGroundFogRange() { return ground_fog_range; }
+    // The point the fog strengths are measured from
+    inline const Vector & getFogOrigin() { return p; }
     
     inline void setFogColor(Vector c) { fog_color = c; }
     inline void setGroundFogMin(float f) { ground_fog_min = f; }
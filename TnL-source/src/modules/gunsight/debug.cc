@@ -38,6 +38,15 @@ void FlexibleGunsight::addProfilingGraph(Ptr<IGame> game) {
     mod->watchData(debugdata, "render_actors", Vector(1,1,1));
     addModule(mod, "screen", HCENTER|TOP, HCENTER|TOP);
 
+    // The collision phases of the last step, in microseconds
+    mod = new TimeGraphModule(game, "collide-timegraph");
+    mod->setWidth(500);
+    mod->setHeight(60);
+    mod->watchData(debugdata, "collide_broadphase_us", Vector(0,1,1));
+    mod->watchData(debugdata, "collide_narrowphase_us", Vector(1,.5,.2));
+    mod->watchData(debugdata, "collide_response_us", Vector(1,1,1));
+    addModule(mod, "timegraph", HCENTER|BOTTOM, HCENTER|TOP, Vector(0,5,0));
+
 }
 
 FPSModule::FPSModule(Ptr<IGame> game)
@@ -189,31 +189,25 @@ void JOpenGLRenderer::disableSmoothShading()
     glShadeModel(GL_FLAT);
 }
 
+namespace {
+    GLenum getGLDrawMode(jrdrawmode_t mode)
+    {
+        switch (mode) {
+        case JR_DRAWMODE_POINTS:         return GL_POINTS;
+        case JR_DRAWMODE_LINES:          return GL_LINES;
+        case JR_DRAWMODE_CONNECTED_LINES:return GL_LINE_STRIP;
+        case JR_DRAWMODE_TRIANGLES:      return GL_TRIANGLES;
+        case JR_DRAWMODE_TRIANGLE_STRIP: return GL_TRIANGLE_STRIP;
+        case JR_DRAWMODE_TRIANGLE_FAN:   return GL_TRIANGLE_FAN;
+        case JR_DRAWMODE_QUADS:          return GL_QUADS;
+        }
+        return GL_POINTS;
+    }
+}
+
 void JOpenGLRenderer::begin(jrdrawmode_t mode)
 {
-    switch (mode) {
-    case JR_DRAWMODE_POINTS:
-        glBegin(GL_POINTS);
-        break;
-    case JR_DRAWMODE_LINES:
-        glBegin(GL_LINES);
-        break;
-    case JR_DRAWMODE_CONNECTED_LINES:
-        glBegin(GL_LINE_STRIP);
-        break;
-    case JR_DRAWMODE_TRIANGLES:
-        glBegin(GL_TRIANGLES);
-        break;
-    case JR_DRAWMODE_TRIANGLE_STRIP:
-        glBegin(GL_TRIANGLE_STRIP);
-        break;
-    case JR_DRAWMODE_TRIANGLE_FAN:
-        glBegin(GL_TRIANGLE_FAN);
-        break;
-    case JR_DRAWMODE_QUADS:
-        glBegin(GL_QUADS);
-        break;
-    }
+    glBegin(getGLDrawMode(mode));
 }
 
 void JOpenGLRenderer::end()
@@ -277,6 +271,30 @@ void JOpenGLRenderer::vertex(const Vector2 & v) {
     glVertex2f(v[0],v[1]);
 }
 
+void JOpenGLRenderer::drawArrays(jrdrawmode_t mode, int count,
+        const float *xyz, const float *uv, const float *rgba)
+{
+    if (count <= 0) return;
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, xyz);
+    if (uv) {
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glTexCoordPointer(2, GL_FLOAT, 0, uv);
+    } else {
+        glTexCoord2f(uvw[0], uvw[1]);
+    }
+    if (rgba) {
+        glEnableClientState(GL_COLOR_ARRAY);
+        glColorPointer(4, GL_FLOAT, 0, rgba);
+    } else {
+        glColor4f(color[0], color[1], color[2], alpha);
+    }
+    glDrawArrays(getGLDrawMode(mode), 0, count);
+    if (rgba) glDisableClientState(GL_COLOR_ARRAY);
+    if (uv) glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
 void JOpenGLRenderer::flush()
 {
     glFlush();
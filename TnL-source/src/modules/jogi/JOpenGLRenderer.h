@@ -81,6 +81,10 @@ public:
     virtual void setNormal(const Vector &);
     virtual void vertex(const Vector &);
     virtual void vertex(const Vector2 &);
+    virtual void drawArrays(jrdrawmode_t mode, int count,
+                            const float *xyz,
+                            const float *uv,
+                            const float *rgba);
 
     virtual void flush();
 
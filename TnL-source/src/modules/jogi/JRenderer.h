@@ -178,6 +178,14 @@ public:
     virtual void vertex(const Vector &) = 0;
     virtual void vertex(const Vector2 &) = 0;
     
+    // Draws count vertices from arrays in a single call. xyz holds three
+    // floats per vertex, uv two and rgba four. uv and rgba may be 0, the
+    // current UVW and color/alpha are used for all vertices then.
+    virtual void drawArrays(jrdrawmode_t mode, int count,
+                            const float *xyz,
+                            const float *uv,
+                            const float *rgba) = 0;
+    
     virtual void flush() = 0;
 
     virtual void clear(bool color=true, bool depth=true) = 0;
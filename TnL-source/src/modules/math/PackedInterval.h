@@ -0,0 +1,292 @@
+#ifndef PACKEDINTERVAL_H
+#define PACKEDINTERVAL_H
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include "Interval.h"
+#include "Vector.h"
+
+// Four intervals side by side, for the interval tests that do the same
+// operations on the components of vectors. Each lane holds the lower bound
+// and the negated upper bound of one interval. With the upper bound negated,
+// both bounds have to be rounded down, so that one rounding step serves both,
+// and subtraction and negation need no shuffling: X-Y is the lower bounds of
+// X plus the negated upper bounds of Y and the other way round.
+//
+// Unlike Interval, the results are rounded outward. The lanes compute in the
+// default rounding mode and then step down by more than the rounding error,
+// which leaves the rounding mode of the thread alone. The step is at least
+// PACKED_INTERVAL_FLOOR, which covers underflow, and keeps the noise of
+// exact zeros from turning into denormals, which are slow.
+//
+// With SSE2 the lanes are SSE registers, else plain floats.
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PACKED_INTERVAL_SSE2 1
+#else
+#define PACKED_INTERVAL_SSE2 0
+#endif
+
+namespace PackedLanes {
+
+// A result x in [2^e, 2^(e+1)) rounded to nearest is off by at most
+// 2^(e-24). Stepping down by 2^(e-22) leaves room for the rounding of the
+// step itself.
+#define PACKED_INTERVAL_STEP  (2*FLT_EPSILON)     // 2^-22
+#define PACKED_INTERVAL_FLOOR 8.67361738e-19f     // 2^-60
+
+#if PACKED_INTERVAL_SSE2
+
+typedef __m128 Floats;
+
+inline Floats set(float a, float b, float c, float d) {
+    return _mm_setr_ps(a, b, c, d);
+}
+inline Floats set1(float x) { return _mm_set1_ps(x); }
+inline Floats add(Floats x, Floats y) { return _mm_add_ps(x, y); }
+inline Floats mul(Floats x, Floats y) { return _mm_mul_ps(x, y); }
+inline Floats min(Floats x, Floats y) { return _mm_min_ps(x, y); }
+inline Floats max(Floats x, Floats y) { return _mm_max_ps(x, y); }
+inline Floats neg(Floats x) {
+    return _mm_xor_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));
+}
+inline Floats abs(Floats x) {
+    return _mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)));
+}
+inline void store(float *f, Floats x) { _mm_storeu_ps(f, x); }
+
+/// Rounds x, a result in the default rounding mode, down. 2^(e-22) is made
+/// from the exponent bits of x, below 2^22 they give no positive float.
+inline Floats down(Floats x) {
+    __m128i e = _mm_and_si128(_mm_castps_si128(x), _mm_set1_epi32(0x7f800000));
+    __m128 step = _mm_castsi128_ps(_mm_sub_epi32(e, _mm_set1_epi32(22 << 23)));
+    return _mm_sub_ps(x,
+        _mm_max_ps(step, _mm_set1_ps(PACKED_INTERVAL_FLOOR)));
+}
+
+/// The sum of lanes 0, 1 and 2, rounded down
+inline float sum3(Floats x) {
+    Floats s = down(_mm_add_ss(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1,1,1,1))));
+    s = down(_mm_add_ss(s, _mm_movehl_ps(x, x)));
+    return _mm_cvtss_f32(s);
+}
+
+/// Lanes A, B, C and D of x
+template<int A, int B, int C, int D> inline Floats shuffle(Floats x) {
+    return _mm_shuffle_ps(x, x, _MM_SHUFFLE(D,C,B,A));
+}
+
+inline void transpose(Floats & a, Floats & b, Floats & c, Floats & d) {
+    _MM_TRANSPOSE4_PS(a, b, c, d);
+}
+
+#else
+
+struct Floats { float f[4]; };
+
+inline Floats set(float a, float b, float c, float d) {
+    Floats r = {{ a, b, c, d }};
+    return r;
+}
+inline Floats set1(float x) { return set(x, x, x, x); }
+
+#define PACKED_INTERVAL_LANEWISE(name, expr)                    \
+    inline Floats name(const Floats & x, const Floats & y) {    \
+        Floats r;                                               \
+        for (int i=0; i<4; i++) r.f[i] = (expr);                \
+        return r;                                               \
+    }
+PACKED_INTERVAL_LANEWISE(add, x.f[i] + y.f[i])
+PACKED_INTERVAL_LANEWISE(mul, x.f[i] * y.f[i])
+PACKED_INTERVAL_LANEWISE(min, x.f[i] < y.f[i] ? x.f[i] : y.f[i])
+PACKED_INTERVAL_LANEWISE(max, x.f[i] > y.f[i] ? x.f[i] : y.f[i])
+#undef PACKED_INTERVAL_LANEWISE
+
+inline Floats neg(const Floats & x) {
+    return set(-x.f[0], -x.f[1], -x.f[2], -x.f[3]);
+}
+inline Floats abs(const Floats & x) {
+    return set(fabsf(x.f[0]), fabsf(x.f[1]), fabsf(x.f[2]), fabsf(x.f[3]));
+}
+inline void store(float *f, const Floats & x) {
+    for (int i=0; i<4; i++) f[i] = x.f[i];
+}
+
+inline float down(float x) {
+    return x - std::max(fabsf(x) * PACKED_INTERVAL_STEP, PACKED_INTERVAL_FLOOR);
+}
+inline Floats down(const Floats & x) {
+    return set(down(x.f[0]), down(x.f[1]), down(x.f[2]), down(x.f[3]));
+}
+
+inline float sum3(const Floats & x) {
+    return down(down(x.f[0] + x.f[1]) + x.f[2]);
+}
+
+template<int A, int B, int C, int D> inline Floats shuffle(const Floats & x) {
+    return set(x.f[A], x.f[B], x.f[C], x.f[D]);
+}
+
+inline void transpose(Floats & a, Floats & b, Floats & c, Floats & d) {
+    Floats *rows[4] = { &a, &b, &c, &d };
+    for (int i=0; i<4; i++) for (int j=i+1; j<4; j++) {
+        float t = rows[i]->f[j];
+        rows[i]->f[j] = rows[j]->f[i];
+        rows[j]->f[i] = t;
+    }
+}
+
+#endif
+
+} // namespace PackedLanes
+
+
+struct PackedInterval {
+    PackedLanes::Floats lo, nhi;     ///< Lower and negated upper bounds
+
+    inline PackedInterval() { }
+    inline PackedInterval(PackedLanes::Floats lo, PackedLanes::Floats nhi)
+    :   lo(lo), nhi(nhi)
+    { }
+    explicit inline PackedInterval(const Interval & x)
+    :   lo(PackedLanes::set1(x.a)), nhi(PackedLanes::set1(-x.b))
+    { }
+    inline PackedInterval(const Interval & x, const Interval & y,
+                          const Interval & z, const Interval & w)
+    :   lo(PackedLanes::set(x.a, y.a, z.a, w.a)),
+        nhi(PackedLanes::set(-x.b, -y.b, -z.b, -w.b))
+    { }
+    /// The components in lanes 0 to 2 and w in lane 3
+    inline PackedInterval(const XVector<3,Interval> & v, const Interval & w)
+    :   lo(PackedLanes::set(v[0].a, v[1].a, v[2].a, w.a)),
+        nhi(PackedLanes::set(-v[0].b, -v[1].b, -v[2].b, -w.b))
+    { }
+    inline PackedInterval(const Vector & v, float w)
+    :   lo(PackedLanes::set(v[0], v[1], v[2], w)),
+        nhi(PackedLanes::set(-v[0], -v[1], -v[2], -w))
+    { }
+
+    inline Interval operator[] (int i) const {
+        float a[4], nb[4];
+        PackedLanes::store(a, lo);
+        PackedLanes::store(nb, nhi);
+        return Interval(a[i], -nb[i]);
+    }
+
+    inline void store(Interval *x) const {
+        float a[4], nb[4];
+        PackedLanes::store(a, lo);
+        PackedLanes::store(nb, nhi);
+        for (int i=0; i<4; i++) x[i] = Interval(a[i], -nb[i]);
+    }
+
+    inline XVector<3,Interval> toIVector() const {
+        float a[4], nb[4];
+        PackedLanes::store(a, lo);
+        PackedLanes::store(nb, nhi);
+        return XVector<3,Interval>(Interval(a[0], -nb[0]),
+                                   Interval(a[1], -nb[1]),
+                                   Interval(a[2], -nb[2]));
+    }
+
+    /// The longest interval of lanes 0 to 2
+    inline float maxLength3() const {
+        float l[4];
+        PackedLanes::store(l, PackedLanes::neg(PackedLanes::add(lo, nhi)));
+        return std::max(l[0], std::max(l[1], l[2]));
+    }
+
+    inline friend PackedInterval operator- (const PackedInterval & X) {
+        return PackedInterval(X.nhi, X.lo);
+    }
+
+    inline friend PackedInterval operator+ (const PackedInterval & X,
+                                            const PackedInterval & Y) {
+        using namespace PackedLanes;
+        return PackedInterval(down(add(X.lo, Y.lo)), down(add(X.nhi, Y.nhi)));
+    }
+
+    inline friend PackedInterval operator- (const PackedInterval & X,
+                                            const PackedInterval & Y) {
+        using namespace PackedLanes;
+        return PackedInterval(down(add(X.lo, Y.nhi)), down(add(X.nhi, Y.lo)));
+    }
+
+    // With X = [a,b] and Y = [c,d], the products of the bounds are
+    // p1 = ac, p2 = a(-d), p3 = (-b)c and p4 = (-b)(-d) = bd. The lower bound
+    // is the least of ac, ad, bc and bd, the negated upper bound the least
+    // of their negations. min commutes with rounding to nearest, so the
+    // least product is rounded down once.
+    inline friend PackedInterval operator* (const PackedInterval & X,
+                                            const PackedInterval & Y) {
+        using namespace PackedLanes;
+        Floats p1 = mul(X.lo, Y.lo), p2 = mul(X.lo, Y.nhi);
+        Floats p3 = mul(X.nhi, Y.lo), p4 = mul(X.nhi, Y.nhi);
+        return PackedInterval(
+            down(min(min(p1, neg(p2)), min(neg(p3), p4))),
+            down(min(min(neg(p1), p2), min(p3, neg(p4)))));
+    }
+
+    /// Multiplies by a scalar
+    inline friend PackedInterval operator* (const PackedInterval & X,
+                                            float s) {
+        using namespace PackedLanes;
+        if (s >= 0) {
+            Floats f = set1(s);
+            return PackedInterval(down(mul(X.lo, f)), down(mul(X.nhi, f)));
+        } else {
+            Floats f = set1(-s);
+            return PackedInterval(down(mul(X.nhi, f)), down(mul(X.lo, f)));
+        }
+    }
+
+    /// Multiplies lanewise by factors that are all >= 0
+    inline friend PackedInterval mulPositive(const PackedInterval & X,
+                                             PackedLanes::Floats f) {
+        using namespace PackedLanes;
+        return PackedInterval(down(mul(X.lo, f)), down(mul(X.nhi, f)));
+    }
+
+    // |[a,b]| is [max(a,-b,0), max(-a,b)], which is exact
+    inline friend PackedInterval abs(const PackedInterval & X) {
+        using namespace PackedLanes;
+        return PackedInterval(max(max(X.lo, X.nhi), set1(0.0f)),
+                              min(X.lo, X.nhi));
+    }
+
+    inline friend PackedInterval square(const PackedInterval & X) {
+        using namespace PackedLanes;
+        PackedInterval A = abs(X);
+        return PackedInterval(down(mul(A.lo, A.lo)),
+                              down(neg(mul(A.nhi, A.nhi))));
+    }
+
+    /// The sum of lanes 0 to 2
+    inline friend Interval sum3(const PackedInterval & X) {
+        return Interval(PackedLanes::sum3(X.lo), -PackedLanes::sum3(X.nhi));
+    }
+
+    /// Swaps lane i of row j with lane j of row i
+    inline friend void transpose(PackedInterval & a, PackedInterval & b,
+                                 PackedInterval & c, PackedInterval & d) {
+        PackedLanes::transpose(a.lo, b.lo, c.lo, d.lo);
+        PackedLanes::transpose(a.nhi, b.nhi, c.nhi, d.nhi);
+    }
+};
+
+/// Lanes A, B, C and D of X
+template<int A, int B, int C, int D>
+inline PackedInterval shuffle(const PackedInterval & X) {
+    return PackedInterval(PackedLanes::shuffle<A,B,C,D>(X.lo),
+                          PackedLanes::shuffle<A,B,C,D>(X.nhi));
+}
+
+/// All lanes set to lane I
+template<int I>
+inline PackedInterval splat(const PackedInterval & X) {
+    return shuffle<I,I,I,I>(X);
+}
+
+#endif
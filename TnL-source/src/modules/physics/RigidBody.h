@@ -90,6 +90,10 @@ public:
     inline Vector getLinearVelocity() { return v; }
     inline Vector getAngularVelocity() { return omega; }
 
+    // The accelerations by the forces applied since the last clearForces()
+    inline Vector getLinearAcceleration() const { return F * M_inv; }
+    inline Vector getAngularAcceleration() const { return I_inv_wcs * torque; }
+
     inline const Vector & getLinearMomentum() const { return P; }
     inline void setLinearMomentum(const Vector & P_new) { P = P_new; v = P * M_inv; }
 
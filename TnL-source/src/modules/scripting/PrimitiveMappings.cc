@@ -75,10 +75,14 @@ template<> IoObject * wrapObject(vector<Ptr<IActor> > v, IoState * state)
 { return wrap_vector(v,state); }
 template<> IoObject * wrapObject(vector<string> v, IoState * state)
 { return wrap_vector(v,state); }
+template<> IoObject * wrapObject(vector<float> v, IoState * state)
+{ return wrap_vector(v,state); }
 
 template<> vector<Ptr<IActor> > unwrapObject(IoObject *self)
 { return unwrap_vector<Ptr<IActor> >(self); }
 template<> vector<string> unwrapObject(IoObject *self)
 { return unwrap_vector<string>(self); }
+template<> vector<float> unwrapObject(IoObject *self)
+{ return unwrap_vector<float>(self); }
 
 #endif // HAVE_IO
@@ -5,6 +5,7 @@
 // ---------------------------------------------------------------
 
 
+#include <vector>
 #include <interfaces/ITerrain.h>
 #include "mappings.h"
 
@@ -23,6 +24,7 @@ namespace {
 		static IoObject *proto(void *state) {
 			IoMethodTable methodTable[] = {
 				{"heightAt", heightAt},
+				{"heightsAt", heightsAt},
 				{"normalAt", normalAt},
 				{"lineIntersection", intersect},
 				{NULL, NULL}
@@ -44,6 +46,22 @@ namespace {
 			return wrapObject(height, IOSTATE);
 		}
 
+		static IoObject *
+		heightsAt(IoObject *self, IoObject *locals, IoMessage *m) {
+			BEGIN_FUNC("Terrain.heightsAt")
+			IOASSERT(IoMessage_argCount(m) == 2,"Expected two arguments")
+			std::vector<float> x = unwrapObject<std::vector<float> >(
+			        IoMessage_locals_valueArgAt_(m, locals, 0));
+			std::vector<float> y = unwrapObject<std::vector<float> >(
+			        IoMessage_locals_valueArgAt_(m, locals, 1));
+			IOASSERT(x.size() == y.size(),"Expected lists of equal size")
+			std::vector<float> heights(x.size());
+			if (!x.empty()) {
+			    getObject(self)->getHeightsAt(x.size(), &x[0], &y[0], &heights[0]);
+			}
+			return wrapObject(heights, IOSTATE);
+		}
+
 		static IoObject *
 		normalAt(IoObject *self, IoObject *locals, IoMessage *m) {
 			BEGIN_FUNC("Terrain.normalAt")
@@ -0,0 +1,147 @@
+#include <cxxtest/TestSuite.h>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+#include <modules/collide/BroadPhase.h>
+
+// Checks that the methods of BroadPhase find the pairs and segment boxes of
+// testing all boxes, like broadphasebench does on a larger scale
+class BroadPhaseSuite : public CxxTest::TestSuite
+{
+    typedef Collide::BroadPhase BroadPhase;
+    typedef BroadPhase::Pair Pair;
+    typedef BroadPhase::PairList PairList;
+
+    enum { BOXES = 150, STATIC_RATE = 5, STEPS = 50, RESPAWN_RATE = 50,
+           SEGMENTS = 200 };
+
+    struct Box {
+        Vector min, max;
+        bool used, is_static;
+    };
+
+    static float random(float a, float b) {
+        return a + (b-a) * (rand() / (RAND_MAX + 1.0f));
+    }
+
+    static void place(Box & box) {
+        Vector p(random(0, 200), random(0, 20), random(0, 200));
+        float r = random(1, 10);
+        box.min = p - Vector(r,r,r);
+        box.max = p + Vector(r,r,r);
+    }
+
+    static void findPairs(const std::vector<Box> & boxes, PairList & pairs) {
+        for (size_t a=0; a<boxes.size(); a++) {
+            for (size_t b=a+1; b<boxes.size(); b++) {
+                if (!boxes[a].used || !boxes[b].used) continue;
+                if (boxes[a].is_static && boxes[b].is_static) continue;
+                bool overlap = true;
+                for (int k=0; k<3; k++) {
+                    if (boxes[a].min[k] > boxes[b].max[k] ||
+                        boxes[b].min[k] > boxes[a].max[k])
+                        overlap = false;
+                }
+                if (overlap) pairs.push_back(Pair(a, b));
+            }
+        }
+    }
+
+    static bool crosses(const Box & box, const Vector & a, const Vector & b) {
+        float t0 = 0, t1 = 1;
+        for (int k=0; k<3; k++) {
+            float d = b[k] - a[k];
+            if (d == 0) {
+                if (a[k] < box.min[k] || a[k] > box.max[k]) return false;
+                continue;
+            }
+            float u0 = (box.min[k] - a[k]) / d, u1 = (box.max[k] - a[k]) / d;
+            t0 = std::max(t0, std::min(u0, u1));
+            t1 = std::min(t1, std::max(u0, u1));
+            if (t0 > t1) return false;
+        }
+        return true;
+    }
+
+    static int add(BroadPhase & broad_phase, std::vector<Box> & boxes,
+                   const Box & box)
+    {
+        int id = broad_phase.add(box.min, box.max);
+        broad_phase.setStatic(id, box.is_static);
+        if ((int) boxes.size() <= id) boxes.resize(id+1);
+        boxes[id] = box;
+        boxes[id].used = true;
+        return id;
+    }
+
+    // Returns the number of steps and segments that differ from testing
+    // all boxes
+    static int check(BroadPhase::Method method) {
+        srand(1);
+        BroadPhase broad_phase(method);
+        std::vector<Box> boxes;
+        for (int i=0; i<BOXES; i++) {
+            Box box;
+            place(box);
+            box.is_static = rand() % STATIC_RATE == 0;
+            add(broad_phase, boxes, box);
+        }
+
+        int wrong = 0;
+        for (int s=0; s<STEPS; s++) {
+            for (size_t id=0; id<boxes.size(); id++) {
+                Box & box = boxes[id];
+                if (!box.used || box.is_static) continue;
+                if (rand() % RESPAWN_RATE == 0) {
+                    broad_phase.remove(id);
+                    box.used = false;
+                    Box moved = box;
+                    place(moved);
+                    add(broad_phase, boxes, moved);
+                    continue;
+                }
+                Vector d(random(-2,2), random(-2,2), random(-2,2));
+                box.min += d;
+                box.max += d;
+                broad_phase.set(id, box.min, box.max);
+            }
+
+            PairList found, expected;
+            broad_phase.findPairs(found);
+            findPairs(boxes, expected);
+            if (found != expected) wrong++;
+        }
+
+        broad_phase.prepareSegments();
+        for (int i=0; i<SEGMENTS; i++) {
+            Vector a(random(-20, 220), random(-10, 30), random(-20, 220));
+            Vector b(random(-20, 220), random(-10, 30), random(-20, 220));
+            std::vector<int> found, expected;
+            broad_phase.findSegment(a, b, found);
+            std::sort(found.begin(), found.end());
+            for (size_t id=0; id<boxes.size(); id++) {
+                if (boxes[id].used && crosses(boxes[id], a, b)) {
+                    expected.push_back(id);
+                }
+            }
+            if (found != expected) wrong++;
+        }
+        return wrong;
+    }
+
+public:
+    void testSweepX( void )
+    {
+        TS_ASSERT_EQUALS( check(BroadPhase::SWEEP_X), 0 );
+    }
+
+    void testSweepXYZ( void )
+    {
+        TS_ASSERT_EQUALS( check(BroadPhase::SWEEP_XYZ), 0 );
+    }
+
+    void testGrid( void )
+    {
+        TS_ASSERT_EQUALS( check(BroadPhase::GRID), 0 );
+    }
+};
@@ -1,4 +1,5 @@
 #include <cxxtest/TestSuite.h>
+#include <vector>
 #include <modules/collide/BoundingNode.h>
 #include <modules/collide/Primitive.h>
 
@@ -131,17 +132,20 @@ public:
     {
         using namespace Collide;
         
-        BoundingNode node;
+        // The vertices of a leaf follow it in the same block
+        std::vector<char> block(sizeof(BoundingNode) + 6*sizeof(Vector));
+        BoundingNode & node = *(BoundingNode *) &block[0];
         node.type = BoundingNode::LEAF;
+        node.size = block.size();
         node.data.leaf.n_triangles = 2;
-        node.data.leaf.vertices = new Vector[6];
-        
-        node.data.leaf.vertices[0] = Vector(-2,-1,-1);
-        node.data.leaf.vertices[1] = Vector(0,1,-1);
-        node.data.leaf.vertices[2] = Vector(0,1,2);
-        node.data.leaf.vertices[3] = Vector(2,-1,-1);
-        node.data.leaf.vertices[4] = Vector(0,1,-1);
-        node.data.leaf.vertices[5] = Vector(0,1,2);
+        
+        Vector *vertices = (Vector *) node.vertices();
+        vertices[0] = Vector(-2,-1,-1);
+        vertices[1] = Vector(0,1,-1);
+        vertices[2] = Vector(0,1,2);
+        vertices[3] = Vector(2,-1,-1);
+        vertices[4] = Vector(0,1,-1);
+        vertices[5] = Vector(0,1,2);
         
         node.box.pos = Vector(0,0,0.5);
         node.box.dim[0]=2;
@@ -0,0 +1,140 @@
+#include <cxxtest/TestSuite.h>
+#include <cmath>
+#include <sstream>
+#include <modules/actors/simpleactor.h>
+#include <modules/collide/CollisionManager.h>
+#include <modules/physics/RigidBody.h>
+
+// Checks the contacts found and resolved by CollisionManager::run
+class CollisionManagerSuite : public CxxTest::TestSuite
+{
+    // A triangle in the x/y plane, 20 wide and high
+    static Ptr<Collide::BoundingGeometry> triangle() {
+        std::istringstream in(
+            "Geometry( 14.142136\n( 0 ) ( default )\nNode(\nBox(\n"
+            "Vector3( 0 0 0 )\n10 10 0\n)\nL\n1\n"
+            "Vector3( 0 10 0 )\nVector3( 10 -10 0 )\nVector3( -10 -10 0 )\n"
+            ")\n)\n");
+        Ptr<Collide::BoundingGeometry> bounds = new Collide::BoundingGeometry;
+        in >> *bounds;
+        return bounds;
+    }
+
+    // Flies along x and remembers where it was at its first contact, and
+    // how fast it went after the impulse
+    class Body : public SimpleActor, public Collide::Collidable {
+        Ptr<RigidBody> body;
+    public:
+        int collisions;
+        float contact_x, contact_v;
+
+        Body(Ptr<Collide::BoundingGeometry> bounds, const Vector & x,
+             const Quaternion & q, float v)
+        :   SimpleActor(0), Collide::Collidable(bounds), body(new RigidBody),
+            collisions(0), contact_x(0), contact_v(0)
+        {
+            // Hard to turn, since the contacts lie off the center
+            body->construct(1, 1e6, 1e6, 1e6);
+            RigidBodyState s = body->getState();
+            s.x = x;
+            s.q = q;
+            s.P = Vector(v, 0, 0);
+            s.L = Vector(0,0,0);
+            body->setState(s);
+            setRigidBody(ptr(body));
+            setActor(this);
+        }
+
+        using Collide::Collidable::setSleepAllowed;
+        using Collide::Collidable::setSweptPoint;
+
+        float x() { return body->getState().x[0]; }
+        float velocity() { return body->getLinearVelocity()[0]; }
+
+        virtual void integrate(float delta_t, Transform * transforms) {
+            const RigidBodyState & s = body->getState();
+            transforms[0] = Transform(s.q,
+                s.x + delta_t * body->getLinearVelocity());
+        }
+
+        virtual void update(float delta_t, const Transform * new_transforms) {
+            RigidBodyState s = body->getState();
+            s.x = new_transforms[0].vec();
+            s.q = new_transforms[0].quat();
+            body->setState(s);
+        }
+
+        virtual void collide(const Collide::Contact &) {
+            if (collisions++) return;
+            contact_x = x();
+            contact_v = velocity();
+        }
+    };
+
+public:
+    // Two pairs closing at 100 m/s meet 8 ms apart within one step. In
+    // each, an edge of a triangle hits the face of one across its path.
+    // Each pair must get its impulse where it meets, not where the other
+    // one does, give or take the exactness of the narrow phase.
+    void testStaggeredContactsAreResolvedAtTheirOwnTime( void )
+    {
+        Ptr<Collide::CollisionManager> cm =
+            new Collide::CollisionManager(Ptr<IConfig>());
+        Ptr<Collide::BoundingGeometry> bounds = triangle();
+        // The edge is along y, the face in the y/z plane
+        Quaternion edge(sqrtf(0.5f), 0, 0, sqrtf(0.5f));
+        Quaternion face(sqrtf(0.5f), 0, sqrtf(0.5f), 0);
+        const float gap[2] = { 1.0f, 1.8f };
+        Ptr<Body> body[4];
+        for (int i=0; i<2; i++) {
+            float z = 100*i;
+            body[2*i] = new Body(bounds,
+                Vector(-10 - gap[i]/2, 0, z), edge, 50);
+            body[2*i+1] = new Body(bounds,
+                Vector(gap[i]/2, 0, z), face, -50);
+        }
+        for (int i=0; i<4; i++) cm->add(body[i]);
+
+        cm->run(0, 0.02f);
+
+        for (int i=0; i<2; i++) {
+            Body & a = *body[2*i];
+            Body & b = *body[2*i+1];
+            TS_ASSERT_LESS_THAN( 0, a.collisions );
+            TS_ASSERT_LESS_THAN( 0, b.collisions );
+            TS_ASSERT_DELTA( b.contact_x - (a.contact_x + 10), 0, 0.3f );
+            TS_ASSERT_LESS_THAN( a.contact_v, 49 );
+            TS_ASSERT_LESS_THAN( -49, b.contact_v );
+        }
+
+        for (int i=0; i<4; i++) cm->remove(body[i]);
+    }
+
+    // A swept point flying into a sleeping body wakes it and pushes it on
+    void testSweptPointWakesAndPushesItsTarget( void )
+    {
+        Ptr<Collide::CollisionManager> cm =
+            new Collide::CollisionManager(Ptr<IConfig>());
+        Ptr<Collide::BoundingGeometry> bounds = triangle();
+        Quaternion face(sqrtf(0.5f), 0, sqrtf(0.5f), 0);
+        Ptr<Body> target = new Body(bounds, Vector(0,0,0), face, 0);
+        target->setSleepAllowed(true);
+        cm->add(target);
+        for (int i=0; i<150 && !target->isSleeping(); i++) cm->run(0, 0.02f);
+        TS_ASSERT( target->isSleeping() );
+
+        Ptr<Body> point = new Body(bounds, Vector(-5,0,0),
+                                   Quaternion(1,0,0,0), 500);
+        point->setSweptPoint(true);
+        cm->add(point);
+        cm->run(0, 0.02f);
+
+        TS_ASSERT_EQUALS( point->collisions, 1 );
+        TS_ASSERT_EQUALS( target->collisions, 1 );
+        TS_ASSERT( !target->isSleeping() );
+        TS_ASSERT_LESS_THAN( 0, target->velocity() );
+
+        cm->remove(point);
+        cm->remove(target);
+    }
+};
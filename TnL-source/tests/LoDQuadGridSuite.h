@@ -0,0 +1,183 @@
+#include <cxxtest/TestSuite.h>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <WorkerPool.h>
+#include <modules/LoDTerrain/LoDTerrain.h>
+
+// Checks that setting the quads of a grid up in isolation on a pool and
+// stitching them builds the same mesh as setting them up one after the
+// other, on a small generated terrain
+class LoDQuadGridSuite : public CxxTest::TestSuite
+{
+    enum { QUADS = 2, LEVELS = 6, GRID = 1 << LEVELS, THREADS = 2 };
+
+    static float quadSize() { return 256.0f; }
+
+    static float height(float x, float z) {
+        return 30*sinf(x*0.011f)*cosf(z*0.009f) + 8*sinf(x*0.05f+z*0.03f)
+             + 2*sinf(x*0.2f)*sinf(z*0.23f);
+    }
+
+    struct QuadWriter {
+        int u, v;
+        std::vector<LoDTriangleFileStruct> triangles;
+        std::vector<float> vx, vy, vz;
+
+        float x(int i) const { return (u*GRID + i) * quadSize() / GRID; }
+        float z(int j) const { return (v*GRID + j) * quadSize() / GRID; }
+        ju32 vertex(int i, int j) const { return j*(GRID+1) + i; }
+
+        // Splits the triangle down to the grid, with its hypotenuse from
+        // (i0,j0) to (i1,j1) and its apex at (i2,j2). Returns its error.
+        float build(ju32 t, int i0, int j0, int i1, int j1, int i2, int j2) {
+            LoDTriangleFileStruct & ft = triangles[t];
+            ft.vertex[0] = vertex(i0, j0);
+            ft.vertex[1] = vertex(i1, j1);
+            ft.vertex[2] = vertex(i2, j2);
+            ft.neighbor[0] = ft.neighbor[1] = ft.neighbor[2] = 0;
+            ft.error = 0;
+            ft.flags = 0;
+            if ((i0+i1) % 2 || (j0+j1) % 2) return 0;
+            int im = (i0+i1) / 2, jm = (j0+j1) / 2;
+            ju32 c = triangles.size();
+            triangles.resize(c+2);
+            float e0 = build(c, i2, j2, i0, j0, im, jm);
+            float e1 = build(c+1, i1, j1, i2, j2, im, jm);
+            float mid = (height(x(i0), z(j0)) + height(x(i1), z(j1))) / 2;
+            LoDTriangleFileStruct & ft2 = triangles[t];
+            ft2.child[0] = c;
+            ft2.child[1] = c+1;
+            ft2.error = std::max(std::max(e0, e1),
+                                 fabsf(height(x(im), z(jm)) - mid));
+            ft2.flags = TFLAG_HAS_CHILDREN;
+            return ft2.error;
+        }
+
+        // Writes a .qad file, see LoDQuad::readQuadFile
+        bool write(const char *name) {
+            for (int j=0; j<=GRID; j++) {
+                for (int i=0; i<=GRID; i++) {
+                    vx.push_back(x(i));
+                    vz.push_back(z(j));
+                    vy.push_back(height(x(i), z(j)) + 40);
+                }
+            }
+            triangles.resize(2);
+            build(0, 0, GRID, GRID, 0, 0, 0);
+            build(1, GRID, 0, 0, GRID, GRID, GRID);
+
+            FILE *out = fopen(name, "wb");
+            if (!out) return false;
+            ju32 header[2] = { triangles.size(), vx.size() };
+            fwrite("LQAD", 1, 4, out);
+            fwrite(header, sizeof(ju32), 2, out);
+            fwrite(&triangles[0], sizeof(LoDTriangleFileStruct),
+                   triangles.size(), out);
+            fwrite(&vx[0], sizeof(float), vx.size(), out);
+            fwrite(&vz[0], sizeof(float), vz.size(), out);
+            fwrite(&vy[0], sizeof(float), vy.size(), out);
+            return fclose(out) == 0;
+        }
+    };
+
+    static void quadNames(int i, char *quad_name, char *texmap_name) {
+        sprintf(quad_name, "LoDQuadGridSuite-%d-%d.qad", i % QUADS, i / QUADS);
+        sprintf(texmap_name, "LoDQuadGridSuite-%d-%d.tga", i % QUADS, i / QUADS);
+    }
+
+    static bool load(LoDQuadGrid & grid) {
+        grid.setSize(QUADS, QUADS);
+        for (int i=0; i<QUADS*QUADS; i++) {
+            char quad_name[64], texmap_name[64];
+            quadNames(i, quad_name, texmap_name);
+            if (!grid.quad[i].load(quad_name, texmap_name, false)) return false;
+        }
+        grid.setLayout(0);
+        for (int i=0; i<QUADS*QUADS; i++) {
+            LoDQuad *neighbor[4];
+            grid.getNeighbors(i, neighbor);
+            grid.quad[i].init(neighbor, TexPtr(), TexPtr(), 0, TexPtr(),
+                              Ptr<Environment>());
+            grid.addResident(i);
+        }
+        return true;
+    }
+
+    // Returns the number of quads whose meshes differ
+    static int compare(LoDQuadGrid & a, LoDQuadGrid & b, int *leaves) {
+        int wrong = 0;
+        for (int i=0; i<QUADS*QUADS; i++) {
+            std::vector<ju32> ta, tb, da, db;
+            a.quad[i].getMesh(ta, da);
+            b.quad[i].getMesh(tb, db);
+            *leaves += ta.size();
+            bool same = ta.size() == tb.size() && da == db;
+            for (size_t k=0; same && k<ta.size(); k++) {
+                Vector pa[3], pb[3];
+                a.quad[i].getCorners(ta[k], pa);
+                b.quad[i].getCorners(tb[k], pb);
+                same = a.quad[i].getMorph(ta[k]) == b.quad[i].getMorph(tb[k]);
+                for (int j=0; j<3; j++) {
+                    if ((pa[j] - pb[j]).length() != 0) same = false;
+                }
+            }
+            if (!same) wrong++;
+        }
+        return wrong;
+    }
+
+public:
+    void testStitchedSetupMatchesSerialSetup( void )
+    {
+        int i;
+        for (i=0; i<QUADS*QUADS; i++) {
+            char quad_name[64], texmap_name[64];
+            quadNames(i, quad_name, texmap_name);
+            QuadWriter writer;
+            writer.u = i % QUADS;
+            writer.v = i / QUADS;
+            TS_ASSERT( writer.write(quad_name) );
+            Ptr<Image> texmap = new Image(1, 1);
+            texmap->saveTo(texmap_name);
+        }
+
+        LoDQuadGrid serial, stitched;
+        TS_ASSERT( load(serial) );
+        TS_ASSERT( load(stitched) );
+        WorkerPool pool(THREADS);
+
+        // Low over a corner and the middle of the grid, high above it and
+        // outside of it, looking north, i.e. along -z
+        const float camera[][3] = {
+            {100, 30, -20}, {256, 20, -256}, {260, 400, 300},
+            {-200, 15, -100}, {500, 40, -500}
+        };
+        int wrong = 0, leaves = 0;
+        for (size_t c=0; c<sizeof(camera)/sizeof(camera[0]); c++) {
+            Vector pos(camera[c][0], camera[c][1], camera[c][2]);
+            float planes[6][4];
+            for (int p=0; p<6; p++) {
+                planes[p][0] = planes[p][1] = planes[p][2] = 0;
+                planes[p][3] = 1e6;
+            }
+            planes[0][2] = -1;
+            planes[0][3] = pos[2];
+            serial.setupQuads(0, pos, planes, 1.0f);
+            stitched.setupQuads(&pool, pos, planes, 1.0f);
+            wrong += compare(serial, stitched, &leaves);
+        }
+        TS_ASSERT_EQUALS( wrong, 0 );
+        // The terrain must not be too flat to need a mesh
+        TS_ASSERT_LESS_THAN( 20*QUADS*QUADS, leaves );
+
+        for (i=0; i<QUADS*QUADS; i++) {
+            char quad_name[64], texmap_name[64];
+            quadNames(i, quad_name, texmap_name);
+            serial.quad[i].done();
+            stitched.quad[i].done();
+            remove(quad_name);
+            remove(texmap_name);
+        }
+    }
+};
@@ -0,0 +1,207 @@
+#include <cxxtest/TestSuite.h>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <modules/math/PackedInterval.h>
+#include <modules/collide/Primitive.h>
+
+// Checks the packed intervals and the packed box/box test against exact
+// results and against the Interval versions, like intervalbench does on a
+// larger scale
+class PackedIntervalSuite : public CxxTest::TestSuite
+{
+    typedef Collide::BoundingBox BoundingBox;
+    typedef Collide::ITransform ITransform;
+    typedef Collide::IVector IVector;
+    typedef Collide::PackedITransform PackedITransform;
+    typedef XVector<3,double> DVector;
+    typedef XQuaternion<double> DQuaternion;
+
+    enum { SAMPLES = 16 };
+
+    static float random(float a, float b) {
+        return a + (b-a) * (rand() / (RAND_MAX + 1.0f));
+    }
+
+    // Bounds of at most 20 bits of exponent range, where sums and products
+    // of floats are exact in double
+    static Interval randomInterval() {
+        float a = ldexpf(random(-1, 1), rand() % 21 - 10);
+        switch (rand() % 4) {
+        case 0: return Interval(a);
+        case 1: return Interval(-fabsf(a), ldexpf(random(0, 1), rand() % 21 - 10));
+        default: return Interval(a, a + ldexpf(random(0, 1), rand() % 21 - 10));
+        }
+    }
+
+    static bool contains(const Interval & x, double lo, double hi) {
+        return x.a <= lo && hi <= x.b;
+    }
+
+    static bool contains(const PackedInterval & x, const DVector & v) {
+        for (int k=0; k<3; k++) {
+            if (!contains(x[k], v[k], v[k])) return false;
+        }
+        return true;
+    }
+
+    // A body that moves and turns during a step, over the whole step as
+    // PossibleContact sees it
+    static ITransform randomMotion(const Vector & pos) {
+        Vector axis(random(-1,1), random(-1,1), random(-1,1));
+        Quaternion q = Quaternion::Rotation(axis.normalize(), random(0, 6.28f));
+        axis = Vector(random(-1,1), random(-1,1), random(-1,1));
+        Quaternion dq = Quaternion::Rotation(axis.normalize(), random(0, 0.5f));
+        Vector dp(random(-5,5), random(-5,5), random(-5,5));
+        return interp(Interval(0,1), (ITransform) Transform(q, pos),
+                      (ITransform) Transform(q*dq, pos + dp));
+    }
+
+    static double pick(const Interval & x) {
+        switch (rand() % 4) {
+        case 0: return x.a;
+        case 1: return x.b;
+        }
+        return x.a + (x.b - (double) x.a) * (rand() / (double) RAND_MAX);
+    }
+
+    // A quaternion and translation from within an interval transform
+    static void pick(const ITransform & T, DQuaternion & q, DVector & t) {
+        q = DQuaternion(pick(T.quat().real()), pick(T.quat().imag()[0]),
+                        pick(T.quat().imag()[1]), pick(T.quat().imag()[2]));
+        t = DVector(pick(T.vec()[0]), pick(T.vec()[1]), pick(T.vec()[2]));
+    }
+
+    // Whether boxes at transforms picked from the intervals are separated
+    // by one of their axes. Those within 1e-6 of the limit aren't clear.
+    static bool separated(const BoundingBox * box, const ITransform * T,
+                          bool & clear)
+    {
+        DVector pos[2], axes[2][3];
+        for (int i=0; i<2; i++) {
+            DQuaternion q;
+            DVector t;
+            pick(T[i], q, t);
+            const Vector & p = box[i].pos;
+            pos[i] = q.rot(DVector(p[0], p[1], p[2])) + t;
+            for (int j=0; j<3; j++) {
+                axes[i][j] = q.rot(DVector(j == 0, j == 1, j == 2));
+            }
+        }
+        DVector d = pos[1] - pos[0];
+        clear = true;
+        for (int i=0; i<6; i++) {
+            const DVector & axis = axes[i/3][i%3];
+            double A = fabs(d * axis), B = 0;
+            for (int j=0; j<3; j++) {
+                B += box[0].dim[j] * fabs(axis * axes[0][j]);
+                B += box[1].dim[j] * fabs(axis * axes[1][j]);
+            }
+            if (fabs(A - B) < 1e-6) clear = false;
+            if (A > B) return true;
+        }
+        return false;
+    }
+
+public:
+    void testOperationsContainExactResults( void )
+    {
+        srand(1);
+        int failed = 0;
+        for (int n=0; n<10000; n++) {
+            Interval x[4], y[4];
+            for (int i=0; i<4; i++) {
+                x[i] = randomInterval();
+                y[i] = randomInterval();
+            }
+            PackedInterval X(x[0], x[1], x[2], x[3]), Y(y[0], y[1], y[2], y[3]);
+            PackedInterval sum = X + Y, diff = X - Y, prod = X * Y;
+            PackedInterval absolute = abs(X), sq = square(X);
+            for (int i=0; i<4; i++) {
+                double a = x[i].a, b = x[i].b, c = y[i].a, d = y[i].b;
+                double p[4] = { a*c, a*d, b*c, b*d };
+                double abs_lo = a > 0 ? a : b < 0 ? -b : 0;
+                double abs_hi = std::max(-a, b);
+                if (!contains(sum[i], a+c, b+d) ||
+                    !contains(diff[i], a-d, b-c) ||
+                    !contains(prod[i], *std::min_element(p, p+4),
+                                       *std::max_element(p, p+4)) ||
+                    !contains(absolute[i], abs_lo, abs_hi) ||
+                    !contains(sq[i], abs_lo*abs_lo, abs_hi*abs_hi))
+                    failed++;
+            }
+            if (!contains(sum3(X), (double) x[0].a + x[1].a + x[2].a,
+                                   (double) x[0].b + x[1].b + x[2].b))
+                failed++;
+        }
+        TS_ASSERT_EQUALS( failed, 0 );
+    }
+
+    void testTransformContainsPointsAndAxes( void )
+    {
+        srand(2);
+        int failed = 0;
+        for (int n=0; n<1000; n++) {
+            ITransform T = randomMotion(Vector(0,0,0));
+            PackedITransform P(T);
+            Vector p(random(-5,5), random(-5,5), random(-5,5));
+            PackedInterval x = P(p);
+            for (int s=0; s<SAMPLES; s++) {
+                DQuaternion q;
+                DVector t;
+                pick(T, q, t);
+                if (!contains(x, q.rot(DVector(p[0], p[1], p[2])) + t))
+                    failed++;
+                for (int j=0; j<3; j++) {
+                    if (!contains(P.axes[j], q.rot(DVector(j == 0, j == 1, j == 2))))
+                        failed++;
+                }
+            }
+        }
+        TS_ASSERT_EQUALS( failed, 0 );
+    }
+
+    void testBoxBoxMatchesScalar( void )
+    {
+        srand(3);
+        int cases = 2000, differ = 0, failed = 0;
+        for (int n=0; n<cases; n++) {
+            BoundingBox box[2];
+            ITransform T[2];
+            T[0] = randomMotion(Vector(0,0,0));
+            T[1] = randomMotion(Vector(random(-15,15), random(-15,15), random(-15,15)));
+            for (int i=0; i<2; i++) {
+                box[i].pos = Vector(random(-5,5), random(-5,5), random(-5,5));
+                for (int k=0; k<3; k++) box[i].dim[k] = random(0.2f, 5);
+            }
+
+            IVector orient[2][3];
+            for (int i=0; i<2; i++) {
+                orient[i][0] = T[i].quat().rot(IVector(1,0,0));
+                orient[i][1] = T[i].quat().rot(IVector(0,1,0));
+                orient[i][2] = T[i].quat().rot(IVector(0,0,1));
+            }
+            Collide::Hints hints;
+            bool scalar = Collide::intersectBoxBox(
+                box[0], T[0]((IVector) box[0].pos), orient[0],
+                box[1], T[1]((IVector) box[1].pos), orient[1],
+                hints);
+            bool packed = Collide::intersectBoxBox(
+                box[0], PackedITransform(T[0]),
+                box[1], PackedITransform(T[1]),
+                hints);
+            if (scalar != packed) differ++;
+            if (packed) continue;
+
+            // Boxes the packed test separates must not intersect anywhere
+            // in the intervals
+            for (int s=0; s<SAMPLES; s++) {
+                bool clear;
+                if (!separated(box, T, clear) && clear) failed++;
+            }
+        }
+        TS_ASSERT_EQUALS( failed, 0 );
+        // They only differ by rounding, on pairs at the limit
+        TS_ASSERT_LESS_THAN_EQUALS( differ, cases / 500 );
+    }
+};
@@ -0,0 +1,135 @@
+#include <cxxtest/TestSuite.h>
+#include <cstdlib>
+#include <set>
+#include <vector>
+#include <modules/collide/SweepNPrune3D.h>
+
+// Checks SweepNPrune3D against all pairs of boxes, like sweepbench does on a
+// larger scale
+class SweepNPrune3DSuite : public CxxTest::TestSuite
+{
+    typedef Collide::SweepNPrune3D SweepNPrune3D;
+    typedef SweepNPrune3D::Pair Pair;
+    typedef SweepNPrune3D::PairList PairList;
+    typedef std::set<Pair> PairSet;
+
+    enum { BOXES = 100, STEPS = 200, RESPAWN_RATE = 50 };
+
+    // Boxes sit on a coarse grid, so that many of them touch
+    struct Box {
+        Vector min, max;
+        SweepNPrune3D::Handle handle;
+
+        void place() {
+            for (int k=0; k<3; k++) {
+                min[k] = rand() % 20;
+                max[k] = min[k] + 1 + rand() % 3;
+            }
+        }
+        void step() {
+            for (int k=0; k<3; k++) {
+                float d = rand() % 3 - 1;
+                min[k] += d;
+                max[k] += d;
+            }
+        }
+    };
+
+    static Pair makePair(int a, int b) {
+        return a < b ? Pair(a, b) : Pair(b, a);
+    }
+
+    static void findPairs(const std::vector<Box> & boxes, PairSet & pairs) {
+        for (size_t a=0; a<boxes.size(); a++) {
+            for (size_t b=a+1; b<boxes.size(); b++) {
+                bool overlap = true;
+                for (int k=0; k<3; k++) {
+                    if (boxes[a].min[k] > boxes[b].max[k] ||
+                        boxes[b].min[k] > boxes[a].max[k])
+                        overlap = false;
+                }
+                if (overlap) pairs.insert(makePair(a, b));
+            }
+        }
+    }
+
+public:
+    void testPairsAndChangesMatchAllPairs( void )
+    {
+        srand(1);
+        std::vector<Box> boxes(BOXES);
+        std::vector<int> box_of;
+        SweepNPrune3D snp;
+        for (int i=0; i<BOXES; i++) {
+            boxes[i].place();
+            boxes[i].handle = snp.add(boxes[i].min, boxes[i].max);
+        }
+
+        PairSet known;      // Sum of the reported changes, by box indices
+        int wrong_pairs = 0, wrong_changes = 0;
+        for (int s=0; s<STEPS; s++) {
+            for (int i=0; i<BOXES; i++) {
+                Box & b = boxes[i];
+                if (rand() % RESPAWN_RATE == 0) {
+                    snp.remove(b.handle);
+                    b.place();
+                    b.handle = snp.add(b.min, b.max);
+                } else {
+                    b.step();
+                    snp.set(b.handle, b.min, b.max);
+                }
+            }
+
+            // Removed pairs are in the handles of the last step
+            PairList added, removed;
+            snp.flushChanges(added, removed);
+            for (size_t j=0; j<removed.size(); j++) {
+                if (!known.erase(makePair(box_of[removed[j].first],
+                                          box_of[removed[j].second])))
+                    wrong_changes++;
+            }
+            for (int i=0; i<BOXES; i++) {
+                if ((int) box_of.size() <= boxes[i].handle) {
+                    box_of.resize(boxes[i].handle + 1);
+                }
+                box_of[boxes[i].handle] = i;
+            }
+            for (size_t j=0; j<added.size(); j++) {
+                if (!known.insert(makePair(box_of[added[j].first],
+                                           box_of[added[j].second])).second)
+                    wrong_changes++;
+            }
+
+            PairSet expected, found;
+            findPairs(boxes, expected);
+            PairList contacts;
+            snp.findContacts(contacts);
+            for (size_t j=0; j<contacts.size(); j++) {
+                found.insert(makePair(box_of[contacts[j].first],
+                                      box_of[contacts[j].second]));
+            }
+            if (found != expected
+                || (int) contacts.size() != snp.getNumOfPairs())
+                wrong_pairs++;
+            if (known != expected) wrong_changes++;
+        }
+        TS_ASSERT_EQUALS( wrong_pairs, 0 );
+        TS_ASSERT_EQUALS( wrong_changes, 0 );
+    }
+
+    void testTouchingBoxesOverlap( void )
+    {
+        SweepNPrune3D snp(false);
+        snp.add(Vector(0,0,0), Vector(1,1,1));
+        snp.add(Vector(1,0,0), Vector(2,1,1));
+        SweepNPrune3D::Handle c = snp.add(Vector(3,0,0), Vector(4,1,1));
+        TS_ASSERT_EQUALS( snp.getNumOfPairs(), 1 );
+
+        // Touching at a corner only
+        snp.set(c, Vector(2,1,1), Vector(3,2,2));
+        PairList contacts;
+        snp.findContacts(contacts);
+        TS_ASSERT_EQUALS( contacts.size(), 2u );
+        TS_ASSERT_EQUALS( snp.getNumOfPairs(), 2 );
+    }
+};
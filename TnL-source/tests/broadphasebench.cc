@@ -0,0 +1,276 @@
+// Compares the broad phase methods of Collide::BroadPhase on a mission full
+// of formations.
+//
+// usage: broadphasebench [steps]
+//
+// The scene has tank convoys heading north in columns, drone formations
+// with bullet streams in front of them, some missiles and a carrier. The
+// columns line up along z, so that many boxes share their x interval, which
+// is the worst case for sweeping along x alone. Each step moves everything
+// by one collision time step and queries the pairs of the boxes around the
+// swept bounding spheres, as CollisionManager::run does. The benchmark fails
+// unless all methods give the same pairs in every step, and for the smaller
+// scenes the pairs of the first step are also checked against testing all
+// pairs.
+//
+// After the last step, each method looks up the boxes on SEGMENTS lines of
+// sight between random bodies, as CollisionManager::lineQuery does. These
+// are checked the same way, against testing all boxes for the smaller
+// scenes.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <SDL.h>
+#include <modules/collide/BroadPhase.h>
+
+#define DELTA_T       0.02f
+#define AREA_PER_BODY 900.0f    // Square meters of ground per body
+#define CONVOY_LENGTH 20
+#define FORMATION     6
+#define STREAM_LENGTH 10
+#define BRUTE_FORCE_N 2000      // Largest scene that is checked brute force
+#define SEGMENTS      1000
+
+using namespace Collide;
+
+typedef BroadPhase::PairList PairList;
+typedef std::vector<int> IdList;
+
+static float frand(float a, float b) {
+    return a + (b-a) * (rand() / (RAND_MAX + 1.0f));
+}
+
+struct Body {
+    Vector pos, vel;
+    float radius;
+
+    Body(const Vector & pos, const Vector & vel, float radius)
+    :   pos(pos), vel(vel), radius(radius)
+    { }
+
+    inline bool operator< (const Body & b) const {
+        return pos[0] - radius < b.pos[0] - b.radius;
+    }
+
+    void box(int step, Vector & min, Vector & max) const {
+        Vector p0 = pos + (step*DELTA_T) * vel;
+        Vector p1 = pos + ((step+1)*DELTA_T) * vel;
+        for (int k=0; k<3; k++) {
+            min[k] = std::min(p0[k], p1[k]) - radius;
+            max[k] = std::max(p0[k], p1[k]) + radius;
+        }
+    }
+};
+
+static void makeScene(int n, std::vector<Body> & bodies) {
+    srand(n);
+    float size = sqrtf(n * AREA_PER_BODY);
+    bodies.push_back(Body(Vector(size/2, 0, size/2), Vector(0,0,5), 150));
+
+    while ((int) bodies.size() < n) {
+        int kind = rand() % 20;
+        if (kind < 8) {
+            // A tank convoy heading north in a column
+            Vector p(frand(0, size), 2, frand(0, size));
+            for (int i=0; i<CONVOY_LENGTH; i++) {
+                bodies.push_back(Body(p - Vector(0,0,12*i),
+                                      Vector(0,0,15), 4));
+            }
+        } else if (kind < 19) {
+            // A drone formation in echelon, each firing a bullet stream
+            Vector p(frand(0, size), frand(500, 1500), frand(0, size));
+            Vector vel(frand(-20, 20), 0, 200);
+            for (int i=0; i<FORMATION; i++) {
+                Vector d = p + Vector(15*i, 0, -15*i);
+                bodies.push_back(Body(d, vel, 8));
+                if (rand() % 2) continue;
+                for (int j=0; j<STREAM_LENGTH; j++) {
+                    bodies.push_back(Body(d + Vector(0,0,10 + 18*j),
+                                          vel + Vector(0,0,900), 0.2f));
+                }
+            }
+        } else {
+            Vector p(frand(0, size), frand(100, 1500), frand(0, size));
+            Vector dir(frand(-1, 1), frand(-0.2f, 0.2f), frand(-1, 1));
+            dir.normalize();
+            bodies.push_back(Body(p, 400*dir, 2));
+        }
+    }
+    bodies.erase(bodies.begin() + n, bodies.end());
+    // Adding the bodies from left to right keeps SweepNPrune from sorting
+    // them all through each other while setting up
+    std::sort(bodies.begin(), bodies.end());
+}
+
+static bool overlaps(const Vector & a0, const Vector & a1,
+                     const Vector & b0, const Vector & b1)
+{
+    for (int k=0; k<3; k++) {
+        if (a0[k] > b1[k] || b0[k] > a1[k]) return false;
+    }
+    return true;
+}
+
+static bool crosses(const Vector & min, const Vector & max,
+                    const Vector & a, const Vector & b)
+{
+    float t0 = 0, t1 = 1;
+    for (int k=0; k<3; k++) {
+        float d = b[k] - a[k];
+        if (d == 0) {
+            if (a[k] < min[k] || a[k] > max[k]) return false;
+            continue;
+        }
+        float u0 = (min[k] - a[k]) / d, u1 = (max[k] - a[k]) / d;
+        t0 = std::max(t0, std::min(u0, u1));
+        t1 = std::min(t1, std::max(u0, u1));
+        if (t0 > t1) return false;
+    }
+    return true;
+}
+
+static void bruteForceSegment(const std::vector<Body> & bodies, int step,
+                              const Vector & a, const Vector & b,
+                              IdList & ids)
+{
+    Vector min, max;
+    for (size_t i=0; i<bodies.size(); i++) {
+        bodies[i].box(step, min, max);
+        if (crosses(min, max, a, b)) ids.push_back(i);
+    }
+}
+
+static void bruteForce(const std::vector<Body> & bodies, PairList & pairs) {
+    int n = bodies.size();
+    std::vector<Vector> min(n), max(n);
+    for (int i=0; i<n; i++) bodies[i].box(0, min[i], max[i]);
+    for (int i=0; i<n; i++) {
+        for (int j=i+1; j<n; j++) {
+            if (overlaps(min[i], max[i], min[j], max[j])) {
+                pairs.push_back(BroadPhase::Pair(i, j));
+            }
+        }
+    }
+}
+
+static const char * method_names[] = { "sweep", "sweep3d", "grid" };
+
+static bool bench(int n, int steps) {
+    std::vector<Body> bodies;
+    makeScene(n, bodies);
+
+    // Lines of sight between the bodies where the last step leaves them
+    std::vector<Vector> from(SEGMENTS), to(SEGMENTS);
+    for (int i=0; i<SEGMENTS; i++) {
+        const Body & a = bodies[rand() % n], & b = bodies[rand() % n];
+        from[i] = a.pos + (steps*DELTA_T) * a.vel;
+        to[i] = b.pos + (steps*DELTA_T) * b.vel;
+    }
+
+    std::vector<PairList> results[3];
+    std::vector<IdList> segment_results[3];
+    Uint32 time[3], segment_time[3];
+    for (int m=0; m<3; m++) {
+        BroadPhase broad_phase((BroadPhase::Method) m);
+        Vector min, max;
+        for (int i=0; i<n; i++) {
+            bodies[i].box(0, min, max);
+            broad_phase.add(min, max);
+        }
+
+        results[m].resize(steps);
+        Uint32 t0 = SDL_GetTicks();
+        for (int s=0; s<steps; s++) {
+            for (int i=0; i<n; i++) {
+                bodies[i].box(s, min, max);
+                broad_phase.set(i, min, max);
+            }
+            broad_phase.findPairs(results[m][s]);
+        }
+        time[m] = SDL_GetTicks() - t0;
+
+        segment_results[m].resize(SEGMENTS);
+        t0 = SDL_GetTicks();
+        broad_phase.prepareSegments();
+        for (int i=0; i<SEGMENTS; i++) {
+            broad_phase.findSegment(from[i], to[i], segment_results[m][i]);
+        }
+        segment_time[m] = SDL_GetTicks() - t0;
+        for (int i=0; i<SEGMENTS; i++) {
+            std::sort(segment_results[m][i].begin(),
+                      segment_results[m][i].end());
+        }
+    }
+
+    for (int m=1; m<3; m++) {
+        for (int s=0; s<steps; s++) {
+            if (results[m][s] != results[0][s]) {
+                printf("n=%d step %d: %s finds %d pairs, sweep %d\n",
+                        n, s, method_names[m], (int) results[m][s].size(),
+                        (int) results[0][s].size());
+                return false;
+            }
+        }
+        for (int i=0; i<SEGMENTS; i++) {
+            if (segment_results[m][i] != segment_results[0][i]) {
+                printf("n=%d segment %d: %s finds %d boxes, sweep %d\n",
+                        n, i, method_names[m],
+                        (int) segment_results[m][i].size(),
+                        (int) segment_results[0][i].size());
+                return false;
+            }
+        }
+    }
+    if (n <= BRUTE_FORCE_N) {
+        PairList expected;
+        bruteForce(bodies, expected);
+        if (expected != results[0][0]) {
+            printf("n=%d: %d pairs, %d expected\n", n,
+                    (int) results[0][0].size(), (int) expected.size());
+            return false;
+        }
+        for (int i=0; i<SEGMENTS; i++) {
+            IdList expected_ids;
+            bruteForceSegment(bodies, steps-1, from[i], to[i], expected_ids);
+            if (expected_ids != segment_results[0][i]) {
+                printf("n=%d segment %d: %d boxes, %d expected\n", n, i,
+                        (int) segment_results[0][i].size(),
+                        (int) expected_ids.size());
+                return false;
+            }
+        }
+    }
+
+    size_t pairs = 0;
+    for (int s=0; s<steps; s++) pairs += results[0][s].size();
+    printf("%6d bodies, %7.1f pairs:", n, pairs / (float) steps);
+    for (int m=0; m<3; m++) {
+        printf("  %s %8.3f ms", method_names[m], time[m] / (float) steps);
+    }
+    printf("\n%6d segments:               ", SEGMENTS);
+    for (int m=0; m<3; m++) {
+        printf("  %s %8.3f ms", method_names[m], (float) segment_time[m]);
+    }
+    printf("\n");
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int steps = argc > 1 ? atoi(argv[1]) : 100;
+    if (steps < 1) {
+        fprintf(stderr, "usage: %s [steps]\n", argv[0]);
+        return 1;
+    }
+
+    int sizes[] = { 100, 1000, 10000 };
+    for (int i=0; i<3; i++) {
+        if (!bench(sizes[i], steps)) {
+            printf("Verification failed\n");
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,164 @@
+// Measures CollisionManager::run and checks that it doesn't allocate once
+// the scene is warmed up.
+//
+// usage: collidebench <model.bounds> [steps] [threads]
+//
+// The scene has PAIRS pairs of bodies with the given bounding geometry,
+// each pair flying head on into each other along x. The bodies are put
+// back on a scripted path before each step, so that the scene repeats
+// every PERIOD steps: the bodies of a pair approach by one bounding radius
+// per step and meet in the last step of their period, the pairs are
+// staggered so that every step has some contacts. After WARMUP_PERIODS
+// periods, the tables of the CollisionManager have grown as large as the
+// scene needs, and the benchmark fails if any of the following steps
+// allocates memory. The allocations are counted by replacing the global
+// operator new, atomically, since the narrow phase runs on the given
+// number of threads, see CollisionManager_narrowphase_threads. "make check"
+// runs it on test.bounds.
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <SDL.h>
+#include <modules/actors/simpleactor.h>
+#include <modules/collide/CollisionManager.h>
+#include <modules/config/config.h>
+#include <modules/physics/RigidBody.h>
+
+#define PAIRS          100
+#define PERIOD         25
+#define WARMUP_PERIODS 2
+#define DELTA_T        0.02f
+#define MASS           1000.0f
+
+static long allocations = 0;
+
+void *operator new(std::size_t n) {
+    __sync_fetch_and_add(&allocations, 1);
+    void *p = malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](std::size_t n) {
+    __sync_fetch_and_add(&allocations, 1);
+    void *p = malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) throw() { free(p); }
+void operator delete[](void *p) throw() { free(p); }
+
+class Body : public SimpleActor, public Collide::Collidable {
+    Ptr<RigidBody> body;
+    Vector center;
+    float direction;    // +1 or -1, along x
+    int phase;
+public:
+    int collisions;
+
+    Body(Ptr<Collide::BoundingGeometry> bounds, const Vector & center,
+         float direction, int phase)
+    :   SimpleActor(0), Collide::Collidable(bounds),
+        body(new RigidBody), center(center), direction(direction),
+        phase(phase), collisions(0)
+    {
+        body->construct(MASS, MASS, MASS, MASS);
+        setRigidBody(ptr(body));
+        setActor(this);
+    }
+
+    // Puts the body where the script has it at the beginning of step
+    void reset(int step) {
+        float r = getBoundingGeometry()->getBoundingRadius();
+        int p = (step + phase) % PERIOD;
+        RigidBodyState s = body->getState();
+        s.x = center - (direction * r * (PERIOD - p)) * Vector(1,0,0);
+        s.q = Quaternion(1,0,0,0);
+        s.P = (direction * MASS * r / DELTA_T) * Vector(1,0,0);
+        s.L = Vector(0,0,0);
+        body->setState(s);
+    }
+
+    virtual void integrate(float delta_t, Transform * transforms) {
+        const RigidBodyState & s = body->getState();
+        transforms[0] = Transform(s.q,
+            s.x + delta_t * body->getLinearVelocity());
+    }
+
+    virtual void update(float delta_t, const Transform * new_transforms) {
+        RigidBodyState s = body->getState();
+        s.x = new_transforms[0].vec();
+        s.q = new_transforms[0].quat();
+        body->setState(s);
+    }
+
+    virtual void collide(const Collide::Contact &) { collisions++; }
+};
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <model.bounds> [steps] [threads]\n",
+                argv[0]);
+        return 1;
+    }
+    int steps = argc > 2 ? atoi(argv[2]) : 1000;
+    const char *threads = argc > 3 ? argv[3] : "1";
+    if (steps < 1) {
+        fprintf(stderr, "usage: %s <model.bounds> [steps] [threads]\n",
+                argv[0]);
+        return 1;
+    }
+
+    Ptr<Config> cfg = new Config;
+    cfg->set("CollisionManager_narrowphase_threads", threads);
+    Ptr<Collide::CollisionManager> cm =
+        new Collide::CollisionManager(Ptr<IConfig>(cfg));
+    Ptr<Collide::BoundingGeometry> bounds = cm->queryGeometry(argv[1]);
+    if (!bounds) return 1;
+    float r = bounds->getBoundingRadius();
+
+    std::vector<Ptr<Body> > bodies;
+    for (int i=0; i<PAIRS; i++) {
+        Vector center(0, 4*r * (i%10), 4*r * (i/10));
+        bodies.push_back(new Body(bounds, center, 1, i));
+        bodies.push_back(new Body(bounds, center, -1, i));
+    }
+    for (size_t i=0; i<bodies.size(); i++) cm->add(bodies[i]);
+
+    int step = 0;
+    for (; step<WARMUP_PERIODS*PERIOD; step++) {
+        for (size_t i=0; i<bodies.size(); i++) bodies[i]->reset(step);
+        cm->run(0, DELTA_T);
+    }
+
+    SDL_Init(SDL_INIT_TIMER);
+    int collisions = 0, bad_step = -1;
+    for (size_t i=0; i<bodies.size(); i++) bodies[i]->collisions = 0;
+    Uint32 t0 = SDL_GetTicks();
+    for (int s=0; s<steps; s++, step++) {
+        for (size_t i=0; i<bodies.size(); i++) bodies[i]->reset(step);
+        long before = __sync_fetch_and_add(&allocations, 0);
+        cm->run(0, DELTA_T);
+        long after = __sync_fetch_and_add(&allocations, 0);
+        if (after != before && bad_step < 0) bad_step = s;
+    }
+    Uint32 t = SDL_GetTicks() - t0;
+    SDL_Quit();
+    for (size_t i=0; i<bodies.size(); i++) collisions += bodies[i]->collisions;
+
+    for (size_t i=0; i<bodies.size(); i++) cm->remove(bodies[i]);
+
+    if (bad_step >= 0) {
+        printf("%s: step %d after the warm-up allocates memory\n",
+                argv[1], bad_step);
+        return 1;
+    }
+    printf("%s: %d bodies, %d steps, %s threads, %.1f collisions per step, "
+            "no allocations, %.3f ms per step\n", argv[1],
+            (int) bodies.size(), steps, threads, collisions / (float) steps,
+            t / (float) steps);
+    return 0;
+}
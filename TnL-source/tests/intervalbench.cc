@@ -0,0 +1,315 @@
+// Compares the packed intervals of PackedInterval.h with Interval, and the
+// box/box test of Collide::intersectBoxBox on both.
+//
+// usage: intervalbench [repeats]
+//
+// The packed operations are checked against their exact results, computed
+// in double from bounds of at most 20 bits of exponent range, where sums and
+// products of floats are exact. The packed transforms and box/box tests are
+// checked against transforms picked from within the interval transforms:
+// whatever quaternion and translation inside the intervals, the transformed
+// points and axes have to lie within the packed results, and boxes that
+// aren't separated by any of their axes have to intersect. The transforms
+// move and turn like bodies during one collision time step, some of them
+// with a second, child transform like a turret.
+//
+// The benchmark fails if any of these checks fails, and prints how much
+// wider the packed results are than the Interval ones, in how many tests
+// the two box/box tests disagree, and the time of each test including the
+// setup of the orientations and transforms.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <SDL.h>
+#include <modules/math/PackedInterval.h>
+#include <modules/collide/Primitive.h>
+
+#define OPERATIONS  1000000
+#define TRANSFORMS  10000
+#define SAMPLES     16          // Picked from each interval transform
+#define CASES       10000       // Box pairs
+
+using namespace Collide;
+
+typedef XVector<3,double> DVector;
+typedef XQuaternion<double> DQuaternion;
+
+static float frand(float a, float b) {
+    return a + (b-a) * (rand() / (RAND_MAX + 1.0f));
+}
+
+static Interval randomInterval() {
+    float a = ldexpf(frand(-1, 1), rand() % 21 - 10);
+    switch (rand() % 4) {
+    case 0: return Interval(a);
+    case 1: return Interval(-fabsf(a), ldexpf(frand(0, 1), rand() % 21 - 10));
+    default:
+        float b = a + ldexpf(frand(0, 1), rand() % 21 - 10);
+        return Interval(a, b);
+    }
+}
+
+static bool contains(const Interval & x, double lo, double hi) {
+    return x.a <= lo && hi <= x.b;
+}
+
+static bool checkOperations() {
+    double excess = 0, width = 0;
+    for (int n=0; n<OPERATIONS; n+=4) {
+        Interval x[4], y[4];
+        for (int i=0; i<4; i++) {
+            x[i] = randomInterval();
+            y[i] = randomInterval();
+        }
+        PackedInterval X(x[0], x[1], x[2], x[3]), Y(y[0], y[1], y[2], y[3]);
+        PackedInterval sum = X + Y, diff = X - Y, prod = X * Y;
+        PackedInterval absolute = abs(X), sq = square(X);
+        for (int i=0; i<4; i++) {
+            double a = x[i].a, b = x[i].b, c = y[i].a, d = y[i].b;
+            double p[4] = { a*c, a*d, b*c, b*d };
+            double abs_lo = a > 0 ? a : b < 0 ? -b : 0;
+            double abs_hi = std::max(-a, b);
+            if (!contains(sum[i], a+c, b+d) ||
+                !contains(diff[i], a-d, b-c) ||
+                !contains(prod[i], *std::min_element(p, p+4),
+                                   *std::max_element(p, p+4)) ||
+                !contains(absolute[i], abs_lo, abs_hi) ||
+                !contains(sq[i], abs_lo*abs_lo, abs_hi*abs_hi))
+            {
+                printf("Operation on [%g, %g] and [%g, %g] isn't contained\n",
+                       a, b, c, d);
+                return false;
+            }
+            Interval scalar = x[i] * y[i];
+            excess += prod[i].length() - scalar.length();
+            width += scalar.length();
+        }
+        double s_lo = (double) x[0].a + x[1].a + x[2].a;
+        double s_hi = (double) x[0].b + x[1].b + x[2].b;
+        if (!contains(sum3(X), s_lo, s_hi)) {
+            printf("Sum of lanes isn't contained\n");
+            return false;
+        }
+    }
+    printf("%d operations: products %.2g%% wider than Interval\n",
+           OPERATIONS, 100 * excess / width);
+    return true;
+}
+
+// A body that moves and turns during a step, with an optional child
+struct Motion {
+    Transform from[2], to[2];
+    int levels;
+
+    Motion(const Vector & pos) {
+        levels = 1 + rand() % 2;
+        for (int i=0; i<levels; i++) {
+            Vector axis(frand(-1,1), frand(-1,1), frand(-1,1));
+            axis.normalize();
+            Quaternion q = Quaternion::Rotation(axis, frand(0, 6.28f));
+            axis = Vector(frand(-1,1), frand(-1,1), frand(-1,1));
+            axis.normalize();
+            Quaternion dq = Quaternion::Rotation(axis, frand(0, 0.5f));
+            Vector p = i == 0 ? pos : Vector(frand(-3,3), frand(-3,3), 0);
+            Vector dp(frand(-5,5), frand(-5,5), frand(-5,5));
+            from[i] = Transform(q, p);
+            to[i] = Transform(q*dq, p + (i == 0 ? dp : Vector(0,0,0)));
+        }
+    }
+
+    // As PossibleContact does for the whole time interval
+    ITransform interval() const {
+        ITransform T = interp(Interval(0,1),
+            (ITransform) from[0], (ITransform) to[0]);
+        for (int i=1; i<levels; i++) {
+            T = T * interp(Interval(0,1),
+                (ITransform) from[i], (ITransform) to[i]);
+        }
+        return T;
+    }
+};
+
+static double pick(const Interval & x) {
+    switch (rand() % 4) {
+    case 0: return x.a;
+    case 1: return x.b;
+    }
+    return x.a + (x.b - (double) x.a) * (rand() / (double) RAND_MAX);
+}
+
+// A quaternion and translation from within an interval transform
+static void pick(const ITransform & T, DQuaternion & q, DVector & t) {
+    q = DQuaternion(pick(T.quat().real()), pick(T.quat().imag()[0]),
+                    pick(T.quat().imag()[1]), pick(T.quat().imag()[2]));
+    t = DVector(pick(T.vec()[0]), pick(T.vec()[1]), pick(T.vec()[2]));
+}
+
+static bool contains(const PackedInterval & x, const DVector & v) {
+    for (int k=0; k<3; k++) {
+        if (!contains(x[k], v[k], v[k])) return false;
+    }
+    return true;
+}
+
+static double width(const IVector & v) {
+    return v[0].length() + v[1].length() + v[2].length();
+}
+
+static bool checkTransforms() {
+    double packed_width = 0, scalar_width = 0;
+    for (int n=0; n<TRANSFORMS; n++) {
+        ITransform T = Motion(Vector(0,0,0)).interval();
+        PackedITransform P(T);
+        Vector p(frand(-5,5), frand(-5,5), frand(-5,5));
+        PackedInterval x = P(p);
+        packed_width += width(x.toIVector());
+        scalar_width += width(T((IVector) p));
+
+        for (int s=0; s<SAMPLES; s++) {
+            DQuaternion q;
+            DVector t;
+            pick(T, q, t);
+            bool ok = contains(x, q.rot(DVector(p[0], p[1], p[2])) + t);
+            for (int j=0; j<3; j++) {
+                DVector e(j == 0, j == 1, j == 2);
+                ok = ok && contains(P.axes[j], q.rot(e));
+            }
+            if (!ok) {
+                printf("Transform %d: sample %d isn't contained\n", n, s);
+                return false;
+            }
+        }
+    }
+    printf("%d transforms: points %.2g%% wider than Interval\n",
+           TRANSFORMS, 100 * (packed_width / scalar_width - 1));
+    return true;
+}
+
+struct Case {
+    BoundingBox box[2];
+    ITransform T[2];
+};
+
+static void makeCases(std::vector<Case> & cases) {
+    for (int n=0; n<CASES; n++) {
+        Case c;
+        Vector pos(frand(-15,15), frand(-15,15), frand(-15,15));
+        c.T[0] = Motion(Vector(0,0,0)).interval();
+        c.T[1] = Motion(pos).interval();
+        for (int i=0; i<2; i++) {
+            c.box[i].pos = Vector(frand(-5,5), frand(-5,5), frand(-5,5));
+            for (int k=0; k<3; k++) c.box[i].dim[k] = frand(0.2f, 5);
+        }
+        cases.push_back(c);
+    }
+}
+
+// As PossibleContact used to set up the test
+static bool scalarTest(const Case & c, Hints & hints) {
+    IVector orient[2][3];
+    for (int i=0; i<2; i++) {
+        orient[i][0] = c.T[i].quat().rot(IVector(1,0,0));
+        orient[i][1] = c.T[i].quat().rot(IVector(0,1,0));
+        orient[i][2] = c.T[i].quat().rot(IVector(0,0,1));
+    }
+    return intersectBoxBox(
+        c.box[0], c.T[0]((IVector) c.box[0].pos), orient[0],
+        c.box[1], c.T[1]((IVector) c.box[1].pos), orient[1],
+        hints);
+}
+
+static bool packedTest(const Case & c, Hints & hints) {
+    return intersectBoxBox(c.box[0], PackedITransform(c.T[0]),
+                           c.box[1], PackedITransform(c.T[1]),
+                           hints);
+}
+
+// Whether the boxes are separated by one of their axes, for transforms
+// picked from the intervals. Cases within 1e-6 of the limit don't count.
+static bool separated(const Case & c, bool & clear) {
+    DVector pos[2], axes[2][3];
+    for (int i=0; i<2; i++) {
+        DQuaternion q;
+        DVector t;
+        pick(c.T[i], q, t);
+        const Vector & p = c.box[i].pos;
+        pos[i] = q.rot(DVector(p[0], p[1], p[2])) + t;
+        for (int j=0; j<3; j++) {
+            axes[i][j] = q.rot(DVector(j == 0, j == 1, j == 2));
+        }
+    }
+    DVector d = pos[1] - pos[0];
+    clear = true;
+    for (int i=0; i<6; i++) {
+        const DVector & axis = axes[i/3][i%3];
+        double A = fabs(d * axis), B = 0;
+        for (int j=0; j<3; j++) {
+            B += c.box[0].dim[j] * fabs(axis * axes[0][j]);
+            B += c.box[1].dim[j] * fabs(axis * axes[1][j]);
+        }
+        if (fabs(A - B) < 1e-6) clear = false;
+        if (A > B) return true;
+    }
+    return false;
+}
+
+static bool checkBoxBox(int repeats) {
+    std::vector<Case> cases;
+    makeCases(cases);
+
+    int hits[2] = { 0, 0 }, disagree = 0;
+    for (int n=0; n<CASES; n++) {
+        Hints hints;
+        bool scalar = scalarTest(cases[n], hints);
+        bool packed = packedTest(cases[n], hints);
+        hits[0] += scalar;
+        hits[1] += packed;
+        disagree += scalar != packed;
+        if (packed) continue;
+        for (int s=0; s<SAMPLES; s++) {
+            bool clear;
+            if (!separated(cases[n], clear) && clear) {
+                printf("Case %d: sample %d intersects\n", n, s);
+                return false;
+            }
+        }
+    }
+
+    Uint32 time[2];
+    for (int m=0; m<2; m++) {
+        Uint32 t0 = SDL_GetTicks();
+        for (int r=0; r<repeats; r++) {
+            for (int n=0; n<CASES; n++) {
+                Hints hints;
+                if (m) packedTest(cases[n], hints);
+                else scalarTest(cases[n], hints);
+            }
+        }
+        time[m] = SDL_GetTicks() - t0;
+    }
+    printf("%d box pairs: Interval %d, packed %d intersect, %d differ\n",
+           CASES, hits[0], hits[1], disagree);
+    printf("Per box test: Interval %.1f ns, packed %.1f ns (%s)\n",
+           1e6f * time[0] / (repeats * CASES),
+           1e6f * time[1] / (repeats * CASES),
+           PACKED_INTERVAL_SSE2 ? "SSE2" : "scalar");
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int repeats = argc > 1 ? atoi(argv[1]) : 100;
+    if (repeats < 1) {
+        fprintf(stderr, "usage: %s [repeats]\n", argv[0]);
+        return 1;
+    }
+
+    srand(1);
+    if (!checkOperations() || !checkTransforms() || !checkBoxBox(repeats)) {
+        printf("Verification failed\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,264 @@
+// Compares the broadphase classes Collide::SweepNPrune and
+// Collide::SweepNPrune3D.
+//
+// usage: sweepbench [steps]
+//
+// Boxes of random size move on random walks through a flat slab of the
+// world, at the density of a busy mission. For 100, 1000 and 10000 boxes,
+// each step moves every box and then asks the broadphase for its pairs:
+// SweepNPrune sorts on the x axis and reports all pairs anew, SweepNPrune3D
+// updates its persistent pairs and reports the changes. After every step
+// the benchmark checks that SweepNPrune3D knows the pairs of boxes that
+// overlap on all axes, and that its changes add up to them. Some boxes are
+// removed and added again along the way. That is left out of the timed
+// runs, since SweepNPrune loses track of a box whose minimum passes its old
+// maximum.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <set>
+#include <vector>
+#include <SDL.h>
+#include <modules/collide/SweepNPrune.h>
+#include <modules/collide/SweepNPrune3D.h>
+
+#define WORLD_HEIGHT 2000.0f
+#define BOX_SPACING  200.0f     // Per box on the ground
+#define MIN_RADIUS   5.0f
+#define MAX_RADIUS   40.0f
+#define MAX_STEP     10.0f
+#define RESPAWN_RATE 100        // One box in this many per step
+
+using namespace Collide;
+
+typedef SweepNPrune3D::Pair Pair;
+typedef SweepNPrune3D::PairList PairList;
+typedef std::set<Pair> PairSet;
+
+static float frand(float a, float b) {
+    return a + (b-a) * (rand() / (RAND_MAX + 1.0f));
+}
+
+static Pair makePair(int a, int b) {
+    return a < b ? Pair(a, b) : Pair(b, a);
+}
+
+struct Body {
+    Vector pos;
+    float radius;
+    SweepNPrune3D::Handle handle;
+};
+
+struct World {
+    std::vector<Body> bodies;
+    float size;
+
+    World(int n) : bodies(n), size(BOX_SPACING * sqrtf(n)) {
+        for (int i=0; i<n; i++) place(bodies[i]);
+    }
+
+    void place(Body & b) {
+        b.pos = Vector(frand(0, size), frand(0, WORLD_HEIGHT),
+                       frand(0, size));
+        b.radius = frand(MIN_RADIUS, MAX_RADIUS);
+    }
+
+    void step() {
+        for (size_t i=0; i<bodies.size(); i++) {
+            Vector & p = bodies[i].pos;
+            p += Vector(frand(-MAX_STEP, MAX_STEP),
+                        frand(-MAX_STEP, MAX_STEP),
+                        frand(-MAX_STEP, MAX_STEP));
+            p[0] = std::max(0.0f, std::min(size, p[0]));
+            p[1] = std::max(0.0f, std::min(WORLD_HEIGHT, p[1]));
+            p[2] = std::max(0.0f, std::min(size, p[2]));
+        }
+    }
+
+    Vector min(int i) const {
+        float r = bodies[i].radius;
+        return bodies[i].pos - Vector(r,r,r);
+    }
+    Vector max(int i) const {
+        float r = bodies[i].radius;
+        return bodies[i].pos + Vector(r,r,r);
+    }
+
+    // Sweeps over x the simple way for reference
+    void findPairs(PairSet & pairs) const {
+        std::vector<std::pair<float, int> > order;
+        for (size_t i=0; i<bodies.size(); i++) {
+            order.push_back(std::make_pair(min(i)[0], (int) i));
+        }
+        std::sort(order.begin(), order.end());
+        for (size_t i=0; i<order.size(); i++) {
+            int a = order[i].second;
+            for (size_t j=i+1; j<order.size(); j++) {
+                if (order[j].first > max(a)[0]) break;
+                int b = order[j].second;
+                if (overlaps(a, b)) pairs.insert(makePair(a, b));
+            }
+        }
+    }
+
+    bool overlaps(int a, int b) const {
+        Vector a0 = min(a), a1 = max(a), b0 = min(b), b1 = max(b);
+        for (int k=0; k<3; k++) {
+            if (a0[k] > b1[k] || b0[k] > a1[k]) return false;
+        }
+        return true;
+    }
+};
+
+static bool verify(int n, int steps) {
+    srand(n);
+    World world(n);
+    SweepNPrune3D snp;
+    PairSet known;      // Sum of the reported changes, by body indices
+    std::vector<int> body_of;
+
+    for (int i=0; i<n; i++) {
+        Body & b = world.bodies[i];
+        b.handle = snp.add(world.min(i), world.max(i));
+        if ((int) body_of.size() <= b.handle) body_of.resize(b.handle+1);
+        body_of[b.handle] = i;
+    }
+
+    for (int s=0; s<steps; s++) {
+        PairList added, removed;
+        world.step();
+        for (int i=0; i<n; i++) {
+            Body & b = world.bodies[i];
+            if (rand() % RESPAWN_RATE == 0) {
+                snp.remove(b.handle);
+                world.place(b);
+                b.handle = snp.add(world.min(i), world.max(i));
+                if ((int) body_of.size() <= b.handle) {
+                    body_of.resize(b.handle+1);
+                }
+            } else {
+                snp.set(b.handle, world.min(i), world.max(i));
+            }
+        }
+
+        // The changes are reported in handles, which are mapped to bodies
+        // before the new handles are
+        snp.flushChanges(added, removed);
+        for (size_t j=0; j<removed.size(); j++) {
+            Pair p = makePair(body_of[removed[j].first],
+                              body_of[removed[j].second]);
+            if (!known.erase(p)) {
+                printf("n=%d step %d: removed unknown pair %d %d\n",
+                        n, s, p.first, p.second);
+                return false;
+            }
+        }
+        for (int i=0; i<n; i++) body_of[world.bodies[i].handle] = i;
+        for (size_t j=0; j<added.size(); j++) {
+            Pair p = makePair(body_of[added[j].first],
+                              body_of[added[j].second]);
+            if (!known.insert(p).second) {
+                printf("n=%d step %d: added known pair %d %d\n",
+                        n, s, p.first, p.second);
+                return false;
+            }
+        }
+
+        PairSet expected;
+        world.findPairs(expected);
+
+        PairList contacts;
+        snp.findContacts(contacts);
+        PairSet found;
+        for (size_t j=0; j<contacts.size(); j++) {
+            found.insert(makePair(body_of[contacts[j].first],
+                                  body_of[contacts[j].second]));
+        }
+
+        if (found != expected || known != expected
+            || (int) contacts.size() != snp.getNumOfPairs())
+        {
+            printf("n=%d step %d: %d pairs, %d known, %d expected\n",
+                    n, s, (int) found.size(), (int) known.size(),
+                    (int) expected.size());
+            return false;
+        }
+    }
+    return true;
+}
+
+static void bench(int n, int steps) {
+    srand(n);
+    const World world(n);
+    std::vector<World> path(1, world);
+    for (int s=0; s<steps; s++) {
+        path.push_back(path.back());
+        path.back().step();
+    }
+    path.erase(path.begin());
+
+    // Adding the boxes from left to right keeps the setup from sorting
+    std::vector<std::pair<float, int> > order;
+    for (int i=0; i<n; i++) order.push_back(std::make_pair(world.min(i)[0], i));
+    std::sort(order.begin(), order.end());
+
+    SweepNPrune<int, float> old_snp;
+    for (int j=0; j<n; j++) {
+        int i = order[j].second;
+        old_snp.set(i, world.min(i)[0], world.max(i)[0]);
+    }
+    size_t old_pairs = 0;
+    Uint32 t0 = SDL_GetTicks();
+    for (int s=0; s<steps; s++) {
+        const World & w = path[s];
+        for (int i=0; i<n; i++) old_snp.set(i, w.min(i)[0], w.max(i)[0]);
+        SweepNPrune<int, float>::ContactList candidates;
+        old_snp.findContacts(candidates);
+        old_pairs += candidates.size();
+    }
+    Uint32 t1 = SDL_GetTicks();
+
+    SweepNPrune3D snp;
+    std::vector<SweepNPrune3D::Handle> handles(n);
+    for (int j=0; j<n; j++) {
+        int i = order[j].second;
+        handles[i] = snp.add(world.min(i), world.max(i));
+    }
+    size_t pairs = 0, changes = 0;
+    Uint32 t2 = SDL_GetTicks();
+    for (int s=0; s<steps; s++) {
+        const World & w = path[s];
+        for (int i=0; i<n; i++) snp.set(handles[i], w.min(i), w.max(i));
+        PairList added, removed;
+        snp.flushChanges(added, removed);
+        changes += added.size() + removed.size();
+        pairs += snp.getNumOfPairs();
+    }
+    Uint32 t3 = SDL_GetTicks();
+
+    printf("%6d boxes: SweepNPrune %8.3f ms/step, %8.1f candidates"
+           " | SweepNPrune3D %8.3f ms/step, %6.1f pairs, %6.1f changes\n",
+            n, (t1-t0) / (float) steps, old_pairs / (float) steps,
+            (t3-t2) / (float) steps, pairs / (float) steps,
+            changes / (float) steps);
+}
+
+int main(int argc, char **argv) {
+    int steps = argc > 1 ? atoi(argv[1]) : 100;
+    if (steps < 1) {
+        fprintf(stderr, "usage: %s [steps]\n", argv[0]);
+        return 1;
+    }
+
+    int sizes[] = { 100, 1000, 10000 };
+    for (int i=0; i<3; i++) {
+        if (!verify(sizes[i], std::min(steps, 20))) {
+            printf("Verification failed\n");
+            return 1;
+        }
+    }
+    for (int i=0; i<3; i++) bench(sizes[i], steps);
+    return 0;
+}
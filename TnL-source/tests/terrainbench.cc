@@ -0,0 +1,144 @@
+// Measures LoDQuad::setup on a single terrain quad.
+//
+// usage: terrainbench <quad.qad> <texmap.tga> [frames]
+//
+// The camera circles the quad at a fixed height above the ground, looking
+// along its path, so that each frame refines a different part of the
+// triangle tree. The cache file next to the quad is not used, so the
+// numbers don't depend on whether it exists. To count cache misses, run the
+// benchmark under a profiler, e.g.
+//     perf stat -e cache-misses,cache-references ./terrainbench ...
+//
+// setup is timed with the scalar and with the vectorized evaluator, taking
+// the best of RUNS runs over all frames for each. Before that, every frame
+// is set up with both, and the benchmark fails unless they give the same
+// mesh.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <SDL.h>
+#include <interfaces/ICamera.h>
+#include <modules/math/Plane.h>
+#include <modules/LoDTerrain/LoDTerrain.h>
+
+#define CAMERA_HEIGHT 150.0f
+#define CAMERA_FOCUS  1.0f
+#define CAMERA_ASPECT 0.75f
+#define CAMERA_NEAR   1.0f
+#define CAMERA_FAR    6000.0f
+
+#define RUNS 5
+
+struct PlaneSet {
+    float p[6][4];
+};
+
+// Same planes as SimpleCameraBase::getFrustumPlanes, for a camera that
+// looks horizontally along front
+static void makeFrustum(const Vector & pos, const Vector & front,
+                        float out_planes[6][4])
+{
+    Vector up(0,1,0);
+    Vector right = up % front;
+    right.normalize();
+    float n[6][3]={
+        {  0.0,   0.0,    1.0}, {   0.0,    0.0,   -1.0},
+        {CAMERA_FOCUS,   0.0, CAMERA_ASPECT},
+        {-CAMERA_FOCUS,  0.0, CAMERA_ASPECT},
+        {  0.0, CAMERA_FOCUS,    1.0}, {   0.0, -CAMERA_FOCUS,    1.0}};
+    Plane planes[6];
+    for (int i=0; i<6; i++) {
+        Vector normal = n[i][0]*right + n[i][1]*up + n[i][2]*front;
+        normal.normalize();
+        planes[i] = Plane(pos, normal);
+    }
+    planes[PLANE_MINUS_Z] = Plane(pos + CAMERA_NEAR*front, front);
+    planes[PLANE_PLUS_Z] = Plane(pos + CAMERA_FAR*front, -front);
+    for (int i=0; i<6; i++) {
+        for (int j=0; j<4; j++) out_planes[i][j] = planes[i][j];
+    }
+}
+
+// Sets up all frames and returns the time that took in milliseconds
+static Uint32 runFrames(LoDQuad & quad, const std::vector<Vector> & pos,
+                        const std::vector<PlaneSet> & planes, bool vectorized)
+{
+    Uint32 t0 = SDL_GetTicks();
+    for (size_t i=0; i<pos.size(); i++) {
+        quad.presetup(pos[i], planes[i].p, CAMERA_FOCUS, vectorized);
+        quad.setup();
+    }
+    return SDL_GetTicks() - t0;
+}
+
+// Returns the first frame where the vectorized evaluator gives a different
+// mesh than the scalar one, or -1
+static int compareFrames(LoDQuad & quad, const std::vector<Vector> & pos,
+                         const std::vector<PlaneSet> & planes)
+{
+    for (size_t i=0; i<pos.size(); i++) {
+        std::vector<ju32> mesh[2], drawn[2];
+        for (int j=0; j<2; j++) {
+            quad.presetup(pos[i], planes[i].p, CAMERA_FOCUS, j == 1);
+            quad.setup();
+            quad.getMesh(mesh[j], drawn[j]);
+        }
+        if (mesh[0] != mesh[1] || drawn[0] != drawn[1]) return i;
+    }
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <quad.qad> <texmap.tga> [frames]\n",
+                argv[0]);
+        return 1;
+    }
+    int frames = argc > 3 ? atoi(argv[3]) : 1000;
+
+    LoDQuad quad;
+    if (!quad.load(argv[1], argv[2], false)) return 1;
+
+    float x0, z0, x1, z1;
+    quad.getExtent(&x0, &z0, &x1, &z1);
+    Vector center((x0+x1)/2, 0, (z0+z1)/2);
+    float radius = 0.35f * (x1-x0);
+
+    std::vector<Vector> pos(frames);
+    std::vector<PlaneSet> planes(frames);
+    for (int i=0; i<frames; i++) {
+        float angle = 2*M_PI * i / frames;
+        Vector p = center + radius * Vector(cos(angle), 0, sin(angle));
+        p[1] = quad.getHeightAt(p[0], p[2]) + CAMERA_HEIGHT;
+        pos[i] = p;
+        makeFrustum(p, Vector(-sin(angle), 0, cos(angle)), planes[i].p);
+    }
+
+    int bad_frame = compareFrames(quad, pos, planes);
+    if (bad_frame >= 0) {
+        fprintf(stderr, "%s: frame %d: the vectorized evaluator gives a "
+                "different mesh\n", argv[1], bad_frame);
+        quad.done();
+        return 1;
+    }
+
+    // Take the best of a few alternating runs, to even out noise
+    SDL_Init(SDL_INIT_TIMER);
+    Uint32 scalar = 0, vectorized = 0;
+    for (int i=0; i<RUNS; i++) {
+        Uint32 t = runFrames(quad, pos, planes, false);
+        if (i == 0 || t < scalar) scalar = t;
+        t = runFrames(quad, pos, planes, true);
+        if (i == 0 || t < vectorized) vectorized = t;
+    }
+    SDL_Quit();
+
+    printf("%s: %d frames, same meshes, %.3f ms per setup (scalar), "
+            "%.3f ms (vectorized)\n", argv[1], frames,
+            (float) scalar / frames, (float) vectorized / frames);
+    quad.done();
+    return 0;
+}
@@ -0,0 +1,481 @@
+// Replays recorded flights over a terrain, without a renderer.
+//
+// usage: terrainreplay <terrain_dir> <trajectory>... [key=value]...
+//
+// The quads are loaded from <terrain_dir>/terrain-u-v.qad and
+// <terrain_dir>/texmap-u-v.tga, as LoDQuadManager does, into the
+// LoDQuadGrid that LoDQuadManager builds on. The trajectories are the files written by
+// TrajectoryRecorder.io: one line per sample, holding the camera location
+// followed by the columns of its orientation matrix, i.e. the right, up and
+// front vectors. Between two samples, frames_per_sample frames are
+// interpolated.
+//
+// Every frame is set up by LoDQuadGrid::setupQuads, REPEAT
+// times since a single setup takes about as long as the resolution of
+// SDL_GetTicks, and then drawn once into a renderer that only counts the
+// calls it gets. Then queries heights and as many lines around the camera
+// are tested against the terrain.
+//
+// Settings are given as key=value, with the config keys of the game where
+// there is one:
+//     LoDQuadManager_quads_w, LoDQuadManager_quads_h,
+//     LoDQuadManager_quad_cache, LoDQuadManager_compact_vertices,
+//     LoDQuadManager_setup_threads, Camera_focus, Camera_aspect and the
+//     Environment_ keys
+//     frames_per_sample  frames per trajectory sample (default 10)
+//     queries            height and line queries per frame (default 1000)
+//
+// One line is printed per frame, with the setup time in milliseconds, the
+// enabled triangles, the splits made by setup and by stitching the quads,
+// and the triangles and calls the draw traversal sent to the renderer.
+// A summary follows at the end.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <SDL.h>
+#include <WorkerPool.h>
+#include <modules/camera/SimpleCamera.h>
+#include <modules/config/config.h>
+#include <modules/environment/environment.h>
+#include <modules/LoDTerrain/LoDTerrain.h>
+
+#define REPEAT 10
+
+// Distance from the camera within which the queries are made
+#define QUERY_RADIUS 3000.0f
+
+// A renderer that draws nothing, but counts the triangles and calls it gets
+class CountingRenderer : public JRenderer
+{
+public:
+    int calls;          // drawArrays calls and begin/end pairs
+    int triangles;
+    int state_changes;  // textures and blend state
+
+    CountingRenderer() : calls(0), triangles(0), state_changes(0),
+                         next_txtid(1), mode(JR_DRAWMODE_POINTS),
+                         vertices(0) { }
+
+    void reset() { calls = triangles = state_changes = 0; }
+
+    virtual void resize(int, int) { }
+    virtual void setVertexMode(jrvertexmode_t) { }
+    virtual void setCoordSystem(jrcoordsystem_t) { }
+    virtual void setCullMode(jrcullmode_t) { }
+    virtual void setClipRange(float, float) { }
+    virtual void setCamera(jcamera_t *) { }
+    virtual void setBackgroundColor(const jcolor3_t *) { }
+    virtual void setClearDepth(float) { }
+
+    virtual int getWidth() { return 640; }
+    virtual int getHeight() { return 480; }
+    virtual float getAspect() { return 0.75f; }
+    virtual float getFocus() { return 1.5f; }
+    virtual float getClipNear() { return 1.0f; }
+    virtual float getClipFar() { return 20000.0f; }
+
+    virtual void enableSmoothShading() { }
+    virtual void disableSmoothShading() { }
+
+    virtual void enableAlphaBlending() { state_changes++; }
+    virtual void disableAlphaBlending() { state_changes++; }
+    virtual jBool alphaBlendingEnabled() { return false; }
+    virtual void setBlendMode(jrblendmode_t) { state_changes++; }
+
+    virtual void setZBufferFunc(jrzbfunc_t) { }
+    virtual void enableZBufferReading() { }
+    virtual void disableZBufferReading() { }
+    virtual void enableZBufferWriting() { }
+    virtual void disableZBufferWriting() { }
+    virtual void enableZBuffer() { }
+    virtual void disableZBuffer() { }
+
+    virtual float getGammaCorrectionValue() { return 1.0f; }
+    virtual void setGammaCorrectionValue(float) { }
+
+    virtual void begin(jrdrawmode_t m) { mode = m; vertices = 0; }
+    virtual void end() {
+        calls++;
+        if (mode == JR_DRAWMODE_TRIANGLES) triangles += vertices / 3;
+    }
+
+    virtual void addVertex(jvertex_col *) { vertices++; }
+    virtual void addVertex(jvertex_txt *) { vertices++; }
+    virtual void addVertex(jvertex_coltxt *) { vertices++; }
+
+    virtual void setAlpha(float) { }
+    virtual void setColor(const Vector &) { }
+    virtual void setUVW(const Vector &) { }
+    virtual void setAbsoluteUVW(const Vector &) { }
+    virtual void setNormal(const Vector &) { }
+    virtual void vertex(const Vector &) { vertices++; }
+    virtual void vertex(const Vector2 &) { vertices++; }
+
+    virtual void drawArrays(jrdrawmode_t m, int count, const float *,
+                            const float *, const float *) {
+        calls++;
+        if (m == JR_DRAWMODE_TRIANGLES) triangles += count / 3;
+    }
+
+    virtual void flush() { }
+    virtual void clear(bool, bool) { }
+
+    virtual void enableTexturing() { }
+    virtual void disableTexturing() { }
+    virtual bool texturingEnabled() { return true; }
+
+    virtual unsigned int getMaxCompression(unsigned int) { return 0; }
+
+    virtual jError createTexture(const jsprite_t *, unsigned int,
+                                 unsigned int, jBool, jrtxtid_t *dst) {
+        *dst = next_txtid++;
+        return JERR_OK;
+    }
+    virtual jError createEmptyTexture(jrtxtformat_t, int, int,
+                                      jrtxtid_t *dst) {
+        *dst = next_txtid++;
+        return JERR_OK;
+    }
+
+    virtual jError destroyTexture(jrtxtid_t) { return JERR_OK; }
+    virtual jError setTexture(jrtxtid_t) {
+        state_changes++;
+        return JERR_OK;
+    }
+
+    virtual void setWrapMode(jrtexdim_t, jrwrapmode_t) { }
+
+    virtual unsigned int getGLTexFromTxtid(jrtxtid_t txtid) { return txtid; }
+#ifndef __EMSCRIPTEN__
+    virtual jError createTxtidFromGLTex(unsigned int tex, jrtxtid_t *txtid) {
+        *txtid = tex;
+        return JERR_OK;
+    }
+#endif
+
+    virtual int getTextureWidth(jrtxtid_t) { return 256; }
+    virtual int getTextureHeight(jrtxtid_t) { return 256; }
+
+    virtual void setFogColor(const jcolor3_t *) { }
+    virtual void getFogColor(jcolor3_t *) { }
+    virtual jError setFogType(jrfogtype_t, float) { return JERR_OK; }
+
+    virtual jError enableFog() { return JERR_OK; }
+    virtual jError disableFog() { return JERR_OK; }
+    virtual jBool fogEnabled() { return false; }
+
+    virtual void pushMatrix() { }
+    virtual void setMatrix(const Matrix &) { }
+    virtual void multMatrix(const Matrix &) { }
+    virtual void popMatrix() { }
+
+    virtual jError pushClipPlane(const Vector &, float) { return JERR_OK; }
+    virtual void popClipPlanes(int) { }
+
+    virtual void enableLighting() { }
+    virtual void disableLighting() { }
+    virtual void setAmbientColor(const Vector &) { }
+
+    virtual Ptr<JMaterial> createMaterial() { return 0; }
+
+    virtual Ptr<JPointLight> createPointLight() { return 0; }
+    virtual Ptr<JDirectionalLight> createDirectionalLight() { return 0; }
+
+private:
+    jrtxtid_t next_txtid;
+    jrdrawmode_t mode;
+    int vertices;
+};
+
+struct CameraSample {
+    Vector pos, right, up, front;
+};
+
+// Reads a file written by TrajectoryRecorder.io. Returns false if it can't
+// be opened.
+static bool readTrajectory(const char *name, std::vector<CameraSample> & out)
+{
+    std::ifstream in(name);
+    if (!in) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream is(line);
+        float v[12];
+        int n = 0;
+        while (n < 12 && is >> v[n]) n++;
+        if (n < 12) continue;
+        CameraSample s;
+        s.pos = Vector(v[0], v[1], v[2]);
+        s.right = Vector(v[3], v[4], v[5]);
+        s.up = Vector(v[6], v[7], v[8]);
+        s.front = Vector(v[9], v[10], v[11]);
+        out.push_back(s);
+    }
+    return true;
+}
+
+// Interpolates frames_per_sample frames between each two samples
+static void interpolate(const std::vector<CameraSample> & samples,
+                        int frames_per_sample,
+                        std::vector<CameraSample> & out)
+{
+    for (size_t i=0; i+1<samples.size(); i++) {
+        const CameraSample & a = samples[i];
+        const CameraSample & b = samples[i+1];
+        for (int j=0; j<frames_per_sample; j++) {
+            float t = (float) j / frames_per_sample;
+            CameraSample s;
+            s.pos = (1-t)*a.pos + t*b.pos;
+            s.front = (1-t)*a.front + t*b.front;
+            s.front.normalize();
+            s.up = (1-t)*a.up + t*b.up;
+            s.right = s.up % s.front;
+            s.right.normalize();
+            s.up = s.front % s.right;
+            out.push_back(s);
+        }
+    }
+    if (!samples.empty()) out.push_back(samples.back());
+}
+
+// All quads of the terrain, resident all the time
+class Terrain
+{
+public:
+    LoDQuadGrid grid;
+    int n;
+
+    Terrain(int w, int h) : n(w*h) { grid.setSize(w, h); }
+
+    bool load(const std::string & dir, bool use_cache, bool compact_vertices,
+              TexPtr tex, TexPtr (*textures)[16], Ptr<Environment> env)
+    {
+        char buf[256];
+        for (int i=0; i<n; i++) {
+            int u = i % grid.width, v = i / grid.width;
+            std::string quad_name, texmap_name;
+            sprintf(buf, "%s/terrain-%d-%d.qad", dir.c_str(), u, v);
+            quad_name = buf;
+            sprintf(buf, "%s/texmap-%d-%d.tga", dir.c_str(), u, v);
+            texmap_name = buf;
+            if (!grid.quad[i].load(quad_name.c_str(), texmap_name.c_str(),
+                    use_cache, compact_vertices))
+            {
+                return false;
+            }
+        }
+        // Linked as LoDQuadManager::finishQuad links the quads when they
+        // are all loaded at startup
+        grid.setLayout(0);
+        for (int i=0; i<n; i++) {
+            LoDQuad *neighbor[4];
+            grid.getNeighbors(i, neighbor);
+            grid.quad[i].init(neighbor, tex, tex, textures, tex, env);
+            grid.addResident(i);
+        }
+        return true;
+    }
+
+    void done() {
+        for (int i=0; i<n; i++) grid.quad[i].done();
+    }
+
+    int countTriangles() {
+        int count = 0;
+        for (int i=0; i<n; i++) {
+            std::vector<ju32> triangles, drawn;
+            grid.quad[i].getMesh(triangles, drawn);
+            count += triangles.size();
+        }
+        return count;
+    }
+};
+
+static float frand()
+{
+    return (float) rand() / RAND_MAX;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<const char *> args;
+    for (int i=1; i<argc; i++) {
+        if (!strchr(argv[i], '=')) args.push_back(argv[i]);
+    }
+    if (args.size() < 2) {
+        fprintf(stderr, "usage: %s <terrain_dir> <trajectory>... "
+                "[key=value]...\n", argv[0]);
+        return 1;
+    }
+
+    // The game's defaults, see defaults.cc
+    Ptr<Config> cfg = new Config;
+    cfg->set("LoDQuadManager_quads_w", "1");
+    cfg->set("LoDQuadManager_quads_h", "1");
+    cfg->set("LoDQuadManager_quad_cache", "true");
+    cfg->set("LoDQuadManager_compact_vertices", "false");
+    cfg->set("LoDQuadManager_setup_threads", "1");
+    cfg->set("Camera_aspect", "1.333");
+    cfg->set("Camera_focus", "1.5");
+    cfg->set("Environment_clip_min", "1.0");
+    cfg->set("Environment_clip_max", "20000.0");
+    cfg->set("Environment_fog_r", "0.7922");
+    cfg->set("Environment_fog_g", "0.6431");
+    cfg->set("Environment_fog_b", "0.5686");
+    cfg->set("Environment_ground_fog_min", "0.0");
+    cfg->set("Environment_ground_fog_max", "400.0");
+    cfg->set("Environment_ground_fog_range", "3500.0");
+    cfg->set("frames_per_sample", "10");
+    cfg->set("queries", "1000");
+    cfg->feedArguments(argc, (const char **) argv);
+
+    int frames_per_sample = std::max(1,
+            cfg->queryInt("frames_per_sample", 10));
+    int queries = std::max(0, cfg->queryInt("queries", 1000));
+
+    std::vector<CameraSample> frames;
+    for (size_t i=1; i<args.size(); i++) {
+        std::vector<CameraSample> samples;
+        if (!readTrajectory(args[i], samples)) {
+            fprintf(stderr, "%s: can't open %s\n", argv[0], args[i]);
+            return 1;
+        }
+        interpolate(samples, frames_per_sample, frames);
+    }
+    if (frames.empty()) {
+        fprintf(stderr, "%s: no samples in the trajectories\n", argv[0]);
+        return 1;
+    }
+
+    // All textures are the same, the renderer only counts them
+    CountingRenderer renderer;
+    TexPtr tex = new Texture(0, renderer);
+    TexPtr textures[256][16];
+    for (int i=0; i<256; i++) {
+        for (int j=0; j<16; j++) textures[i][j] = tex;
+    }
+    Ptr<Environment> env = new Environment(Ptr<IConfig>(cfg));
+
+    Terrain terrain(cfg->queryInt("LoDQuadManager_quads_w", 1),
+                    cfg->queryInt("LoDQuadManager_quads_h", 1));
+    if (!terrain.load(args[0],
+            cfg->queryBool("LoDQuadManager_quad_cache", true),
+            cfg->queryBool("LoDQuadManager_compact_vertices", false),
+            tex, textures, env))
+    {
+        terrain.done();
+        return 1;
+    }
+
+    int setup_threads = cfg->queryInt("LoDQuadManager_setup_threads", 1);
+    if (setup_threads <= 0) setup_threads = WorkerPool::getCPUCount();
+    setup_threads = std::min(setup_threads, terrain.n);
+    // As in LoDQuadManager, only more than one thread stitches the quads
+    WorkerPool *pool = setup_threads > 1 ? new WorkerPool(setup_threads) : 0;
+
+    Ptr<SimpleCamera> camera = new SimpleCamera;
+    camera->setFocus(cfg->queryFloat("Camera_focus", 1.5));
+    camera->setAspect(cfg->queryFloat("Camera_aspect", 1.5));
+    camera->setNearDistance(env->getClipMin());
+    camera->setFarDistance(env->getClipMax());
+
+    SDL_Init(SDL_INIT_TIMER);
+    srand(1);
+    Uint32 setup_ms = 0, draw_ms = 0, height_ms = 0, line_ms = 0;
+    double sum_triangles = 0;
+    int max_triangles = 0, hits = 0;
+    float worst_setup = 0;
+    std::vector<float> heights_x(queries), heights_z(queries);
+    std::vector<Vector> lines_a(queries), lines_b(queries);
+
+    printf("# frame setup_ms triangles splits stitch_splits "
+           "drawn_triangles draw_calls\n");
+    for (size_t f=0; f<frames.size(); f++) {
+        const CameraSample & s = frames[f];
+        camera->setLocation(s.pos);
+        camera->setOrientation(s.up, s.right, s.front);
+        env->update(camera);
+        float planes[6][4];
+        camera->getFrustumPlanes(planes);
+        float focus = camera->getFocus();
+
+        Uint32 t0 = SDL_GetTicks();
+        int stitch_splits = 0;
+        for (int i=0; i<REPEAT; i++) {
+            stitch_splits = terrain.grid.setupQuads(pool, s.pos, planes,
+                                                     focus);
+        }
+        Uint32 t1 = SDL_GetTicks();
+
+        renderer.reset();
+        for (int i=0; i<terrain.n; i++) {
+            terrain.grid.quad[i].draw(&renderer, s.pos);
+        }
+        Uint32 t2 = SDL_GetTicks();
+        setup_ms += t1 - t0;
+        draw_ms += t2 - t1;
+
+        // A mesh from scratch has two triangles per quad, each split
+        // adds one
+        int triangles = terrain.countTriangles();
+        int splits = triangles - 2 * terrain.n;
+        sum_triangles += triangles;
+        max_triangles = std::max(max_triangles, triangles);
+        float frame_ms = (float) (t1 - t0) / REPEAT;
+        worst_setup = std::max(worst_setup, frame_ms);
+        printf("%d %.3f %d %d %d %d %d\n", (int) f, frame_ms, triangles,
+                splits, stitch_splits, renderer.triangles, renderer.calls);
+
+        // Heights around the camera, and lines from the camera towards
+        // the ground ahead
+        for (int i=0; i<queries; i++) {
+            heights_x[i] = s.pos[0] + QUERY_RADIUS * (2*frand() - 1);
+            heights_z[i] = s.pos[2] + QUERY_RADIUS * (2*frand() - 1);
+            Vector d = s.front + (2*frand() - 1) * s.right
+                    - frand() * s.up;
+            lines_a[i] = s.pos;
+            lines_b[i] = s.pos + QUERY_RADIUS * d.normalize();
+        }
+        Uint32 t3 = SDL_GetTicks();
+        float sum = 0;
+        for (int i=0; i<queries; i++) {
+            sum += terrain.grid.getHeightAt(heights_x[i], heights_z[i]);
+        }
+        Uint32 t4 = SDL_GetTicks();
+        for (int i=0; i<queries; i++) {
+            Vector x;
+            if (terrain.grid.castRay(lines_a[i], lines_b[i], &x, 0)) hits++;
+        }
+        Uint32 t5 = SDL_GetTicks();
+        height_ms += t4 - t3;
+        line_ms += t5 - t4;
+        // Keeps the height queries from being optimized away
+        if (sum != sum) printf("# nan height\n");
+    }
+    SDL_Quit();
+
+    int n = frames.size();
+    double total_queries = (double) n * queries;
+    printf("# %d frames, %d quads, %d setup threads\n", n,
+            terrain.n, setup_threads > 1 ? setup_threads : 1);
+    printf("# setup: %.3f ms per frame, %.3f ms worst\n",
+            (float) setup_ms / (n * REPEAT), worst_setup);
+    printf("# draw traversal: %.3f ms per frame\n", (float) draw_ms / n);
+    printf("# triangles: %.0f per frame, %d most\n",
+            sum_triangles / n, max_triangles);
+    printf("# getHeightAt: %.0f queries/s\n",
+            height_ms ? 1000.0 * total_queries / height_ms : 0.0);
+    printf("# castRay: %.0f queries/s, %d hits\n",
+            line_ms ? 1000.0 * total_queries / line_ms : 0.0, hits);
+
+    delete pool;
+    terrain.done();
+    return 0;
+}